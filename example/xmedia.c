@@ -26,8 +26,15 @@ typedef struct {
 
     char inputFile[XPATH_MAX];
     char inputFmt[XPATH_MAX];
+    char streamInfo[XPATH_MAX];
+    char keyIndex[XPATH_MAX];
     char outFile[XPATH_MAX];
     char outFmt[XSTR_TINY];
+    char batchFile[XPATH_MAX];
+
+    /* Codec options of the batch jobs */
+    xcodec_t videoOpts;
+    xcodec_t audioOpts;
 
     int nWidth;
     int nHeight;
@@ -36,8 +43,25 @@ typedef struct {
     int nSampleRate;
     int nChannels;
 
+    xloadshed_policy_t eShedPolicy;
     xpts_ctl_t eTSType;
     size_t nIOBuffSize;
+    size_t nAsyncDepth;
+    size_t nSegmentTime;
+    int nDecodeThreads;
+    int nEncodeThreads;
+    int nAnalyzeTime;
+    int nChunks;
+    int nWorkers;
+    xbool_t bThreadedInput;
+    xbool_t bMapInput;
+    xbool_t bKeyOnly;
+    int nDecodeRate;
+    int nLowres;
+    xbool_t bLowLatency;
+    xbool_t bFileSink;
+    xbool_t bNativeTS;
+    xbool_t bDirectIO;
     xbool_t bCustomIO;
     xbool_t bRemux;
     xbool_t bDebug;
@@ -52,8 +76,40 @@ typedef struct {
     xarray_t streams;
     xmeta_t meta;
     FILE *pFile;
+
+    /* Decoding progress in per mille */
+    int64_t nStartTime;
+    int64_t nDuration;
+    XATOMIC nProgress;
 } xtranscoder_t;
 
+/* Intermediate container of the chunk outputs, takes any codec */
+#define XCHUNK_FORMAT       "nut"
+#define XCHUNK_INDEX        "kfindex"
+#define XCHUNK_GUARD_TIME   2000000 /* Read past the end for interleaved audio (usec) */
+
+/* Progress report interval of the batch mode (msec) */
+#define XBATCH_REPORT_TIME  2000
+
+typedef struct {
+    xtranscoder_t transcoder;
+    xbool_t bStatus;
+
+    /* GOP-aligned range, AV_NOPTS_VALUE is open */
+    int nVideoIndex;
+    int64_t nStartTS;
+    int64_t nEndTS;
+    int64_t nStartTime;
+    int64_t nEndTime;
+} xchunk_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    xchunk_t *pChunks;
+    int nCount;
+    int nNext;
+} xchunk_pool_t;
+
 static int g_nInterrupted = 0;
 
 static void signal_callback(int sig)
@@ -106,6 +162,13 @@ static int decoder_cb(void *pCtx, AVFrame *pFrame, int nStreamIndex)
     XASSERT(pStream, xthrow("Source stream is not found: src(%d)", nStreamIndex));
     XASSERT((pStream->nDstIndex >= 0), xthrow("Output stream is not found: src(%d)", nStreamIndex));
 
+    if (pTransmuxer->nDuration > 0 && pFrame->pts != AV_NOPTS_VALUE && pStream->pAvStream != NULL)
+    {
+        int64_t nTime = av_rescale_q(pFrame->pts, pStream->pAvStream->time_base, AV_TIME_BASE_Q);
+        int64_t nProgress = (nTime - pTransmuxer->nStartTime) * 1000 / pTransmuxer->nDuration;
+        XSYNC_ATOMIC_SET(&pTransmuxer->nProgress, (uint32_t)XSTD_MAX(XSTD_MIN(nProgress, 1000), 0));
+    }
+
     return XEncoder_WriteFrame3(pEncoder, pFrame, pStream->nDstIndex);
 }
 
@@ -130,13 +193,37 @@ void XTranscoder_Init(xtranscoder_t *pTransmuxer)
 
     xstrnul(pTransmuxer->args.inputFile);
     xstrnul(pTransmuxer->args.inputFmt);
+    xstrnul(pTransmuxer->args.streamInfo);
+    xstrnul(pTransmuxer->args.keyIndex);
     xstrnul(pTransmuxer->args.outFile);
     xstrnul(pTransmuxer->args.outFmt);
+    xstrnul(pTransmuxer->args.batchFile);
+
+    XCodec_Init(&pTransmuxer->args.videoOpts);
+    XCodec_Init(&pTransmuxer->args.audioOpts);
+    pTransmuxer->args.videoOpts.scaleFmt = XSCALE_FMT_NONE;
 
     pTransmuxer->args.nIOBuffSize = XSTDNON;
+    pTransmuxer->args.nAsyncDepth = XSTDNON;
+    pTransmuxer->args.nSegmentTime = XSTDNON;
+    pTransmuxer->args.bLowLatency = XFALSE;
+    pTransmuxer->args.bFileSink = XFALSE;
+    pTransmuxer->args.bNativeTS = XFALSE;
+    pTransmuxer->args.bDirectIO = XFALSE;
     pTransmuxer->args.bCustomIO = XFALSE;
+    pTransmuxer->args.bThreadedInput = XFALSE;
+    pTransmuxer->args.bMapInput = XFALSE;
+    pTransmuxer->args.bKeyOnly = XFALSE;
+    pTransmuxer->args.nDecodeRate = XSTDNON;
+    pTransmuxer->args.nLowres = XSTDNON;
+    pTransmuxer->args.eShedPolicy = XLOADSHED_OFF;
     pTransmuxer->args.eTSType = XPTS_RESCALE;
     pTransmuxer->args.nTSFix = XSTDNON;
+    pTransmuxer->args.nDecodeThreads = XSTDNON;
+    pTransmuxer->args.nEncodeThreads = XSTDNON;
+    pTransmuxer->args.nAnalyzeTime = XSTDNON;
+    pTransmuxer->args.nChunks = XSTDNON;
+    pTransmuxer->args.nWorkers = XSTDNON;
     pTransmuxer->args.bRemux = XFALSE;
     pTransmuxer->args.bDebug = XFALSE;
     pTransmuxer->args.bLoop = XFALSE;
@@ -148,6 +235,10 @@ void XTranscoder_Init(xtranscoder_t *pTransmuxer)
     XEncoder_Init(&pTransmuxer->encoder);
     XMeta_Init(&pTransmuxer->meta);
     pTransmuxer->pFile = NULL;
+
+    pTransmuxer->nStartTime = XSTDNON;
+    pTransmuxer->nDuration = XSTDNON;
+    pTransmuxer->nProgress = XSTDNON;
 }
 
 void XTranscoder_Destroy(xtranscoder_t *pTransmuxer)
@@ -178,12 +269,80 @@ xbool_t XTranscoder_InitDecoder(xtranscoder_t *pTransmuxer)
     pTransmuxer->decoder.bDemuxOnly = bDemuxOnly;
     pTransmuxer->decoder.status.cb = status_cb;
     pTransmuxer->decoder.status.nTypes = XSTATUS_ALL;
+    pTransmuxer->decoder.bMapInput = pTransmuxer->args.bMapInput;
+
+    /* Analytics mode: fewer and smaller decoded frames */
+    xdecoder_opts_t *pVideoOpts = &pTransmuxer->decoder.videoOpts;
+    if (pTransmuxer->args.bKeyOnly) pVideoOpts->skipFrame = AVDISCARD_NONKEY;
+    if (pTransmuxer->args.nDecodeRate > 0) pVideoOpts->frameRate = (AVRational){pTransmuxer->args.nDecodeRate, 1};
+    pVideoOpts->nLowres = pTransmuxer->args.nLowres;
+
+    /* Bounded probing or known stream info from the previous run */
+    const char *pStreamInfo = pTransmuxer->args.streamInfo;
+    xbool_t bHaveInfo = xstrused(pStreamInfo) && XPath_Exists(pStreamInfo);
+    pTransmuxer->decoder.nAnalyzeDuration = (int64_t)pTransmuxer->args.nAnalyzeTime * 1000;
+    if (bHaveInfo) XDecoder_LoadStreamInfo(&pTransmuxer->decoder, pStreamInfo);
 
     /* Open input file for decoding */
     XSTATUS nStatus = XDecoder_OpenInput(&pTransmuxer->decoder, pInput, pFmt);
+    if (nStatus > 0 && xstrused(pStreamInfo) && !bHaveInfo)
+        XDecoder_SaveStreamInfo(&pTransmuxer->decoder, pStreamInfo);
+
+    if (nStatus > 0 && pTransmuxer->decoder.pFmtCtx->duration != AV_NOPTS_VALUE)
+    {
+        AVFormatContext *pFmtCtx = pTransmuxer->decoder.pFmtCtx;
+        pTransmuxer->nStartTime = pFmtCtx->start_time != AV_NOPTS_VALUE ? pFmtCtx->start_time : 0;
+        pTransmuxer->nDuration = pFmtCtx->duration;
+    }
+
+    /* Use saved keyframe index or record one during the first read */
+    const char *pKeyIndex = pTransmuxer->args.keyIndex;
+    if (nStatus > 0 && xstrused(pKeyIndex))
+    {
+        if (XPath_Exists(pKeyIndex)) XDecoder_LoadIndex(&pTransmuxer->decoder, pKeyIndex);
+        else pTransmuxer->decoder.bIndexing = XTRUE;
+    }
+
     return nStatus <= 0 ? XFALSE : XTRUE;
 }
 
+void XTranscoder_ApplyCodec(xcodec_t *pInfo, const xcodec_t *pOpts)
+{
+    if (pOpts->codecId != AV_CODEC_ID_NONE) pInfo->codecId = pOpts->codecId;
+    if (pOpts->nBitRate > 0) pInfo->nBitRate = pOpts->nBitRate;
+    if (pOpts->nProfile != FF_PROFILE_UNKNOWN) pInfo->nProfile = pOpts->nProfile;
+    if (pOpts->nCompressLevel != XCODEC_NOT_SET) pInfo->nCompressLevel = pOpts->nCompressLevel;
+
+    if (pInfo->mediaType == AVMEDIA_TYPE_VIDEO)
+    {
+        if (pOpts->scaleFmt != XSCALE_FMT_NONE) pInfo->scaleFmt = pOpts->scaleFmt;
+        if (pOpts->pixFmt != AV_PIX_FMT_NONE) pInfo->pixFmt = pOpts->pixFmt;
+
+        if (pOpts->nWidth > 0 && pOpts->nHeight > 0)
+        {
+            pInfo->nWidth = pOpts->nWidth;
+            pInfo->nHeight = pOpts->nHeight;
+        }
+
+        if (pOpts->frameRate.num > 0 && pOpts->frameRate.den > 0)
+        {
+            pInfo->frameRate = pOpts->frameRate;
+            pInfo->timeBase = av_inv_q(pInfo->frameRate);
+        }
+    }
+    else if (pInfo->mediaType == AVMEDIA_TYPE_AUDIO)
+    {
+        if (pOpts->sampleFmt != AV_SAMPLE_FMT_NONE) pInfo->sampleFmt = pOpts->sampleFmt;
+        if (pOpts->nChannels > 0) XCodec_InitChannels(pInfo, pOpts->nChannels);
+
+        if (pOpts->nSampleRate > 0)
+        {
+            pInfo->nSampleRate = pOpts->nSampleRate;
+            pInfo->timeBase = (AVRational){1, pInfo->nSampleRate};
+        }
+    }
+}
+
 xbool_t XTranscoder_InitEncoder(xtranscoder_t *pTransmuxer)
 {
     xarray_t *pSrcStreams = &pTransmuxer->decoder.streams;
@@ -210,6 +369,25 @@ xbool_t XTranscoder_InitEncoder(xtranscoder_t *pTransmuxer)
     pTransmuxer->encoder.status.nTypes = XSTATUS_ALL;
     pTransmuxer->encoder.packetCallback = encoder_cb;
     pTransmuxer->encoder.pUserCtx = pTransmuxer;
+    pTransmuxer->encoder.bLowLatency = pTransmuxer->args.bLowLatency;
+    pTransmuxer->encoder.bFileSink = pTransmuxer->args.bFileSink;
+    pTransmuxer->encoder.bNativeTS = pTransmuxer->args.bNativeTS;
+    pTransmuxer->encoder.bDirectIO = pTransmuxer->args.bDirectIO;
+    pTransmuxer->encoder.nCodecThreads = pTransmuxer->args.nEncodeThreads;
+
+    if (pTransmuxer->args.eShedPolicy != XLOADSHED_OFF)
+    {
+        /* Drop frames and lower the preset when encoding can not keep up */
+        pTransmuxer->encoder.loadShed.ePolicy = pTransmuxer->args.eShedPolicy;
+        pTransmuxer->encoder.loadShed.bStepDown = XTRUE;
+    }
+
+    if (pTransmuxer->args.nSegmentTime)
+    {
+        /* Output path is the HLS playlist, segments are written next to it */
+        pTransmuxer->encoder.segmenter.nTargetDuration = pTransmuxer->args.nSegmentTime * 1000000;
+        pTransmuxer->encoder.bSegment = XTRUE;
+    }
     pTransmuxer->encoder.bMuxOnly = bMuxOnly;
     pTransmuxer->encoder.eTSType = eTSType;
     pTransmuxer->encoder.nTSFix = nTSFix;
@@ -276,6 +454,12 @@ xbool_t XTranscoder_InitEncoder(xtranscoder_t *pTransmuxer)
                     codecInfo.timeBase = (AVRational){1, codecInfo.nSampleRate};
                 }
             }
+
+            /* Options from the batch job spec */
+            if (codecInfo.mediaType == AVMEDIA_TYPE_VIDEO)
+                XTranscoder_ApplyCodec(&codecInfo, &pTransmuxer->args.videoOpts);
+            else if (codecInfo.mediaType == AVMEDIA_TYPE_AUDIO)
+                XTranscoder_ApplyCodec(&codecInfo, &pTransmuxer->args.audioOpts);
         }
 
         /* Open codec for output stream */
@@ -327,6 +511,14 @@ xbool_t XTranscoder_InitEncoder(xtranscoder_t *pTransmuxer)
     XEncoder_AddMeta(&pTransmuxer->encoder, &pTransmuxer->meta);
     pTransmuxer->encoder.nIOBuffSize = pTransmuxer->args.nIOBuffSize;
 
+    if (pTransmuxer->args.bCustomIO && pTransmuxer->args.nAsyncDepth)
+    {
+        /* Write output from a separate thread with writev() */
+        pTransmuxer->encoder.nAsyncFD = fileno(pTransmuxer->pFile);
+        pTransmuxer->encoder.nAsyncDepth = pTransmuxer->args.nAsyncDepth;
+        pTransmuxer->encoder.bAsyncIO = XTRUE;
+    }
+
     /* Open encder IO and setup write callback */
     nStatus = XEncoder_OpenOutput(&pTransmuxer->encoder, pMuxOpts);
     XASSERT((nStatus > 0), xthrowr(XFALSE, "Failed to open output: %s", pOutput));
@@ -346,15 +538,51 @@ xbool_t XTranscoder_Transcode(xtranscoder_t *pTransmuxer)
 
     /* Read packet from the input */
     xbool_t bRemux = pTransmuxer->args.bRemux;
-    XSTATUS nStatus = XDecoder_ReadPacket(&pTransmuxer->decoder, pPacket);
+    XSTATUS nStatus = XSTDERR;
+
+    xbool_t bThreadsDone = XFALSE;
+
+    if (!bRemux && pTransmuxer->args.bThreadedInput)
+    {
+        /* Demux and decode from separate threads */
+        nStatus = XDecoder_StartThreads(&pTransmuxer->decoder);
+        if (nStatus > 0)
+        {
+            while (!g_nInterrupted && (nStatus = XDecoder_WaitThreads(&pTransmuxer->decoder, 100)) == XSTDNON);
+            XDecoder_StopThreads(&pTransmuxer->decoder);
+            bThreadsDone = XTRUE;
+
+            /* Report the failed reader or decoder instead of the end of input */
+            if (nStatus < 0) xloge("Threaded decoding failed: %d", nStatus);
+            else nStatus = AVERROR_EOF;
+        }
+    }
+
+    if (!bThreadsDone)
+        nStatus = XDecoder_ReadPacket(&pTransmuxer->decoder, pPacket);
 
     while (!g_nInterrupted && nStatus >= 0)
     {
-        if (bRemux) XEncoder_WritePacket(&pTransmuxer->encoder, pPacket);
+        if (bRemux)
+        {
+            /* Output streams are numbered separately from the input */
+            xstream_t *pStream = XStreams_GetBySrcIndex(&pTransmuxer->decoder.streams, pPacket->stream_index);
+            if (pStream != NULL && pStream->nDstIndex >= 0)
+            {
+                pPacket->stream_index = pStream->nDstIndex;
+                XEncoder_WritePacket(&pTransmuxer->encoder, pPacket);
+            }
+        }
         else XDecoder_DecodePacket(&pTransmuxer->decoder, pPacket);
         av_packet_unref(pPacket); /* Recycle packet */
 
         nStatus = XDecoder_ReadPacket(&pTransmuxer->decoder, pPacket);
+        if (nStatus == AVERROR_EOF && !bRemux)
+        {
+            /* Deliver frames delayed in the decoders */
+            XDecoder_Drain(&pTransmuxer->decoder);
+        }
+
         if (nStatus == AVERROR_EOF && pTransmuxer->args.bLoop)
         {
             int nStream = pPacket->stream_index;
@@ -367,8 +595,833 @@ xbool_t XTranscoder_Transcode(xtranscoder_t *pTransmuxer)
 
     /* Finish encoding and destroy context */
     XEncoder_FinishWrite(&pTransmuxer->encoder, !bRemux);
+
+    const char *pKeyIndex = pTransmuxer->args.keyIndex;
+    if (xstrused(pKeyIndex) && !XPath_Exists(pKeyIndex))
+        XDecoder_SaveIndex(&pTransmuxer->decoder, pKeyIndex);
+
     av_packet_free(&pPacket);
-    return XSTDOK;
+    return (nStatus == AVERROR_EOF || g_nInterrupted) ? XTRUE : XFALSE;
+}
+
+void XTranscoder_InitChunk(xtranscoder_t *pTransmuxer, xchunk_t *pChunk, int nIndex)
+{
+    xtranscoder_t *pPart = &pChunk->transcoder;
+    XTranscoder_Init(pPart);
+    pPart->args = pTransmuxer->args;
+
+    /* Parts keep the source timestamps for the concatenation */
+    xstrncpyf(pPart->args.outFile, sizeof(pPart->args.outFile), "%s.part%d.%s",
+        pTransmuxer->args.outFile, nIndex, XCHUNK_FORMAT);
+
+    xstrncpy(pPart->args.outFmt, sizeof(pPart->args.outFmt), XCHUNK_FORMAT);
+    pPart->args.eTSType = XPTS_RESCALE;
+    pPart->args.nSegmentTime = XSTDNON;
+    pPart->args.bThreadedInput = XFALSE;
+    pPart->args.bCustomIO = XFALSE;
+    pPart->args.bFileSink = XFALSE;
+    pPart->args.bNativeTS = XFALSE;
+    pPart->args.bLoop = XFALSE;
+    pPart->args.nChunks = XSTDNON;
+
+    /* Only read the caches, parts must not write them concurrently */
+    const char *pStreamInfo = pPart->args.streamInfo;
+    const char *pKeyIndex = pPart->args.keyIndex;
+    if (xstrused(pStreamInfo) && !XPath_Exists(pStreamInfo)) xstrnul(pPart->args.streamInfo);
+    if (xstrused(pKeyIndex) && !XPath_Exists(pKeyIndex)) xstrnul(pPart->args.keyIndex);
+}
+
+int XTranscoder_PlanChunks(xtranscoder_t *pTransmuxer, xchunk_t **ppChunks)
+{
+    xmedia_args_t *pArgs = &pTransmuxer->args;
+    const char *pFmt = xstrused(pArgs->inputFmt) ? pArgs->inputFmt : NULL;
+    const char *pKeyIndex = pArgs->keyIndex;
+
+    xdecoder_t scanner;
+    XDecoder_Init(&scanner);
+    scanner.status.cb = status_cb;
+    scanner.status.nTypes = XSTATUS_ERROR;
+    scanner.bDemuxOnly = XTRUE;
+
+    if (XDecoder_OpenInput(&scanner, pArgs->inputFile, pFmt) <= 0)
+    {
+        XDecoder_Destroy(&scanner);
+        return XSTDERR;
+    }
+
+    int nVideo = av_find_best_stream(scanner.pFmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (nVideo < 0)
+    {
+        xloge("Chunked transcoding requires video stream: %s", pArgs->inputFile);
+        XDecoder_Destroy(&scanner);
+        return XSTDERR;
+    }
+
+    /* Keyframes of the whole input, saved index is used if it exists */
+    XSTATUS nStatus = XSTDERR;
+    if (xstrused(pKeyIndex) && XPath_Exists(pKeyIndex))
+        nStatus = XDecoder_LoadIndex(&scanner, pKeyIndex);
+
+    if (nStatus <= 0)
+    {
+        nStatus = XDecoder_BuildIndex(&scanner, XFALSE);
+        if (nStatus > 0 && xstrused(pKeyIndex)) XDecoder_SaveIndex(&scanner, pKeyIndex);
+    }
+
+    /* Parts seek with the same index, mapped from a temporary sidecar */
+    char sPartIndex[XPATH_MAX];
+    xstrnul(sPartIndex);
+
+    if (nStatus > 0 && !xstrused(pKeyIndex))
+    {
+        xstrncpyf(sPartIndex, sizeof(sPartIndex), "%s.%s", pArgs->outFile, XCHUNK_INDEX);
+        if (XDecoder_SaveIndex(&scanner, sPartIndex) <= 0) xstrnul(sPartIndex);
+    }
+
+    xkf_index_t *pIndex = &scanner.kfIndex;
+    size_t nKeyCount = nStatus > 0 ? XKFIndex_GetCount(pIndex, nVideo) : 0;
+    int nCount = (int)XSTD_MIN((size_t)pArgs->nChunks, nKeyCount);
+
+    xchunk_t *pChunks = nCount > 0 ? (xchunk_t*)calloc(nCount, sizeof(xchunk_t)) : NULL;
+    if (pChunks == NULL)
+    {
+        xloge("Failed to split input at keyframes: %s", pArgs->inputFile);
+        if (xstrused(sPartIndex)) remove(sPartIndex);
+        XDecoder_Destroy(&scanner);
+        return XSTDERR;
+    }
+
+    /* Entries are sorted by stream, then by time */
+    size_t nFirst = 0;
+    while (pIndex->pEntries[nFirst].nStream != nVideo) nFirst++;
+
+    AVRational timeBase = scanner.pFmtCtx->streams[nVideo]->time_base;
+    int64_t nLastTS = AV_NOPTS_VALUE;
+    int i, nUsed = 0;
+
+    for (i = 0; i < nCount; i++)
+    {
+        /* Same count of GOPs in each range */
+        const xkf_entry_t *pEntry = &pIndex->pEntries[nFirst + nKeyCount * i / nCount];
+        int64_t nTS = pEntry->nPTS != AV_NOPTS_VALUE ? pEntry->nPTS : pEntry->nDTS;
+        if (nUsed && nTS <= nLastTS) continue;
+
+        xchunk_t *pChunk = &pChunks[nUsed];
+        pChunk->nVideoIndex = nVideo;
+        pChunk->nStartTS = nUsed ? nTS : AV_NOPTS_VALUE;
+        pChunk->nStartTime = nUsed ? av_rescale_q(nTS, timeBase, AV_TIME_BASE_Q) : AV_NOPTS_VALUE;
+        pChunk->nEndTS = AV_NOPTS_VALUE;
+        pChunk->nEndTime = AV_NOPTS_VALUE;
+
+        if (nUsed)
+        {
+            /* Previous range ends where this one starts */
+            pChunks[nUsed - 1].nEndTS = pChunk->nStartTS;
+            pChunks[nUsed - 1].nEndTime = pChunk->nStartTime;
+        }
+
+        XTranscoder_InitChunk(pTransmuxer, pChunk, nUsed);
+        if (xstrused(sPartIndex)) xstrncpy(pChunk->transcoder.args.keyIndex,
+            sizeof(pChunk->transcoder.args.keyIndex), sPartIndex);
+
+        nLastTS = nTS;
+        nUsed++;
+    }
+
+    xlogn("Transcoding %d chunks: keyframes(%zu), stream(%d)", nUsed, nKeyCount, nVideo);
+    XDecoder_Destroy(&scanner);
+
+    *ppChunks = pChunks;
+    return nUsed;
+}
+
+xbool_t XTranscoder_TranscodeChunk(xchunk_t *pChunk)
+{
+    xtranscoder_t *pTransmuxer = &pChunk->transcoder;
+    xdecoder_t *pDecoder = &pTransmuxer->decoder;
+
+    AVPacket *pPacket = av_packet_alloc();
+    XASSERT(pPacket, xthrowr(XFALSE, "Failed to allocate packet: %s", strerror(errno)));
+    XSTATUS nStatus = XSTDOK;
+
+    if (pChunk->nStartTS != AV_NOPTS_VALUE)
+    {
+        /* Indexed seek is exact, otherwise demuxer lands at or before the keyframe */
+        nStatus = XDecoder_Seek(pDecoder, pChunk->nVideoIndex, pChunk->nStartTS, AVSEEK_FLAG_BACKWARD);
+        if (nStatus < 0) xloge("Failed to seek chunk start: ts(%lld)", (long long)pChunk->nStartTS);
+    }
+
+    xbool_t bVideoStarted = pChunk->nStartTS == AV_NOPTS_VALUE;
+    xbool_t bVideoDone = XFALSE;
+    if (nStatus >= 0) nStatus = XDecoder_ReadPacket(pDecoder, pPacket);
+
+    while (!g_nInterrupted && nStatus >= 0)
+    {
+        AVStream *pAvStream = pDecoder->pFmtCtx->streams[pPacket->stream_index];
+        int64_t nTS = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+        int64_t nTime = nTS != AV_NOPTS_VALUE ? av_rescale_q(nTS, pAvStream->time_base, AV_TIME_BASE_Q) : AV_NOPTS_VALUE;
+        xbool_t bDecode = XTRUE;
+
+        if (pPacket->stream_index == pChunk->nVideoIndex)
+        {
+            /* Seek may land before the range, it starts exactly at the keyframe */
+            if (!bVideoStarted && nTS != AV_NOPTS_VALUE &&
+                (pPacket->flags & AV_PKT_FLAG_KEY) && nTS >= pChunk->nStartTS) bVideoStarted = XTRUE;
+
+            /* Next range starts with this keyframe */
+            if (pChunk->nEndTS != AV_NOPTS_VALUE && nTS != AV_NOPTS_VALUE &&
+                (pPacket->flags & AV_PKT_FLAG_KEY) && nTS >= pChunk->nEndTS) bVideoDone = XTRUE;
+
+            bDecode = bVideoStarted && !bVideoDone;
+        }
+        else if (nTime != AV_NOPTS_VALUE)
+        {
+            /* Other streams are cut at the same times */
+            if (pChunk->nStartTime != AV_NOPTS_VALUE && nTime < pChunk->nStartTime) bDecode = XFALSE;
+            if (pChunk->nEndTime != AV_NOPTS_VALUE && nTime >= pChunk->nEndTime) bDecode = XFALSE;
+        }
+
+        if (bDecode) XDecoder_DecodePacket(pDecoder, pPacket);
+        av_packet_unref(pPacket);
+
+        if (bVideoDone && nTime != AV_NOPTS_VALUE &&
+            nTime >= pChunk->nEndTime + XCHUNK_GUARD_TIME) break;
+
+        nStatus = XDecoder_ReadPacket(pDecoder, pPacket);
+    }
+
+    /* Deliver delayed frames and flush the encoders */
+    XDecoder_Drain(pDecoder);
+    XEncoder_FinishWrite(&pTransmuxer->encoder, XTRUE);
+
+    av_packet_free(&pPacket);
+    return (!g_nInterrupted && (nStatus >= 0 || nStatus == AVERROR_EOF)) ? XTRUE : XFALSE;
+}
+
+static void* XTranscoder_ChunkThread(void *pCtx)
+{
+    xchunk_pool_t *pPool = (xchunk_pool_t*)pCtx;
+
+    while (!g_nInterrupted)
+    {
+        /* Next range in order, at most one per worker at a time */
+        pthread_mutex_lock(&pPool->lock);
+        int nIndex = pPool->nNext < pPool->nCount ? pPool->nNext++ : XSTDERR;
+        pthread_mutex_unlock(&pPool->lock);
+        if (nIndex < 0) break;
+
+        xchunk_t *pChunk = &pPool->pChunks[nIndex];
+        xtranscoder_t *pTransmuxer = &pChunk->transcoder;
+
+        pChunk->bStatus = XTranscoder_InitDecoder(pTransmuxer) &&
+                          XTranscoder_InitEncoder(pTransmuxer) &&
+                          XTranscoder_TranscodeChunk(pChunk);
+
+        if (!pChunk->bStatus) xloge("Failed to transcode chunk: %s", pTransmuxer->args.outFile);
+    }
+
+    return NULL;
+}
+
+xbool_t XTranscoder_AppendPart(xtranscoder_t *pTransmuxer, xdecoder_t *pPart, AVPacket *pPacket,
+                               int64_t *pNextDTS, int64_t nStartTime, int64_t *pOffset)
+{
+    AVFormatContext *pFmtCtx = pPart->pFmtCtx;
+    unsigned int i, nStreams = pFmtCtx->nb_streams;
+    int64_t nOffset = *pOffset;
+    size_t nDropped = 0;
+
+    if (nStartTime != AV_NOPTS_VALUE)
+    {
+        /* Audio runs past the cut and is trimmed below, only video moves the shift */
+        for (i = 0; i < nStreams; i++)
+        {
+            if (pNextDTS[i] == AV_NOPTS_VALUE || pFmtCtx->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) continue;
+            int64_t nEndTime = av_rescale_q(pNextDTS[i], pFmtCtx->streams[i]->time_base, AV_TIME_BASE_Q);
+            nOffset = XSTD_MAX(nOffset, nEndTime - nStartTime);
+        }
+    }
+
+    XSTATUS nStatus = XDecoder_ReadPacket(pPart, pPacket);
+    while (!g_nInterrupted && nStatus >= 0)
+    {
+        int nIndex = pPacket->stream_index;
+        xstream_t *pStream = XStreams_GetBySrcIndex(&pTransmuxer->decoder.streams, nIndex);
+        int64_t nDTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+
+        if (pStream != NULL && pStream->nDstIndex >= 0)
+        {
+            int64_t nShift = av_rescale_q(nOffset, AV_TIME_BASE_Q, pFmtCtx->streams[nIndex]->time_base);
+            if (nDTS != AV_NOPTS_VALUE) nDTS += nShift;
+
+            /* Encoder priming before the range start is already covered by the previous part */
+            if (nDTS != AV_NOPTS_VALUE && pNextDTS[nIndex] != AV_NOPTS_VALUE && nDTS < pNextDTS[nIndex])
+            {
+                av_packet_unref(pPacket);
+                nStatus = XDecoder_ReadPacket(pPart, pPacket);
+                nDropped++;
+                continue;
+            }
+
+            if (pPacket->pts != AV_NOPTS_VALUE) pPacket->pts += nShift;
+            if (pPacket->dts != AV_NOPTS_VALUE) pPacket->dts += nShift;
+            if (nDTS != AV_NOPTS_VALUE) pNextDTS[nIndex] = nDTS + XSTD_MAX(pPacket->duration, 1);
+
+            pPacket->stream_index = pStream->nDstIndex;
+            XEncoder_WritePacket(&pTransmuxer->encoder, pPacket);
+        }
+
+        av_packet_unref(pPacket);
+        nStatus = XDecoder_ReadPacket(pPart, pPacket);
+    }
+
+    if (nDropped) xlogd("Dropped overlapping chunk packets: count(%zu), shift(%lld us)", nDropped, (long long)nOffset);
+    *pOffset = nOffset;
+    return nStatus == AVERROR_EOF ? XTRUE : XFALSE;
+}
+
+xbool_t XTranscoder_Concat(xtranscoder_t *pTransmuxer, xchunk_t *pChunks, int nCount)
+{
+    xmedia_args_t *pArgs = &pTransmuxer->args;
+
+    /* Output is opened with the streams of the first part */
+    xstrncpy(pArgs->inputFile, sizeof(pArgs->inputFile), pChunks[0].transcoder.args.outFile);
+    xstrncpy(pArgs->inputFmt, sizeof(pArgs->inputFmt), XCHUNK_FORMAT);
+    xstrnul(pArgs->streamInfo);
+    xstrnul(pArgs->keyIndex);
+    pArgs->eTSType = XPTS_RESCALE;
+    pArgs->bMapInput = XFALSE;
+    pArgs->bRemux = XTRUE;
+
+    if (!XTranscoder_InitDecoder(pTransmuxer) ||
+        !XTranscoder_InitEncoder(pTransmuxer)) return XFALSE;
+
+    unsigned int nStreams = pTransmuxer->decoder.pFmtCtx->nb_streams;
+    int64_t *pNextDTS = (int64_t*)malloc(nStreams * sizeof(int64_t));
+    AVPacket *pPacket = av_packet_alloc();
+
+    if (pNextDTS == NULL || pPacket == NULL)
+    {
+        xloge("Failed to allocate concat context: %s", strerror(errno));
+        av_packet_free(&pPacket);
+        free(pNextDTS);
+        return XFALSE;
+    }
+
+    xbool_t bStatus = XTRUE;
+    int64_t nOffset = 0;
+    unsigned int j;
+    int i;
+
+    for (j = 0; j < nStreams; j++) pNextDTS[j] = AV_NOPTS_VALUE;
+    bStatus = XTranscoder_AppendPart(pTransmuxer, &pTransmuxer->decoder, pPacket, pNextDTS, AV_NOPTS_VALUE, &nOffset);
+
+    for (i = 1; i < nCount && bStatus; i++)
+    {
+        xdecoder_t part;
+        XDecoder_Init(&part);
+        part.status.cb = status_cb;
+        part.status.nTypes = XSTATUS_ERROR;
+        part.bDemuxOnly = XTRUE;
+
+        const char *pPath = pChunks[i].transcoder.args.outFile;
+        bStatus = XDecoder_OpenInput(&part, pPath, XCHUNK_FORMAT) > 0 && part.pFmtCtx->nb_streams == nStreams;
+
+        if (bStatus) bStatus = XTranscoder_AppendPart(pTransmuxer, &part, pPacket, pNextDTS, pChunks[i].nStartTime, &nOffset);
+        else xloge("Chunk output does not match the first part: %s", pPath);
+
+        XDecoder_Destroy(&part);
+    }
+
+    XEncoder_FinishWrite(&pTransmuxer->encoder, XFALSE);
+    av_packet_free(&pPacket);
+    free(pNextDTS);
+    return bStatus;
+}
+
+xbool_t XTranscoder_Chunked(xtranscoder_t *pTransmuxer)
+{
+    xchunk_t *pChunks = NULL;
+    int i, nCount = XTranscoder_PlanChunks(pTransmuxer, &pChunks);
+    XASSERT((nCount > 0), XFALSE);
+    xbool_t bStatus = XTRUE;
+
+    /* Without user sidecar the parts share a temporary one */
+    xbool_t bPartIndex = !xstrused(pTransmuxer->args.keyIndex);
+
+    long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nCPUs <= 0) nCPUs = 1;
+
+    /* Ranges in flight are capped, each gets an equal share of the CPUs */
+    int nWorkers = pTransmuxer->args.nWorkers > 0 ? pTransmuxer->args.nWorkers : (int)nCPUs;
+    nWorkers = XSTD_MAX(XSTD_MIN(nWorkers, nCount), 1);
+    int nEncodeThreads = pTransmuxer->args.nEncodeThreads > 0 ?
+        pTransmuxer->args.nEncodeThreads : XSTD_MAX((int)nCPUs / nWorkers, 1);
+
+    for (i = 0; i < nCount; i++)
+        pChunks[i].transcoder.args.nEncodeThreads = nEncodeThreads;
+
+    /* Budget is split between the decoders running at once */
+    XDecoder_SetThreadBudget(pTransmuxer->args.nDecodeThreads, nWorkers);
+
+    xchunk_pool_t pool;
+    pthread_mutex_init(&pool.lock, NULL);
+    pool.pChunks = pChunks;
+    pool.nCount = nCount;
+    pool.nNext = 0;
+
+    pthread_t *pThreads = (pthread_t*)calloc(nWorkers, sizeof(pthread_t));
+    int nStarted = 0;
+
+    if (pThreads == NULL)
+    {
+        xloge("Failed to allocate chunk workers: %s", strerror(errno));
+        bStatus = XFALSE;
+    }
+
+    /* Each range has own decoder/encoder pair, workers take them in order */
+    while (bStatus && nStarted < nWorkers)
+    {
+        if (!pthread_create(&pThreads[nStarted], NULL, XTranscoder_ChunkThread, &pool))
+        {
+            nStarted++;
+            continue;
+        }
+
+        xloge("Failed to start chunk worker: %d", nStarted);
+        bStatus = nStarted > 0;
+        break;
+    }
+
+    if (nStarted) xlogn("Running chunk workers: workers(%d), encoder threads(%d)", nStarted, nEncodeThreads);
+    for (i = 0; i < nStarted; i++) pthread_join(pThreads[i], NULL);
+
+    for (i = 0; i < nCount; i++)
+        if (!pChunks[i].bStatus) bStatus = XFALSE;
+
+    pthread_mutex_destroy(&pool.lock);
+    free(pThreads);
+
+    /* Stream copy all parts to the requested output */
+    if (bStatus) bStatus = XTranscoder_Concat(pTransmuxer, pChunks, nCount);
+
+    const char *pPartIndex = pChunks[0].transcoder.args.keyIndex;
+    if (bPartIndex && xstrused(pPartIndex)) remove(pPartIndex);
+
+    for (i = 0; i < nCount; i++)
+    {
+        xtranscoder_t *pPart = &pChunks[i].transcoder;
+        XTranscoder_Destroy(pPart);
+        remove(pPart->args.outFile);
+    }
+
+    free(pChunks);
+    return bStatus;
+}
+
+typedef enum {
+    XJOB_PENDING = 0,
+    XJOB_RUNNING,
+    XJOB_DONE,
+    XJOB_FAILED
+} xjob_state_t;
+
+typedef struct {
+    xjson_obj_t *pJobObj;
+    const char *pInput;
+    xjob_state_t eState;
+
+    /* Output in progress, guarded by the batch lock */
+    xtranscoder_t *pRunning;
+    size_t nOutputs;
+    size_t nOutput;
+
+    int nRetries;
+    int nAttempts;
+    uint64_t nElapsed;
+} xjob_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t doneCond;
+    xtranscoder_t *pDefaults;
+    xjob_t *pJobs;
+    size_t nJobs;
+    size_t nNext;
+    size_t nActive;
+} xbatch_t;
+
+const char* XBatch_GetStateStr(xjob_state_t eState)
+{
+    switch (eState)
+    {
+        case XJOB_PENDING: return "pending";
+        case XJOB_RUNNING: return "running";
+        case XJOB_DONE: return "done";
+        case XJOB_FAILED: return "failed";
+        default: break;
+    }
+
+    return "unknown";
+}
+
+xbool_t XBatch_LoadCodecs(xmedia_args_t *pArgs, xjson_obj_t *pCodecsObj)
+{
+    size_t i, nCount = pCodecsObj != NULL ? XJSON_GetArrayLength(pCodecsObj) : 0;
+
+    for (i = 0; i < nCount; i++)
+    {
+        xjson_obj_t *pCodecObj = XJSON_GetArrayItem(pCodecsObj, i);
+        xcodec_t codecInfo;
+
+        /* Same syntax as the codec JSON dump, media type is required */
+        if (XCodec_FromJSONObj(&codecInfo, pCodecObj) <= 0) return XFALSE;
+        XCodec_Clear(&codecInfo);
+
+        if (!XJSON_GetObject(pCodecObj, "scaleFmt")) codecInfo.scaleFmt = XSCALE_FMT_NONE;
+        if (codecInfo.mediaType == AVMEDIA_TYPE_VIDEO) pArgs->videoOpts = codecInfo;
+        else if (codecInfo.mediaType == AVMEDIA_TYPE_AUDIO) pArgs->audioOpts = codecInfo;
+        else return XFALSE;
+    }
+
+    return XTRUE;
+}
+
+xbool_t XBatch_RunOutput(xbatch_t *pBatch, xjob_t *pJob, xjson_obj_t *pOutputObj)
+{
+    const char *pOutput = XJSON_GetString(XJSON_GetObject(pOutputObj, "path"));
+    const char *pOutFmt = XJSON_GetString(XJSON_GetObject(pOutputObj, "format"));
+    const char *pInFmt = XJSON_GetString(XJSON_GetObject(pJob->pJobObj, "inputFormat"));
+    xjson_obj_t *pRemuxObj = XJSON_GetObject(pJob->pJobObj, "remux");
+    XASSERT(xstrused(pOutput), xthrowr(XFALSE, "Missing output path: %s", pJob->pInput));
+
+    xtranscoder_t *pTransmuxer = (xtranscoder_t*)malloc(sizeof(xtranscoder_t));
+    XASSERT(pTransmuxer, xthrowr(XFALSE, "Failed to allocate transcoder: %s", strerror(errno)));
+
+    /* Command line options are the defaults of each job */
+    XTranscoder_Init(pTransmuxer);
+    pTransmuxer->args = pBatch->pDefaults->args;
+    xmedia_args_t *pArgs = &pTransmuxer->args;
+
+    /* Caches describe one input, jobs must not share them */
+    xstrnul(pArgs->streamInfo);
+    xstrnul(pArgs->keyIndex);
+
+    xstrncpy(pArgs->inputFile, sizeof(pArgs->inputFile), pJob->pInput);
+    xstrncpy(pArgs->outFile, sizeof(pArgs->outFile), pOutput);
+    if (xstrused(pInFmt)) xstrncpy(pArgs->inputFmt, sizeof(pArgs->inputFmt), pInFmt);
+    if (xstrused(pOutFmt)) xstrncpy(pArgs->outFmt, sizeof(pArgs->outFmt), pOutFmt);
+    if (pRemuxObj != NULL) pArgs->bRemux = XJSON_GetBool(pRemuxObj);
+
+    pArgs->nChunks = XSTDNON;
+    pArgs->bLoop = XFALSE;
+
+    /* Output codecs override the job codecs */
+    xbool_t bStatus = XBatch_LoadCodecs(pArgs, XJSON_GetObject(pJob->pJobObj, "codecs")) &&
+                      XBatch_LoadCodecs(pArgs, XJSON_GetObject(pOutputObj, "codecs"));
+
+    if (!bStatus) xloge("Invalid codec options: %s", pOutput);
+    else
+    {
+        pthread_mutex_lock(&pBatch->lock);
+        pJob->pRunning = pTransmuxer;
+        pthread_mutex_unlock(&pBatch->lock);
+
+        bStatus = XTranscoder_InitDecoder(pTransmuxer) &&
+                  XTranscoder_InitEncoder(pTransmuxer) &&
+                  XTranscoder_Transcode(pTransmuxer) &&
+                  !g_nInterrupted;
+
+        pthread_mutex_lock(&pBatch->lock);
+        pJob->pRunning = NULL;
+        pthread_mutex_unlock(&pBatch->lock);
+    }
+
+    XTranscoder_Destroy(pTransmuxer);
+    free(pTransmuxer);
+    return bStatus;
+}
+
+void XBatch_RunJob(xbatch_t *pBatch, xjob_t *pJob)
+{
+    xjson_obj_t *pOutputsObj = XJSON_GetObject(pJob->pJobObj, "outputs");
+    uint64_t nStartTime = XTime_GetStamp();
+    xbool_t bStatus = XFALSE;
+
+    while (!bStatus && !g_nInterrupted && pJob->nAttempts <= pJob->nRetries)
+    {
+        if (pJob->nAttempts++) xlogw("Retrying job: %s (attempt %d, output %zu/%zu)",
+            pJob->pInput, pJob->nAttempts, pJob->nOutput + 1, pJob->nOutputs);
+        bStatus = XTRUE;
+
+        /* Each output is a separate pass, retry resumes at the failed one */
+        while (bStatus && pJob->nOutput < pJob->nOutputs)
+        {
+            xjson_obj_t *pOutputObj = XJSON_GetArrayItem(pOutputsObj, pJob->nOutput);
+            bStatus = XBatch_RunOutput(pBatch, pJob, pOutputObj);
+            if (!bStatus) break;
+
+            pthread_mutex_lock(&pBatch->lock);
+            pJob->nOutput++;
+            pthread_mutex_unlock(&pBatch->lock);
+        }
+    }
+
+    pthread_mutex_lock(&pBatch->lock);
+    pJob->eState = bStatus ? XJOB_DONE : XJOB_FAILED;
+    pJob->nElapsed = XTime_GetStamp() - nStartTime;
+    pthread_mutex_unlock(&pBatch->lock);
+
+    if (bStatus) xlogn("Job done: %s (%.2fs)", pJob->pInput, (double)pJob->nElapsed / 1000000);
+    else xloge("Job failed: %s (attempts: %d)", pJob->pInput, pJob->nAttempts);
+}
+
+void* XBatch_WorkerThread(void *pCtx)
+{
+    xbatch_t *pBatch = (xbatch_t*)pCtx;
+
+    while (!g_nInterrupted)
+    {
+        pthread_mutex_lock(&pBatch->lock);
+        xjob_t *pJob = NULL;
+
+        /* Jobs are taken in the order of the spec */
+        while (pBatch->nNext < pBatch->nJobs && pJob == NULL)
+        {
+            xjob_t *pNext = &pBatch->pJobs[pBatch->nNext++];
+            if (pNext->eState == XJOB_PENDING) pJob = pNext;
+        }
+
+        if (pJob != NULL) pJob->eState = XJOB_RUNNING;
+        pthread_mutex_unlock(&pBatch->lock);
+
+        if (pJob == NULL) break;
+        XBatch_RunJob(pBatch, pJob);
+    }
+
+    pthread_mutex_lock(&pBatch->lock);
+    pBatch->nActive--;
+    pthread_cond_signal(&pBatch->doneCond);
+    pthread_mutex_unlock(&pBatch->lock);
+    return NULL;
+}
+
+xbool_t XBatch_Wait(xbatch_t *pBatch, int nTimeoutMs)
+{
+    pthread_mutex_lock(&pBatch->lock);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += nTimeoutMs / 1000;
+    ts.tv_nsec += (long)(nTimeoutMs % 1000) * 1000000;
+
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_nsec -= 1000000000;
+        ts.tv_sec++;
+    }
+
+    while (pBatch->nActive)
+        if (pthread_cond_timedwait(&pBatch->doneCond, &pBatch->lock, &ts)) break;
+
+    xbool_t bDone = !pBatch->nActive;
+    pthread_mutex_unlock(&pBatch->lock);
+    return bDone;
+}
+
+void XBatch_Progress(xbatch_t *pBatch)
+{
+    size_t i;
+    pthread_mutex_lock(&pBatch->lock);
+
+    for (i = 0; i < pBatch->nJobs; i++)
+    {
+        xjob_t *pJob = &pBatch->pJobs[i];
+        if (pJob->eState != XJOB_RUNNING || pJob->pRunning == NULL) continue;
+
+        uint32_t nProgress = XSYNC_ATOMIC_GET(&pJob->pRunning->nProgress);
+        xlogn("Job %zu/%zu: %s, output(%zu/%zu), progress(%u.%u%%)", i + 1, pBatch->nJobs,
+            pJob->pInput, pJob->nOutput + 1, pJob->nOutputs, nProgress / 10, nProgress % 10);
+    }
+
+    pthread_mutex_unlock(&pBatch->lock);
+}
+
+void XBatch_Report(xbatch_t *pBatch, const char *pPath, uint64_t nElapsed)
+{
+    size_t i, nDone = 0, nFailed = 0;
+    xjson_obj_t *pRootObj = XJSON_NewObject(NULL, NULL, XFALSE);
+    xjson_obj_t *pJobsObj = XJSON_NewArray(NULL, "jobs", XFALSE);
+
+    for (i = 0; i < pBatch->nJobs; i++)
+    {
+        xjob_t *pJob = &pBatch->pJobs[i];
+        if (pJob->eState == XJOB_DONE) nDone++;
+        else nFailed++;
+
+        xlog("%s%-8s%s %5.2fs  attempts(%d)  %s", pJob->eState == XJOB_DONE ? XSTR_CLR_GREEN : XSTR_CLR_RED,
+            XBatch_GetStateStr(pJob->eState), XSTR_FMT_RESET, (double)pJob->nElapsed / 1000000,
+            pJob->nAttempts, xstrused(pJob->pInput) ? pJob->pInput : "(none)");
+
+        xjson_obj_t *pJobObj = pJobsObj != NULL ? XJSON_NewObject(NULL, NULL, XFALSE) : NULL;
+        if (pJobObj == NULL) continue;
+
+        XJSON_AddObject(pJobObj, XJSON_NewString(NULL, "input", xstrused(pJob->pInput) ? pJob->pInput : ""));
+        XJSON_AddObject(pJobObj, XJSON_NewString(NULL, "state", XBatch_GetStateStr(pJob->eState)));
+        XJSON_AddObject(pJobObj, XJSON_NewInt(NULL, "attempts", pJob->nAttempts));
+        XJSON_AddObject(pJobObj, XJSON_NewU64(NULL, "elapsedUs", pJob->nElapsed));
+        XJSON_AddObject(pJobsObj, pJobObj);
+    }
+
+    xlog("Jobs: %zu, done: %zu, failed: %zu, time: %.2fs", pBatch->nJobs,
+        nDone, nFailed, (double)nElapsed / 1000000);
+
+    if (pRootObj == NULL || pJobsObj == NULL || !xstrused(pPath))
+    {
+        XJSON_FreeObject(pJobsObj);
+        XJSON_FreeObject(pRootObj);
+        return;
+    }
+
+    XJSON_AddObject(pRootObj, XJSON_NewU64(NULL, "jobCount", pBatch->nJobs));
+    XJSON_AddObject(pRootObj, XJSON_NewU64(NULL, "doneCount", nDone));
+    XJSON_AddObject(pRootObj, XJSON_NewU64(NULL, "failedCount", nFailed));
+    XJSON_AddObject(pRootObj, XJSON_NewU64(NULL, "elapsedUs", nElapsed));
+    XJSON_AddObject(pRootObj, pJobsObj);
+
+    xjson_writer_t writer;
+    XJSON_InitWriter(&writer, NULL, NULL, XSTR_MID);
+    writer.nTabSize = 4;
+    writer.nPretty = XTRUE;
+
+    XSTATUS nStatus = XJSON_WriteObject(pRootObj, &writer) ? XSTDOK : XSTDERR;
+    if (nStatus == XSTDOK) nStatus = XPath_Write(pPath, (uint8_t*)writer.pData, writer.nLength, "cwt");
+    if (nStatus <= 0) xloge("Failed to write batch report: %s", pPath);
+
+    XJSON_DestroyWriter(&writer);
+    XJSON_FreeObject(pRootObj);
+}
+
+xbool_t XBatch_LoadJobs(xbatch_t *pBatch, xjson_obj_t *pJobsObj, int nRetries)
+{
+    size_t i, nCount = pJobsObj != NULL ? XJSON_GetArrayLength(pJobsObj) : 0;
+    XASSERT(nCount, xthrowr(XFALSE, "Batch job list is empty"));
+
+    pBatch->pJobs = (xjob_t*)calloc(nCount, sizeof(xjob_t));
+    XASSERT(pBatch->pJobs, xthrowr(XFALSE, "Failed to allocate jobs: %s", strerror(errno)));
+    pBatch->nJobs = nCount;
+
+    for (i = 0; i < nCount; i++)
+    {
+        xjob_t *pJob = &pBatch->pJobs[i];
+        pJob->pJobObj = XJSON_GetArrayItem(pJobsObj, i);
+        pJob->pInput = XJSON_GetString(XJSON_GetObject(pJob->pJobObj, "input"));
+        xjson_obj_t *pOutputsObj = XJSON_GetObject(pJob->pJobObj, "outputs");
+        pJob->nOutputs = pOutputsObj != NULL ? XJSON_GetArrayLength(pOutputsObj) : 0;
+
+        xjson_obj_t *pRetriesObj = XJSON_GetObject(pJob->pJobObj, "retries");
+        pJob->nRetries = pRetriesObj != NULL ? XJSON_GetInt(pRetriesObj) : nRetries;
+        pJob->eState = XJOB_PENDING;
+
+        /* Invalid jobs are reported, the others still run */
+        if (!xstrused(pJob->pInput) || !pJob->nOutputs)
+        {
+            xloge("Invalid batch job: %zu (input and outputs are required)", i);
+            pJob->eState = XJOB_FAILED;
+        }
+    }
+
+    return XTRUE;
+}
+
+xbool_t XTranscoder_Batch(xtranscoder_t *pTransmuxer)
+{
+    const char *pPath = pTransmuxer->args.batchFile;
+    size_t nLength = 0;
+
+    char *pData = (char*)XPath_Load(pPath, &nLength);
+    XASSERT(pData, xthrowr(XFALSE, "Failed to load batch file: %s", pPath));
+
+    xjson_t json;
+    if (!XJSON_Parse(&json, NULL, pData, nLength))
+    {
+        xloge("Failed to parse batch file: %s", pPath);
+        XJSON_Destroy(&json);
+        free(pData);
+        return XFALSE;
+    }
+
+    xjson_obj_t *pWorkersObj = XJSON_GetObject(json.pRootObj, "workers");
+    xjson_obj_t *pBudgetObj = XJSON_GetObject(json.pRootObj, "cpuBudget");
+    xjson_obj_t *pRetriesObj = XJSON_GetObject(json.pRootObj, "retries");
+    const char *pReport = XJSON_GetString(XJSON_GetObject(json.pRootObj, "report"));
+
+    long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nCPUs <= 0) nCPUs = 1;
+
+    /* One thread budget is shared by all running jobs */
+    xmedia_args_t *pArgs = &pTransmuxer->args;
+    if (pArgs->nDecodeThreads <= 0) pArgs->nDecodeThreads = pBudgetObj != NULL ? XJSON_GetInt(pBudgetObj) : (int)nCPUs;
+    if (pArgs->nWorkers <= 0) pArgs->nWorkers = pWorkersObj != NULL ? XJSON_GetInt(pWorkersObj) : (int)nCPUs;
+    int nRetries = pRetriesObj != NULL ? XJSON_GetInt(pRetriesObj) : XSTDNON;
+
+    xbatch_t batch;
+    memset(&batch, 0, sizeof(xbatch_t));
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.doneCond, NULL);
+    batch.pDefaults = pTransmuxer;
+
+    xbool_t bStatus = XBatch_LoadJobs(&batch, XJSON_GetObject(json.pRootObj, "jobs"), nRetries);
+    size_t i, nWorkers = bStatus ? XSTD_MIN((size_t)XSTD_MAX(pArgs->nWorkers, 1), batch.nJobs) : 0;
+    pthread_t *pThreads = nWorkers ? (pthread_t*)calloc(nWorkers, sizeof(pthread_t)) : NULL;
+    uint64_t nStartTime = XTime_GetStamp();
+
+    if (bStatus && pThreads == NULL)
+    {
+        xloge("Failed to allocate batch workers: %s", strerror(errno));
+        bStatus = XFALSE;
+    }
+
+    if (bStatus)
+    {
+        /* Half of the budget is for the decoders, half for the video encoders */
+        int nShare = XSTD_MAX(pArgs->nDecodeThreads / (2 * (int)nWorkers), 1);
+        if (pArgs->nEncodeThreads <= 0) pArgs->nEncodeThreads = nShare;
+
+        xlogn("Starting batch: jobs(%zu), workers(%zu), budget(%d), decoder threads(%d), encoder threads(%d)",
+            batch.nJobs, nWorkers, pArgs->nDecodeThreads, nShare, pArgs->nEncodeThreads);
+        XDecoder_SetThreadBudget(nShare * (int)nWorkers, (int)nWorkers);
+
+        /* Workers wait for the lock until all of them are started */
+        pthread_mutex_lock(&batch.lock);
+        for (i = 0; i < nWorkers; i++)
+        {
+            if (pthread_create(&pThreads[i], NULL, XBatch_WorkerThread, &batch)) break;
+            batch.nActive++;
+        }
+
+        pthread_mutex_unlock(&batch.lock);
+        if (i < nWorkers) xloge("Started %zu of %zu batch workers", i, nWorkers);
+        nWorkers = i;
+
+        while (!XBatch_Wait(&batch, XBATCH_REPORT_TIME))
+            if (!g_nInterrupted) XBatch_Progress(&batch);
+
+        for (i = 0; i < nWorkers; i++)
+            pthread_join(pThreads[i], NULL);
+
+        XBatch_Report(&batch, pReport, XTime_GetStamp() - nStartTime);
+        for (i = 0; i < batch.nJobs; i++)
+            if (batch.pJobs[i].eState != XJOB_DONE) bStatus = XFALSE;
+    }
+
+    pthread_cond_destroy(&batch.doneCond);
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.pJobs);
+    free(pThreads);
+
+    XJSON_Destroy(&json);
+    free(pData);
+    return bStatus;
 }
 
 void XTranscoder_Usage(const char *pName)
@@ -382,6 +1435,9 @@ void XTranscoder_Usage(const char *pName)
     xlog("  -o <path>            # Output file or srewam path (%s*%s)", XSTR_CLR_RED, XSTR_FMT_RESET);
     xlog("  -e <format>          # Input format name (example: v4l2)");
     xlog("  -f <format>          # Output format name (example: mp4)");
+    xlog("  -I <path>            # Stream info cache (skips probing if exists)");
+    xlog("  -A <msec>            # Input analyze duration (default: 5000)");
+    xlog("  -X <path>            # Keyframe index file (created after first read)");
     xlog("  -x <format>          # Video scale format (example: aspect)");
     xlog("  -p <format>          # Video pixel format (example: yuv420p)");
     xlog("  -s <format>          # Audio sample format (example: s16p)");
@@ -393,9 +1449,24 @@ void XTranscoder_Usage(const char *pName)
     xlog("  -w <width>           # Output video width (example: 1280)");
     xlog("  -h <height>          # Output video height (example: 720)");
     xlog("  -b <bytes>           # IO buffer size (default: 65536)");
+    xlog("  -j <number>          # Async output buffer count (with -z)");
+    xlog("  -g <mode>            # Native file output mode (buffered, direct)");
+    xlog("  -P <number>          # Decoder thread budget (default: auto)");
+    xlog("  -R <fps>             # Decoded video frame rate (analytics mode)");
+    xlog("  -L <number>          # Decode at reduced size (1: 1/2, 2: 1/4, 3: 1/8)");
+    xlog("  -S <seconds>         # HLS segment duration (output is playlist)");
+    xlog("  -C <count>           # Parallel chunked transcoding (file input)");
+    xlog("  -B <path>            # Batch job list (JSON, replaces -i/-o)");
+    xlog("  -W <count>           # Batch/chunk worker count (default: CPU count)");
+    xlog("  -D <policy>          # Frame drop policy under load (decimate, skip)");
     xlog("  -t <type>            # Timestamp calculation type");
     xlog("  -m <path>            # Metadata file path");
     xlog("  -n <number>          # Fix non motion PTS/DTS");
+    xlog("  -T                   # Native MPEG-TS muxer (with -f mpegts)");
+    xlog("  -N                   # Threaded input (demux/decode threads)");
+    xlog("  -M                   # Memory-mapped input (local files)");
+    xlog("  -K                   # Decode video keyframes only");
+    xlog("  -y                   # Low latency output mode");
     xlog("  -z                   # Custom output handling");
     xlog("  -l                   # Loop transcoding/remuxing");
     xlog("  -r                   # Remux only");
@@ -411,7 +1482,8 @@ void XTranscoder_Usage(const char *pName)
     xlog("- compute   %s(Compute TS based on the sample rate and time base)%s", XSTR_FMT_DIM, XSTR_FMT_RESET);
     xlog("- rescale   %s(Rescale original TS using av_packet_rescale_ts())%s", XSTR_FMT_DIM, XSTR_FMT_RESET);
     xlog("- round     %s(Rescale original TS and round to the nearest value)%s", XSTR_FMT_DIM, XSTR_FMT_RESET);
-    xlog("- source    %s(Use original PTS from the source stream)%s\n", XSTR_FMT_DIM, XSTR_FMT_RESET);
+    xlog("- source    %s(Use original PTS from the source stream)%s", XSTR_FMT_DIM, XSTR_FMT_RESET);
+    xlog("- normalize %s(Unwrap, smooth and drift correct original TS)%s\n", XSTR_FMT_DIM, XSTR_FMT_RESET);
 
     xlog("Metadata file syntax:");
     xlog("%sstart-time|end-time|chapter-name%s", XSTR_FMT_DIM, XSTR_FMT_RESET);
@@ -441,6 +1513,7 @@ xpts_ctl_t XTranscoder_GetTSType(const char *pType)
     else if (!strncmp(pType, "rescale", 7)) return XPTS_RESCALE;
     else if (!strncmp(pType, "round", 5)) return XPTS_ROUND;
     else if (!strncmp(pType, "source", 6)) return XPTS_SOURCE;
+    else if (!strncmp(pType, "normalize", 9)) return XPTS_NORMALIZE;
     return XPTS_INVALID;
 }
 
@@ -531,7 +1604,7 @@ XSTATUS XTranscoder_ParseArgs(xtranscoder_t *pTransmuxer, int argc, char *argv[]
     xbool_t bPixelFormatParsed = XFALSE;
     xbool_t bSampleFormatParsed = XFALSE;
 
-    while ((nChar = getopt(argc, argv, "a:b:c:f:i:e:m:n:o:p:k:q:s:t:w:h:v:x:z1:l1:d1:r1:u1")) != -1)
+    while ((nChar = getopt(argc, argv, "a:b:c:f:g:i:e:j:A:B:C:D:I:P:R:L:S:W:X:T1:N1:M1:K1:m:n:o:p:k:q:s:t:w:h:v:x:y1:z1:l1:d1:r1:u1")) != -1)
     {
         switch (nChar)
         {
@@ -541,6 +1614,15 @@ XSTATUS XTranscoder_ParseArgs(xtranscoder_t *pTransmuxer, int argc, char *argv[]
             case 'e':
                 xstrncpy(pArgs->inputFmt, sizeof(pArgs->inputFmt), optarg);
                 break;
+            case 'I':
+                xstrncpy(pArgs->streamInfo, sizeof(pArgs->streamInfo), optarg);
+                break;
+            case 'A':
+                pArgs->nAnalyzeTime = atoi(optarg);
+                break;
+            case 'X':
+                xstrncpy(pArgs->keyIndex, sizeof(pArgs->keyIndex), optarg);
+                break;
             case 'o':
                 xstrncpy(pArgs->outFile, sizeof(pArgs->outFile), optarg);
                 break;
@@ -585,6 +1667,38 @@ XSTATUS XTranscoder_ParseArgs(xtranscoder_t *pTransmuxer, int argc, char *argv[]
             case 'b':
                 pArgs->nIOBuffSize = atoi(optarg);
                 break;
+            case 'j':
+                pArgs->nAsyncDepth = atoi(optarg);
+                break;
+            case 'P':
+                pArgs->nDecodeThreads = atoi(optarg);
+                break;
+            case 'R':
+                pArgs->nDecodeRate = atoi(optarg);
+                break;
+            case 'L':
+                pArgs->nLowres = atoi(optarg);
+                break;
+            case 'S':
+                pArgs->nSegmentTime = atoi(optarg);
+                break;
+            case 'C':
+                pArgs->nChunks = atoi(optarg);
+                break;
+            case 'B':
+                xstrncpy(pArgs->batchFile, sizeof(pArgs->batchFile), optarg);
+                break;
+            case 'W':
+                pArgs->nWorkers = atoi(optarg);
+                break;
+            case 'D':
+                if (!strncmp(optarg, "decimate", 8)) pArgs->eShedPolicy = XLOADSHED_DECIMATE;
+                else if (!strncmp(optarg, "skip", 4)) pArgs->eShedPolicy = XLOADSHED_SKIP;
+                break;
+            case 'g':
+                pArgs->bDirectIO = !strncmp(optarg, "direct", 6);
+                pArgs->bFileSink = XTRUE;
+                break;
             case 'w':
                 pArgs->nWidth = atoi(optarg);
                 break;
@@ -594,6 +1708,21 @@ XSTATUS XTranscoder_ParseArgs(xtranscoder_t *pTransmuxer, int argc, char *argv[]
             case 'n':
                 pArgs->nTSFix = atoi(optarg);
                 break;
+            case 'T':
+                pArgs->bNativeTS = XTRUE;
+                break;
+            case 'N':
+                pArgs->bThreadedInput = XTRUE;
+                break;
+            case 'M':
+                pArgs->bMapInput = XTRUE;
+                break;
+            case 'K':
+                pArgs->bKeyOnly = XTRUE;
+                break;
+            case 'y':
+                pArgs->bLowLatency = XTRUE;
+                break;
             case 'z':
                 pArgs->bCustomIO = XTRUE;
                 break;
@@ -613,13 +1742,13 @@ XSTATUS XTranscoder_ParseArgs(xtranscoder_t *pTransmuxer, int argc, char *argv[]
         }
     }
 
-    if (!xstrused(pArgs->inputFile))
+    if (!xstrused(pArgs->inputFile) && !xstrused(pArgs->batchFile))
     {
         xloge("Required input file argument");
         return XSTDERR;
     }
 
-    if (!xstrused(pArgs->outFile))
+    if (!xstrused(pArgs->outFile) && !xstrused(pArgs->batchFile))
     {
         xloge("Required output file argument");
         return XSTDERR;
@@ -723,10 +1852,21 @@ int main(int argc, char *argv[])
         return XSTDERR;
     }
 
+    /* Run all jobs of the list in this process */
+    xbool_t bBatch = xstrused(transcoder.args.batchFile);
+    if (bBatch && !XTranscoder_Batch(&transcoder)) nStatus = XSTDERR;
+
+    /* Split the input between parallel transcoders */
+    xbool_t bChunked = !bBatch && transcoder.args.nChunks > 1 && !transcoder.args.bRemux;
+    if (bChunked && !XTranscoder_Chunked(&transcoder)) nStatus = XSTDERR;
+
+    /* Single decoder may use the whole thread budget */
+    if (!bBatch && !bChunked) XDecoder_SetThreadBudget(transcoder.args.nDecodeThreads, 1);
+
     /* Init encoder/decoder and start transcoding */
-    if (!XTranscoder_InitDecoder(&transcoder) ||
+    if (!bBatch && !bChunked && (!XTranscoder_InitDecoder(&transcoder) ||
         !XTranscoder_InitEncoder(&transcoder) ||
-        !XTranscoder_Transcode(&transcoder)) nStatus = XSTDERR;
+        !XTranscoder_Transcode(&transcoder))) nStatus = XSTDERR;
 
     /* Cleanup everything */
     XTranscoder_Destroy(&transcoder);
@@ -0,0 +1,408 @@
+/*!
+ *  @file libxmedia/src/asyncio.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the asynchronous muxer output
+ * with a ring of preallocated buffers and a writer thread.
+ */
+
+#include "asyncio.h"
+#include <sys/uio.h>
+
+void XAsyncIO_Init(xasync_io_t *pAsyncIO)
+{
+    XASSERT_VOID(pAsyncIO);
+    memset(&pAsyncIO->stats, 0, sizeof(xasync_stats_t));
+
+    pAsyncIO->nRunning = 0;
+    pAsyncIO->bStop = XFALSE;
+
+    pAsyncIO->pBuffers = NULL;
+    pAsyncIO->nBuffSize = 0;
+    pAsyncIO->nDepth = 0;
+    pAsyncIO->nPending = 0;
+    pAsyncIO->nHead = 0;
+
+    pAsyncIO->pressureCallback = NULL;
+    pAsyncIO->nHighWatermark = 0;
+    pAsyncIO->nLowWatermark = 0;
+    pAsyncIO->nPressure = 0;
+
+    pAsyncIO->writeCallback = NULL;
+    pAsyncIO->pUserCtx = NULL;
+    pAsyncIO->nFD = XSTDERR;
+    pAsyncIO->nError = 0;
+}
+
+static void XAsyncIO_FreeBuffers(xasync_io_t *pAsyncIO)
+{
+    XASSERT_VOID_RET(pAsyncIO->pBuffers);
+    size_t i;
+
+    for (i = 0; i < pAsyncIO->nDepth; i++)
+    {
+        xasync_buffer_t *pBuffer = &pAsyncIO->pBuffers[i];
+        if (pBuffer->pData != NULL) free(pBuffer->pData);
+    }
+
+    free(pAsyncIO->pBuffers);
+    pAsyncIO->pBuffers = NULL;
+    pAsyncIO->nDepth = 0;
+}
+
+void XAsyncIO_Destroy(xasync_io_t *pAsyncIO)
+{
+    XASSERT_VOID(pAsyncIO);
+    XASSERT_VOID_RET(pAsyncIO->pBuffers);
+    XAsyncIO_Stop(pAsyncIO);
+
+    pthread_cond_destroy(&pAsyncIO->fillCond);
+    pthread_cond_destroy(&pAsyncIO->freeCond);
+    pthread_mutex_destroy(&pAsyncIO->lock);
+    XAsyncIO_FreeBuffers(pAsyncIO);
+}
+
+static int XAsyncIO_WriteVector(int nFD, struct iovec *pIov, int nCount)
+{
+    while (nCount > 0)
+    {
+        ssize_t nWritten = writev(nFD, pIov, nCount);
+        if (nWritten < 0)
+        {
+            if (errno == EINTR) continue;
+            return AVERROR(errno);
+        }
+
+        /* Skip fully written vectors and adjust the partial one */
+        while (nCount > 0 && (size_t)nWritten >= pIov->iov_len)
+        {
+            nWritten -= pIov->iov_len;
+            pIov++;
+            nCount--;
+        }
+
+        if (nCount > 0)
+        {
+            pIov->iov_base = (uint8_t*)pIov->iov_base + nWritten;
+            pIov->iov_len -= nWritten;
+        }
+    }
+
+    return XSTDOK;
+}
+
+static int XAsyncIO_WriteBatch(xasync_io_t *pAsyncIO, size_t nHead, size_t nCount, size_t *pBytes)
+{
+    struct iovec iov[XASYNCIO_BATCH_MAX];
+    size_t i, nBytes = 0;
+    *pBytes = 0;
+
+    for (i = 0; i < nCount; i++)
+    {
+        xasync_buffer_t *pBuffer = &pAsyncIO->pBuffers[(nHead + i) % pAsyncIO->nDepth];
+        iov[i].iov_base = pBuffer->pData;
+        iov[i].iov_len = pBuffer->nUsed;
+        nBytes += pBuffer->nUsed;
+    }
+
+    if (pAsyncIO->nFD >= 0)
+    {
+        int nStatus = XAsyncIO_WriteVector(pAsyncIO->nFD, iov, (int)nCount);
+        if (nStatus < 0) return nStatus;
+
+        *pBytes = nBytes;
+        return XSTDOK;
+    }
+
+    for (i = 0; i < nCount; i++)
+    {
+        int nStatus = pAsyncIO->writeCallback(pAsyncIO->pUserCtx,
+            (const uint8_t*)iov[i].iov_base, (int)iov[i].iov_len);
+
+        if (nStatus < 0) return nStatus;
+        *pBytes += iov[i].iov_len;
+    }
+
+    return XSTDOK;
+}
+
+static void* XAsyncIO_WriterThread(void *pCtx)
+{
+    xasync_io_t *pAsyncIO = (xasync_io_t*)pCtx;
+    pthread_mutex_lock(&pAsyncIO->lock);
+
+    while (XTRUE)
+    {
+        while (!pAsyncIO->nPending && !pAsyncIO->bStop)
+            pthread_cond_wait(&pAsyncIO->fillCond, &pAsyncIO->lock);
+
+        if (!pAsyncIO->nPending && pAsyncIO->bStop) break;
+        size_t nCount = XSTD_MIN(pAsyncIO->nPending, XASYNCIO_BATCH_MAX);
+        size_t i, nHead = pAsyncIO->nHead;
+        int nError = pAsyncIO->nError;
+        size_t nBytes = 0;
+        int nStatus = 0;
+
+        /* Pending buffers are owned by writer until released */
+        pthread_mutex_unlock(&pAsyncIO->lock);
+        uint64_t nStartTime = XTime_GetStamp();
+
+        if (!nError)
+            nStatus = XAsyncIO_WriteBatch(pAsyncIO, nHead, nCount, &nBytes);
+
+        uint64_t nWriteTime = XTime_GetStamp() - nStartTime;
+        pthread_mutex_lock(&pAsyncIO->lock);
+
+        if (nStatus < 0 && !pAsyncIO->nError) pAsyncIO->nError = nStatus;
+        xasync_stats_t *pStats = &pAsyncIO->stats;
+
+        if (nWriteTime > pStats->nMaxWriteTime) pStats->nMaxWriteTime = nWriteTime;
+        pStats->nBuffersWritten += nCount;
+        pStats->nBytesWritten += nBytes;
+        pStats->nBatches++;
+
+        for (i = 0; i < nCount; i++)
+            pAsyncIO->pBuffers[(nHead + i) % pAsyncIO->nDepth].nUsed = 0;
+
+        pAsyncIO->nHead = (nHead + nCount) % pAsyncIO->nDepth;
+        pAsyncIO->nPending -= nCount;
+        pthread_cond_broadcast(&pAsyncIO->freeCond);
+    }
+
+    pthread_mutex_unlock(&pAsyncIO->lock);
+    return NULL;
+}
+
+XSTATUS XAsyncIO_SetWatermarks(xasync_io_t *pAsyncIO, size_t nHigh, size_t nLow)
+{
+    XASSERT(pAsyncIO, XSTDINV);
+    XASSERT((nLow <= nHigh), XSTDINV);
+    pAsyncIO->nHighWatermark = nHigh;
+    pAsyncIO->nLowWatermark = nLow;
+    return XSTDOK;
+}
+
+XSTATUS XAsyncIO_Start(xasync_io_t *pAsyncIO, size_t nDepth, size_t nBuffSize)
+{
+    XASSERT((pAsyncIO && nBuffSize), XSTDINV);
+    XASSERT((pAsyncIO->pBuffers == NULL), XSTDINV);
+    XASSERT((pAsyncIO->writeCallback != NULL || pAsyncIO->nFD >= 0), XSTDINV);
+
+    if (!nDepth) nDepth = XASYNCIO_DEPTH;
+    else if (nDepth < XASYNCIO_DEPTH_MIN) nDepth = XASYNCIO_DEPTH_MIN;
+
+    pAsyncIO->pBuffers = (xasync_buffer_t*)calloc(nDepth, sizeof(xasync_buffer_t));
+    XASSERT(pAsyncIO->pBuffers, XSTDERR);
+    pAsyncIO->nDepth = nDepth;
+    size_t i;
+
+    for (i = 0; i < nDepth; i++)
+    {
+        xasync_buffer_t *pBuffer = &pAsyncIO->pBuffers[i];
+        pBuffer->pData = (uint8_t*)malloc(nBuffSize);
+        pBuffer->nUsed = 0;
+
+        if (pBuffer->pData == NULL)
+        {
+            XAsyncIO_FreeBuffers(pAsyncIO);
+            return XSTDERR;
+        }
+    }
+
+    if (!pAsyncIO->nHighWatermark || pAsyncIO->nHighWatermark > nDepth)
+        pAsyncIO->nHighWatermark = nDepth - 1;
+
+    if (pAsyncIO->nLowWatermark > pAsyncIO->nHighWatermark)
+        pAsyncIO->nLowWatermark = pAsyncIO->nHighWatermark / 2;
+
+    pAsyncIO->nBuffSize = nBuffSize;
+    pAsyncIO->nPending = 0;
+    pAsyncIO->nHead = 0;
+    pAsyncIO->nError = 0;
+    pAsyncIO->bStop = XFALSE;
+
+    pthread_mutex_init(&pAsyncIO->lock, NULL);
+    pthread_cond_init(&pAsyncIO->fillCond, NULL);
+    pthread_cond_init(&pAsyncIO->freeCond, NULL);
+
+    if (pthread_create(&pAsyncIO->writerThread, NULL, XAsyncIO_WriterThread, pAsyncIO))
+    {
+        pthread_cond_destroy(&pAsyncIO->fillCond);
+        pthread_cond_destroy(&pAsyncIO->freeCond);
+        pthread_mutex_destroy(&pAsyncIO->lock);
+        XAsyncIO_FreeBuffers(pAsyncIO);
+        return XSTDERR;
+    }
+
+    XSYNC_ATOMIC_SET(&pAsyncIO->nRunning, XTRUE);
+    return XSTDOK;
+}
+
+static xasync_buffer_t* XAsyncIO_AcquireBuffer(xasync_io_t *pAsyncIO)
+{
+    xbool_t bRelease = XFALSE;
+    pthread_mutex_lock(&pAsyncIO->lock);
+
+    if (pAsyncIO->nPending >= pAsyncIO->nDepth && !pAsyncIO->nError)
+    {
+        /* Ring is full, wait for the writer to release a buffer */
+        uint64_t nStartTime = XTime_GetStamp();
+
+        while (pAsyncIO->nPending >= pAsyncIO->nDepth && !pAsyncIO->nError)
+            pthread_cond_wait(&pAsyncIO->freeCond, &pAsyncIO->lock);
+
+        uint64_t nStallTime = XTime_GetStamp() - nStartTime;
+        xasync_stats_t *pStats = &pAsyncIO->stats;
+
+        if (nStallTime > pStats->nMaxStallTime) pStats->nMaxStallTime = nStallTime;
+        pStats->nStallTime += nStallTime;
+        pStats->nStalls++;
+    }
+
+    if (pAsyncIO->nError)
+    {
+        pthread_mutex_unlock(&pAsyncIO->lock);
+        return NULL;
+    }
+
+    if (XSYNC_ATOMIC_GET(&pAsyncIO->nPressure) &&
+        pAsyncIO->nPending <= pAsyncIO->nLowWatermark)
+    {
+        XSYNC_ATOMIC_SET(&pAsyncIO->nPressure, XFALSE);
+        bRelease = XTRUE;
+    }
+
+    size_t nIndex = (pAsyncIO->nHead + pAsyncIO->nPending) % pAsyncIO->nDepth;
+    size_t nPending = pAsyncIO->nPending;
+    pthread_mutex_unlock(&pAsyncIO->lock);
+
+    if (bRelease && pAsyncIO->pressureCallback != NULL)
+        pAsyncIO->pressureCallback(pAsyncIO->pUserCtx, XFALSE, nPending);
+
+    return &pAsyncIO->pBuffers[nIndex];
+}
+
+static void XAsyncIO_Commit(xasync_io_t *pAsyncIO)
+{
+    xbool_t bPressure = XFALSE;
+    pthread_mutex_lock(&pAsyncIO->lock);
+
+    if (pAsyncIO->nPending >= pAsyncIO->nDepth)
+    {
+        pthread_mutex_unlock(&pAsyncIO->lock);
+        return;
+    }
+
+    size_t nIndex = (pAsyncIO->nHead + pAsyncIO->nPending) % pAsyncIO->nDepth;
+    if (!pAsyncIO->pBuffers[nIndex].nUsed)
+    {
+        pthread_mutex_unlock(&pAsyncIO->lock);
+        return;
+    }
+
+    size_t nPending = ++pAsyncIO->nPending;
+    xasync_stats_t *pStats = &pAsyncIO->stats;
+    if (nPending > pStats->nMaxPending) pStats->nMaxPending = nPending;
+
+    if (!XSYNC_ATOMIC_GET(&pAsyncIO->nPressure) &&
+        nPending >= pAsyncIO->nHighWatermark)
+    {
+        XSYNC_ATOMIC_SET(&pAsyncIO->nPressure, XTRUE);
+        pStats->nPressureEvents++;
+        bPressure = XTRUE;
+    }
+
+    pthread_cond_signal(&pAsyncIO->fillCond);
+    pthread_mutex_unlock(&pAsyncIO->lock);
+
+    if (bPressure && pAsyncIO->pressureCallback != NULL)
+        pAsyncIO->pressureCallback(pAsyncIO->pUserCtx, XTRUE, nPending);
+}
+
+static int XAsyncIO_GetError(xasync_io_t *pAsyncIO)
+{
+    pthread_mutex_lock(&pAsyncIO->lock);
+    int nError = pAsyncIO->nError;
+    pthread_mutex_unlock(&pAsyncIO->lock);
+    return nError;
+}
+
+int XAsyncIO_Write(xasync_io_t *pAsyncIO, const uint8_t *pData, int nSize)
+{
+    XASSERT((pAsyncIO && pData && nSize >= 0), AVERROR(EINVAL));
+    XASSERT(XSYNC_ATOMIC_GET(&pAsyncIO->nRunning), AVERROR(EINVAL));
+    size_t nLeft = (size_t)nSize;
+
+    while (nLeft > 0)
+    {
+        xasync_buffer_t *pBuffer = XAsyncIO_AcquireBuffer(pAsyncIO);
+        if (pBuffer == NULL) return XAsyncIO_GetError(pAsyncIO);
+
+        size_t nSpace = pAsyncIO->nBuffSize - pBuffer->nUsed;
+        size_t nCopy = XSTD_MIN(nSpace, nLeft);
+
+        memcpy(pBuffer->pData + pBuffer->nUsed, pData, nCopy);
+        pBuffer->nUsed += nCopy;
+        pData += nCopy;
+        nLeft -= nCopy;
+
+        /*
+         * Muxer writes whole AVIO buffers, or less on an explicit
+         * flush (low latency), so a partly filled buffer must not
+         * wait for the next write that may come much later.
+         */
+        XAsyncIO_Commit(pAsyncIO);
+    }
+
+    return nSize;
+}
+
+int XAsyncIO_Flush(xasync_io_t *pAsyncIO)
+{
+    XASSERT(pAsyncIO, AVERROR(EINVAL));
+    XASSERT(XSYNC_ATOMIC_GET(&pAsyncIO->nRunning), AVERROR(EINVAL));
+    XAsyncIO_Commit(pAsyncIO);
+
+    pthread_mutex_lock(&pAsyncIO->lock);
+    while (pAsyncIO->nPending && !pAsyncIO->nError)
+        pthread_cond_wait(&pAsyncIO->freeCond, &pAsyncIO->lock);
+
+    int nStatus = pAsyncIO->nError ? pAsyncIO->nError : XSTDOK;
+    pthread_mutex_unlock(&pAsyncIO->lock);
+    return nStatus;
+}
+
+int XAsyncIO_Stop(xasync_io_t *pAsyncIO)
+{
+    XASSERT(pAsyncIO, AVERROR(EINVAL));
+    XASSERT(XSYNC_ATOMIC_GET(&pAsyncIO->nRunning), XSTDNON);
+    int nStatus = XAsyncIO_Flush(pAsyncIO);
+
+    pthread_mutex_lock(&pAsyncIO->lock);
+    pAsyncIO->bStop = XTRUE;
+    pthread_cond_signal(&pAsyncIO->fillCond);
+    pthread_mutex_unlock(&pAsyncIO->lock);
+
+    pthread_join(pAsyncIO->writerThread, NULL);
+    XSYNC_ATOMIC_SET(&pAsyncIO->nRunning, XFALSE);
+    return nStatus;
+}
+
+XSTATUS XAsyncIO_GetStats(xasync_io_t *pAsyncIO, xasync_stats_t *pStats)
+{
+    XASSERT((pAsyncIO && pStats), XSTDINV);
+    XASSERT(pAsyncIO->pBuffers, XSTDNON);
+
+    pthread_mutex_lock(&pAsyncIO->lock);
+    *pStats = pAsyncIO->stats;
+    pthread_mutex_unlock(&pAsyncIO->lock);
+    return XSTDOK;
+}
+
+xbool_t XAsyncIO_IsPressured(xasync_io_t *pAsyncIO)
+{
+    XASSERT(pAsyncIO, XFALSE);
+    return XSYNC_ATOMIC_GET(&pAsyncIO->nPressure) ? XTRUE : XFALSE;
+}
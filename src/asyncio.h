@@ -0,0 +1,92 @@
+/*!
+ *  @file libxmedia/src/asyncio.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the asynchronous muxer output
+ * with a ring of preallocated buffers and a writer thread.
+ */
+
+#ifndef __XMEDIA_ASYNCIO_H__
+#define __XMEDIA_ASYNCIO_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include <pthread.h>
+
+#define XASYNCIO_DEPTH_MIN      2
+#define XASYNCIO_DEPTH          4
+#define XASYNCIO_BATCH_MAX      64
+
+typedef int(*xasync_write_cb_t)(void *pUserCtx, const uint8_t *pData, int nSize);
+typedef void(*xasync_pressure_cb_t)(void *pUserCtx, xbool_t bHigh, size_t nPending);
+
+typedef struct xasync_buffer_ {
+    uint8_t*                pData;
+    size_t                  nUsed;
+} xasync_buffer_t;
+
+typedef struct xasync_stats_ {
+    uint64_t                nBytesWritten;
+    uint64_t                nBuffersWritten;
+    uint64_t                nBatches;
+    uint64_t                nPressureEvents;
+    uint64_t                nStalls;
+    uint64_t                nStallTime;     /* usec */
+    uint64_t                nMaxStallTime;  /* usec */
+    uint64_t                nMaxWriteTime;  /* usec */
+    size_t                  nMaxPending;
+} xasync_stats_t;
+
+typedef struct xasync_io_ {
+    /* Writer thread and ring sync */
+    pthread_mutex_t         lock;
+    pthread_cond_t          fillCond;
+    pthread_cond_t          freeCond;
+    pthread_t               writerThread;
+    XATOMIC                 nRunning;
+    xbool_t                 bStop;
+
+    /* Ring of preallocated buffers */
+    xasync_buffer_t*        pBuffers;
+    size_t                  nBuffSize;
+    size_t                  nDepth;
+    size_t                  nPending;
+    size_t                  nHead;
+
+    /* Back-pressure watermarks */
+    xasync_pressure_cb_t    pressureCallback;
+    size_t                  nHighWatermark;
+    size_t                  nLowWatermark;
+    XATOMIC                 nPressure;
+
+    /* Output sink (writev() to fd or callback) */
+    xasync_write_cb_t       writeCallback;
+    void*                   pUserCtx;
+    int                     nFD;
+    int                     nError;
+
+    xasync_stats_t          stats;
+} xasync_io_t;
+
+void XAsyncIO_Init(xasync_io_t *pAsyncIO);
+void XAsyncIO_Destroy(xasync_io_t *pAsyncIO);
+
+XSTATUS XAsyncIO_Start(xasync_io_t *pAsyncIO, size_t nDepth, size_t nBuffSize);
+XSTATUS XAsyncIO_SetWatermarks(xasync_io_t *pAsyncIO, size_t nHigh, size_t nLow);
+XSTATUS XAsyncIO_GetStats(xasync_io_t *pAsyncIO, xasync_stats_t *pStats);
+xbool_t XAsyncIO_IsPressured(xasync_io_t *pAsyncIO);
+
+int XAsyncIO_Write(xasync_io_t *pAsyncIO, const uint8_t *pData, int nSize);
+int XAsyncIO_Flush(xasync_io_t *pAsyncIO);
+int XAsyncIO_Stop(xasync_io_t *pAsyncIO);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_ASYNCIO_H__ */
@@ -0,0 +1,154 @@
+/*!
+ *  @file libxmedia/src/batch.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the batched packet delivery
+ * with refcounted packet vectors.
+ */
+
+#include "batch.h"
+
+xpacket_batch_t* XPacketBatch_New(size_t nCapacity)
+{
+    if (!nCapacity) nCapacity = XBATCH_MAX_PACKETS;
+    xpacket_batch_t *pBatch = (xpacket_batch_t*)malloc(sizeof(xpacket_batch_t));
+    XASSERT(pBatch, NULL);
+
+    pBatch->pPackets = (xbatch_packet_t*)calloc(nCapacity, sizeof(xbatch_packet_t));
+    XASSERT_CALL(pBatch->pPackets, free, pBatch, NULL);
+
+    pBatch->nCapacity = nCapacity;
+    pBatch->nCount = 0;
+    pBatch->nBytes = 0;
+    pBatch->nStartTime = 0;
+    pBatch->nRefs = 1;
+
+    return pBatch;
+}
+
+xpacket_batch_t* XPacketBatch_Ref(xpacket_batch_t *pBatch)
+{
+    XASSERT(pBatch, NULL);
+    XSYNC_ATOMIC_ADD(&pBatch->nRefs, 1);
+    return pBatch;
+}
+
+void XPacketBatch_Unref(xpacket_batch_t *pBatch)
+{
+    XASSERT_VOID(pBatch);
+    XASSERT_VOID_RET(!XSYNC_ATOMIC_SUB(&pBatch->nRefs, 1));
+    size_t i;
+
+    for (i = 0; i < pBatch->nCount; i++)
+    {
+        AVPacket *pPacket = pBatch->pPackets[i].pPacket;
+        if (pPacket != NULL) av_packet_free(&pPacket);
+    }
+
+    free(pBatch->pPackets);
+    free(pBatch);
+}
+
+void XBatcher_Init(xbatcher_t *pBatcher)
+{
+    XASSERT_VOID(pBatcher);
+    pBatcher->pBatch = NULL;
+    pBatcher->callback = NULL;
+    pBatcher->pUserCtx = NULL;
+
+    pBatcher->nMaxPackets = XBATCH_MAX_PACKETS;
+    pBatcher->nMaxBytes = XBATCH_MAX_BYTES;
+    pBatcher->nMaxWindow = XBATCH_MAX_WINDOW;
+
+    pBatcher->nBatches = 0;
+    pBatcher->nPackets = 0;
+}
+
+void XBatcher_Destroy(xbatcher_t *pBatcher)
+{
+    XASSERT_VOID(pBatcher);
+    XPacketBatch_Unref(pBatcher->pBatch);
+    pBatcher->pBatch = NULL;
+}
+
+XSTATUS XBatcher_Setup(xbatcher_t *pBatcher, size_t nMaxPackets, size_t nMaxBytes, uint64_t nMaxWindow)
+{
+    XASSERT(pBatcher, XSTDINV);
+    XASSERT(pBatcher->callback, XSTDINV);
+
+    pBatcher->nMaxPackets = nMaxPackets ? nMaxPackets : XBATCH_MAX_PACKETS;
+    pBatcher->nMaxBytes = nMaxBytes;
+    pBatcher->nMaxWindow = nMaxWindow;
+    return XSTDOK;
+}
+
+static xbool_t XBatcher_IsFull(xbatcher_t *pBatcher)
+{
+    xpacket_batch_t *pBatch = pBatcher->pBatch;
+    XASSERT_RET((pBatch && pBatch->nCount), XFALSE);
+
+    if (pBatch->nCount >= pBatcher->nMaxPackets) return XTRUE;
+    if (pBatcher->nMaxBytes && pBatch->nBytes >= pBatcher->nMaxBytes) return XTRUE;
+
+    return (pBatcher->nMaxWindow &&
+        XTime_GetStamp() - pBatch->nStartTime >= pBatcher->nMaxWindow) ?
+            XTRUE : XFALSE;
+}
+
+int XBatcher_Add(xbatcher_t *pBatcher, const AVPacket *pPacket)
+{
+    XASSERT((pBatcher && pPacket), XSTDINV);
+    XASSERT(pBatcher->callback, XSTDINV);
+
+    if (pBatcher->pBatch == NULL)
+    {
+        pBatcher->pBatch = XPacketBatch_New(pBatcher->nMaxPackets);
+        XASSERT(pBatcher->pBatch, XSTDERR);
+    }
+
+    xpacket_batch_t *pBatch = pBatcher->pBatch;
+    XASSERT((pBatch->nCount < pBatch->nCapacity), XSTDERR);
+
+    /* Takes a new reference, payload of the refcounted packet is not copied */
+    AVPacket *pClone = av_packet_clone(pPacket);
+    XASSERT(pClone, XSTDERR);
+
+    xbatch_packet_t *pEntry = &pBatch->pPackets[pBatch->nCount];
+    pEntry->bKeyFrame = (pPacket->flags & AV_PKT_FLAG_KEY) ? XTRUE : XFALSE;
+    pEntry->nStreamIndex = pPacket->stream_index;
+    pEntry->nSize = pPacket->size;
+    pEntry->nPTS = pPacket->pts;
+    pEntry->nDTS = pPacket->dts;
+    pEntry->pPacket = pClone;
+
+    if (!pBatch->nCount) pBatch->nStartTime = XTime_GetStamp();
+    pBatch->nBytes += (size_t)pPacket->size;
+    pBatch->nCount++;
+
+    return XBatcher_Check(pBatcher);
+}
+
+int XBatcher_Check(xbatcher_t *pBatcher)
+{
+    XASSERT(pBatcher, XSTDINV);
+    XASSERT_RET(XBatcher_IsFull(pBatcher), XSTDOK);
+    return XBatcher_Flush(pBatcher);
+}
+
+int XBatcher_Flush(xbatcher_t *pBatcher)
+{
+    XASSERT(pBatcher, XSTDINV);
+    xpacket_batch_t *pBatch = pBatcher->pBatch;
+    XASSERT_RET((pBatch && pBatch->nCount), XSTDOK);
+
+    /* Next packet starts a new batch, consumer may keep this one */
+    pBatcher->pBatch = NULL;
+    pBatcher->nPackets += pBatch->nCount;
+    pBatcher->nBatches++;
+
+    int nRetVal = pBatcher->callback(pBatcher->pUserCtx, pBatch);
+    XPacketBatch_Unref(pBatch);
+    return nRetVal;
+}
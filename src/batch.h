@@ -0,0 +1,76 @@
+/*!
+ *  @file libxmedia/src/batch.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the batched packet delivery
+ * with refcounted packet vectors.
+ */
+
+#ifndef __XMEDIA_BATCH_H__
+#define __XMEDIA_BATCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XBATCH_MAX_PACKETS      32
+#define XBATCH_MAX_BYTES        (1024 * 64)
+#define XBATCH_MAX_WINDOW       (20 * 1000) /* usec */
+
+typedef struct xbatch_packet_ {
+    AVPacket*           pPacket;        /* Payload reference owned by the batch */
+    int64_t             nPTS;
+    int64_t             nDTS;
+    int                 nStreamIndex;
+    int                 nSize;
+    xbool_t             bKeyFrame;
+} xbatch_packet_t;
+
+typedef struct xpacket_batch_ {
+    xbatch_packet_t*    pPackets;
+    size_t              nCapacity;
+    size_t              nCount;
+    size_t              nBytes;
+    uint64_t            nStartTime;     /* usec, first packet arrival */
+    XATOMIC             nRefs;
+} xpacket_batch_t;
+
+/* Consumer may call XPacketBatch_Ref() to keep the batch after return */
+typedef int(*xbatch_cb_t)(void *pUserCtx, xpacket_batch_t *pBatch);
+
+xpacket_batch_t* XPacketBatch_New(size_t nCapacity);
+xpacket_batch_t* XPacketBatch_Ref(xpacket_batch_t *pBatch);
+void XPacketBatch_Unref(xpacket_batch_t *pBatch);
+
+typedef struct xbatcher_ {
+    xpacket_batch_t*    pBatch;
+    xbatch_cb_t         callback;
+    void*               pUserCtx;
+
+    /* Flush thresholds, whichever comes first */
+    size_t              nMaxPackets;
+    size_t              nMaxBytes;
+    uint64_t            nMaxWindow;
+
+    /* Delivery counters */
+    uint64_t            nBatches;
+    uint64_t            nPackets;
+} xbatcher_t;
+
+void XBatcher_Init(xbatcher_t *pBatcher);
+void XBatcher_Destroy(xbatcher_t *pBatcher);
+
+XSTATUS XBatcher_Setup(xbatcher_t *pBatcher, size_t nMaxPackets, size_t nMaxBytes, uint64_t nMaxWindow);
+int XBatcher_Add(xbatcher_t *pBatcher, const AVPacket *pPacket);
+int XBatcher_Check(xbatcher_t *pBatcher);
+int XBatcher_Flush(xbatcher_t *pBatcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_BATCH_H__ */
@@ -75,6 +75,7 @@ void XCodec_Init(xcodec_t *pInfo)
 
     /* Video codec properties */
     pInfo->aspectRatio = XRATIONAL_NOT_SET;
+    pInfo->frameRate = XRATIONAL_NOT_SET;
     pInfo->scaleFmt = XSCALE_FMT_STRETCH;
     pInfo->pixFmt = AV_PIX_FMT_NONE;
     pInfo->nWidth = XCODEC_NOT_SET;
@@ -410,6 +411,7 @@ XSTATUS XCodec_ApplyStreamExtra(xcodec_t *pInfo, AVStream *pStream)
     int nPaddingSize = AV_INPUT_BUFFER_PADDING_SIZE;
 
     /* Store extra data in AVStream codec parameters */
+    if (pCodecPar->extradata != NULL) av_freep(&pCodecPar->extradata);
     pCodecPar->extradata = av_mallocz(pInfo->nExtraSize + nPaddingSize);
     memcpy(pCodecPar->extradata, pInfo->pExtraData, pInfo->nExtraSize);
     pCodecPar->extradata_size = pInfo->nExtraSize;
@@ -523,11 +525,11 @@ size_t XCodec_DumpStr(xcodec_t *pCodec, char *pOutput, size_t nSize)
         pCodec->timeBase.num, pCodec->timeBase.den);
 }
 
-size_t XCodec_DumpJSON(xcodec_t *pCodec, char *pOutput, size_t nSize, size_t nTabSize, xbool_t bPretty)
+xjson_obj_t* XCodec_ToJSON(xcodec_t *pCodec, const char *pName)
 {
-    XASSERT((pCodec && pOutput && nSize), XSTDINV);
-    xjson_obj_t *pCodecObj = XJSON_NewObject(NULL, NULL, XFALSE);
-    XASSERT((pCodecObj != NULL), XSTDERR);
+    XASSERT(pCodec, NULL);
+    xjson_obj_t *pCodecObj = XJSON_NewObject(NULL, pName, XFALSE);
+    XASSERT(pCodecObj, NULL);
 
     const char *pMediaType = av_get_media_type_string(pCodec->mediaType);
     const char *pType = pMediaType != NULL ? pMediaType : "unknown";
@@ -553,6 +555,19 @@ size_t XCodec_DumpJSON(xcodec_t *pCodec, char *pOutput, size_t nSize, size_t nTa
     XJSON_AddObject(pCodecObj, XJSON_NewInt(NULL, "bitRate", pCodec->nBitRate));
     XJSON_AddObject(pCodecObj, XJSON_NewInt(NULL, "profile", pCodec->nProfile));
 
+    if (pCodec->pExtraData != NULL && pCodec->nExtraSize > 0)
+    {
+        int nBase64Size = AV_BASE64_SIZE(pCodec->nExtraSize);
+        char *pExtraData = (char*)malloc(nBase64Size);
+
+        if (pExtraData != NULL)
+        {
+            av_base64_encode(pExtraData, nBase64Size, pCodec->pExtraData, pCodec->nExtraSize);
+            XJSON_AddObject(pCodecObj, XJSON_NewString(NULL, "extraData", pExtraData));
+            free(pExtraData);
+        }
+    }
+
     if (pCodec->mediaType == AVMEDIA_TYPE_AUDIO)
     {
         const char *pSampleFormat = av_get_sample_fmt_name(pCodec->sampleFmt);
@@ -605,6 +620,15 @@ size_t XCodec_DumpJSON(xcodec_t *pCodec, char *pOutput, size_t nSize, size_t nTa
         }
     }
 
+    return pCodecObj;
+}
+
+size_t XCodec_DumpJSON(xcodec_t *pCodec, char *pOutput, size_t nSize, size_t nTabSize, xbool_t bPretty)
+{
+    XASSERT((pCodec && pOutput && nSize), XSTDINV);
+    xjson_obj_t *pCodecObj = XCodec_ToJSON(pCodec, NULL);
+    XASSERT((pCodecObj != NULL), XSTDERR);
+
     xjson_writer_t writer;
     XJSON_InitWriter(&writer, NULL, pOutput, nSize);
 
@@ -618,19 +642,11 @@ size_t XCodec_DumpJSON(xcodec_t *pCodec, char *pOutput, size_t nSize, size_t nTa
     return writer.nLength;
 }
 
-XSTATUS XCodec_FromJSON(xcodec_t *pCodec, char* pJson, size_t nLength)
+XSTATUS XCodec_FromJSONObj(xcodec_t *pCodec, xjson_obj_t *pRootObj)
 {
-    XASSERT((pCodec && pJson && nLength), XSTDINV);
+    XASSERT((pCodec && pRootObj), XSTDINV);
     XCodec_Init(pCodec);
 
-    xjson_t json;
-    if (!XJSON_Parse(&json, NULL, pJson, nLength))
-    {
-        XJSON_Destroy(&json);
-        return XSTDERR;
-    }
-
-    xjson_obj_t *pRootObj = json.pRootObj;
     xjson_obj_t *pRationalObj = NULL;
     xjson_obj_t *pChildObj = NULL;
 
@@ -662,6 +678,20 @@ XSTATUS XCodec_FromJSON(xcodec_t *pCodec, char* pJson, size_t nLength)
     pChildObj = XJSON_GetObject(pRootObj, "profile");
     if (pChildObj != NULL) pCodec->nProfile = XJSON_GetInt(pChildObj);
 
+    const char *pExtraData = XJSON_GetString(XJSON_GetObject(pRootObj, "extraData"));
+    if (xstrused(pExtraData))
+    {
+        int nMaxSize = (int)strlen(pExtraData) * 3 / 4 + 1;
+        uint8_t *pDecoded = (uint8_t*)malloc(nMaxSize);
+        XASSERT(pDecoded, XSTDERR);
+
+        int nExtraSize = av_base64_decode(pDecoded, pExtraData, nMaxSize);
+        XSTATUS nStatus = nExtraSize > 0 ? XCodec_AddExtra(pCodec, pDecoded, nExtraSize) : XSTDERR;
+
+        free(pDecoded);
+        XASSERT((nStatus > 0), XSTDERR);
+    }
+
     if (pCodec->mediaType == AVMEDIA_TYPE_AUDIO)
     {
         const char *pSampleFmt = XJSON_GetString(XJSON_GetObject(pRootObj, "sampleFmt"));
@@ -719,6 +749,21 @@ XSTATUS XCodec_FromJSON(xcodec_t *pCodec, char* pJson, size_t nLength)
         }
     }
 
-    XJSON_Destroy(&json);
     return XSTDOK;
+}
+
+XSTATUS XCodec_FromJSON(xcodec_t *pCodec, char* pJson, size_t nLength)
+{
+    XASSERT((pCodec && pJson && nLength), XSTDINV);
+
+    xjson_t json;
+    if (!XJSON_Parse(&json, NULL, pJson, nLength))
+    {
+        XJSON_Destroy(&json);
+        return XSTDERR;
+    }
+
+    XSTATUS nStatus = XCodec_FromJSONObj(pCodec, json.pRootObj);
+    XJSON_Destroy(&json);
+    return nStatus;
 }
\ No newline at end of file
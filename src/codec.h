@@ -77,9 +77,11 @@ char* XCodec_GetScaleFmtStr(char *pOutput, size_t nLength, xscale_fmt_t eScaleFm
 enum AVCodecID XCodec_GetIDByName(const char *pCodecName);
 char* XCodec_GetNameByID(char *pName, size_t nLength, enum AVCodecID codecId);
 
+xjson_obj_t* XCodec_ToJSON(xcodec_t *pCodec, const char *pName);
 size_t XCodec_DumpJSON(xcodec_t *pCodec, char *pOutput, size_t nSize, size_t nTabSize, xbool_t bPretty);
 size_t XCodec_DumpStr(xcodec_t *pCodec, char *pOutput, size_t nSize);
 XSTATUS XCodec_FromJSON(xcodec_t *pCodec, char* pJson, size_t nLength);
+XSTATUS XCodec_FromJSONObj(xcodec_t *pCodec, xjson_obj_t *pRootObj);
 
 uint8_t* X264_CreateExtra(x264_extra_t *pExtra, int *pExtraSize);
 uint8_t* XOPUS_CreateExtra(xopus_header_t *pHeader, int *pExtraSize);
@@ -9,6 +9,186 @@
  */
 
 #include "decoder.h"
+#include <pthread.h>
+
+/* Process wide thread budget shared by all open video decoders */
+static pthread_mutex_t g_budgetLock = PTHREAD_MUTEX_INITIALIZER;
+static int g_nBudgetThreads = 0;
+static int g_nBudgetUsed = 0;
+static int g_nBudgetUsers = 0;
+static int g_nBudgetDecoders = 1;
+
+void XDecoder_SetThreadBudget(int nThreads, int nDecoders)
+{
+    pthread_mutex_lock(&g_budgetLock);
+    g_nBudgetThreads = XSTD_MAX(nThreads, 0);
+    g_nBudgetDecoders = XSTD_MAX(nDecoders, 1);
+    pthread_mutex_unlock(&g_budgetLock);
+}
+
+static int XDecoder_AcquireThreads(xdecoder_t *pDecoder, int nWanted)
+{
+    pthread_mutex_lock(&g_budgetLock);
+    int nThreads = nWanted;
+
+    if (g_nBudgetThreads > 0)
+    {
+        /* Early decoders must leave room for the expected ones, never more than what is left */
+        int nSlots = XSTD_MAX(g_nBudgetUsers + 1, g_nBudgetDecoders);
+        int nShare = XSTD_MAX(g_nBudgetThreads / nSlots, 1);
+        int nFree = g_nBudgetThreads - g_nBudgetUsed;
+
+        if (nThreads <= 0) nThreads = nShare;
+        nThreads = XSTD_MAX(XSTD_MIN(nThreads, nFree), 1);
+
+        g_nBudgetUsed += nThreads;
+        g_nBudgetUsers++;
+
+        pDecoder->nBudgetThreads += nThreads;
+        pDecoder->nBudgetStreams++;
+    }
+
+    pthread_mutex_unlock(&g_budgetLock);
+    return nThreads;
+}
+
+static void XDecoder_ReleaseThreads(xdecoder_t *pDecoder)
+{
+    XASSERT_VOID_RET(pDecoder->nBudgetStreams);
+    pthread_mutex_lock(&g_budgetLock);
+
+    g_nBudgetUsed = XSTD_MAX(g_nBudgetUsed - pDecoder->nBudgetThreads, 0);
+    g_nBudgetUsers = XSTD_MAX(g_nBudgetUsers - pDecoder->nBudgetStreams, 0);
+
+    pthread_mutex_unlock(&g_budgetLock);
+    pDecoder->nBudgetThreads = 0;
+    pDecoder->nBudgetStreams = 0;
+}
+
+void XDecoder_InitOpts(xdecoder_opts_t *pOpts, enum AVMediaType mediaType)
+{
+    XASSERT_VOID(pOpts);
+    pOpts->nThreadType = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    pOpts->nThreads = mediaType == AVMEDIA_TYPE_VIDEO ? 0 : 1;
+    pOpts->nFlags = 0;
+    pOpts->nFlags2 = 0;
+    pOpts->skipLoopFilter = AVDISCARD_DEFAULT;
+    pOpts->skipIdct = AVDISCARD_DEFAULT;
+    pOpts->skipFrame = AVDISCARD_DEFAULT;
+    pOpts->frameRate = (AVRational){0, 0};
+    pOpts->nLowres = 0;
+}
+
+static XSTATUS XDecoder_SetupPolicy(xdecoder_t *pDecoder, xstream_t *pStream, const xdecoder_opts_t *pOpts)
+{
+    xstatus_t *pStatus = &pDecoder->status;
+    XASSERT((pStream->nSrcIndex >= 0), XSTDINV);
+    size_t nIndex = (size_t)pStream->nSrcIndex;
+
+    if (nIndex >= pDecoder->nPolicies)
+    {
+        size_t i, nCount = nIndex + 1;
+        xdecoder_policy_t *pPolicies = (xdecoder_policy_t*)realloc(pDecoder->pPolicies, nCount * sizeof(xdecoder_policy_t));
+        XASSERT(pPolicies, XStat_ErrCb(pStatus, "Failed to alloc decode policy: %s", strerror(errno)));
+
+        for (i = pDecoder->nPolicies; i < nCount; i++)
+        {
+            memset(&pPolicies[i], 0, sizeof(xdecoder_policy_t));
+            pPolicies[i].nNextTS = AV_NOPTS_VALUE;
+        }
+
+        pDecoder->pPolicies = pPolicies;
+        pDecoder->nPolicies = nCount;
+    }
+
+    xdecoder_policy_t *pPolicy = &pDecoder->pPolicies[nIndex];
+    pPolicy->skipFrame = pOpts->skipFrame;
+    pPolicy->nNextTS = AV_NOPTS_VALUE;
+    pPolicy->nInterval = 0;
+
+    if (pOpts->frameRate.num > 0 && pOpts->frameRate.den > 0)
+    {
+        AVRational timeBase = pStream->pAvStream != NULL ?
+            pStream->pAvStream->time_base : pStream->pCodecCtx->time_base;
+
+        pPolicy->nInterval = av_rescale_q(1, av_inv_q(pOpts->frameRate), timeBase);
+        if (pPolicy->nInterval < 1) pPolicy->nInterval = 1;
+    }
+
+    return XSTDOK;
+}
+
+static xdecoder_policy_t* XDecoder_StreamPolicy(xdecoder_t *pDecoder, int nStream)
+{
+    XASSERT_RET((nStream >= 0 && (size_t)nStream < pDecoder->nPolicies), NULL);
+    return &pDecoder->pPolicies[nStream];
+}
+
+static void XDecoder_ResetPolicies(xdecoder_t *pDecoder)
+{
+    size_t i;
+    for (i = 0; i < pDecoder->nPolicies; i++)
+        pDecoder->pPolicies[i].nNextTS = AV_NOPTS_VALUE;
+}
+
+const xdecoder_policy_t* XDecoder_GetPolicy(xdecoder_t *pDecoder, int nStream)
+{
+    XASSERT(pDecoder, NULL);
+    return XDecoder_StreamPolicy(pDecoder, nStream);
+}
+
+static XSTATUS XDecoder_OpenAVCodec(xdecoder_t *pDecoder, xstream_t *pStream, const AVCodec *pAvCodec)
+{
+    xstatus_t *pStatus = &pDecoder->status;
+    AVCodecContext *pCodecCtx = pStream->pCodecCtx;
+    xdecoder_opts_t opts;
+
+    if (pCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO) opts = pDecoder->videoOpts;
+    else opts = pDecoder->audioOpts;
+
+    if (pDecoder->optsCallback != NULL)
+        pDecoder->optsCallback(pDecoder->pUserCtx, &opts, &pStream->codecInfo, pStream->nSrcIndex);
+
+    if (pCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        opts.nThreads = XDecoder_AcquireThreads(pDecoder, opts.nThreads);
+
+    pCodecCtx->thread_count = opts.nThreads;
+    pCodecCtx->thread_type = opts.nThreadType;
+    pCodecCtx->flags |= opts.nFlags;
+    pCodecCtx->flags2 |= opts.nFlags2;
+    pCodecCtx->skip_loop_filter = opts.skipLoopFilter;
+    pCodecCtx->skip_idct = opts.skipIdct;
+    pCodecCtx->skip_frame = opts.skipFrame;
+
+    /* Only some codecs can decode at reduced resolution */
+    if (opts.nLowres > 0) pCodecCtx->lowres = XSTD_MIN(opts.nLowres, (int)pAvCodec->max_lowres);
+
+    /* avcodec_open2() consumes the entries it recognizes */
+    AVDictionary *pCodecOpts = NULL;
+    if (pDecoder->pCodecOpts != NULL) av_dict_copy(&pCodecOpts, pDecoder->pCodecOpts, 0);
+
+    pStatus->nAVStatus = avcodec_open2(pCodecCtx, pAvCodec, &pCodecOpts);
+    if (pCodecOpts != NULL) av_dict_free(&pCodecOpts);
+
+    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus,
+        "Failed to open decoder: src(%d)", pStream->nSrcIndex));
+
+    XStat_DebugCb(pStatus, "Decoder threads: count(%d), type(%d), src(%d)",
+        pCodecCtx->thread_count, pCodecCtx->thread_type, pStream->nSrcIndex);
+
+    XSTATUS nStatus = XDecoder_SetupPolicy(pDecoder, pStream, &opts);
+    XASSERT((nStatus == XSTDOK), nStatus);
+
+    if (opts.nLowres > 0 || opts.frameRate.num > 0)
+    {
+        XStat_DebugCb(pStatus, "Decode policy: lowres(%d), rate(%d/%d), skip(%d), src(%d)",
+            pCodecCtx->lowres, opts.frameRate.num, opts.frameRate.den,
+            (int)opts.skipFrame, pStream->nSrcIndex);
+    }
+
+    pStream->bCodecOpen = XTRUE;
+    return XSTDOK;
+}
 
 void XDecoder_Init(xdecoder_t *pDecoder)
 {
@@ -17,20 +197,91 @@ void XDecoder_Init(xdecoder_t *pDecoder)
     XStat_Init(&pDecoder->status, XSTDNON, NULL, NULL);
 
     pDecoder->pDemuxOpts = NULL;
+    pDecoder->demuxerCallback = NULL;
+    pDecoder->seekCallback = NULL;
+    pDecoder->pIOCtx = NULL;
+    pDecoder->nIOBuffSize = 0;
+    XInputIO_Init(&pDecoder->inputIO);
+    XInputMap_Init(&pDecoder->inputMap);
+    pDecoder->bMapInput = XFALSE;
+
+    pDecoder->nProbeSize = 0;
+    pDecoder->nAnalyzeDuration = 0;
+    pDecoder->pKnownCodecs = NULL;
+    pDecoder->nKnownCount = 0;
     pDecoder->bDemuxOnly = XFALSE;
     pDecoder->bHaveInput = XFALSE;
 
     pDecoder->statusCallback = NULL;
     pDecoder->errorCallback = NULL;
     pDecoder->frameCallback = NULL;
+    pDecoder->optsCallback = NULL;
     pDecoder->pUserCtx = NULL;
     pDecoder->pFmtCtx = NULL;
+
+    XDecoder_InitOpts(&pDecoder->videoOpts, AVMEDIA_TYPE_VIDEO);
+    XDecoder_InitOpts(&pDecoder->audioOpts, AVMEDIA_TYPE_AUDIO);
+    pDecoder->pCodecOpts = NULL;
+    pDecoder->nBudgetThreads = 0;
+    pDecoder->nBudgetStreams = 0;
+    pDecoder->pPolicies = NULL;
+    pDecoder->nPolicies = 0;
+
+    XKFIndex_Init(&pDecoder->kfIndex);
+    pthread_mutex_init(&pDecoder->indexLock, NULL);
+    pDecoder->bIndexThread = XFALSE;
+    pDecoder->bIndexComplete = XFALSE;
+    pDecoder->bIndexing = XFALSE;
+    pDecoder->nIndexStop = 0;
+    pDecoder->nSeekTime = AV_NOPTS_VALUE;
+    pDecoder->nSeekStream = XSTDERR;
+    xstrnul(pDecoder->sInput);
+    xstrnul(pDecoder->sInputFmt);
+
+    pthread_mutex_init(&pDecoder->callbackLock, NULL);
+    pthread_mutex_init(&pDecoder->threadLock, NULL);
+    pthread_cond_init(&pDecoder->doneCond, NULL);
+
+    pDecoder->pWorkers = NULL;
+    pDecoder->nWorkers = 0;
+    pDecoder->nQueueDepth = XPKTQUEUE_DEPTH;
+    pDecoder->nActiveThreads = 0;
+    pDecoder->bReaderStarted = XFALSE;
+    pDecoder->bThreaded = XFALSE;
+    pDecoder->nReadStatus = 0;
+    pDecoder->nThreadStatus = 0;
+    pDecoder->nStop = 0;
+
+    XPktPool_Init(&pDecoder->pktPool);
+    pDecoder->nFrameDepth = XFRMQUEUE_DEPTH;
+    pDecoder->nRecvIndex = 0;
+    pDecoder->bPullFrames = XFALSE;
 }
 
 void XDecoder_Destroy(xdecoder_t *pDecoder)
 {
     XASSERT_VOID(pDecoder);
+
+    /* Wake up the demuxer if it waits for pushed input */
+    XDecoder_AbortInput(pDecoder);
+    XDecoder_StopThreads(pDecoder);
+
+    if (pDecoder->bIndexThread)
+    {
+        XSYNC_ATOMIC_SET(&pDecoder->nIndexStop, XTRUE);
+        pthread_join(pDecoder->indexThread, NULL);
+        pDecoder->bIndexThread = XFALSE;
+    }
+
+    XKFIndex_Destroy(&pDecoder->kfIndex);
+
     XStreams_Destroy(&pDecoder->streams);
+    XDecoder_ClearStreamInfo(pDecoder);
+    XDecoder_ReleaseThreads(pDecoder);
+
+    free(pDecoder->pPolicies);
+    pDecoder->pPolicies = NULL;
+    pDecoder->nPolicies = 0;
 
     if (pDecoder->pDemuxOpts != NULL)
     {
@@ -38,6 +289,12 @@ void XDecoder_Destroy(xdecoder_t *pDecoder)
         pDecoder->pDemuxOpts = NULL;
     }
 
+    if (pDecoder->pCodecOpts != NULL)
+    {
+        av_dict_free(&pDecoder->pCodecOpts);
+        pDecoder->pCodecOpts = NULL;
+    }
+
     if (pDecoder->pFmtCtx != NULL)
     {
         if (pDecoder->bHaveInput) avformat_close_input(&pDecoder->pFmtCtx);
@@ -46,6 +303,22 @@ void XDecoder_Destroy(xdecoder_t *pDecoder)
         pDecoder->bHaveInput = XFALSE;
         pDecoder->pFmtCtx = NULL;
     }
+
+    if (pDecoder->pIOCtx != NULL)
+    {
+        /* AVIO may have replaced the buffer we allocated */
+        av_freep(&pDecoder->pIOCtx->buffer);
+        avio_context_free(&pDecoder->pIOCtx);
+        pDecoder->pIOCtx = NULL;
+    }
+
+    XPktPool_Destroy(&pDecoder->pktPool);
+    XInputMap_Close(&pDecoder->inputMap);
+    XInputIO_Destroy(&pDecoder->inputIO);
+    pthread_mutex_destroy(&pDecoder->indexLock);
+    pthread_cond_destroy(&pDecoder->doneCond);
+    pthread_mutex_destroy(&pDecoder->threadLock);
+    pthread_mutex_destroy(&pDecoder->callbackLock);
 }
 
 XSTATUS XDecoder_OpenCodec(xdecoder_t *pDecoder, xcodec_t *pCodec)
@@ -70,11 +343,11 @@ XSTATUS XDecoder_OpenCodec(xdecoder_t *pDecoder, xcodec_t *pCodec)
     XSTATUS nStatus = XCodec_ApplyToAVCodec(pCodec, pStream->pCodecCtx);
     XASSERT((nStatus == XSTDOK), XStat_ErrCb(pStatus, "Failed to apply codec to context: src(%d)", nStreamIndex));
 
-    pStatus->nAVStatus = avcodec_open2(pStream->pCodecCtx, pAvCodec, NULL);
-    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to open decoder: src(%d)", nStreamIndex));
+    pStream->nSrcIndex = nStreamIndex;
+    nStatus = XDecoder_OpenAVCodec(pDecoder, pStream, pAvCodec);
+    XASSERT((nStatus == XSTDOK), nStatus);
 
     XCodec_GetFromAVCodec(&pStream->codecInfo, pStream->pCodecCtx);
-    pStream->bCodecOpen = XTRUE;
 
     char sCodecId[XSTR_TINY];
     XCodec_GetNameByID(sCodecId, sizeof(sCodecId), pStream->codecInfo.codecId);
@@ -88,11 +361,320 @@ XSTATUS XDecoder_OpenCodec(xdecoder_t *pDecoder, xcodec_t *pCodec)
     return nStreamIndex;
 }
 
+void XDecoder_ClearStreamInfo(xdecoder_t *pDecoder)
+{
+    XASSERT_VOID(pDecoder);
+    size_t i;
+
+    for (i = 0; i < pDecoder->nKnownCount; i++)
+        XCodec_Clear(&pDecoder->pKnownCodecs[i]);
+
+    free(pDecoder->pKnownCodecs);
+    pDecoder->pKnownCodecs = NULL;
+    pDecoder->nKnownCount = 0;
+}
+
+XSTATUS XDecoder_SaveStreamInfo(xdecoder_t *pDecoder, const char *pPath)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pPath, XStat_ErrCb(pStatus, "Invalid stream info path argument"));
+    XASSERT(pDecoder->bHaveInput, XStat_ErrCb(pStatus, "Input format is not open"));
+
+    xjson_obj_t *pRootObj = XJSON_NewObject(NULL, NULL, XFALSE);
+    XASSERT(pRootObj, XStat_ErrCb(pStatus, "Failed to allocate JSON object"));
+
+    xjson_obj_t *pStreamsObj = XJSON_NewArray(NULL, "streams", XFALSE);
+    if (pStreamsObj == NULL)
+    {
+        XJSON_FreeObject(pRootObj);
+        return XStat_ErrCb(pStatus, "Failed to allocate JSON array");
+    }
+
+    XJSON_AddObject(pRootObj, XJSON_NewInt(NULL, "streamCount", (int)pDecoder->pFmtCtx->nb_streams));
+    XJSON_AddObject(pRootObj, pStreamsObj);
+    size_t i;
+
+    for (i = 0; i < XArray_Used(&pDecoder->streams); i++)
+    {
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, i);
+        if (pStream == NULL || pStream->pAvStream == NULL) continue;
+
+        xjson_obj_t *pCodecObj = XCodec_ToJSON(&pStream->codecInfo, NULL);
+        if (pCodecObj == NULL) continue;
+
+        XJSON_AddObject(pCodecObj, XJSON_NewInt(NULL, "index", pStream->nSrcIndex));
+        XJSON_AddObject(pStreamsObj, pCodecObj);
+    }
+
+    xjson_writer_t writer;
+    XJSON_InitWriter(&writer, NULL, NULL, XSTR_MID);
+    writer.nTabSize = 4;
+    writer.nPretty = XTRUE;
+
+    XSTATUS nStatus = XJSON_WriteObject(pRootObj, &writer) ? XSTDOK : XSTDERR;
+    if (nStatus == XSTDOK) nStatus = XPath_Write(pPath, (uint8_t*)writer.pData, writer.nLength, "cwt");
+
+    XJSON_DestroyWriter(&writer);
+    XJSON_FreeObject(pRootObj);
+
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to save stream info: %s", pPath));
+    XStat_InfoCb(pStatus, "Saved stream info: %s", pPath);
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_LoadStreamInfo(xdecoder_t *pDecoder, const char *pPath)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pPath, XStat_ErrCb(pStatus, "Invalid stream info path argument"));
+    XDecoder_ClearStreamInfo(pDecoder);
+
+    size_t nLength = 0;
+    char *pData = (char*)XPath_Load(pPath, &nLength);
+    XASSERT(pData, XStat_ErrCb(pStatus, "Failed to load stream info: %s", pPath));
+
+    xjson_t json;
+    if (!XJSON_Parse(&json, NULL, pData, nLength))
+    {
+        XJSON_Destroy(&json);
+        free(pData);
+        return XStat_ErrCb(pStatus, "Failed to parse stream info: %s", pPath);
+    }
+
+    xjson_obj_t *pCountObj = XJSON_GetObject(json.pRootObj, "streamCount");
+    xjson_obj_t *pStreamsObj = XJSON_GetObject(json.pRootObj, "streams");
+    int nCount = pCountObj != NULL ? XJSON_GetInt(pCountObj) : 0;
+    XSTATUS nStatus = XSTDOK;
+
+    if (nCount > 0 && pStreamsObj != NULL)
+        pDecoder->pKnownCodecs = (xcodec_t*)calloc((size_t)nCount, sizeof(xcodec_t));
+
+    if (pDecoder->pKnownCodecs != NULL)
+    {
+        size_t i, nStreams = XJSON_GetArrayLength(pStreamsObj);
+        pDecoder->nKnownCount = (size_t)nCount;
+
+        /* Streams missing in the sidecar stay unknown */
+        for (i = 0; i < pDecoder->nKnownCount; i++)
+            XCodec_Init(&pDecoder->pKnownCodecs[i]);
+
+        for (i = 0; i < nStreams && nStatus > 0; i++)
+        {
+            xjson_obj_t *pCodecObj = XJSON_GetArrayItem(pStreamsObj, i);
+            xjson_obj_t *pIndexObj = XJSON_GetObject(pCodecObj, "index");
+            int nIndex = pIndexObj != NULL ? XJSON_GetInt(pIndexObj) : XSTDERR;
+
+            if (nIndex < 0 || nIndex >= nCount) nStatus = XSTDERR;
+            else nStatus = XCodec_FromJSONObj(&pDecoder->pKnownCodecs[nIndex], pCodecObj);
+        }
+    }
+    else nStatus = XSTDERR;
+
+    XJSON_Destroy(&json);
+    free(pData);
+
+    if (nStatus <= 0)
+    {
+        XDecoder_ClearStreamInfo(pDecoder);
+        return XStat_ErrCb(pStatus, "Invalid stream info: %s", pPath);
+    }
+
+    XStat_InfoCb(pStatus, "Loaded stream info: streams(%d), path(%s)", nCount, pPath);
+    return XSTDOK;
+}
+
+static XSTATUS XDecoder_ApplyStreamInfo(xdecoder_t *pDecoder)
+{
+    AVFormatContext *pFmtCtx = pDecoder->pFmtCtx;
+    unsigned int i;
+
+    /* Streams must match exactly, otherwise the input has changed */
+    XASSERT_RET((pFmtCtx->nb_streams == pDecoder->nKnownCount), XSTDNON);
+
+    for (i = 0; i < pFmtCtx->nb_streams; i++)
+    {
+        AVCodecParameters *pCodecPar = pFmtCtx->streams[i]->codecpar;
+        xcodec_t *pKnown = &pDecoder->pKnownCodecs[i];
+
+        if (pKnown->mediaType != AVMEDIA_TYPE_VIDEO &&
+            pKnown->mediaType != AVMEDIA_TYPE_AUDIO)
+        {
+            /* Demuxer found a stream we are going to decode without info */
+            if (pCodecPar->codec_type == AVMEDIA_TYPE_VIDEO ||
+                pCodecPar->codec_type == AVMEDIA_TYPE_AUDIO) return XSTDNON;
+
+            continue;
+        }
+
+        if (pCodecPar->codec_id != AV_CODEC_ID_NONE &&
+            pCodecPar->codec_id != pKnown->codecId) return XSTDNON;
+    }
+
+    for (i = 0; i < pFmtCtx->nb_streams; i++)
+    {
+        AVStream *pAvStream = pFmtCtx->streams[i];
+        xcodec_t *pKnown = &pDecoder->pKnownCodecs[i];
+
+        if (pKnown->mediaType != AVMEDIA_TYPE_VIDEO &&
+            pKnown->mediaType != AVMEDIA_TYPE_AUDIO) continue;
+
+        /* Keep the time base selected by the demuxer */
+        AVRational timeBase = pAvStream->time_base;
+        XCodec_ApplyToAVStream(pKnown, pAvStream);
+        if (timeBase.num > 0 && timeBase.den > 0) pAvStream->time_base = timeBase;
+
+        if (pKnown->mediaType == AVMEDIA_TYPE_VIDEO &&
+            pKnown->frameRate.num > 0 && pKnown->frameRate.den > 0)
+        {
+            if (!pAvStream->avg_frame_rate.num) pAvStream->avg_frame_rate = pKnown->frameRate;
+            if (!pAvStream->r_frame_rate.num) pAvStream->r_frame_rate = pKnown->frameRate;
+        }
+    }
+
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_SetupInputRing(xdecoder_t *pDecoder, size_t nSize)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(!pDecoder->bHaveInput, XStat_ErrCb(pStatus, "Input is already open"));
+    XSTATUS nStatus = XInputIO_Setup(&pDecoder->inputIO, nSize);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to setup input ring: size(%zu)", nSize));
+
+    XStat_InfoCb(pStatus, "Created input ring: size(%zu)", pDecoder->inputIO.nCapacity);
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_PushInput(xdecoder_t *pDecoder, const uint8_t *pData, size_t nSize)
+{
+    XASSERT(pDecoder, XSTDINV);
+    return XInputIO_Write(&pDecoder->inputIO, pData, nSize);
+}
+
+uint8_t* XDecoder_ReserveInput(xdecoder_t *pDecoder, size_t *pSize)
+{
+    XASSERT(pDecoder, NULL);
+    return XInputIO_Reserve(&pDecoder->inputIO, pSize);
+}
+
+XSTATUS XDecoder_CommitInput(xdecoder_t *pDecoder, size_t nSize)
+{
+    XASSERT(pDecoder, XSTDINV);
+    return XInputIO_Commit(&pDecoder->inputIO, nSize);
+}
+
+void XDecoder_EndInput(xdecoder_t *pDecoder)
+{
+    XASSERT_VOID(pDecoder);
+    XInputIO_SetEOF(&pDecoder->inputIO);
+}
+
+void XDecoder_AbortInput(xdecoder_t *pDecoder)
+{
+    XASSERT_VOID(pDecoder);
+    XASSERT_VOID_RET(pDecoder->inputIO.pBuffer);
+
+    /* Producer and demuxer blocked in the ring return immediately */
+    XInputIO_Abort(&pDecoder->inputIO);
+}
+
+static int XDecoder_RingRead(void *pCtx, uint8_t *pData, int nSize)
+{
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    return XInputIO_Read(&pDecoder->inputIO, pData, nSize);
+}
+
+static int XDecoder_MapRead(void *pCtx, uint8_t *pData, int nSize)
+{
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    return XInputMap_Read(&pDecoder->inputMap, pData, nSize);
+}
+
+static int64_t XDecoder_MapSeek(void *pCtx, int64_t nOffset, int nWhence)
+{
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    return XInputMap_Seek(&pDecoder->inputMap, nOffset, nWhence);
+}
+
+static void XDecoder_MapInput(xdecoder_t *pDecoder, const char *pInput)
+{
+    xstatus_t *pStatus = &pDecoder->status;
+    if (!strncmp(pInput, "file:", 5)) pInput += 5;
+    else if (strstr(pInput, "://") != NULL) return;
+
+    XSTATUS nStatus = XInputMap_Open(&pDecoder->inputMap, pInput);
+    if (nStatus > 0)
+    {
+        XStat_InfoCb(pStatus, "Mapped input file: size(%zu)", pDecoder->inputMap.nSize);
+        return;
+    }
+
+    XStat_InfoCb(pStatus, "Can not map input, using file protocol: %s (%s)",
+        pInput, nStatus < 0 ? strerror(errno) : "not a regular file");
+}
+
+static XSTATUS XDecoder_OpenCustomIO(xdecoder_t *pDecoder)
+{
+    xstatus_t *pStatus = &pDecoder->status;
+    if (!pDecoder->nIOBuffSize) pDecoder->nIOBuffSize = XDECODER_IO_SIZE;
+    size_t nBuffSize = pDecoder->nIOBuffSize;
+
+    xdemuxer_seek_cb_t seekCallback = pDecoder->seekCallback;
+    xdemuxer_cb_t readCallback = pDecoder->demuxerCallback;
+    void *pReadCtx = pDecoder->pUserCtx;
+
+    if (pDecoder->inputIO.pBuffer != NULL)
+    {
+        /* Pushed input is a stream, it can not be seeked */
+        readCallback = XDecoder_RingRead;
+        seekCallback = NULL;
+        pReadCtx = pDecoder;
+    }
+    else if (pDecoder->inputMap.pData != NULL)
+    {
+        readCallback = XDecoder_MapRead;
+        seekCallback = XDecoder_MapSeek;
+        pReadCtx = pDecoder;
+    }
+
+    /* Context may be pre-allocated by the caller (e.g. with interrupt callback) */
+    if (pDecoder->pFmtCtx == NULL) pDecoder->pFmtCtx = avformat_alloc_context();
+    XASSERT(pDecoder->pFmtCtx, XStat_ErrCb(pStatus, "Failed to alloc input format context"));
+
+    uint8_t *pBuffer = (uint8_t*)av_malloc(nBuffSize);
+    XASSERT(pBuffer, XStat_ErrCb(pStatus, "Failed to alloc input buffer: %s", strerror(errno)));
+
+    pDecoder->pIOCtx = avio_alloc_context(pBuffer, (int)nBuffSize, 0,
+        pReadCtx, readCallback, NULL, seekCallback);
+
+    XASSERT_CALL(pDecoder->pIOCtx, av_free, pBuffer,
+        XStat_ErrCb(pStatus, "Failed to alloc input context"));
+
+    if (seekCallback == NULL) pDecoder->pIOCtx->seekable = 0;
+
+    /* Large reads go straight from the mapped pages to the packet data */
+    if (pDecoder->inputMap.pData != NULL) pDecoder->pIOCtx->direct = 1;
+    pDecoder->pFmtCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    pDecoder->pFmtCtx->pb = pDecoder->pIOCtx;
+
+    XStat_InfoCb(pStatus, "Created input context: buffer(%zu), seekable(%d)",
+        nBuffSize, seekCallback != NULL);
+
+    return XSTDOK;
+}
+
 XSTATUS XDecoder_OpenInput(xdecoder_t *pDecoder, const char *pInput, const char *pInputFmt)
 {
     XASSERT(pDecoder, XSTDINV);
     xstatus_t *pStatus = &pDecoder->status;
-    XASSERT(pInput, XStat_ErrCb(pStatus, "Invalid input argument"));
+
+    xbool_t bCustomIO = pDecoder->demuxerCallback != NULL || pDecoder->inputIO.pBuffer != NULL;
+    XASSERT((pInput || bCustomIO), XStat_ErrCb(pStatus, "Invalid input argument"));
 
 #ifdef XCODEC_USE_NEW_FIFO
     const AVInputFormat *pAvInFmt = pInputFmt ? av_find_input_format(pInputFmt) : NULL;
@@ -100,11 +682,44 @@ XSTATUS XDecoder_OpenInput(xdecoder_t *pDecoder, const char *pInput, const char
     AVInputFormat *pAvInFmt = pInputFmt ? av_find_input_format(pInputFmt) : NULL;
 #endif
 
+    if (!bCustomIO)
+    {
+        /* Keep input location for the background index builder */
+        xstrncpy(pDecoder->sInput, sizeof(pDecoder->sInput), pInput);
+        if (pInputFmt != NULL) xstrncpy(pDecoder->sInputFmt, sizeof(pDecoder->sInputFmt), pInputFmt);
+        if (pDecoder->bMapInput) XDecoder_MapInput(pDecoder, pInput);
+    }
+
+    if (bCustomIO || pDecoder->inputMap.pData != NULL)
+    {
+        XSTATUS nStatus = XDecoder_OpenCustomIO(pDecoder);
+        if (nStatus <= 0) return nStatus;
+        if (pInput == NULL) pInput = "custom";
+    }
+
+    /* Bounded probing, also used by avformat_find_stream_info() */
+    if (pDecoder->nProbeSize > 0) av_dict_set_int(&pDecoder->pDemuxOpts, "probesize", pDecoder->nProbeSize, 0);
+    if (pDecoder->nAnalyzeDuration > 0) av_dict_set_int(&pDecoder->pDemuxOpts, "analyzeduration", pDecoder->nAnalyzeDuration, 0);
+
     pStatus->nAVStatus = avformat_open_input(&pDecoder->pFmtCtx, pInput, pAvInFmt, &pDecoder->pDemuxOpts);
     XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Cannot open input: %s", pInput));
 
-    pStatus->nAVStatus = avformat_find_stream_info(pDecoder->pFmtCtx, NULL);
-    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Cannot find stream info: %s", pInput));
+    if (pDecoder->pKnownCodecs != NULL && XDecoder_ApplyStreamInfo(pDecoder) > 0)
+    {
+        XStat_InfoCb(pStatus, "Using known stream info, probing skipped: %s", pInput);
+    }
+    else
+    {
+        if (pDecoder->pKnownCodecs != NULL)
+            XStat_InfoCb(pStatus, "Known stream info does not match input, probing: %s", pInput);
+
+        pStatus->nAVStatus = avformat_find_stream_info(pDecoder->pFmtCtx, NULL);
+        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Cannot find stream info: %s", pInput));
+    }
+
+    /* Size the readahead window to the input bitrate */
+    if (pDecoder->inputMap.pData != NULL)
+        XInputMap_SetBitrate(&pDecoder->inputMap, pDecoder->pFmtCtx->bit_rate);
 
     pDecoder->bHaveInput = XTRUE;
     unsigned int i;
@@ -142,7 +757,7 @@ XSTATUS XDecoder_OpenInput(xdecoder_t *pDecoder, const char *pInput, const char
         if (pDecoder->bDemuxOnly)
         {
             XStat_InfoCb(pStatus, "Demuxing stream: %s, src(%d)", sCodecStr, i);
-            return XSTDOK;
+            continue;
         }
 
         const AVCodec *pDecCodec = avcodec_find_decoder(pAvStream->codecpar->codec_id);
@@ -161,9 +776,8 @@ XSTATUS XDecoder_OpenInput(xdecoder_t *pDecoder, const char *pInput, const char
         if (pStream->pCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO ||
             pStream->pCodecCtx->codec_type == AVMEDIA_TYPE_AUDIO)
         {
-            pStatus->nAVStatus = avcodec_open2(pStream->pCodecCtx, pDecCodec, NULL);
-            XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to open decoder: src(%u)", i));
-            pStream->bCodecOpen = XTRUE;
+            XSTATUS nStatus = XDecoder_OpenAVCodec(pDecoder, pStream, pDecCodec);
+            XASSERT((nStatus == XSTDOK), nStatus);
         }
 
         XStat_InfoCb(pStatus, "Decoding stream: %s, src(%d)", sCodecStr, i);
@@ -172,16 +786,290 @@ XSTATUS XDecoder_OpenInput(xdecoder_t *pDecoder, const char *pInput, const char
     return XSTDOK;
 }
 
-XSTATUS XDecoder_Seek(xdecoder_t *pDecoder, int nStream, int64_t nTS, int nFlags)
+static int XDecoder_IndexInterruptCb(void *pCtx)
 {
-    XASSERT(pDecoder, XSTDINV);
-    xstatus_t *pStatus = &pDecoder->status;
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    return (int)XSYNC_ATOMIC_GET(&pDecoder->nIndexStop);
+}
+
+static xbool_t XDecoder_IndexStream(AVFormatContext *pFmtCtx, const AVPacket *pPacket)
+{
+    /* Every audio packet is a keyframe, seeking goes by video */
+    XASSERT_RET((pPacket->stream_index >= 0 && (unsigned int)pPacket->stream_index < pFmtCtx->nb_streams), XFALSE);
+    return pFmtCtx->streams[pPacket->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+}
+
+static void XDecoder_IndexPacket(xdecoder_t *pDecoder, const AVPacket *pPacket, int nStatus)
+{
+    pthread_mutex_lock(&pDecoder->indexLock);
+
+    if (pDecoder->bIndexing && !pDecoder->bIndexComplete)
+    {
+        /* Whole input was read once, index covers everything */
+        if (nStatus == AVERROR_EOF)
+        {
+            pDecoder->bIndexComplete = XTRUE;
+            pDecoder->bIndexing = XFALSE;
+        }
+        else if (nStatus >= 0 && XDecoder_IndexStream(pDecoder->pFmtCtx, pPacket))
+            XKFIndex_Add(&pDecoder->kfIndex, pPacket);
+    }
+
+    pthread_mutex_unlock(&pDecoder->indexLock);
+}
+
+static XSTATUS XDecoder_SeekIndex(xdecoder_t *pDecoder, int nStream, int64_t nTS)
+{
+    xstatus_t *pStatus = &pDecoder->status;
+    AVFormatContext *pFmtCtx = pDecoder->pFmtCtx;
+    XASSERT_RET((nStream >= 0 && (unsigned int)nStream < pFmtCtx->nb_streams), XSTDNON);
+
+    pthread_mutex_lock(&pDecoder->indexLock);
+    const xkf_entry_t *pFound = NULL;
+    xkf_entry_t entry;
+
+    if (pDecoder->bIndexComplete) pFound = XKFIndex_Find(&pDecoder->kfIndex, nStream, nTS);
+    if (pFound != NULL) entry = *pFound;
+
+    pthread_mutex_unlock(&pDecoder->indexLock);
+    XASSERT_RET(pFound, XSTDNON);
+
+    /* Byte offset is exact for index-less formats like TS */
+    pStatus->nAVStatus = AVERROR(ENOSYS);
+    if (entry.nPos >= 0 && !(pFmtCtx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        pStatus->nAVStatus = av_seek_frame(pFmtCtx, nStream, entry.nPos, AVSEEK_FLAG_BYTE);
+
+    if (pStatus->nAVStatus < 0)
+    {
+        int64_t nKeyTS = entry.nPTS != AV_NOPTS_VALUE ? entry.nPTS : entry.nDTS;
+        pStatus->nAVStatus = av_seek_frame(pFmtCtx, nStream, nKeyTS, AVSEEK_FLAG_BACKWARD);
+    }
+
+    XASSERT_RET((pStatus->nAVStatus >= 0), XSTDERR);
+    size_t i;
+
+    for (i = 0; i < XArray_Used(&pDecoder->streams); i++)
+    {
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, i);
+        if (pStream != NULL && pStream->pCodecCtx != NULL) XStream_FlushBuffers(pStream);
+    }
+
+    XDecoder_ResetPolicies(pDecoder);
+
+    /* Decode forward from the keyframe, deliver from the exact target */
+    AVRational timeBase = pFmtCtx->streams[nStream]->time_base;
+    pDecoder->nSeekTime = av_rescale_q(nTS, timeBase, AV_TIME_BASE_Q);
+    pDecoder->nSeekStream = nStream;
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_Seek(xdecoder_t *pDecoder, int nStream, int64_t nTS, int nFlags)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pDecoder->bHaveInput, XStat_ErrCb(pStatus, "Input format is not open"));
+    XASSERT(!pDecoder->bThreaded, XStat_ErrCb(pStatus, "Decoder threads are running"));
+
+    pthread_mutex_lock(&pDecoder->indexLock);
+    if (pDecoder->bIndexing && !pDecoder->bIndexComplete)
+    {
+        /* Partial index would get duplicate entries after the seek */
+        XKFIndex_Destroy(&pDecoder->kfIndex);
+        pDecoder->bIndexing = XFALSE;
+    }
+    pthread_mutex_unlock(&pDecoder->indexLock);
+
+    pDecoder->nSeekTime = AV_NOPTS_VALUE;
+    pDecoder->nSeekStream = XSTDERR;
+    XDecoder_ResetPolicies(pDecoder);
+
+    if (!(nFlags & AVSEEK_FLAG_BYTE))
+    {
+        XSTATUS nStatus = XDecoder_SeekIndex(pDecoder, nStream, nTS);
+        if (nStatus != XSTDNON) return pStatus->nAVStatus;
+    }
 
-    XASSERT(pDecoder->bHaveInput, XStat_ErrCb(pStatus, "Input format is not open"));
     pStatus->nAVStatus = av_seek_frame(pDecoder->pFmtCtx, nStream, nTS, nFlags);
     return pStatus->nAVStatus;
 }
 
+static int XDecoder_OpenIndexInput(xdecoder_t *pDecoder, AVFormatContext **pFmtCtx)
+{
+#ifdef XCODEC_USE_NEW_FIFO
+    const AVInputFormat *pAvInFmt = NULL;
+#else
+    AVInputFormat *pAvInFmt = NULL;
+#endif
+
+    if (xstrused(pDecoder->sInputFmt)) pAvInFmt = av_find_input_format(pDecoder->sInputFmt);
+    *pFmtCtx = avformat_alloc_context();
+    XASSERT(*pFmtCtx, AVERROR(ENOMEM));
+
+    (*pFmtCtx)->interrupt_callback.callback = XDecoder_IndexInterruptCb;
+    (*pFmtCtx)->interrupt_callback.opaque = pDecoder;
+    return avformat_open_input(pFmtCtx, pDecoder->sInput, pAvInFmt, NULL);
+}
+
+static int XDecoder_ReadIndex(xdecoder_t *pDecoder, xkf_index_t *pIndex)
+{
+    AVFormatContext *pFmtCtx = NULL;
+    int nStatus = XDecoder_OpenIndexInput(pDecoder, &pFmtCtx);
+    XASSERT((nStatus >= 0), nStatus);
+
+    AVPacket *pPacket = av_packet_alloc();
+    if (pPacket == NULL) nStatus = AVERROR(ENOMEM);
+
+    /* Demux only, nothing is decoded */
+    while (nStatus >= 0 && !XSYNC_ATOMIC_GET(&pDecoder->nIndexStop))
+    {
+        nStatus = av_read_frame(pFmtCtx, pPacket);
+        if (nStatus < 0) break;
+
+        if (XDecoder_IndexStream(pFmtCtx, pPacket)) XKFIndex_Add(pIndex, pPacket);
+        av_packet_unref(pPacket);
+    }
+
+    if (pFmtCtx->pb != NULL) pIndex->nSourceSize = avio_size(pFmtCtx->pb);
+    av_packet_free(&pPacket);
+    avformat_close_input(&pFmtCtx);
+
+    XKFIndex_Sort(pIndex);
+    return nStatus;
+}
+
+static XSTATUS XDecoder_FinishIndex(xdecoder_t *pDecoder, xkf_index_t *pIndex, int nStatus)
+{
+    xstatus_t *pParent = &pDecoder->status;
+    xstatus_t status;
+
+    XStat_Init(&status, pParent->nTypes, pParent->cb, pParent->pUserCtx);
+    status.nAVStatus = nStatus;
+
+    if (nStatus != AVERROR_EOF)
+    {
+        XKFIndex_Destroy(pIndex);
+        return XStat_ErrCb(&status, "Failed to build keyframe index: %s", pDecoder->sInput);
+    }
+
+    size_t nCount = pIndex->nCount;
+    pthread_mutex_lock(&pDecoder->indexLock);
+
+    XKFIndex_Move(&pDecoder->kfIndex, pIndex);
+    pDecoder->bIndexComplete = XTRUE;
+    pDecoder->bIndexing = XFALSE;
+
+    pthread_mutex_unlock(&pDecoder->indexLock);
+    XStat_InfoCb(&status, "Built keyframe index: keyframes(%zu), input(%s)", nCount, pDecoder->sInput);
+    return XSTDOK;
+}
+
+static void* XDecoder_IndexThread(void *pCtx)
+{
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    xkf_index_t index;
+
+    XKFIndex_Init(&index);
+    int nStatus = XDecoder_ReadIndex(pDecoder, &index);
+
+    XDecoder_FinishIndex(pDecoder, &index, nStatus);
+    return NULL;
+}
+
+XSTATUS XDecoder_BuildIndex(xdecoder_t *pDecoder, xbool_t bBackground)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(xstrused(pDecoder->sInput), XStat_ErrCb(pStatus, "Input is not open"));
+    XASSERT(!pDecoder->bIndexThread, XStat_ErrCb(pStatus, "Index builder is already started"));
+    XSYNC_ATOMIC_SET(&pDecoder->nIndexStop, XFALSE);
+
+    if (bBackground)
+    {
+        /* Separate demuxer, the main input is not touched */
+        if (pthread_create(&pDecoder->indexThread, NULL, XDecoder_IndexThread, pDecoder))
+            return XStat_ErrCb(pStatus, "Failed to start index builder thread");
+
+        pDecoder->bIndexThread = XTRUE;
+        return XSTDOK;
+    }
+
+    xkf_index_t index;
+    XKFIndex_Init(&index);
+
+    int nStatus = XDecoder_ReadIndex(pDecoder, &index);
+    return XDecoder_FinishIndex(pDecoder, &index, nStatus);
+}
+
+XSTATUS XDecoder_LoadIndex(xdecoder_t *pDecoder, const char *pPath)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+    XASSERT(pPath, XStat_ErrCb(pStatus, "Invalid index path argument"));
+
+    xkf_index_t index;
+    XKFIndex_Init(&index);
+
+    XSTATUS nStatus = XKFIndex_Load(&index, pPath);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to load keyframe index: %s", pPath));
+
+    /* Source has changed since the index was saved */
+    int64_t nSourceSize = XSTDERR;
+    if (pDecoder->pFmtCtx != NULL && pDecoder->pFmtCtx->pb != NULL) nSourceSize = avio_size(pDecoder->pFmtCtx->pb);
+
+    if ((nSourceSize >= 0 && nSourceSize != index.nSourceSize) ||
+        (pDecoder->pFmtCtx != NULL && index.nStreams > pDecoder->pFmtCtx->nb_streams))
+    {
+        XKFIndex_Destroy(&index);
+        return XStat_ErrCb(pStatus, "Keyframe index does not match input: %s", pPath);
+    }
+
+    size_t nCount = index.nCount;
+    pthread_mutex_lock(&pDecoder->indexLock);
+
+    XKFIndex_Move(&pDecoder->kfIndex, &index);
+    pDecoder->bIndexComplete = XTRUE;
+    pDecoder->bIndexing = XFALSE;
+
+    pthread_mutex_unlock(&pDecoder->indexLock);
+    XStat_InfoCb(pStatus, "Loaded keyframe index: keyframes(%zu), path(%s)", nCount, pPath);
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_SaveIndex(xdecoder_t *pDecoder, const char *pPath)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+    XASSERT(pPath, XStat_ErrCb(pStatus, "Invalid index path argument"));
+
+    pthread_mutex_lock(&pDecoder->indexLock);
+    xkf_index_t *pIndex = &pDecoder->kfIndex;
+    XSTATUS nStatus = XSTDNON;
+
+    if (pDecoder->bIndexComplete)
+    {
+        if (pIndex->nSourceSize < 0 && pDecoder->pFmtCtx != NULL && pDecoder->pFmtCtx->pb != NULL)
+            pIndex->nSourceSize = avio_size(pDecoder->pFmtCtx->pb);
+
+        /* Loaded index is already on disk */
+        nStatus = pIndex->pMap != NULL ? XSTDNON : XKFIndex_Save(pIndex, pPath);
+    }
+
+    pthread_mutex_unlock(&pDecoder->indexLock);
+    XASSERT((nStatus >= 0), XStat_ErrCb(pStatus, "Failed to save keyframe index: %s", pPath));
+    return nStatus;
+}
+
+xbool_t XDecoder_HaveIndex(xdecoder_t *pDecoder)
+{
+    XASSERT_RET(pDecoder, XFALSE);
+    pthread_mutex_lock(&pDecoder->indexLock);
+    xbool_t bComplete = pDecoder->bIndexComplete;
+    pthread_mutex_unlock(&pDecoder->indexLock);
+    return bComplete;
+}
+
 XSTATUS XDecoder_ReadPacket(xdecoder_t *pDecoder, AVPacket *pPacket)
 {
     XASSERT(pDecoder, XSTDINV);
@@ -191,26 +1079,141 @@ XSTATUS XDecoder_ReadPacket(xdecoder_t *pDecoder, AVPacket *pPacket)
     XASSERT(pDecoder->bHaveInput, XStat_ErrCb(pStatus, "Input format is not open"));
 
     pStatus->nAVStatus = av_read_frame(pDecoder->pFmtCtx, pPacket);
+    if (pDecoder->bIndexing) XDecoder_IndexPacket(pDecoder, pPacket, pStatus->nAVStatus);
     return pStatus->nAVStatus;
 }
 
-XSTATUS XDecoder_DecodePacket(xdecoder_t *pDecoder, AVPacket *pPacket)
+static void XDecoder_SetThreadError(xdecoder_t *pDecoder, int nStatus)
 {
-    XASSERT(pDecoder, XSTDINV);
-    xstatus_t *pStatus = &pDecoder->status;
+    XASSERT_VOID_RET(!XSYNC_ATOMIC_GET(&pDecoder->nStop));
+    size_t i;
 
-    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
-    XASSERT(pDecoder->frameCallback, XStat_ErrCb(pStatus, "Decoder frame callback is not set"));
+    pthread_mutex_lock(&pDecoder->threadLock);
+    if (pDecoder->nThreadStatus >= 0) pDecoder->nThreadStatus = nStatus;
+    pthread_mutex_unlock(&pDecoder->threadLock);
 
-    xstream_t *pStream = XStreams_GetBySrcIndex(&pDecoder->streams, pPacket->stream_index);
-    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: src(%d)", pPacket->stream_index));
-    XASSERT(pStream->bCodecOpen, XStat_ErrCb(pStatus, "Codec is not open: src(%d)", pStream->nSrcIndex));
+    /* Stop the reader and the other decoders, wake up the consumer */
+    XSYNC_ATOMIC_SET(&pDecoder->nStop, XTRUE);
+    for (i = 0; i < pDecoder->nWorkers; i++)
+        XPktQueue_Abort(&pDecoder->pWorkers[i].queue);
+
+    if (pDecoder->bPullFrames) XFrmQueue_Abort(&pDecoder->frameQueue);
+}
+
+static int XDecoder_GetThreadError(xdecoder_t *pDecoder)
+{
+    pthread_mutex_lock(&pDecoder->threadLock);
+    int nStatus = pDecoder->nThreadStatus;
+    pthread_mutex_unlock(&pDecoder->threadLock);
+    return nStatus;
+}
+
+static int XDecoder_DeliverFrame(xdecoder_t *pDecoder, AVFrame *pFrame, int nStreamIndex)
+{
+    if (pDecoder->bPullFrames)
+    {
+        /* Consumer takes over the frame reference, blocks while queue is full */
+        XSTATUS nStatus = XFrmQueue_Push(&pDecoder->frameQueue, pFrame, nStreamIndex);
+        return nStatus > 0 ? 0 : AVERROR_EXIT;
+    }
+
+    /* Decoder threads share the user callback, one frame at a time */
+    if (!pDecoder->bThreaded) return pDecoder->frameCallback(pDecoder->pUserCtx, pFrame, nStreamIndex);
+
+    pthread_mutex_lock(&pDecoder->callbackLock);
+    int nStatus = pDecoder->frameCallback(pDecoder->pUserCtx, pFrame, nStreamIndex);
+    pthread_mutex_unlock(&pDecoder->callbackLock);
+
+    /* Consumer failed, there is no point to keep decoding */
+    if (nStatus < 0) XDecoder_SetThreadError(pDecoder, nStatus);
+    return nStatus;
+}
+
+static xbool_t XDecoder_SkipFrame(int64_t *pSeekTime, int *pSeekStream, xstream_t *pStream, AVFrame *pFrame)
+{
+    XASSERT_RET((*pSeekTime != AV_NOPTS_VALUE && pStream->pAvStream), XFALSE);
+    int64_t nTS = pFrame->best_effort_timestamp != AV_NOPTS_VALUE ? pFrame->best_effort_timestamp : pFrame->pts;
+    XASSERT_RET((nTS != AV_NOPTS_VALUE), XFALSE);
+
+    /* Frames between the keyframe and the seek target */
+    int64_t nTime = av_rescale_q(nTS, pStream->pAvStream->time_base, AV_TIME_BASE_Q);
+    if (nTime < *pSeekTime) return XTRUE;
+
+    if (pStream->nSrcIndex == *pSeekStream)
+    {
+        *pSeekTime = AV_NOPTS_VALUE;
+        *pSeekStream = XSTDERR;
+    }
+
+    return XFALSE;
+}
+
+static xbool_t XDecoder_DropPacket(xdecoder_policy_t *pPolicy, AVPacket *pPacket)
+{
+    XASSERT_RET((pPolicy && pPacket), XFALSE);
+    xbool_t bDisposable = (pPacket->flags & AV_PKT_FLAG_DISPOSABLE) ? XTRUE : XFALSE;
+    xbool_t bKeyOnly = pPolicy->skipFrame >= AVDISCARD_NONKEY;
+
+    /* Decoder would discard these anyway, do not even send them */
+    if ((bKeyOnly && !(pPacket->flags & AV_PKT_FLAG_KEY)) ||
+        (bDisposable && pPolicy->skipFrame >= AVDISCARD_NONREF))
+    {
+        pPolicy->nDropped++;
+        return XTRUE;
+    }
+
+    XASSERT_RET((pPolicy->nInterval && pPolicy->nNextTS != AV_NOPTS_VALUE), XFALSE);
+    int64_t nTS = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+    XASSERT_RET((nTS != AV_NOPTS_VALUE && nTS < pPolicy->nNextTS), XFALSE);
+
+    /* Target rate is already satisfied and nothing references this packet */
+    if (bDisposable || bKeyOnly)
+    {
+        pPolicy->nDropped++;
+        return XTRUE;
+    }
+
+    return XFALSE;
+}
+
+static xbool_t XDecoder_SkipRate(xdecoder_policy_t *pPolicy, AVFrame *pFrame)
+{
+    XASSERT_RET((pPolicy && pPolicy->nInterval), XFALSE);
+    int64_t nTS = pFrame->best_effort_timestamp != AV_NOPTS_VALUE ? pFrame->best_effort_timestamp : pFrame->pts;
+    XASSERT_RET((nTS != AV_NOPTS_VALUE), XFALSE);
+
+    if (pPolicy->nNextTS != AV_NOPTS_VALUE && nTS < pPolicy->nNextTS)
+    {
+        pPolicy->nSkipped++;
+        return XTRUE;
+    }
+
+    /* Stay on the rate grid, but do not burst after a gap */
+    if (pPolicy->nNextTS == AV_NOPTS_VALUE || nTS - pPolicy->nNextTS >= pPolicy->nInterval)
+        pPolicy->nNextTS = nTS + pPolicy->nInterval;
+    else pPolicy->nNextTS += pPolicy->nInterval;
+
+    return XFALSE;
+}
+
+static XSTATUS XDecoder_DecodeStream(xdecoder_t *pDecoder, xdecoder_worker_t *pWorker, xstream_t *pStream, AVPacket *pPacket)
+{
+    /* Decoder threads never touch the shared seek state */
+    xstatus_t *pStatus = pWorker != NULL ? &pWorker->status : &pDecoder->status;
+    int64_t *pSeekTime = pWorker != NULL ? &pWorker->nSeekTime : &pDecoder->nSeekTime;
+    int *pSeekStream = pWorker != NULL ? &pWorker->nSeekStream : &pDecoder->nSeekStream;
+
+    xdecoder_policy_t *pPolicy = XDecoder_StreamPolicy(pDecoder, pStream->nSrcIndex);
+    if (XDecoder_DropPacket(pPolicy, pPacket)) return XSTDOK;
 
     AVFrame *pFrame = XStream_GetOrCreateFrame(pStream);
     XASSERT(pFrame, XStat_ErrCb(pStatus, "Failed to alloc frame: src(%d)", pStream->nSrcIndex));
 
-    pFrame->pts = pPacket->pts;
-    pFrame->pkt_dts = pPacket->dts;
+    if (pPacket != NULL)
+    {
+        pFrame->pts = pPacket->pts;
+        pFrame->pkt_dts = pPacket->dts;
+    }
 
     pStatus->nAVStatus = avcodec_send_packet(pStream->pCodecCtx, pPacket);
     XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus,
@@ -225,13 +1228,465 @@ XSTATUS XDecoder_DecodePacket(xdecoder_t *pDecoder, AVPacket *pPacket)
         XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus,
             "Failed to receive frame: src(%d)", pStream->nSrcIndex));
 
-        pStatus->nAVStatus = pDecoder->frameCallback(pDecoder->pUserCtx, pFrame, pStream->nSrcIndex);
+        if (XDecoder_SkipFrame(pSeekTime, pSeekStream, pStream, pFrame) ||
+            XDecoder_SkipRate(pPolicy, pFrame))
+        {
+            av_frame_unref(pFrame);
+            continue;
+        }
+
+        pStatus->nAVStatus = XDecoder_DeliverFrame(pDecoder, pFrame, pStream->nSrcIndex);
         av_frame_unref(pFrame);
     }
 
     return pStatus->nAVStatus;
 }
 
+XSTATUS XDecoder_DecodePacket(xdecoder_t *pDecoder, AVPacket *pPacket)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+    XASSERT(pDecoder->frameCallback, XStat_ErrCb(pStatus, "Decoder frame callback is not set"));
+    XASSERT(!pDecoder->bThreaded, XStat_ErrCb(pStatus, "Decoder threads are running"));
+
+    xstream_t *pStream = XStreams_GetBySrcIndex(&pDecoder->streams, pPacket->stream_index);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: src(%d)", pPacket->stream_index));
+    XASSERT(pStream->bCodecOpen, XStat_ErrCb(pStatus, "Codec is not open: src(%d)", pStream->nSrcIndex));
+
+    return XDecoder_DecodeStream(pDecoder, NULL, pStream, pPacket);
+}
+
+XSTATUS XDecoder_Drain(xdecoder_t *pDecoder)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pDecoder->frameCallback, XStat_ErrCb(pStatus, "Decoder frame callback is not set"));
+    XASSERT(!pDecoder->bThreaded, XStat_ErrCb(pStatus, "Decoder threads are running"));
+    size_t i;
+
+    for (i = 0; i < XArray_Used(&pDecoder->streams); i++)
+    {
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, i);
+        if (pStream == NULL || !pStream->bCodecOpen) continue;
+
+        /* Deliver delayed frames and make decoder ready for new input */
+        XDecoder_DecodeStream(pDecoder, NULL, pStream, NULL);
+        XStream_FlushBuffers(pStream);
+    }
+
+    return XSTDOK;
+}
+
+int XDecoder_SendPacket(xdecoder_t *pDecoder, AVPacket *pPacket)
+{
+    XASSERT(pDecoder, AVERROR(EINVAL));
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+    XASSERT(!pDecoder->bThreaded, XStat_ErrCb(pStatus, "Decoder threads are running"));
+
+    xstream_t *pStream = XStreams_GetBySrcIndex(&pDecoder->streams, pPacket->stream_index);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: src(%d)", pPacket->stream_index));
+    XASSERT(pStream->bCodecOpen, XStat_ErrCb(pStatus, "Codec is not open: src(%d)", pStream->nSrcIndex));
+
+    xdecoder_policy_t *pPolicy = XDecoder_StreamPolicy(pDecoder, pStream->nSrcIndex);
+    if (XDecoder_DropPacket(pPolicy, pPacket)) return 0;
+
+    /* AVERROR(EAGAIN) means that frames must be received first */
+    pStatus->nAVStatus = avcodec_send_packet(pStream->pCodecCtx, pPacket);
+    return pStatus->nAVStatus;
+}
+
+XSTATUS XDecoder_SendEOF(xdecoder_t *pDecoder)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+    XASSERT(!pDecoder->bThreaded, XStat_ErrCb(pStatus, "Decoder threads are running"));
+    size_t i;
+
+    for (i = 0; i < XArray_Used(&pDecoder->streams); i++)
+    {
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, i);
+        if (pStream != NULL && pStream->bCodecOpen) avcodec_send_packet(pStream->pCodecCtx, NULL);
+    }
+
+    return XSTDOK;
+}
+
+static int XDecoder_ReceiveStream(xdecoder_t *pDecoder, xstream_t *pStream, AVFrame *pFrame)
+{
+    xdecoder_policy_t *pPolicy = XDecoder_StreamPolicy(pDecoder, pStream->nSrcIndex);
+
+    for (;;)
+    {
+        int nStatus = avcodec_receive_frame(pStream->pCodecCtx, pFrame);
+        if (nStatus < 0) return nStatus;
+
+        if (!XDecoder_SkipFrame(&pDecoder->nSeekTime, &pDecoder->nSeekStream, pStream, pFrame) &&
+            !XDecoder_SkipRate(pPolicy, pFrame)) return 0;
+
+        av_frame_unref(pFrame);
+    }
+}
+
+int XDecoder_ReceiveFrame(xdecoder_t *pDecoder, AVFrame *pFrame, int *pStreamIndex)
+{
+    XASSERT(pDecoder, AVERROR(EINVAL));
+    xstatus_t *pStatus = &pDecoder->status;
+    XASSERT(pFrame, XStat_ErrCb(pStatus, "Invalid frame argument"));
+
+    if (pDecoder->bThreaded)
+    {
+        XASSERT(pDecoder->bPullFrames, XStat_ErrCb(pStatus, "Frames are delivered to callback"));
+        XSTATUS nStatus = XFrmQueue_Pop(&pDecoder->frameQueue, pFrame, pStreamIndex);
+        if (nStatus > 0) return 0;
+
+        /* Aborted by a failed thread or drained to the end */
+        int nError = XDecoder_GetThreadError(pDecoder);
+        return nError < 0 ? nError : AVERROR_EOF;
+    }
+
+    size_t i, nCount = XArray_Used(&pDecoder->streams);
+    size_t nOpen = 0, nEOF = 0;
+
+    for (i = 0; i < nCount; i++)
+    {
+        size_t nIndex = (pDecoder->nRecvIndex + i) % nCount;
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, nIndex);
+        if (pStream == NULL || !pStream->bCodecOpen) continue;
+
+        int nStatus = XDecoder_ReceiveStream(pDecoder, pStream, pFrame);
+        nOpen++;
+
+        if (nStatus == 0)
+        {
+            /* Stay on this stream until it needs more input */
+            if (pStreamIndex != NULL) *pStreamIndex = pStream->nSrcIndex;
+            pDecoder->nRecvIndex = nIndex;
+            return 0;
+        }
+        else if (nStatus == AVERROR_EOF) nEOF++;
+        else if (nStatus != AVERROR(EAGAIN))
+        {
+            pStatus->nAVStatus = nStatus;
+            XStat_ErrCb(pStatus, "Failed to receive frame: src(%d)", pStream->nSrcIndex);
+            return nStatus;
+        }
+    }
+
+    XASSERT_RET((nOpen && nEOF == nOpen), AVERROR(EAGAIN));
+
+    /* Every decoder is drained, let them accept new input */
+    for (i = 0; i < nCount; i++)
+    {
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, i);
+        if (pStream != NULL && pStream->bCodecOpen) XStream_FlushBuffers(pStream);
+    }
+
+    return AVERROR_EOF;
+}
+
+static int XDecoder_InterruptCb(void *pCtx)
+{
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    return (int)XSYNC_ATOMIC_GET(&pDecoder->nStop);
+}
+
+static xdecoder_worker_t* XDecoder_GetWorker(xdecoder_t *pDecoder, int nStream)
+{
+    size_t i;
+    for (i = 0; i < pDecoder->nWorkers; i++)
+        if (pDecoder->pWorkers[i].pStream->nSrcIndex == nStream)
+            return &pDecoder->pWorkers[i];
+
+    return NULL;
+}
+
+static void XDecoder_ThreadDone(xdecoder_t *pDecoder)
+{
+    pthread_mutex_lock(&pDecoder->threadLock);
+    if (pDecoder->nActiveThreads) pDecoder->nActiveThreads--;
+    pthread_cond_broadcast(&pDecoder->doneCond);
+    pthread_mutex_unlock(&pDecoder->threadLock);
+}
+
+static void* XDecoder_ReaderThread(void *pCtx)
+{
+    xdecoder_t *pDecoder = (xdecoder_t*)pCtx;
+    xstatus_t *pParent = &pDecoder->status;
+    xstatus_t status;
+
+    XStat_Init(&status, pParent->nTypes, pParent->cb, pParent->pUserCtx);
+    AVPacket *pPacket = av_packet_alloc();
+    int nStatus = pPacket != NULL ? 0 : AVERROR(ENOMEM);
+    size_t i;
+
+    while (nStatus >= 0 && !XSYNC_ATOMIC_GET(&pDecoder->nStop))
+    {
+        nStatus = av_read_frame(pDecoder->pFmtCtx, pPacket);
+        if (pDecoder->bIndexing) XDecoder_IndexPacket(pDecoder, pPacket, nStatus);
+        if (nStatus < 0) break;
+
+        /* Blocks while the queue is full, decoders set the pace */
+        xdecoder_worker_t *pWorker = XDecoder_GetWorker(pDecoder, pPacket->stream_index);
+        if (pWorker == NULL || XPktQueue_Push(&pWorker->queue, pPacket) <= 0) av_packet_unref(pPacket);
+    }
+
+    if (nStatus < 0 && nStatus != AVERROR_EOF && !XSYNC_ATOMIC_GET(&pDecoder->nStop))
+    {
+        status.nAVStatus = nStatus;
+        XStat_ErrCb(&status, "Failed to read input packet");
+        XDecoder_SetThreadError(pDecoder, nStatus);
+    }
+
+    for (i = 0; i < pDecoder->nWorkers; i++)
+        XPktQueue_SetEOF(&pDecoder->pWorkers[i].queue);
+
+    pDecoder->nReadStatus = nStatus;
+    av_packet_free(&pPacket);
+
+    XDecoder_ThreadDone(pDecoder);
+    return NULL;
+}
+
+static void* XDecoder_WorkerThread(void *pCtx)
+{
+    xdecoder_worker_t *pWorker = (xdecoder_worker_t*)pCtx;
+    xdecoder_t *pDecoder = pWorker->pDecoder;
+    AVPacket *pPacket = av_packet_alloc();
+
+    while (pPacket != NULL && XPktQueue_Pop(&pWorker->queue, pPacket) > 0)
+    {
+        XDecoder_DecodeStream(pDecoder, pWorker, pWorker->pStream, pPacket);
+        av_packet_unref(pPacket);
+    }
+
+    /* Input is finished, drain the frames delayed in the codec */
+    if (pPacket != NULL && !XSYNC_ATOMIC_GET(&pDecoder->nStop))
+        XDecoder_DecodeStream(pDecoder, pWorker, pWorker->pStream, NULL);
+
+    if (pDecoder->bPullFrames) XFrmQueue_SetEOF(&pDecoder->frameQueue);
+    av_packet_free(&pPacket);
+    XDecoder_ThreadDone(pDecoder);
+    return NULL;
+}
+
+XSTATUS XDecoder_StartThreads(xdecoder_t *pDecoder)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pDecoder->bHaveInput, XStat_ErrCb(pStatus, "Input format is not open"));
+    XASSERT(!pDecoder->bDemuxOnly, XStat_ErrCb(pStatus, "Threaded input requires decoding"));
+    XASSERT(!pDecoder->pWorkers, XStat_ErrCb(pStatus, "Decoder threads are already started"));
+
+    size_t i, nCount = XArray_Used(&pDecoder->streams);
+    XASSERT(nCount, XStat_ErrCb(pStatus, "No streams to decode"));
+
+    pDecoder->pWorkers = (xdecoder_worker_t*)calloc(nCount, sizeof(xdecoder_worker_t));
+    XASSERT(pDecoder->pWorkers, XStat_ErrCb(pStatus, "Failed to allocate decoder workers"));
+
+    /* Without frame callback the consumer pulls frames with XDecoder_ReceiveFrame() */
+    pDecoder->bPullFrames = pDecoder->frameCallback == NULL;
+    if (pDecoder->bPullFrames) XFrmQueue_Init(&pDecoder->frameQueue);
+
+    for (i = 0; i < nCount; i++)
+    {
+        xstream_t *pStream = (xstream_t*)XArray_GetData(&pDecoder->streams, i);
+        if (pStream == NULL || !pStream->bCodecOpen) continue;
+
+        xdecoder_worker_t *pWorker = &pDecoder->pWorkers[pDecoder->nWorkers++];
+        XStat_Init(&pWorker->status, pStatus->nTypes, pStatus->cb, pStatus->pUserCtx);
+        XPktQueue_Init(&pWorker->queue);
+
+        pWorker->pDecoder = pDecoder;
+        pWorker->pStream = pStream;
+        pWorker->bStarted = XFALSE;
+
+        /* Each stream stops dropping once it reaches the target itself */
+        pWorker->nSeekTime = pDecoder->nSeekTime;
+        pWorker->nSeekStream = pStream->nSrcIndex;
+
+        if (XPktQueue_Setup(&pWorker->queue, pDecoder->nQueueDepth) <= 0)
+        {
+            XDecoder_StopThreads(pDecoder);
+            return XStat_ErrCb(pStatus, "Failed to setup packet queue: src(%d)", pStream->nSrcIndex);
+        }
+    }
+
+    if (pDecoder->bPullFrames &&
+        XFrmQueue_Setup(&pDecoder->frameQueue, pDecoder->nFrameDepth, pDecoder->nWorkers) <= 0)
+    {
+        XDecoder_StopThreads(pDecoder);
+        return XStat_ErrCb(pStatus, "Failed to setup frame queue");
+    }
+
+    if (pDecoder->pFmtCtx->interrupt_callback.callback == NULL)
+    {
+        /* Let the stop request break blocking reads */
+        pDecoder->pFmtCtx->interrupt_callback.callback = XDecoder_InterruptCb;
+        pDecoder->pFmtCtx->interrupt_callback.opaque = pDecoder;
+    }
+
+    /* Seek target is handed over to the workers */
+    pDecoder->nSeekTime = AV_NOPTS_VALUE;
+    pDecoder->nSeekStream = XSTDERR;
+
+    XSYNC_ATOMIC_SET(&pDecoder->nStop, XFALSE);
+    pDecoder->nActiveThreads = 0;
+    pDecoder->nReadStatus = 0;
+    pDecoder->nThreadStatus = 0;
+    pDecoder->bThreaded = XTRUE;
+
+    for (i = 0; i < pDecoder->nWorkers; i++)
+    {
+        xdecoder_worker_t *pWorker = &pDecoder->pWorkers[i];
+        pthread_mutex_lock(&pDecoder->threadLock);
+
+        if (pthread_create(&pWorker->thread, NULL, XDecoder_WorkerThread, pWorker))
+        {
+            pthread_mutex_unlock(&pDecoder->threadLock);
+            XDecoder_StopThreads(pDecoder);
+            return XStat_ErrCb(pStatus, "Failed to start decoder thread: src(%d)", pWorker->pStream->nSrcIndex);
+        }
+
+        pWorker->bStarted = XTRUE;
+        pDecoder->nActiveThreads++;
+        pthread_mutex_unlock(&pDecoder->threadLock);
+    }
+
+    pthread_mutex_lock(&pDecoder->threadLock);
+    if (pthread_create(&pDecoder->readerThread, NULL, XDecoder_ReaderThread, pDecoder))
+    {
+        pthread_mutex_unlock(&pDecoder->threadLock);
+        XDecoder_StopThreads(pDecoder);
+        return XStat_ErrCb(pStatus, "Failed to start input reader thread");
+    }
+
+    pDecoder->bReaderStarted = XTRUE;
+    pDecoder->nActiveThreads++;
+    pthread_mutex_unlock(&pDecoder->threadLock);
+
+    XStat_InfoCb(pStatus, "Started threaded input: decoders(%zu), queue(%zu)",
+        pDecoder->nWorkers, pDecoder->pWorkers[0].queue.nCapacity);
+
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_WaitThreads(xdecoder_t *pDecoder, int nTimeoutMs)
+{
+    XASSERT(pDecoder, XSTDINV);
+    XASSERT(pDecoder->bThreaded, XSTDINV);
+    pthread_mutex_lock(&pDecoder->threadLock);
+
+    if (nTimeoutMs > 0 && pDecoder->nActiveThreads)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += nTimeoutMs / 1000;
+        ts.tv_nsec += (long)(nTimeoutMs % 1000) * 1000000;
+
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+
+        while (pDecoder->nActiveThreads)
+            if (pthread_cond_timedwait(&pDecoder->doneCond, &pDecoder->threadLock, &ts)) break;
+    }
+    else
+    {
+        while (pDecoder->nActiveThreads && nTimeoutMs < 0)
+            pthread_cond_wait(&pDecoder->doneCond, &pDecoder->threadLock);
+    }
+
+    XSTATUS nStatus = pDecoder->nActiveThreads ? XSTDNON : XSTDOK;
+    if (nStatus > 0 && pDecoder->nThreadStatus < 0) nStatus = pDecoder->nThreadStatus;
+
+    pthread_mutex_unlock(&pDecoder->threadLock);
+    return nStatus;
+}
+
+XSTATUS XDecoder_GetQueueStats(xdecoder_t *pDecoder, int nStream, xpkt_queue_stats_t *pStats)
+{
+    XASSERT((pDecoder && pStats), XSTDINV);
+    xdecoder_worker_t *pWorker = XDecoder_GetWorker(pDecoder, nStream);
+    XASSERT(pWorker, XSTDNON);
+    return XPktQueue_GetStats(&pWorker->queue, pStats);
+}
+
+XSTATUS XDecoder_StopThreads(xdecoder_t *pDecoder)
+{
+    XASSERT(pDecoder, XSTDINV);
+    XASSERT_RET(pDecoder->pWorkers, XSTDNON);
+    xstatus_t *pStatus = &pDecoder->status;
+    size_t i;
+
+    XSYNC_ATOMIC_SET(&pDecoder->nStop, XTRUE);
+    for (i = 0; i < pDecoder->nWorkers; i++)
+        XPktQueue_Abort(&pDecoder->pWorkers[i].queue);
+
+    if (pDecoder->bPullFrames) XFrmQueue_Abort(&pDecoder->frameQueue);
+
+    if (pDecoder->bReaderStarted)
+    {
+        pthread_join(pDecoder->readerThread, NULL);
+        pDecoder->bReaderStarted = XFALSE;
+    }
+
+    for (i = 0; i < pDecoder->nWorkers; i++)
+    {
+        xdecoder_worker_t *pWorker = &pDecoder->pWorkers[i];
+        if (pWorker->bStarted) pthread_join(pWorker->thread, NULL);
+
+        xpkt_queue_stats_t *pStats = &pWorker->queue.stats;
+        XStat_InfoCb(pStatus, "Input queue: src(%d), packets(%llu), depth(%zu/%zu), "
+            "full(%llu, %llu ms), empty(%llu, %llu ms)", pWorker->pStream->nSrcIndex,
+            (unsigned long long)pStats->nPopped, pStats->nMaxDepth, pWorker->queue.nCapacity,
+            (unsigned long long)pStats->nPushStalls, (unsigned long long)(pStats->nPushStallTime / 1000),
+            (unsigned long long)pStats->nPopStalls, (unsigned long long)(pStats->nPopStallTime / 1000));
+
+        XPktQueue_Destroy(&pWorker->queue);
+    }
+
+    if (pDecoder->pFmtCtx != NULL &&
+        pDecoder->pFmtCtx->interrupt_callback.callback == XDecoder_InterruptCb)
+    {
+        pDecoder->pFmtCtx->interrupt_callback.callback = NULL;
+        pDecoder->pFmtCtx->interrupt_callback.opaque = NULL;
+    }
+
+    if (pDecoder->bPullFrames)
+    {
+        XFrmQueue_Destroy(&pDecoder->frameQueue);
+        pDecoder->bPullFrames = XFALSE;
+    }
+
+    free(pDecoder->pWorkers);
+    pDecoder->pWorkers = NULL;
+    pDecoder->nWorkers = 0;
+    pDecoder->nActiveThreads = 0;
+    pDecoder->bThreaded = XFALSE;
+
+    XSYNC_ATOMIC_SET(&pDecoder->nStop, XFALSE);
+    return XSTDOK;
+}
+
+XSTATUS XDecoder_SetupPacketPool(xdecoder_t *pDecoder, size_t nPackets)
+{
+    XASSERT(pDecoder, XSTDINV);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XSTATUS nStatus = XPktPool_Setup(&pDecoder->pktPool, nPackets);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to setup packet pool: packets(%zu)", nPackets));
+
+    return XSTDOK;
+}
+
 AVPacket* XDecoder_CreatePacket(xdecoder_t *pDecoder, uint8_t *pData, size_t nSize)
 {
     XASSERT(pDecoder, NULL);
@@ -240,16 +1695,35 @@ AVPacket* XDecoder_CreatePacket(xdecoder_t *pDecoder, uint8_t *pData, size_t nSi
     XASSERT(pData, XStat_ErrPtr(pStatus, "Invalid data argument"));
     XASSERT(nSize, XStat_ErrPtr(pStatus, "Invalid size argument"));
 
-    AVPacket *pPacket = av_packet_alloc();
+    AVPacket *pPacket = XPktPool_Copy(&pDecoder->pktPool, pData, nSize);
     XASSERT(pPacket, XStat_ErrPtr(pStatus, "Failed to allocate AVPacket"));
 
-    pPacket->data = pData;
-    pPacket->size = (int)nSize;
     pPacket->stream_index = 0;
+    return pPacket;
+}
 
+AVPacket* XDecoder_WrapPacket(xdecoder_t *pDecoder, uint8_t *pData, size_t nSize, xpkt_free_cb_t freeCb, void *pOpaque)
+{
+    XASSERT(pDecoder, NULL);
+    xstatus_t *pStatus = &pDecoder->status;
+
+    XASSERT(pData, XStat_ErrPtr(pStatus, "Invalid data argument"));
+    XASSERT(nSize, XStat_ErrPtr(pStatus, "Invalid size argument"));
+    XASSERT(freeCb, XStat_ErrPtr(pStatus, "Invalid free callback argument"));
+
+    AVPacket *pPacket = XPktPool_Wrap(&pDecoder->pktPool, pData, nSize, freeCb, pOpaque);
+    XASSERT(pPacket, XStat_ErrPtr(pStatus, "Failed to wrap AVPacket"));
+
+    pPacket->stream_index = 0;
     return pPacket;
 }
 
+void XDecoder_ReleasePacket(xdecoder_t *pDecoder, AVPacket *pPacket)
+{
+    XASSERT_VOID((pDecoder && pPacket));
+    XPktPool_Release(&pDecoder->pktPool, pPacket);
+}
+
 const xcodec_t* XDecoder_GetCodecInfo(xdecoder_t* pDecoder, int nStream)
 {
     XASSERT(pDecoder, NULL);
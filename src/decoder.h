@@ -18,42 +18,217 @@ extern "C" {
 #include "stdinc.h"
 #include "stream.h"
 #include "status.h"
+#include "pktqueue.h"
+#include "frmqueue.h"
+#include "pktpool.h"
+#include "kfindex.h"
+#include "inputio.h"
+#include <pthread.h>
 
 typedef int(*xdecoder_pkt_cb_t)(void *pUserCtx, AVFrame *pFrame, int nStreamIndex);
 typedef void(*xdecoder_stat_cb_t)(void *pUserCtx, const char *pStatus);
 typedef void(*xdecoder_err_cb_t)(void *pUserCtx, const char *pErrStr);
 
+/* Custom input IO, seek must also handle AVSEEK_SIZE */
+typedef int(*xdemuxer_cb_t)(void *pUserCtx, uint8_t *pData, int nSize);
+typedef int64_t(*xdemuxer_seek_cb_t)(void *pUserCtx, int64_t nOffset, int nWhence);
+
+#define XDECODER_IO_SIZE  (1024 * 64)
+
+typedef struct xdecoder_opts_ {
+    int                 nThreads;           /* 0: auto or budget share */
+    int                 nThreadType;        /* FF_THREAD_FRAME | FF_THREAD_SLICE */
+    int                 nFlags;             /* AV_CODEC_FLAG_* */
+    int                 nFlags2;            /* AV_CODEC_FLAG2_* */
+    enum AVDiscard      skipLoopFilter;
+    enum AVDiscard      skipIdct;
+    enum AVDiscard      skipFrame;          /* AVDISCARD_NONKEY: keyframes only */
+    int                 nLowres;            /* 1: 1/2, 2: 1/4, 3: 1/8 of the size */
+    AVRational          frameRate;          /* Delivered frame rate, 0: all frames */
+} xdecoder_opts_t;
+
+/* Runtime state of the per-stream decode options */
+typedef struct xdecoder_policy_ {
+    enum AVDiscard      skipFrame;
+    int64_t             nInterval;          /* Stream time base, 0: deliver all */
+    int64_t             nNextTS;            /* Earliest timestamp of the next frame */
+    uint64_t            nDropped;           /* Packets dropped before decoding */
+    uint64_t            nSkipped;           /* Decoded frames not delivered */
+} xdecoder_policy_t;
+
+/* Called for every stream before opening its decoder */
+typedef void(*xdecoder_opts_cb_t)(void *pUserCtx, xdecoder_opts_t *pOpts, const xcodec_t *pCodec, int nStreamIndex);
+
+typedef struct xdecoder_worker_ {
+    struct xdecoder_*   pDecoder;
+    xstream_t*          pStream;
+    xpkt_queue_t        queue;
+    xstatus_t           status;
+    pthread_t           thread;
+    xbool_t             bStarted;
+
+    /* Private copy of the seek target, usec */
+    int64_t             nSeekTime;
+    int                 nSeekStream;
+} xdecoder_worker_t;
+
 typedef struct xdecoder_ {
     /* Decoder/demuxer context */
     AVFormatContext*    pFmtCtx;
     AVDictionary*       pDemuxOpts;
     xarray_t            streams;
 
+    /* Custom input IO (user callbacks or push ring) */
+    xdemuxer_cb_t       demuxerCallback;
+    xdemuxer_seek_cb_t  seekCallback;
+    AVIOContext*        pIOCtx;
+    size_t              nIOBuffSize;
+    xinput_io_t         inputIO;
+    xinput_map_t        inputMap;
+    xbool_t             bMapInput;      /* mmap() local files instead of file protocol */
+
+    /* Input probing options */
+    int64_t             nProbeSize;         /* bytes, 0: default */
+    int64_t             nAnalyzeDuration;   /* usec, 0: default */
+    xcodec_t*           pKnownCodecs;       /* Indexed by source stream */
+    size_t              nKnownCount;
+
     /* User input context */
     xbool_t             bDemuxOnly;
     xdecoder_stat_cb_t  statusCallback;
     xdecoder_err_cb_t   errorCallback;
     xdecoder_pkt_cb_t   frameCallback;
+    xdecoder_opts_cb_t  optsCallback;
     void*               pUserCtx;
 
+    /* Decoder options */
+    xdecoder_opts_t     videoOpts;
+    xdecoder_opts_t     audioOpts;
+    AVDictionary*       pCodecOpts;
+    int                 nBudgetThreads;
+    int                 nBudgetStreams;
+    xdecoder_policy_t*  pPolicies;          /* Indexed by source stream */
+    size_t              nPolicies;
+
+    /* Keyframe index and exact seeking */
+    xkf_index_t         kfIndex;
+    pthread_mutex_t     indexLock;
+    pthread_t           indexThread;
+    xbool_t             bIndexThread;
+    xbool_t             bIndexComplete;
+    xbool_t             bIndexing;          /* Record keyframes while reading */
+    XATOMIC             nIndexStop;
+    int64_t             nSeekTime;          /* usec, drop frames before */
+    int                 nSeekStream;
+    char                sInput[XPATH_MAX];
+    char                sInputFmt[XSTR_TINY];
+
+    /* Threaded input (reader and per-stream decoders) */
+    xdecoder_worker_t*  pWorkers;
+    size_t              nWorkers;
+    size_t              nQueueDepth;
+    pthread_t           readerThread;
+    pthread_mutex_t     callbackLock;
+    pthread_mutex_t     threadLock;
+    pthread_cond_t      doneCond;
+    size_t              nActiveThreads;
+    xbool_t             bReaderStarted;
+    xbool_t             bThreaded;
+    XATOMIC             nStop;
+    int                 nReadStatus;
+    int                 nThreadStatus;      /* First reader/worker error */
+
+    /* Pull API (frames are moved to the caller instead of frameCallback) */
+    xfrm_queue_t        frameQueue;
+    size_t              nFrameDepth;
+    size_t              nRecvIndex;
+    xbool_t             bPullFrames;
+
+    /* Packets created from user data */
+    xpkt_pool_t         pktPool;
+
     /* Status related context */
     xbool_t             bHaveInput;
     xstatus_t           status;
 } xdecoder_t;
 
+void XDecoder_InitOpts(xdecoder_opts_t *pOpts, enum AVMediaType mediaType);
+
+/* Auto threaded video decoders get at most nThreads / nDecoders each */
+void XDecoder_SetThreadBudget(int nThreads, int nDecoders);
+
 void XDecoder_Init(xdecoder_t *pDecoder);
 void XDecoder_Destroy(xdecoder_t *pDecoder);
 
+XSTATUS XDecoder_LoadStreamInfo(xdecoder_t *pDecoder, const char *pPath);
+XSTATUS XDecoder_SaveStreamInfo(xdecoder_t *pDecoder, const char *pPath);
+void XDecoder_ClearStreamInfo(xdecoder_t *pDecoder);
+
+/*
+ * The producer thread of the input ring must be stopped before
+ * XDecoder_Destroy(): call XDecoder_AbortInput() to release it from
+ * a blocked push/reserve, join it, then destroy the decoder.
+ * Destroy waits for callers still inside the ring, but the ring
+ * must not be entered again once it has started.
+ */
+XSTATUS XDecoder_SetupInputRing(xdecoder_t *pDecoder, size_t nSize);
+XSTATUS XDecoder_PushInput(xdecoder_t *pDecoder, const uint8_t *pData, size_t nSize);
+uint8_t* XDecoder_ReserveInput(xdecoder_t *pDecoder, size_t *pSize);
+XSTATUS XDecoder_CommitInput(xdecoder_t *pDecoder, size_t nSize);
+void XDecoder_EndInput(xdecoder_t *pDecoder);
+void XDecoder_AbortInput(xdecoder_t *pDecoder);
+
 XSTATUS XDecoder_OpenInput(xdecoder_t *pDecoder, const char *pInput, const char *pInputFmt);
 XSTATUS XDecoder_OpenCodec(xdecoder_t *pDecoder, xcodec_t *pCodec);
 
 const xcodec_t* XDecoder_GetCodecInfo(xdecoder_t* pDecoder, int nStream);
 XSTATUS XDecoder_CopyCodecInfo(xdecoder_t* pDecoder, xcodec_t *pCodecInfo, int nStream);
 XSTATUS XDecoder_Seek(xdecoder_t *pDecoder, int nStream, int64_t nTS, int nFlags);
+const xdecoder_policy_t* XDecoder_GetPolicy(xdecoder_t *pDecoder, int nStream);
 
+/* Only video keyframes are indexed, seeks on other streams use the demuxer */
+XSTATUS XDecoder_BuildIndex(xdecoder_t *pDecoder, xbool_t bBackground);
+XSTATUS XDecoder_LoadIndex(xdecoder_t *pDecoder, const char *pPath);
+XSTATUS XDecoder_SaveIndex(xdecoder_t *pDecoder, const char *pPath);
+xbool_t XDecoder_HaveIndex(xdecoder_t *pDecoder);
+
+/*
+ * Created packets are refcounted and can be queued. CreatePacket copies the
+ * data to a pooled, padded buffer. WrapPacket takes over the caller buffer
+ * without a copy: it must have AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes
+ * after nSize, and freeCb (required) is called when the last reference is
+ * released. Packets come from the decoder pool, so every packet (and every
+ * queued reference) must be released before XDecoder_Destroy().
+ */
+XSTATUS XDecoder_SetupPacketPool(xdecoder_t *pDecoder, size_t nPackets);
 AVPacket* XDecoder_CreatePacket(xdecoder_t *pDecoder, uint8_t *pData, size_t nSize);
+AVPacket* XDecoder_WrapPacket(xdecoder_t *pDecoder, uint8_t *pData, size_t nSize, xpkt_free_cb_t freeCb, void *pOpaque);
+void XDecoder_ReleasePacket(xdecoder_t *pDecoder, AVPacket *pPacket);
 XSTATUS XDecoder_ReadPacket(xdecoder_t *pDecoder, AVPacket *pPacket);
 XSTATUS XDecoder_DecodePacket(xdecoder_t *pDecoder, AVPacket *pPacket);
+XSTATUS XDecoder_Drain(xdecoder_t *pDecoder);
+
+/*
+ * Pull API: send packets, then receive frames until AVERROR(EAGAIN).
+ * Received frames are refcounted and owned by the caller.
+ * After XDecoder_SendEOF() frames are received until AVERROR_EOF,
+ * then decoders are flushed and accept new packets again.
+ * With threads started without frameCallback only receive is used.
+ */
+int XDecoder_SendPacket(xdecoder_t *pDecoder, AVPacket *pPacket);
+int XDecoder_ReceiveFrame(xdecoder_t *pDecoder, AVFrame *pFrame, int *pStreamIndex);
+XSTATUS XDecoder_SendEOF(xdecoder_t *pDecoder);
+
+/*
+ * A frame callback error or input read failure stops all threads.
+ * XDecoder_WaitThreads() then returns that first error (negative)
+ * instead of XSTDOK, and XDecoder_ReceiveFrame() returns it instead
+ * of AVERROR_EOF.
+ */
+XSTATUS XDecoder_StartThreads(xdecoder_t *pDecoder);
+XSTATUS XDecoder_WaitThreads(xdecoder_t *pDecoder, int nTimeoutMs);
+XSTATUS XDecoder_StopThreads(xdecoder_t *pDecoder);
+XSTATUS XDecoder_GetQueueStats(xdecoder_t *pDecoder, int nStream, xpkt_queue_stats_t *pStats);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,309 @@
+/*!
+ *  @file libxmedia/src/dvr.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the in-memory pre-event ring
+ * buffer of encoded packets (DVR).
+ */
+
+#include "dvr.h"
+
+void XDVR_Init(xdvr_t *pDvr)
+{
+    XASSERT_VOID(pDvr);
+    pthread_mutex_init(&pDvr->lock, NULL);
+    memset(&pDvr->stats, 0, sizeof(xdvr_stats_t));
+
+    pDvr->pEntries = NULL;
+    pDvr->nCapacity = 0;
+    pDvr->nHead = 0;
+    pDvr->nCount = 0;
+    pDvr->nBytes = 0;
+    pDvr->nCutPoints = 0;
+
+    pDvr->pCodecs = NULL;
+    pDvr->pTimeBases = NULL;
+    pDvr->nStreams = 0;
+
+    pDvr->nMaxDuration = XDVR_MAX_DURATION;
+    pDvr->nMaxBytes = XDVR_MAX_BYTES;
+    pDvr->nRefStream = XSTDERR;
+}
+
+static void XDVR_DropHead(xdvr_t *pDvr)
+{
+    xdvr_entry_t *pEntry = &pDvr->pEntries[pDvr->nHead];
+    pDvr->nBytes -= (size_t)pEntry->pPacket->size;
+    if (pEntry->bCutPoint) pDvr->nCutPoints--;
+
+    av_packet_free(&pEntry->pPacket);
+    pDvr->nHead = (pDvr->nHead + 1) % pDvr->nCapacity;
+    pDvr->nCount--;
+    pDvr->stats.nEvicted++;
+}
+
+static void XDVR_DropGOP(xdvr_t *pDvr)
+{
+    /* Drop the oldest packet and everything up to the next cut point */
+    do XDVR_DropHead(pDvr);
+    while (pDvr->nCount && !pDvr->pEntries[pDvr->nHead].bCutPoint);
+}
+
+void XDVR_Clear(xdvr_t *pDvr)
+{
+    XASSERT_VOID(pDvr);
+    pthread_mutex_lock(&pDvr->lock);
+
+    while (pDvr->nCount) XDVR_DropHead(pDvr);
+    pDvr->nHead = 0;
+
+    pthread_mutex_unlock(&pDvr->lock);
+}
+
+static void XDVR_FreeCodecs(xcodec_t *pCodecs, AVRational *pTimeBases, size_t nStreams)
+{
+    size_t i;
+    for (i = 0; i < nStreams; i++)
+        XCodec_Clear(&pCodecs[i]);
+
+    free(pTimeBases);
+    free(pCodecs);
+}
+
+void XDVR_Destroy(xdvr_t *pDvr)
+{
+    XASSERT_VOID(pDvr);
+    XDVR_Clear(pDvr);
+
+    free(pDvr->pEntries);
+    pDvr->pEntries = NULL;
+    pDvr->nCapacity = 0;
+
+    XDVR_FreeCodecs(pDvr->pCodecs, pDvr->pTimeBases, pDvr->nStreams);
+    pDvr->pCodecs = NULL;
+    pDvr->pTimeBases = NULL;
+    pDvr->nStreams = 0;
+
+    pthread_mutex_destroy(&pDvr->lock);
+}
+
+XSTATUS XDVR_Setup(xdvr_t *pDvr, size_t nCapacity)
+{
+    XASSERT(pDvr, XSTDINV);
+    XASSERT((pDvr->pEntries == NULL), XSTDINV);
+    if (!nCapacity) nCapacity = XDVR_CAPACITY;
+
+    pDvr->pEntries = (xdvr_entry_t*)calloc(nCapacity, sizeof(xdvr_entry_t));
+    XASSERT(pDvr->pEntries, XSTDERR);
+
+    pDvr->nCapacity = nCapacity;
+    return XSTDOK;
+}
+
+static int64_t XDVR_GetSpan(xdvr_t *pDvr)
+{
+    XASSERT_RET(pDvr->nCount, 0);
+    size_t nTail = (pDvr->nHead + pDvr->nCount - 1) % pDvr->nCapacity;
+    return pDvr->pEntries[nTail].nTime - pDvr->pEntries[pDvr->nHead].nTime;
+}
+
+XSTATUS XDVR_Add(xdvr_t *pDvr, const AVPacket *pPacket, int64_t nTime, xbool_t bCutPoint)
+{
+    XASSERT((pDvr && pPacket), XSTDINV);
+    XASSERT(pDvr->pEntries, XSTDINV);
+
+    AVPacket *pClone = av_packet_clone(pPacket);
+    XASSERT(pClone, XSTDERR);
+
+    pthread_mutex_lock(&pDvr->lock);
+
+    /* Hard limits, make room even if that empties the ring */
+    while (pDvr->nCount && (pDvr->nCount >= pDvr->nCapacity ||
+          (pDvr->nMaxBytes && pDvr->nBytes + (size_t)pPacket->size > pDvr->nMaxBytes)))
+        XDVR_DropGOP(pDvr);
+
+    size_t nTail = (pDvr->nHead + pDvr->nCount) % pDvr->nCapacity;
+    xdvr_entry_t *pEntry = &pDvr->pEntries[nTail];
+
+    pEntry->pPacket = pClone;
+    pEntry->nTime = nTime;
+    pEntry->bCutPoint = bCutPoint;
+
+    pDvr->nBytes += (size_t)pPacket->size;
+    if (bCutPoint) pDvr->nCutPoints++;
+    pDvr->stats.nPackets++;
+    pDvr->nCount++;
+
+    /* Time limit, keep at least one complete GOP */
+    while (pDvr->nMaxDuration && pDvr->nCutPoints > 1 &&
+           XDVR_GetSpan(pDvr) > (int64_t)pDvr->nMaxDuration)
+    {
+        if (!pDvr->pEntries[pDvr->nHead].bCutPoint) XDVR_DropGOP(pDvr);
+        else
+        {
+            /* Only if the next GOP alone still covers the window */
+            size_t i, nNext = 0;
+            for (i = 1; i < pDvr->nCount; i++)
+            {
+                nNext = (pDvr->nHead + i) % pDvr->nCapacity;
+                if (pDvr->pEntries[nNext].bCutPoint) break;
+            }
+
+            size_t nLast = (pDvr->nHead + pDvr->nCount - 1) % pDvr->nCapacity;
+            int64_t nNextSpan = pDvr->pEntries[nLast].nTime - pDvr->pEntries[nNext].nTime;
+            if (nNextSpan < (int64_t)pDvr->nMaxDuration) break;
+
+            XDVR_DropGOP(pDvr);
+        }
+    }
+
+    pthread_mutex_unlock(&pDvr->lock);
+    return XSTDOK;
+}
+
+int64_t XDVR_GetDuration(xdvr_t *pDvr)
+{
+    XASSERT_RET(pDvr, 0);
+    pthread_mutex_lock(&pDvr->lock);
+    int64_t nDuration = XDVR_GetSpan(pDvr);
+    pthread_mutex_unlock(&pDvr->lock);
+    return nDuration;
+}
+
+static XSTATUS XDVR_CopyCodecs(xcodec_t **ppCodecs, AVRational **ppTimeBases,
+                               const xcodec_t *pCodecs, const AVRational *pTimeBases, size_t nStreams)
+{
+    *ppCodecs = (xcodec_t*)calloc(nStreams ? nStreams : 1, sizeof(xcodec_t));
+    *ppTimeBases = (AVRational*)calloc(nStreams ? nStreams : 1, sizeof(AVRational));
+
+    if (*ppCodecs == NULL || *ppTimeBases == NULL)
+    {
+        free(*ppTimeBases);
+        free(*ppCodecs);
+        *ppTimeBases = NULL;
+        *ppCodecs = NULL;
+        return XSTDERR;
+    }
+
+    size_t i;
+    for (i = 0; i < nStreams; i++)
+    {
+        XCodec_Init(&(*ppCodecs)[i]);
+        XCodec_Copy(&(*ppCodecs)[i], &pCodecs[i]);
+        (*ppTimeBases)[i] = pTimeBases[i];
+    }
+
+    return XSTDOK;
+}
+
+XSTATUS XDVR_SetStreams(xdvr_t *pDvr, AVFormatContext *pFmtCtx)
+{
+    XASSERT((pDvr && pFmtCtx), XSTDINV);
+    size_t i, nStreams = pFmtCtx->nb_streams;
+
+    xcodec_t *pCodecs = (xcodec_t*)calloc(nStreams ? nStreams : 1, sizeof(xcodec_t));
+    AVRational *pTimeBases = (AVRational*)calloc(nStreams ? nStreams : 1, sizeof(AVRational));
+
+    if (pCodecs == NULL || pTimeBases == NULL)
+    {
+        free(pTimeBases);
+        free(pCodecs);
+        return XSTDERR;
+    }
+
+    /* Time bases are final once the header is written */
+    for (i = 0; i < nStreams; i++)
+    {
+        XCodec_Init(&pCodecs[i]);
+        XCodec_GetFromAVStream(&pCodecs[i], pFmtCtx->streams[i]);
+        pTimeBases[i] = pFmtCtx->streams[i]->time_base;
+    }
+
+    pthread_mutex_lock(&pDvr->lock);
+    XDVR_FreeCodecs(pDvr->pCodecs, pDvr->pTimeBases, pDvr->nStreams);
+    pDvr->pCodecs = pCodecs;
+    pDvr->pTimeBases = pTimeBases;
+    pDvr->nStreams = nStreams;
+    pthread_mutex_unlock(&pDvr->lock);
+
+    return XSTDOK;
+}
+
+XSTATUS XDVR_Snapshot(xdvr_t *pDvr, xdvr_snapshot_t *pSnapshot)
+{
+    XASSERT((pDvr && pSnapshot), XSTDINV);
+    memset(pSnapshot, 0, sizeof(xdvr_snapshot_t));
+    pSnapshot->nStartTime = AV_NOPTS_VALUE;
+
+    pthread_mutex_lock(&pDvr->lock);
+    size_t i, nFirst = pDvr->nCount;
+
+    /* Output starts at the earliest keyframe in the ring */
+    for (i = 0; i < pDvr->nCount; i++)
+    {
+        if (pDvr->pEntries[(pDvr->nHead + i) % pDvr->nCapacity].bCutPoint)
+        {
+            nFirst = i;
+            break;
+        }
+    }
+
+    if (nFirst >= pDvr->nCount || !pDvr->nStreams)
+    {
+        pthread_mutex_unlock(&pDvr->lock);
+        return XSTDNON;
+    }
+
+    /* Parameters are taken with the packets they describe */
+    size_t nCount = pDvr->nCount - nFirst;
+    pSnapshot->pPackets = (AVPacket**)calloc(nCount, sizeof(AVPacket*));
+
+    if (pSnapshot->pPackets == NULL || XDVR_CopyCodecs(&pSnapshot->pCodecs,
+        &pSnapshot->pTimeBases, pDvr->pCodecs, pDvr->pTimeBases, pDvr->nStreams) <= 0)
+    {
+        pthread_mutex_unlock(&pDvr->lock);
+        XDVR_FreeSnapshot(pSnapshot);
+        return XSTDERR;
+    }
+
+    size_t nFirstPos = (pDvr->nHead + nFirst) % pDvr->nCapacity;
+    pSnapshot->nStartTime = pDvr->pEntries[nFirstPos].nTime;
+    pSnapshot->nStreams = pDvr->nStreams;
+
+    /* References only, payload buffers are shared with the ring */
+    for (i = 0; i < nCount; i++)
+    {
+        xdvr_entry_t *pEntry = &pDvr->pEntries[(nFirstPos + i) % pDvr->nCapacity];
+        pSnapshot->pPackets[i] = av_packet_clone(pEntry->pPacket);
+        if (pSnapshot->pPackets[i] == NULL) break;
+    }
+
+    pSnapshot->nCount = i;
+    pDvr->stats.nSnapshots++;
+
+    pthread_mutex_unlock(&pDvr->lock);
+    return XSTDOK;
+}
+
+void XDVR_FreeSnapshot(xdvr_snapshot_t *pSnapshot)
+{
+    XASSERT_VOID(pSnapshot);
+    size_t i;
+
+    if (pSnapshot->pPackets != NULL)
+    {
+        for (i = 0; i < pSnapshot->nCount; i++)
+            if (pSnapshot->pPackets[i] != NULL) av_packet_free(&pSnapshot->pPackets[i]);
+
+        free(pSnapshot->pPackets);
+        pSnapshot->pPackets = NULL;
+    }
+
+    XDVR_FreeCodecs(pSnapshot->pCodecs, pSnapshot->pTimeBases, pSnapshot->nStreams);
+    pSnapshot->pCodecs = NULL;
+    pSnapshot->pTimeBases = NULL;
+    pSnapshot->nStreams = 0;
+    pSnapshot->nCount = 0;
+}
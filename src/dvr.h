@@ -0,0 +1,89 @@
+/*!
+ *  @file libxmedia/src/dvr.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the in-memory pre-event ring
+ * buffer of encoded packets (DVR).
+ */
+
+#ifndef __XMEDIA_DVR_H__
+#define __XMEDIA_DVR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include "codec.h"
+#include <pthread.h>
+
+#define XDVR_MAX_DURATION       (30 * 1000 * 1000)  /* usec */
+#define XDVR_MAX_BYTES          (64 * 1024 * 1024)
+#define XDVR_CAPACITY           4096                /* packets */
+
+typedef struct xdvr_entry_ {
+    AVPacket*               pPacket;
+    int64_t                 nTime;          /* usec */
+    xbool_t                 bCutPoint;      /* Keyframe of the reference stream */
+} xdvr_entry_t;
+
+typedef struct xdvr_snapshot_ {
+    AVPacket**              pPackets;
+    size_t                  nCount;
+    int64_t                 nStartTime;     /* usec, first keyframe */
+    xcodec_t*               pCodecs;
+    AVRational*             pTimeBases;
+    size_t                  nStreams;
+} xdvr_snapshot_t;
+
+typedef struct xdvr_stats_ {
+    uint64_t                nPackets;
+    uint64_t                nEvicted;
+    uint64_t                nSnapshots;
+} xdvr_stats_t;
+
+/*
+ * Packets are kept by reference and evicted a whole GOP at a
+ * time, so the oldest packet in the ring is always a keyframe
+ * of the reference stream once the first one has arrived.
+ */
+typedef struct xdvr_ {
+    pthread_mutex_t         lock;
+    xdvr_entry_t*           pEntries;
+    size_t                  nCapacity;
+    size_t                  nHead;
+    size_t                  nCount;
+    size_t                  nBytes;
+    size_t                  nCutPoints;
+    xdvr_stats_t            stats;
+
+    /* Muxer parameters of the buffered streams */
+    xcodec_t*               pCodecs;
+    AVRational*             pTimeBases;
+    size_t                  nStreams;
+
+    /* User options */
+    uint64_t                nMaxDuration;   /* usec */
+    size_t                  nMaxBytes;
+    int                     nRefStream;
+} xdvr_t;
+
+void XDVR_Init(xdvr_t *pDvr);
+void XDVR_Destroy(xdvr_t *pDvr);
+void XDVR_Clear(xdvr_t *pDvr);
+
+XSTATUS XDVR_Setup(xdvr_t *pDvr, size_t nCapacity);
+XSTATUS XDVR_Add(xdvr_t *pDvr, const AVPacket *pPacket, int64_t nTime, xbool_t bCutPoint);
+int64_t XDVR_GetDuration(xdvr_t *pDvr);
+
+XSTATUS XDVR_SetStreams(xdvr_t *pDvr, AVFormatContext *pFmtCtx);
+XSTATUS XDVR_Snapshot(xdvr_t *pDvr, xdvr_snapshot_t *pSnapshot);
+void XDVR_FreeSnapshot(xdvr_snapshot_t *pSnapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_DVR_H__ */
@@ -33,13 +33,70 @@ void XEncoder_Init(xencoder_t *pEncoder)
     pEncoder->eTSType = XPTS_RESCALE;
     pEncoder->nTSFix = XSTDNON;
 
+    XInterleaver_Init(&pEncoder->interleaver);
+    pEncoder->nMaxInterleaveDelta = XINTERLEAVE_MAX_DELTA;
+    pEncoder->nInterleaveSize = XINTERLEAVE_QUEUE_SIZE;
+    pEncoder->bLowLatency = XFALSE;
+
+    XAsyncIO_Init(&pEncoder->asyncIO);
+    pEncoder->pressureCallback = NULL;
+    pEncoder->nAsyncDepth = XASYNCIO_DEPTH;
+    pEncoder->nAsyncFD = XSTDERR;
+    pEncoder->bAsyncIO = XFALSE;
+
+    XFileSink_Init(&pEncoder->fileSink);
+    pEncoder->bFileSink = XFALSE;
+    pEncoder->bDirectIO = XFALSE;
+
+    XSegmenter_Init(&pEncoder->segmenter);
+    pEncoder->bSegment = XFALSE;
+
+    XBatcher_Init(&pEncoder->batcher);
+    pEncoder->batchCallback = NULL;
+    pEncoder->nBatchPackets = XBATCH_MAX_PACKETS;
+    pEncoder->nBatchBytes = XBATCH_MAX_BYTES;
+    pEncoder->nBatchWindow = XBATCH_MAX_WINDOW;
+    XLoadShed_Init(&pEncoder->loadShed);
+    XTSMux_Init(&pEncoder->tsMuxer);
+    pEncoder->bNativeTS = XFALSE;
+
+    XDVR_Init(&pEncoder->dvr);
+    pEncoder->nDVRCapacity = XDVR_CAPACITY;
+    pthread_mutex_init(&pEncoder->dvrLock, NULL);
+    pEncoder->bDVR = XFALSE;
+    pEncoder->bDVRThread = XFALSE;
+    pEncoder->nDVRBusy = 0;
+
+    XGOPCache_Init(&pEncoder->gopCache);
+    pEncoder->bGOPCache = XFALSE;
+
     pEncoder->bOutputOpen = XFALSE;
     pEncoder->bMuxOnly = XFALSE;
+    pEncoder->nCodecThreads = XSTDNON;
 }
 
 void XEncoder_Destroy(xencoder_t *pEncoder)
 {
     XASSERT_VOID(pEncoder);
+    XInterleaver_Destroy(&pEncoder->interleaver);
+    XAsyncIO_Destroy(&pEncoder->asyncIO);
+    XFileSink_Close(&pEncoder->fileSink);
+    XSegmenter_Destroy(&pEncoder->segmenter);
+    XBatcher_Destroy(&pEncoder->batcher);
+    XTSMux_Destroy(&pEncoder->tsMuxer);
+
+    pthread_mutex_lock(&pEncoder->dvrLock);
+    if (pEncoder->bDVRThread)
+    {
+        /* Save job owns its snapshot, just wait for it */
+        pthread_join(pEncoder->dvrThread, NULL);
+        pEncoder->bDVRThread = XFALSE;
+    }
+
+    pthread_mutex_unlock(&pEncoder->dvrLock);
+    pthread_mutex_destroy(&pEncoder->dvrLock);
+    XDVR_Destroy(&pEncoder->dvr);
+    XGOPCache_Destroy(&pEncoder->gopCache);
     XStreams_Destroy(&pEncoder->streams);
     pEncoder->bOutputOpen = XFALSE;
 
@@ -136,12 +193,21 @@ XSTATUS XEncoder_RestartCodec(xencoder_t *pEncoder, int nStreamIndex)
     if (pEncoder->pFmtCtx->oformat->flags & AVFMT_GLOBALHEADER)
         pStream->pCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
+    if (pEncoder->nCodecThreads > 0 && pStream->pCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        pStream->pCodecCtx->thread_count = pEncoder->nCodecThreads;
+
+    if (pEncoder->bLowLatency)
+        XEncoder_ApplyLowLatency(pEncoder, pStream->pCodecCtx);
+
     pStatus->nAVStatus = avcodec_open2(pStream->pCodecCtx, pAvCodec, NULL);
     XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Cannot open encoder: %d", pStream->nDstIndex));
 
     pStatus->nAVStatus = avcodec_parameters_from_context(pStream->pAvStream->codecpar, pStream->pCodecCtx);
     XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to copy codec parameters: %d", pStream->nDstIndex));
 
+    if (pEncoder->bDVR && pEncoder->dvr.nStreams && XDVR_SetStreams(&pEncoder->dvr, pEncoder->pFmtCtx) <= 0)
+        XStat_ErrCb(pStatus, "Failed to copy DVR stream parameters");
+
     XStat_InfoCb(pStatus, "Restarted codec: id(%d), type(%d), tb(%d.%d), ind(%d)",
         (int)pCodecInfo->codecId, (int)pCodecInfo->mediaType,
         pStream->pCodecCtx->time_base.num,
@@ -154,6 +220,196 @@ XSTATUS XEncoder_RestartCodec(xencoder_t *pEncoder, int nStreamIndex)
     return pStream->nDstIndex;
 }
 
+void XEncoder_InitReconf(xencoder_reconf_t *pReconf)
+{
+    XASSERT_VOID(pReconf);
+    pReconf->frameRate.num = XSTDNON;
+    pReconf->frameRate.den = XSTDNON;
+    pReconf->pPreset = NULL;
+    pReconf->nBitRate = XSTDNON;
+    pReconf->nWidth = XSTDNON;
+    pReconf->nHeight = XSTDNON;
+}
+
+static xbool_t XEncoder_HasLiveBitRate(AVCodecContext *pCodecCtx)
+{
+    XASSERT_RET((pCodecCtx->codec && pCodecCtx->codec->name), XFALSE);
+    const char *pName = pCodecCtx->codec->name;
+
+    /* Encoders that reconfigure rate control between frames */
+    return (!strcmp(pName, "libx264") || !strcmp(pName, "libx264rgb")) ? XTRUE : XFALSE;
+}
+
+static void XEncoder_ApplyBitRate(AVCodecContext *pCodecCtx, int64_t nBitRate)
+{
+    /* Keep the VBV constraints proportional if they were configured */
+    if (pCodecCtx->rc_max_rate > 0 && pCodecCtx->bit_rate > 0)
+        pCodecCtx->rc_max_rate = av_rescale(pCodecCtx->rc_max_rate, nBitRate, pCodecCtx->bit_rate);
+
+    if (pCodecCtx->rc_buffer_size > 0 && pCodecCtx->bit_rate > 0)
+        pCodecCtx->rc_buffer_size = (int)XSTD_MIN(av_rescale(pCodecCtx->rc_buffer_size, nBitRate, pCodecCtx->bit_rate), INT_MAX);
+
+    pCodecCtx->bit_rate = nBitRate;
+}
+
+static XSTATUS XEncoder_ReopenCodec(xencoder_t *pEncoder, xstream_t *pStream, const xencoder_reconf_t *pReconf)
+{
+    xstatus_t *pStatus = &pEncoder->status;
+    AVCodecContext *pOldCtx = pStream->pCodecCtx;
+    const AVCodec *pAvCodec = pOldCtx->codec;
+    int nDstIndex = pStream->nDstIndex;
+
+    AVCodecContext *pCodecCtx = avcodec_alloc_context3(pAvCodec);
+    XASSERT(pCodecCtx, XStat_ErrCb(pStatus, "Failed to allocate encoder context"));
+
+    /* Carry every generic and private option set on the running encoder */
+    if (av_opt_copy(pCodecCtx, pOldCtx) < 0 || (pCodecCtx->priv_data != NULL &&
+        pOldCtx->priv_data != NULL && av_opt_copy(pCodecCtx->priv_data, pOldCtx->priv_data) < 0))
+        XStat_DebugCb(pStatus, "Failed to copy encoder options: dst(%d)", nDstIndex);
+
+    xcodec_t codecInfo;
+    XCodec_Init(&codecInfo);
+    XCodec_Copy(&codecInfo, &pStream->codecInfo);
+
+    if (pReconf->nWidth > 0) codecInfo.nWidth = pReconf->nWidth;
+    if (pReconf->nHeight > 0) codecInfo.nHeight = pReconf->nHeight;
+    if (pReconf->frameRate.num > 0 && pReconf->frameRate.den > 0) codecInfo.frameRate = pReconf->frameRate;
+
+    /* Time base stays the same to keep the stream timestamps continuous */
+    XSTATUS nStatus = XCodec_ApplyToAVCodec(&codecInfo, pCodecCtx);
+    XCodec_Clear(&codecInfo);
+    XASSERT_CALL((nStatus == XSTDOK), avcodec_free_context, &pCodecCtx,
+        XStat_ErrCb(pStatus, "Failed to apply codec to context: dst(%d)", nDstIndex));
+
+    pCodecCtx->flags = pOldCtx->flags;
+    pCodecCtx->gop_size = pOldCtx->gop_size;
+    pCodecCtx->max_b_frames = pOldCtx->max_b_frames;
+    pCodecCtx->thread_count = pOldCtx->thread_count;
+    pCodecCtx->thread_type = pOldCtx->thread_type;
+    pCodecCtx->rc_max_rate = pOldCtx->rc_max_rate;
+    pCodecCtx->rc_buffer_size = pOldCtx->rc_buffer_size;
+    pCodecCtx->bit_rate = pOldCtx->bit_rate;
+
+    if (pReconf->nBitRate > 0) XEncoder_ApplyBitRate(pCodecCtx, pReconf->nBitRate);
+    if (pEncoder->bLowLatency) XEncoder_ApplyLowLatency(pEncoder, pCodecCtx);
+
+    /* Copied preset is replaced only when a new one is requested */
+    if (xstrused(pReconf->pPreset) && pCodecCtx->priv_data != NULL)
+        av_opt_set(pCodecCtx->priv_data, "preset", pReconf->pPreset, 0);
+
+    /* Open the new encoder first, the old one is untouched if it fails */
+    pStatus->nAVStatus = avcodec_open2(pCodecCtx, pAvCodec, NULL);
+    XASSERT_CALL((pStatus->nAVStatus >= 0), avcodec_free_context, &pCodecCtx,
+        XStat_ErrCb(pStatus, "Cannot open reconfigured encoder: dst(%d)", nDstIndex));
+
+    /* Drain delayed packets of the old encoder into the muxer */
+    if (XEncoder_WriteFrame(pEncoder, NULL, nDstIndex) <= 0)
+    {
+        /* Drained encoder accepts no more frames, the stream is dead */
+        avcodec_free_context(&pCodecCtx);
+        pStream->bCodecOpen = XFALSE;
+        return XStat_ErrCb(pStatus, "Failed to drain encoder, stream is closed: dst(%d)", nDstIndex);
+    }
+
+    avcodec_free_context(&pStream->pCodecCtx);
+    pStream->pCodecCtx = pCodecCtx;
+    XCodec_GetFromAVCodec(&pStream->codecInfo, pCodecCtx);
+
+    /* First packet of the new encoder is IDR, announce its parameter sets */
+    if (pCodecCtx->extradata != NULL && pCodecCtx->extradata_size > 0)
+        pStream->bNewExtra = XTRUE;
+
+    /* New parameter sets start a new segment after a discontinuity tag */
+    if (pEncoder->bSegment && pEncoder->segmenter.nRefStream == nDstIndex)
+        XSegmenter_ForceCut(&pEncoder->segmenter, XTRUE);
+
+    XStat_InfoCb(pStatus, "Reopened encoder: dst(%d), size(%dx%d), fps(%d:%d), bitrate(%lld)",
+        nDstIndex, pCodecCtx->width, pCodecCtx->height, pCodecCtx->framerate.num,
+        pCodecCtx->framerate.den, (long long)pCodecCtx->bit_rate);
+
+    return XSTDOK;
+}
+
+XSTATUS XEncoder_Reconfigure(xencoder_t *pEncoder, int nStreamIndex, const xencoder_reconf_t *pReconf)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pReconf, XStat_ErrCb(pStatus, "Invalid reconfiguration argument"));
+
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
+    XASSERT((pStream->pCodecCtx && pStream->bCodecOpen),
+        XStat_ErrCb(pStatus, "Codec is not open: dst(%d)", nStreamIndex));
+
+    AVCodecContext *pCodecCtx = pStream->pCodecCtx;
+    xbool_t bBitRate = (pReconf->nBitRate > 0 && pReconf->nBitRate != pCodecCtx->bit_rate);
+    xbool_t bReopen = xstrused(pReconf->pPreset);
+
+    if (pCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+        if ((pReconf->nWidth > 0 && pReconf->nWidth != pCodecCtx->width) ||
+            (pReconf->nHeight > 0 && pReconf->nHeight != pCodecCtx->height)) bReopen = XTRUE;
+
+        if (pReconf->frameRate.num > 0 && pReconf->frameRate.den > 0 &&
+            av_cmp_q(pReconf->frameRate, pCodecCtx->framerate)) bReopen = XTRUE;
+    }
+
+    if (!bReopen && bBitRate && XEncoder_HasLiveBitRate(pCodecCtx))
+    {
+        /* Picked up by the encoder on the next frame */
+        XEncoder_ApplyBitRate(pCodecCtx, pReconf->nBitRate);
+        pStream->codecInfo.nBitRate = pReconf->nBitRate;
+        pStream->pAvStream->codecpar->bit_rate = pReconf->nBitRate;
+
+        XStat_InfoCb(pStatus, "Updated encoder bitrate: dst(%d), bitrate(%lld)",
+            nStreamIndex, (long long)pReconf->nBitRate);
+
+        return XSTDOK;
+    }
+
+    XASSERT_RET((bReopen || bBitRate), XSTDNON);
+
+    /* The single init section can not carry the parameter sets of a new encoder */
+    XASSERT((!pEncoder->bSegment || pEncoder->segmenter.eType != XSEGMENT_FMP4 ||
+        pCodecCtx->codec_type != AVMEDIA_TYPE_VIDEO), XStat_ErrCb(pStatus,
+        "Video reopen is not supported with fMP4 segments: dst(%d)", nStreamIndex));
+
+    return XEncoder_ReopenCodec(pEncoder, pStream, pReconf);
+}
+
+XSTATUS XEncoder_SetBitRate(xencoder_t *pEncoder, int nStreamIndex, int64_t nBitRate)
+{
+    xencoder_reconf_t reconf;
+    XEncoder_InitReconf(&reconf);
+    reconf.nBitRate = nBitRate;
+    return XEncoder_Reconfigure(pEncoder, nStreamIndex, &reconf);
+}
+
+XSTATUS XEncoder_ApplyLowLatency(xencoder_t *pEncoder, AVCodecContext *pCodecCtx)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pCodecCtx, XStat_ErrCb(pStatus, "Invalid codec context argument"));
+
+    /* Disable encoder side frame reordering and lookahead */
+    pCodecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    pCodecCtx->thread_type = FF_THREAD_SLICE;
+    pCodecCtx->max_b_frames = 0;
+
+    /* Private options are ignored by the encoders that do not support them */
+    if (pCodecCtx->priv_data != NULL)
+    {
+        av_opt_set(pCodecCtx->priv_data, "tune", "zerolatency", 0);
+        av_opt_set(pCodecCtx->priv_data, "deadline", "realtime", 0);
+        av_opt_set(pCodecCtx->priv_data, "lag-in-frames", "0", 0);
+        av_opt_set(pCodecCtx->priv_data, "zerolatency", "1", 0);
+        av_opt_set(pCodecCtx->priv_data, "delay", "0", 0);
+    }
+
+    XStat_DebugCb(pStatus, "Applied low latency encoder defaults: codec(%d)", (int)pCodecCtx->codec_id);
+    return XSTDOK;
+}
+
 XSTATUS XEncoder_OpenStream(xencoder_t *pEncoder, xcodec_t *pCodecInfo)
 {
     XASSERT(pEncoder, XSTDINV);
@@ -199,6 +455,12 @@ XSTATUS XEncoder_OpenStream(xencoder_t *pEncoder, xcodec_t *pCodecInfo)
     if (pEncoder->pFmtCtx->oformat->flags & AVFMT_GLOBALHEADER)
         pStream->pCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
+    if (pEncoder->nCodecThreads > 0 && pStream->pCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        pStream->pCodecCtx->thread_count = pEncoder->nCodecThreads;
+
+    if (pEncoder->bLowLatency)
+        XEncoder_ApplyLowLatency(pEncoder, pStream->pCodecCtx);
+
     pStatus->nAVStatus = avcodec_open2(pStream->pCodecCtx, pAvCodec, NULL);
     XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Cannot open encoder: dst(%d)", nDstIndex));
 
@@ -215,220 +477,1494 @@ XSTATUS XEncoder_OpenStream(xencoder_t *pEncoder, xcodec_t *pCodecInfo)
     return pStream->nDstIndex;
 }
 
-const xcodec_t* XEncoder_GetCodecInfo(xencoder_t* pEncoder, int nStreamIndex)
+const xcodec_t* XEncoder_GetCodecInfo(xencoder_t* pEncoder, int nStreamIndex)
+{
+    XASSERT(pEncoder, NULL);
+    xstatus_t *pStatus = &pEncoder->status;
+
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+    if (pStream == NULL)
+    {
+        XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex);
+        return NULL;
+    }
+
+    return XStream_GetCodecInfo(pStream);
+}
+
+XSTATUS XEncoder_CopyCodecInfo(xencoder_t* pEncoder, xcodec_t *pCodecInfo, int nStreamIndex)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pCodecInfo, XStat_ErrCb(pStatus, "Invalid codec info argument"));
+
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
+    return XStream_CopyCodecInfo(pStream, pCodecInfo);
+}
+
+static int XEncoder_MuxerSink(void *pCtx, const uint8_t *pData, int nSize)
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return pEncoder->muxerCallback(pEncoder->pUserCtx, (uint8_t*)pData, nSize);
+}
+
+#if XMEDIA_AVFORMAT_AT_LEAST(60, 31) && !defined FF_API_AVIO_WRITE_NONCONST
+static int XEncoder_CacheWrite(void *pCtx, const uint8_t *pData, int nSize)
+#else
+static int XEncoder_CacheWrite(void *pCtx, uint8_t *pData, int nSize)
+#endif
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return XGOPCache_Write(&pEncoder->gopCache, pData, nSize, XEncoder_MuxerSink, pEncoder);
+}
+
+static xbool_t XEncoder_HasGOPData(xencoder_t *pEncoder)
+{
+    /* Bytes must reach the callback in muxing order */
+    return (pEncoder->bGOPCache && pEncoder->muxerCallback != NULL &&
+            !pEncoder->bAsyncIO && !pEncoder->bSegment) ? XTRUE : XFALSE;
+}
+
+static int XEncoder_TSMuxWrite(void *pCtx, const uint8_t *pData, int nSize)
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    AVIOContext *pIOCtx = pEncoder->pFmtCtx->pb;
+
+    /* Cells are already packed, skip the IO buffer copy */
+    if (pEncoder->muxerCallback != NULL && !pEncoder->bAsyncIO)
+    {
+        if (XEncoder_HasGOPData(pEncoder)) return XEncoder_CacheWrite(pEncoder, (uint8_t*)pData, nSize);
+        return pEncoder->muxerCallback(pEncoder->pUserCtx, (uint8_t*)pData, nSize);
+    }
+
+    XASSERT(pIOCtx, AVERROR(EINVAL));
+    avio_write(pIOCtx, pData, nSize);
+    return pIOCtx->error < 0 ? pIOCtx->error : nSize;
+}
+
+static XSTATUS XEncoder_OpenTSMuxer(xencoder_t *pEncoder)
+{
+    AVFormatContext *pFmtCtx = pEncoder->pFmtCtx;
+    xts_muxer_t *pMuxer = &pEncoder->tsMuxer;
+    xstatus_t *pStatus = &pEncoder->status;
+    AVRational timeBase = (AVRational){1, 90000};
+    unsigned int i;
+
+    for (i = 0; i < pFmtCtx->nb_streams; i++)
+    {
+        /* Packets are rescaled to the stream time base by the encoder */
+        AVCodecParameters *pCodecPar = pFmtCtx->streams[i]->codecpar;
+        pFmtCtx->streams[i]->time_base = timeBase;
+
+        if (XTSMux_IsLengthPrefixed(pCodecPar->codec_id, pCodecPar->extradata, pCodecPar->extradata_size))
+        {
+            char sCodec[XSTR_TINY];
+            XCodec_GetNameByID(sCodec, sizeof(sCodec), pCodecPar->codec_id);
+            return XStat_ErrCb(pStatus, "Native TS requires Annex B input: dst(%u), codec(%s)", i, sCodec);
+        }
+
+        int nIndex = XTSMux_AddStream(pMuxer, pCodecPar->codec_id, pCodecPar->codec_type,
+                                    timeBase, pCodecPar->extradata, pCodecPar->extradata_size);
+
+        if (nIndex < 0)
+        {
+            char sCodec[XSTR_TINY];
+            XCodec_GetNameByID(sCodec, sizeof(sCodec), pCodecPar->codec_id);
+            return XStat_ErrCb(pStatus, "Unsupported native TS stream: dst(%u), codec(%s)", i, sCodec);
+        }
+    }
+
+    pMuxer->writeCallback = XEncoder_TSMuxWrite;
+    pMuxer->pUserCtx = pEncoder;
+
+    XSTATUS nStatus = XTSMux_Open(pMuxer, pEncoder->nIOBuffSize / XTS_PACKET_SIZE);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to open native TS muxer"));
+
+    XStat_InfoCb(pStatus, "Native TS muxer: streams(%d), cells(%zu), PCR(dst %d)",
+        pMuxer->nStreamCount, pMuxer->nCells, pMuxer->nPCRIndex);
+
+    return XSTDOK;
+}
+
+static void XEncoder_FlushTSMuxer(xencoder_t *pEncoder)
+{
+    xts_muxer_t *pMuxer = &pEncoder->tsMuxer;
+    xtsmux_stats_t *pStats = &pMuxer->stats;
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT_VOID_RET(pMuxer->pBuffer);
+
+    pStatus->nAVStatus = XTSMux_Flush(pMuxer);
+    if (pEncoder->pFmtCtx->pb != NULL) avio_flush(pEncoder->pFmtCtx->pb);
+
+    XStat_InfoCb(pStatus, "Native TS muxer finished: packets(%llu), cells(%llu), tables(%llu), PCRs(%llu), stuffing(%llu)",
+        (unsigned long long)pStats->nPackets, (unsigned long long)pStats->nCells, (unsigned long long)pStats->nTables,
+        (unsigned long long)pStats->nPCRs, (unsigned long long)pStats->nStuffing);
+}
+
+XSTATUS XEncoder_WriteHeader(xencoder_t *pEncoder, AVDictionary *pHeaderOpts)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XASSERT(pEncoder->pFmtCtx, XStat_ErrCb(pStatus, "Invalid format context"));
+    XASSERT(pEncoder->bOutputOpen, XStat_ErrCb(pStatus, "Output context is not open"));
+
+    if (pEncoder->bNativeTS)
+    {
+        XSTATUS nStatus = XEncoder_OpenTSMuxer(pEncoder);
+        if (nStatus <= 0) return nStatus;
+    }
+    else
+    {
+        pStatus->nAVStatus = avformat_write_header(pEncoder->pFmtCtx, &pHeaderOpts);
+        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to write header"));
+    }
+
+    /* DVR saves use the final muxer parameters */
+    if (pEncoder->bDVR && XDVR_SetStreams(&pEncoder->dvr, pEncoder->pFmtCtx) <= 0)
+        return XStat_ErrCb(pStatus, "Failed to copy DVR stream parameters");
+
+    return XSTDOK;
+}
+
+static int XEncoder_AsyncSink(void *pCtx, const uint8_t *pData, int nSize)
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return pEncoder->muxerCallback(pEncoder->pUserCtx, (uint8_t*)pData, nSize);
+}
+
+#if XMEDIA_AVFORMAT_AT_LEAST(60, 31) && !defined FF_API_AVIO_WRITE_NONCONST
+static int XEncoder_AsyncWrite(void *pCtx, const uint8_t *pData, int nSize)
+#else
+static int XEncoder_AsyncWrite(void *pCtx, uint8_t *pData, int nSize)
+#endif
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return XAsyncIO_Write(&pEncoder->asyncIO, pData, nSize);
+}
+
+static void XEncoder_AsyncPressure(void *pCtx, xbool_t bHigh, size_t nPending)
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XStat_InfoCb(pStatus, "Output back-pressure %s: pending(%zu), depth(%zu)",
+        bHigh ? "started" : "released", nPending, pEncoder->asyncIO.nDepth);
+
+    if (pEncoder->pressureCallback != NULL)
+        pEncoder->pressureCallback(pEncoder->pUserCtx, bHigh, nPending);
+}
+
+static XSTATUS XEncoder_StartAsyncIO(xencoder_t *pEncoder)
+{
+    xasync_io_t *pAsyncIO = &pEncoder->asyncIO;
+    xstatus_t *pStatus = &pEncoder->status;
+
+    pAsyncIO->pressureCallback = XEncoder_AsyncPressure;
+    pAsyncIO->pUserCtx = pEncoder;
+
+    /* Batch buffers with writev() if we have a descriptor */
+    if (pEncoder->nAsyncFD >= 0) pAsyncIO->nFD = pEncoder->nAsyncFD;
+    else pAsyncIO->writeCallback = XEncoder_AsyncSink;
+
+    XSTATUS nStatus = XAsyncIO_Start(pAsyncIO, pEncoder->nAsyncDepth, pEncoder->nIOBuffSize);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to start async writer: depth(%zu)", pEncoder->nAsyncDepth));
+
+    XStat_InfoCb(pStatus, "Started async writer: depth(%zu), buffer(%zu), sink(%s)",
+        pAsyncIO->nDepth, pAsyncIO->nBuffSize, pAsyncIO->nFD >= 0 ? "fd" : "callback");
+
+    return XSTDOK;
+}
+
+XSTATUS XEncoder_GetIOStats(xencoder_t *pEncoder, xasync_stats_t *pStats)
+{
+    XASSERT((pEncoder && pStats), XSTDINV);
+    XASSERT(pEncoder->bAsyncIO, XSTDNON);
+    return XAsyncIO_GetStats(&pEncoder->asyncIO, pStats);
+}
+
+XSTATUS XEncoder_GetStreamStats(xencoder_t *pEncoder, int nStreamIndex, xstream_stats_t *pStats)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pStats, XStat_ErrCb(pStatus, "Invalid stats argument"));
+
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
+
+    XStats_Copy(pStats, &pStream->stats);
+    return XSTDOK;
+}
+
+static xjson_obj_t* XEncoder_QueuesToJSON(xencoder_t *pEncoder)
+{
+    xjson_obj_t *pQueueObj = XJSON_NewObject(NULL, "queues", XFALSE);
+    XASSERT(pQueueObj, NULL);
+
+    /* Interleaver is owned by the encoding thread, value is approximate */
+    XJSON_AddObject(pQueueObj, XJSON_NewU64(NULL, "interleaver", pEncoder->interleaver.nUsed));
+
+    xasync_stats_t ioStats;
+    if (pEncoder->bAsyncIO && XAsyncIO_GetStats(&pEncoder->asyncIO, &ioStats) > 0)
+    {
+        xjson_obj_t *pAsyncObj = XJSON_NewObject(NULL, "asyncIO", XFALSE);
+        if (pAsyncObj != NULL)
+        {
+            XJSON_AddObject(pAsyncObj, XJSON_NewBool(NULL, "pressured", XAsyncIO_IsPressured(&pEncoder->asyncIO)));
+            XJSON_AddObject(pAsyncObj, XJSON_NewU64(NULL, "maxPending", ioStats.nMaxPending));
+            XJSON_AddObject(pAsyncObj, XJSON_NewU64(NULL, "bytesWritten", ioStats.nBytesWritten));
+            XJSON_AddObject(pAsyncObj, XJSON_NewU64(NULL, "stalls", ioStats.nStalls));
+            XJSON_AddObject(pAsyncObj, XJSON_NewU64(NULL, "stallTime", ioStats.nStallTime));
+            XJSON_AddObject(pAsyncObj, XJSON_NewU64(NULL, "maxWriteTime", ioStats.nMaxWriteTime));
+            XJSON_AddObject(pQueueObj, pAsyncObj);
+        }
+    }
+
+    return pQueueObj;
+}
+
+size_t XEncoder_DumpStatsJSON(xencoder_t *pEncoder, char *pOutput, size_t nSize, size_t nTabSize, xbool_t bPretty)
+{
+    XASSERT((pEncoder && pOutput && nSize), XSTDNON);
+    xjson_obj_t *pRootObj = XJSON_NewObject(NULL, NULL, XFALSE);
+    XASSERT(pRootObj, XSTDNON);
+
+    XJSON_AddObject(pRootObj, XJSON_NewString(NULL, "output", pEncoder->sOutputPath));
+    xjson_obj_t *pQueueObj = XEncoder_QueuesToJSON(pEncoder);
+    if (pQueueObj != NULL) XJSON_AddObject(pRootObj, pQueueObj);
+
+    xjson_obj_t *pStreamsObj = XJSON_NewArray(NULL, "streams", XFALSE);
+    if (pStreamsObj != NULL)
+    {
+        size_t i, nCount = XStreams_GetCount(&pEncoder->streams);
+        for (i = 0; i < nCount; i++)
+        {
+            xstream_t *pStream = XStreams_GetByIndex(&pEncoder->streams, i);
+            if (pStream == NULL) continue;
+
+            xjson_obj_t *pStreamObj = XJSON_NewObject(NULL, NULL, XFALSE);
+            if (pStreamObj == NULL) continue;
+
+            XJSON_AddObject(pStreamObj, XJSON_NewInt(NULL, "index", pStream->nDstIndex));
+            xjson_obj_t *pCodecObj = XCodec_ToJSON(&pStream->codecInfo, "codec");
+            if (pCodecObj != NULL) XJSON_AddObject(pStreamObj, pCodecObj);
+
+            xjson_obj_t *pStatsObj = XStats_ToJSON(&pStream->stats, "stats");
+            if (pStatsObj != NULL) XJSON_AddObject(pStreamObj, pStatsObj);
+
+            XJSON_AddObject(pStreamsObj, pStreamObj);
+        }
+
+        XJSON_AddObject(pRootObj, pStreamsObj);
+    }
+
+    xjson_writer_t writer;
+    XJSON_InitWriter(&writer, NULL, pOutput, nSize);
+
+    writer.nTabSize = nTabSize;
+    writer.nPretty = bPretty;
+
+    XJSON_WriteObject(pRootObj, &writer);
+    XJSON_DestroyWriter(&writer);
+    XJSON_FreeObject(pRootObj);
+
+    return writer.nLength;
+}
+
+#if XMEDIA_AVFORMAT_AT_LEAST(60, 31) && !defined FF_API_AVIO_WRITE_NONCONST
+static int XEncoder_FileWrite(void *pCtx, const uint8_t *pData, int nSize)
+#else
+static int XEncoder_FileWrite(void *pCtx, uint8_t *pData, int nSize)
+#endif
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return XFileSink_Write(&pEncoder->fileSink, pData, nSize);
+}
+
+static int64_t XEncoder_FileSeek(void *pCtx, int64_t nOffset, int nWhence)
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return XFileSink_Seek(&pEncoder->fileSink, nOffset, nWhence);
+}
+
+static XSTATUS XEncoder_OpenFileSink(xencoder_t *pEncoder)
+{
+    xfile_sink_t *pSink = &pEncoder->fileSink;
+    xstatus_t *pStatus = &pEncoder->status;
+
+    if (!pEncoder->nIOBuffSize) pEncoder->nIOBuffSize = XENCODER_IO_SIZE;
+    size_t nPacketSize = pEncoder->nIOBuffSize;
+
+    XSTATUS nStatus = XFileSink_Open(pSink, pEncoder->sOutputPath, pEncoder->bDirectIO, XFILESINK_BUFFER_SIZE);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to open output file: %s (%s)",
+        pEncoder->sOutputPath, strerror(errno)));
+
+    unsigned char *pBuffer = (unsigned char *)av_malloc(nPacketSize);
+    XASSERT_CALL(pBuffer, XFileSink_Close, pSink,
+        XStat_ErrCb(pStatus, "Failed to alloc output buffer: %s", strerror(errno)));
+
+    pEncoder->pIOCtx = avio_alloc_context(pBuffer, nPacketSize, 1,
+        pEncoder, NULL, XEncoder_FileWrite, XEncoder_FileSeek);
+
+    if (pEncoder->pIOCtx == NULL)
+    {
+        XFileSink_Close(pSink);
+        av_free(pBuffer);
+        return XStat_ErrCb(pStatus, "Failed to alloc output context");
+    }
+
+    /* Muxers can seek back and patch headers (moov, trailer) */
+    pEncoder->pIOCtx->seekable = AVIO_SEEKABLE_NORMAL;
+    pEncoder->pFmtCtx->pb = pEncoder->pIOCtx;
+    pEncoder->pIOBuffer = pBuffer;
+
+    XStat_InfoCb(pStatus, "Opened file sink: url(%s), direct(%s), align(%zu), window(%zu)",
+        pEncoder->sOutputPath, pSink->bDirect ? "true" : "false", pSink->nAlignment, pSink->nBuffSize);
+
+    return XSTDOK;
+}
+
+XSTATUS XEncoder_GetFileStats(xencoder_t *pEncoder, xfile_stats_t *pStats)
+{
+    XASSERT((pEncoder && pStats), XSTDINV);
+    XASSERT(pEncoder->bFileSink, XSTDNON);
+    *pStats = pEncoder->fileSink.stats;
+    return XSTDOK;
+}
+
+#if XMEDIA_AVFORMAT_AT_LEAST(60, 31) && !defined FF_API_AVIO_WRITE_NONCONST
+static int XEncoder_SegmentWrite(void *pCtx, const uint8_t *pData, int nSize)
+#else
+static int XEncoder_SegmentWrite(void *pCtx, uint8_t *pData, int nSize)
+#endif
+{
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return XSegmenter_Write(&pEncoder->segmenter, pData, nSize);
+}
+
+static XSTATUS XEncoder_OpenDVR(xencoder_t *pEncoder)
+{
+    AVFormatContext *pFmtCtx = pEncoder->pFmtCtx;
+    xstatus_t *pStatus = &pEncoder->status;
+    xdvr_t *pDvr = &pEncoder->dvr;
+
+    XSTATUS nStatus = XDVR_Setup(pDvr, pEncoder->nDVRCapacity);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to setup DVR buffer: %s", strerror(errno)));
+
+    /* GOPs start at keyframes of the first video stream */
+    if (pDvr->nRefStream < 0 || pDvr->nRefStream >= (int)pFmtCtx->nb_streams)
+    {
+        unsigned int i;
+        pDvr->nRefStream = 0;
+
+        for (i = 0; i < pFmtCtx->nb_streams; i++)
+        {
+            if (pFmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            {
+                pDvr->nRefStream = (int)i;
+                break;
+            }
+        }
+    }
+
+    XStat_InfoCb(pStatus, "DVR buffer: duration(%llu us), bytes(%zu), packets(%zu), ref(%d)",
+        (unsigned long long)pDvr->nMaxDuration, pDvr->nMaxBytes, pDvr->nCapacity, pDvr->nRefStream);
+
+    return XSTDOK;
+}
+
+static void XEncoder_SetupGOPCache(xencoder_t *pEncoder)
+{
+    AVFormatContext *pFmtCtx = pEncoder->pFmtCtx;
+    xgop_cache_t *pCache = &pEncoder->gopCache;
+    xstatus_t *pStatus = &pEncoder->status;
+
+    /* GOPs start at keyframes of the first video stream */
+    if (pCache->nRefStream < 0 || pCache->nRefStream >= (int)pFmtCtx->nb_streams)
+    {
+        unsigned int i;
+        pCache->nRefStream = 0;
+
+        for (i = 0; i < pFmtCtx->nb_streams; i++)
+        {
+            if (pFmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            {
+                pCache->nRefStream = (int)i;
+                break;
+            }
+        }
+    }
+
+    if (pEncoder->muxerCallback != NULL && !XEncoder_HasGOPData(pEncoder))
+        XStat_InfoCb(pStatus, "GOP cache is not available for async or segmented output, caching packets only");
+
+    XStat_InfoCb(pStatus, "GOP cache: ref(%d), max bytes(%zu), output(%s)", pCache->nRefStream,
+        pCache->nMaxBytes, XEncoder_HasGOPData(pEncoder) ? "bytes+packets" : "packets");
+}
+
+static XSTATUS XEncoder_OpenSegmenter(xencoder_t *pEncoder)
+{
+    xsegmenter_t *pSegmenter = &pEncoder->segmenter;
+    AVFormatContext *pFmtCtx = pEncoder->pFmtCtx;
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XASSERT(xstrused(pEncoder->sOutputPath), XStat_ErrCb(pStatus, "Segmented output requires playlist path"));
+    const char *pFmtName = pFmtCtx->oformat->name;
+    xsegment_type_t eType = XSEGMENT_TS;
+
+    if (strstr(pFmtName, "mp4") != NULL || strstr(pFmtName, "mov") != NULL)
+    {
+        /* Fragments are written only at segment boundaries */
+        av_opt_set(pFmtCtx->priv_data, "movflags", "frag_custom+empty_moov+default_base_moof+skip_trailer", 0);
+        eType = XSEGMENT_FMP4;
+    }
+
+    /* Cut segments at keyframes of the first video stream */
+    if (pSegmenter->nRefStream < 0 || pSegmenter->nRefStream >= (int)pFmtCtx->nb_streams)
+    {
+        unsigned int i;
+        pSegmenter->nRefStream = 0;
+
+        for (i = 0; i < pFmtCtx->nb_streams; i++)
+        {
+            if (pFmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            {
+                pSegmenter->nRefStream = (int)i;
+                break;
+            }
+        }
+    }
+
+    if (!pEncoder->nIOBuffSize) pEncoder->nIOBuffSize = XENCODER_IO_SIZE;
+    size_t nPacketSize = pEncoder->nIOBuffSize;
+
+    XSTATUS nStatus = XSegmenter_Open(pSegmenter, pEncoder->sOutputPath, eType);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to open segment output: %s (%s)",
+        pEncoder->sOutputPath, strerror(errno)));
+
+    unsigned char *pBuffer = (unsigned char *)av_malloc(nPacketSize);
+    XASSERT_CALL(pBuffer, XSegmenter_Destroy, pSegmenter,
+        XStat_ErrCb(pStatus, "Failed to alloc output buffer: %s", strerror(errno)));
+
+    pEncoder->pIOCtx = avio_alloc_context(pBuffer, nPacketSize, 1,
+        pEncoder, NULL, XEncoder_SegmentWrite, NULL);
+
+    if (pEncoder->pIOCtx == NULL)
+    {
+        XSegmenter_Destroy(pSegmenter);
+        av_free(pBuffer);
+        return XStat_ErrCb(pStatus, "Failed to alloc output context");
+    }
+
+    pFmtCtx->pb = pEncoder->pIOCtx;
+    pEncoder->pIOBuffer = pBuffer;
+
+    XStat_InfoCb(pStatus, "Segmented output: playlist(%s), type(%s), duration(%llu us), list(%zu), max bytes(%zu)",
+        pEncoder->sOutputPath, eType == XSEGMENT_FMP4 ? "fmp4" : "ts",
+        (unsigned long long)pSegmenter->nTargetDuration, pSegmenter->nListSize, pSegmenter->nMaxBytes);
+
+    return XSTDOK;
+}
+
+XSTATUS XEncoder_OpenOutput(xencoder_t *pEncoder, AVDictionary *pOpts)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XASSERT(pEncoder->pFmtCtx, XStat_ErrCb(pStatus, "Invalid format context"));
+    xbool_t bAvFormatNoFile = (pEncoder->pFmtCtx->oformat->flags & AVFMT_NOFILE);
+    xbool_t bAsyncFD = pEncoder->bAsyncIO && pEncoder->nAsyncFD >= 0;
+
+    XASSERT((pEncoder->muxerCallback != NULL || bAsyncFD || xstrused(pEncoder->sOutputPath)),
+        XStat_ErrCb(pStatus, "Required muxer callback or output file to open the muxer"));
+
+    if (pEncoder->bNativeTS && (pEncoder->bSegment || strcmp(pEncoder->pFmtCtx->oformat->name, "mpegts")))
+    {
+        XStat_InfoCb(pStatus, "Native TS muxer requires non-segmented mpegts output, using libavformat");
+        pEncoder->bNativeTS = XFALSE;
+    }
+
+    if (pEncoder->bSegment)
+    {
+        XSTATUS nStatus = XEncoder_OpenSegmenter(pEncoder);
+        if (nStatus <= 0) return nStatus;
+    }
+    else if (pEncoder->muxerCallback || bAsyncFD)
+    {
+        if (!pEncoder->nIOBuffSize) pEncoder->nIOBuffSize = XENCODER_IO_SIZE;
+        size_t nPacketSize = pEncoder->nIOBuffSize;
+
+        xmuxer_cb_t muxerCallback = pEncoder->muxerCallback;
+        void *pMuxerCtx = pEncoder->pUserCtx;
+
+        unsigned char *pBuffer = (unsigned char *)av_malloc(nPacketSize);
+        XASSERT(pBuffer, XStat_ErrCb(pStatus, "Failed to alloc output buffer: %s", strerror(errno)));
+
+        if (pEncoder->bAsyncIO)
+        {
+            /* Muxer writes to the ring and never waits on the sink */
+            XASSERT_CALL((XEncoder_StartAsyncIO(pEncoder) > 0), av_free, pBuffer, XSTDERR);
+            muxerCallback = XEncoder_AsyncWrite;
+            pMuxerCtx = pEncoder;
+        }
+        else if (XEncoder_HasGOPData(pEncoder))
+        {
+            /* Keep the header and current GOP for late joiners */
+            muxerCallback = XEncoder_CacheWrite;
+            pMuxerCtx = pEncoder;
+        }
+
+        pEncoder->pIOCtx = avio_alloc_context(pBuffer, nPacketSize, 1,
+            pMuxerCtx, NULL, muxerCallback, NULL);
+
+        XASSERT_CALL(pEncoder->pIOCtx, av_free, pBuffer,
+            XStat_ErrCb(pStatus, "Failed to alloc output context"));
+
+        pEncoder->pFmtCtx->packet_size = nPacketSize;
+        pEncoder->pFmtCtx->pb = pEncoder->pIOCtx;
+        pEncoder->pIOBuffer = pBuffer;
+
+        /* Bypass IO buffering and pass every write to the callback */
+        if (pEncoder->bLowLatency) pEncoder->pIOCtx->direct = 1;
+
+        XStat_InfoCb(pStatus, "Created output context: buffer(%zu)", nPacketSize);
+    }
+    else if (pEncoder->bFileSink && !bAvFormatNoFile)
+    {
+        XSTATUS nStatus = XEncoder_OpenFileSink(pEncoder);
+        if (nStatus <= 0) return nStatus;
+    }
+    else if (xstrused(pEncoder->sOutputPath))
+    {
+        if (!bAvFormatNoFile)
+        {
+            int nFlags = AVIO_FLAG_WRITE;
+            if (pEncoder->bLowLatency) nFlags |= AVIO_FLAG_DIRECT;
+
+            pStatus->nAVStatus = avio_open(&pEncoder->pFmtCtx->pb, pEncoder->sOutputPath, nFlags);
+            XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to open output context"));
+        }
+
+        XStat_InfoCb(pStatus, "Output context: url(%s), AVFMT_NOFILE(%s)",
+            pEncoder->sOutputPath, bAvFormatNoFile ? "true" : "false");
+    }
+
+    if (pEncoder->bLowLatency)
+    {
+        int nStreams = (int)pEncoder->pFmtCtx->nb_streams;
+        int64_t nMaxDelta = pEncoder->nMaxInterleaveDelta;
+        size_t nQueueSize = pEncoder->nInterleaveSize;
+
+        XSTATUS nStatus = XInterleaver_Setup(&pEncoder->interleaver, nStreams, nQueueSize, nMaxDelta);
+        XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to setup interleaver: streams(%d)", nStreams));
+
+        /* Flush IO context after each packet */
+        pEncoder->pFmtCtx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+        pEncoder->pFmtCtx->max_interleave_delta = nMaxDelta;
+        pEncoder->pFmtCtx->flush_packets = 1;
+
+        XStat_InfoCb(pStatus, "Low latency output: queue(%zu), delta(%lld)",
+            nQueueSize, (long long)nMaxDelta);
+    }
+
+    if (pEncoder->bDVR)
+    {
+        XSTATUS nStatus = XEncoder_OpenDVR(pEncoder);
+        if (nStatus <= 0) return nStatus;
+    }
+
+    if (pEncoder->bGOPCache) XEncoder_SetupGOPCache(pEncoder);
+    pEncoder->bOutputOpen = XTRUE;
+
+    XSTATUS nStatus = XEncoder_WriteHeader(pEncoder, pOpts);
+    if (nStatus > 0 && XEncoder_HasGOPData(pEncoder))
+    {
+        /* Everything written so far is the container header */
+        avio_flush(pEncoder->pFmtCtx->pb);
+        XGOPCache_EndHeader(&pEncoder->gopCache);
+    }
+
+    if (nStatus <= 0 || !pEncoder->bSegment) return nStatus;
+
+    /* Header is complete (fMP4 init section), start media segments */
+    avio_flush(pEncoder->pFmtCtx->pb);
+    nStatus = XSegmenter_Begin(&pEncoder->segmenter);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to open first segment: %s", strerror(errno)));
+
+    return XSTDOK;
+}
+
+static void XEncoder_LogTSEvents(xencoder_t *pEncoder, xstream_t *pStream)
+{
+    xts_norm_t *pNorm = &pStream->tsNorm;
+    xts_metrics_t *pMetrics = &pNorm->metrics;
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT_VOID_RET(pNorm->nEvents);
+
+    if (pNorm->nEvents & XTSNORM_EV_WRAP)
+        XStat_InfoCb(pStatus, "Timestamp wrap: dst(%d), wraps(%llu)",
+            pStream->nDstIndex, (unsigned long long)pMetrics->nWraps);
+
+    if (pNorm->nEvents & XTSNORM_EV_DISCONT)
+        XStat_InfoCb(pStatus, "Timestamp discontinuity: dst(%d), rebase(%lld)",
+            pStream->nDstIndex, (long long)pNorm->nRebase);
+
+    if (pNorm->nEvents & XTSNORM_EV_RESYNC)
+        XStat_DebugCb(pStatus, "Timestamp resync: dst(%d), resyncs(%llu)",
+            pStream->nDstIndex, (unsigned long long)pMetrics->nResyncs);
+
+    if (pNorm->nEvents & XTSNORM_EV_REORDER)
+        XStat_DebugCb(pStatus, "Non monotonic timestamp: dst(%d), output(%lld)",
+            pStream->nDstIndex, (long long)pNorm->nLastOutput);
+}
+
+static void XEncoder_NormalizePacket(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+{
+    xts_norm_t *pNorm = &pStream->tsNorm;
+    xbool_t bAudio = pStream->codecInfo.mediaType == AVMEDIA_TYPE_AUDIO;
+
+    if (!pNorm->bSetup)
+    {
+        AVRational timeBase = pStream->pAvStream->time_base;
+        XTSNorm_Setup(pNorm, timeBase, pPacket->duration, bAudio);
+    }
+
+    /* DTS is monotonic in decode order, PTS keeps its offset */
+    int64_t nTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+    XASSERT_VOID_RET((nTS != AV_NOPTS_VALUE));
+
+    int64_t nOutput = XTSNorm_Apply(pNorm, nTS, bAudio ? pPacket->duration : 0);
+    int64_t nShift = nOutput - nTS;
+
+    if (pPacket->dts != AV_NOPTS_VALUE) pPacket->dts += nShift;
+    if (pPacket->pts != AV_NOPTS_VALUE) pPacket->pts += nShift;
+    XEncoder_LogTSEvents(pEncoder, pStream);
+}
+
+XSTATUS XEncoder_RescaleTS(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+{
+    XASSERT_RET(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+
+    if (pStream == NULL)
+    {
+        pStream = XStreams_GetByDstIndex(&pEncoder->streams, pPacket->stream_index);
+        XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", pPacket->stream_index));
+    }
+
+    if (pEncoder->eTSType == XPTS_RESCALE)
+    {
+        /* Rescale packet timestamps and reset position */
+        AVRational srcTimeBase = pStream->codecInfo.timeBase;
+        AVRational dstTimeBase = pStream->pAvStream->time_base;
+
+        av_packet_rescale_ts(pPacket, srcTimeBase, dstTimeBase);
+        pPacket->pos = XSTDERR; /* Let FFMPEG decide position */
+    }
+    else if (pEncoder->eTSType == XPTS_NORMALIZE)
+    {
+        /* Encoded packets already carry normalized frame timestamps */
+        AVRational srcTimeBase = pStream->codecInfo.timeBase;
+        AVRational dstTimeBase = pStream->pAvStream->time_base;
+
+        av_packet_rescale_ts(pPacket, srcTimeBase, dstTimeBase);
+        pPacket->pos = XSTDERR;
+
+        if (!pStream->bCodecOpen)
+            XEncoder_NormalizePacket(pEncoder, pPacket, pStream);
+    }
+    else if (pEncoder->eTSType == XPTS_ROUND)
+    {
+        /* Rescale and round PTS/DTS to the nearest value */
+        AVRational srcTimeBase =  pStream->codecInfo.timeBase;
+        AVRational dstTimeBase = pStream->pAvStream->time_base;
+        enum AVRounding avRound = (enum AVRounding)(AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
+
+        pPacket->pts = av_rescale_q_rnd(pPacket->pts, srcTimeBase, dstTimeBase, avRound);
+        pPacket->dts = av_rescale_q_rnd(pPacket->dts, srcTimeBase, dstTimeBase, avRound);
+    }
+    else if (pEncoder->eTSType == XPTS_CALCULATE)
+    {
+        /* Calculate PTS based on the elapsed time and clock rate */
+        if (!pEncoder->nStartTime) pEncoder->nStartTime = XTime_GetStamp();
+        AVRational dstTimeBase = pStream->pAvStream->time_base;
+
+        uint64_t nCurrentTime = XTime_GetStamp();
+        uint64_t nElapsedTime = nCurrentTime - pEncoder->nStartTime;
+        uint64_t nPTS = (nElapsedTime * dstTimeBase.den) / 1000000;
+
+        pPacket->pts = nPTS;
+        pPacket->dts = nPTS;
+    }
+    else if (pEncoder->eTSType == XPTS_COMPUTE)
+    {
+        if (pStream->codecInfo.mediaType == AVMEDIA_TYPE_VIDEO)
+        {
+            /* Calculate the PTS and DTS based on the frame count and time base */
+            AVRational srcTimeBase = av_inv_q(pStream->codecInfo.frameRate);
+            AVRational dstTimeBase = pStream->pAvStream->time_base;
+
+            pPacket->duration = av_rescale_q(1, srcTimeBase, dstTimeBase);
+            pPacket->pts = av_rescale_q(pStream->nPacketCount, srcTimeBase, dstTimeBase);
+            pPacket->dts = pPacket->pts;
+        }
+        else if (pStream->codecInfo.mediaType == AVMEDIA_TYPE_AUDIO)
+        {
+            /* Calculate the PTS based on the sample rate and time base */
+            AVRational srcTimeBase = (AVRational){1, pStream->codecInfo.nSampleRate};
+            AVRational dstTimeBase = pStream->pAvStream->time_base;
+            int nSamplesPerFrame = pStream->codecInfo.nFrameSize;
+
+            pPacket->duration = av_rescale_q(nSamplesPerFrame, srcTimeBase, dstTimeBase);
+            pPacket->pts = av_rescale_q(pStream->nPacketCount * nSamplesPerFrame, srcTimeBase, dstTimeBase);
+            pPacket->dts = pPacket->pts;
+        }
+    }
+
+    return XSTDOK;
+}
+
+XSTATUS XEncoder_FixTS(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+{
+    XASSERT_RET(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+
+    enum AVMediaType eType = pStream->codecInfo.mediaType;
+    const char* pType = (eType == AVMEDIA_TYPE_AUDIO) ? "audio" : "video";
+
+    if (pStream == NULL)
+    {
+        pStream = XStreams_GetByDstIndex(&pEncoder->streams, pPacket->stream_index);
+        XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", pPacket->stream_index));
+    }
+
+    if (pEncoder->nTSFix &&
+       (pStream->nLastPTS >= pPacket->pts ||
+        pStream->nLastDTS >= pPacket->dts))
+    {
+        pPacket->pts = pStream->nLastPTS + pEncoder->nTSFix;
+        pPacket->dts = pStream->nLastDTS + pEncoder->nTSFix;
+
+        XStat_InfoCb(pStatus, "Fixed %s TS: PTS(%lld), DTS(%lld)",
+            pType, pPacket->pts, pPacket->dts);
+
+        return XSTDOK;
+    }
+
+    return XSTDNON;
+}
+
+static void XEncoder_BeginGOP(xencoder_t *pEncoder)
+{
+    AVFormatContext *pFmtCtx = pEncoder->pFmtCtx;
+
+    /* Push out everything that belongs to the previous GOP */
+    if (pEncoder->bNativeTS) XTSMux_Flush(&pEncoder->tsMuxer);
+    else
+    {
+        av_interleaved_write_frame(pFmtCtx, NULL);
+        av_write_frame(pFmtCtx, NULL);
+
+        /* Start the GOP with PAT/PMT so it is decodable on its own */
+        if (!strcmp(pFmtCtx->oformat->name, "mpegts"))
+            av_opt_set(pFmtCtx->priv_data, "mpegts_flags", "+resend_headers", 0);
+    }
+
+    avio_flush(pFmtCtx->pb);
+    XGOPCache_BeginData(&pEncoder->gopCache);
+}
+
+static int XEncoder_MuxPacket(xencoder_t *pEncoder, AVPacket *pPacket, xbool_t bInterleave)
+{
+    if (XEncoder_HasGOPData(pEncoder) && (pPacket->flags & AV_PKT_FLAG_KEY) &&
+        pPacket->stream_index == pEncoder->gopCache.nRefStream) XEncoder_BeginGOP(pEncoder);
+
+    if (!pEncoder->bNativeTS)
+    {
+        if (bInterleave) return av_interleaved_write_frame(pEncoder->pFmtCtx, pPacket);
+        return av_write_frame(pEncoder->pFmtCtx, pPacket);
+    }
+
+    /* Packets are muxed in arrival order, interleaving is up to the caller */
+    xts_muxer_t *pMuxer = &pEncoder->tsMuxer;
+    int nStatus = XTSMux_WritePacket(pMuxer, pPacket->stream_index, pPacket);
+    if (nStatus >= 0 && pEncoder->bLowLatency) nStatus = XTSMux_Flush(pMuxer);
+
+    /* Same ownership as av_interleaved_write_frame() */
+    if (bInterleave) av_packet_unref(pPacket);
+    return nStatus;
+}
+
+static XSTATUS XEncoder_WriteInterleaved(xencoder_t *pEncoder, xbool_t bFlush)
+{
+    xstatus_t *pStatus = &pEncoder->status;
+    uint64_t nStartTime = 0;
+    AVPacket *pPacket;
+
+    while ((pPacket = XInterleaver_Pop(&pEncoder->interleaver, bFlush, &nStartTime)) != NULL)
+    {
+        int nStreamIndex = pPacket->stream_index;
+        uint64_t nWriteTime = XTime_GetStamp();
+
+        pStatus->nAVStatus = XEncoder_MuxPacket(pEncoder, pPacket, XFALSE);
+        nWriteTime = XTime_GetStamp() - nWriteTime;
+        av_packet_free(&pPacket);
+
+        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to write packet: dst(%d)", nStreamIndex));
+        xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+        if (pStream == NULL) continue;
+
+        XStats_AddMuxTime(&pStream->stats, nWriteTime);
+
+        xlatency_t *pLatency = &pStream->latency;
+        uint64_t nLatency = XStream_UpdateLatency(pStream, nStartTime);
+        uint64_t nAverage = pLatency->nCount ? pLatency->nSum / pLatency->nCount : 0;
+
+        XStat_DebugCb(pStatus, "Packet latency: dst(%d), last(%llu), avg(%llu), max(%llu)",
+            nStreamIndex, (unsigned long long)nLatency, (unsigned long long)nAverage,
+            (unsigned long long)pLatency->nMax);
+    }
+
+    return XSTDOK;
+}
+
+static XSTATUS XEncoder_CheckSegment(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+{
+    xsegmenter_t *pSegmenter = &pEncoder->segmenter;
+    xstatus_t *pStatus = &pEncoder->status;
+
+    int64_t nTS = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+    XASSERT_RET((nTS != AV_NOPTS_VALUE), XSTDOK);
+
+    AVRational timeBase = pStream->pAvStream->time_base;
+    int64_t nTimestamp = av_rescale_q(nTS, timeBase, AV_TIME_BASE_Q);
+    int64_t nDuration = av_rescale_q(pPacket->duration, timeBase, AV_TIME_BASE_Q);
+
+    xbool_t bCutPoint = (pPacket->stream_index == pSegmenter->nRefStream &&
+                        (pPacket->flags & AV_PKT_FLAG_KEY)) ? XTRUE : XFALSE;
+
+    XASSERT_RET(XSegmenter_Check(pSegmenter, nTimestamp, nDuration, bCutPoint), XSTDOK);
+
+    /* Drain queued packets and flush the fragment into the current segment */
+    if (pEncoder->bLowLatency) XEncoder_WriteInterleaved(pEncoder, XTRUE);
+    else av_interleaved_write_frame(pEncoder->pFmtCtx, NULL);
+
+    av_write_frame(pEncoder->pFmtCtx, NULL);
+    avio_flush(pEncoder->pFmtCtx->pb);
+
+    XSTATUS nStatus = XSegmenter_Cut(pSegmenter, nTimestamp);
+    XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to cut segment: %s", strerror(errno)));
+
+    /* Repeat PAT/PMT at the start of every TS segment */
+    if (pSegmenter->eType == XSEGMENT_TS)
+        av_opt_set(pEncoder->pFmtCtx->priv_data, "mpegts_flags", "+resend_headers", 0);
+
+    const xsegment_t *pSegment = XSegmenter_GetLast(pSegmenter);
+    if (pSegment != NULL)
+    {
+        XStat_InfoCb(pStatus, "Segment complete: name(%s), duration(%.3f), size(%zu)",
+            pSegment->sName, pSegment->fDuration, pSegment->nSize);
+    }
+
+    return XSTDOK;
+}
+
+static size_t XEncoder_GetQueueDepth(xencoder_t *pEncoder)
+{
+    size_t nDepth = pEncoder->interleaver.nUsed;
+
+    /* Writer thread is near the high watermark */
+    if (pEncoder->bAsyncIO && XAsyncIO_IsPressured(&pEncoder->asyncIO))
+        nDepth += pEncoder->nAsyncDepth;
+
+    return nDepth;
+}
+
+static void XEncoder_ReportShed(xencoder_t *pEncoder, xbool_t bOverload)
+{
+    xloadshed_t *pShed = &pEncoder->loadShed;
+    xloadshed_stats_t *pStats = &pShed->stats;
+    XASSERT_VOID_RET((bOverload != pShed->bOverload));
+
+    if (pShed->bOverload)
+    {
+        XStat_InfoCb(&pEncoder->status, "Encoder overloaded, shedding load: policy(%s), lag(%lld us), encode time(%llu us)",
+            XLoadShed_GetPolicyStr(pShed->ePolicy), (long long)pStats->nLag, (unsigned long long)pStats->nEncodeTime);
+    }
+    else
+    {
+        XStat_InfoCb(&pEncoder->status, "Encoder recovered: lag(%lld us), dropped frames(%llu), dropped packets(%llu)",
+            (long long)pStats->nLag, (unsigned long long)pStats->nDropped, (unsigned long long)pStats->nPacketsDropped);
+    }
+}
+
+static XSTATUS XEncoder_ShedPacket(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+{
+    xloadshed_t *pShed = &pEncoder->loadShed;
+    xbool_t bOverload = pShed->bOverload;
+
+    int64_t nTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+    XASSERT_RET((nTS != AV_NOPTS_VALUE), XSTDOK);
+
+    int64_t nMediaTime = av_rescale_q(nTS, pStream->codecInfo.timeBase, AV_TIME_BASE_Q);
+    size_t nDepth = XEncoder_GetQueueDepth(pEncoder);
+
+    xbool_t bDrop = XLoadShed_CheckPacket(pShed, nMediaTime, pPacket->flags, nDepth);
+    XEncoder_ReportShed(pEncoder, bOverload);
+    XASSERT_RET(bDrop, XSTDOK);
+
+    XStat_DebugCb(&pEncoder->status, "Dropped packet: dst(%d), dts(%lld), flags(%d), lag(%lld us)",
+        pStream->nDstIndex, (long long)pPacket->dts, pPacket->flags, (long long)pShed->stats.nLag);
+
+    return XSTDNON;
+}
+
+static void XEncoder_BufferPacket(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+{
+    xdvr_t *pDvr = &pEncoder->dvr;
+    int64_t nTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+    XASSERT_VOID_RET((nTS != AV_NOPTS_VALUE));
+
+    int64_t nTime = av_rescale_q(nTS, pStream->pAvStream->time_base, AV_TIME_BASE_Q);
+    xbool_t bCutPoint = (pPacket->stream_index == pDvr->nRefStream &&
+                        (pPacket->flags & AV_PKT_FLAG_KEY)) ? XTRUE : XFALSE;
+
+    /* Payload is shared by reference, the muxer keeps its own */
+    if (XDVR_Add(pDvr, pPacket, nTime, bCutPoint) <= 0)
+        XStat_ErrCb(&pEncoder->status, "Failed to buffer DVR packet: dst(%d)", pPacket->stream_index);
+}
+
+XSTATUS XEncoder_WritePacket(xencoder_t *pEncoder, AVPacket *pPacket)
+{
+    XASSERT_RET(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+    XASSERT(pEncoder->pFmtCtx, XStat_ErrCb(pStatus, "Encoder format context is not init"));
+    XASSERT(pEncoder->bOutputOpen, XStat_ErrCb(pStatus, "Output context is not open"));
+
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, pPacket->stream_index);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", pPacket->stream_index));
+    XASSERT(pStream->pAvStream, XStat_ErrCb(pStatus, "Stream is not open: dst(%d)", pStream->nDstIndex));
+
+    if (pEncoder->bMuxOnly && pEncoder->loadShed.ePolicy != XLOADSHED_OFF &&
+        pStream->codecInfo.mediaType == AVMEDIA_TYPE_VIDEO)
+    {
+        XSTATUS nStatus = XEncoder_ShedPacket(pEncoder, pPacket, pStream);
+        if (nStatus <= 0) return nStatus;
+    }
+
+    /* Rescale timestamps and fix non motion PTS/DTS if detected */
+    XEncoder_RescaleTS(pEncoder, pPacket, pStream);
+    XEncoder_FixTS(pEncoder, pPacket, pStream);
+
+    pStream->nLastPTS = pPacket->pts;
+    pStream->nLastDTS = pPacket->dts;
+
+    if (pEncoder->bSegment)
+    {
+        XSTATUS nStatus = XEncoder_CheckSegment(pEncoder, pPacket, pStream);
+        if (nStatus <= 0) return nStatus;
+    }
+
+    xbool_t bKeyFrame = (pPacket->flags & AV_PKT_FLAG_KEY) ? XTRUE : XFALSE;
+    XStats_AddPacket(&pStream->stats, pPacket->size, bKeyFrame);
+    if (pEncoder->bDVR) XEncoder_BufferPacket(pEncoder, pPacket, pStream);
+
+    if (pEncoder->bLowLatency)
+    {
+        uint64_t nStartTime = pStream->nPacketTime;
+        if (!nStartTime) nStartTime = XTime_GetStamp();
+        pStream->nPacketTime = 0;
+
+        AVRational timeBase = pStream->pAvStream->time_base;
+        XSTATUS nStatus = XInterleaver_Push(&pEncoder->interleaver, pPacket, timeBase, nStartTime);
+        XASSERT((nStatus > 0), XStat_ErrCb(pStatus, "Failed to queue packet: dst(%d)", pPacket->stream_index));
+
+        pStream->nPacketCount++;
+        return XEncoder_WriteInterleaved(pEncoder, XFALSE);
+    }
+
+    uint64_t nWriteTime = XTime_GetStamp();
+    int nStreamIndex = pPacket->stream_index;
+    pStatus->nAVStatus = XEncoder_MuxPacket(pEncoder, pPacket, XTRUE);
+    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to write packet: dst(%d)", nStreamIndex));
+    XStats_AddMuxTime(&pStream->stats, XTime_GetStamp() - nWriteTime);
+
+    pStream->nPacketCount++;
+    return XSTDOK;
+}
+
+typedef struct xdvr_job_ {
+    xstatus_t           status;
+    xdvr_snapshot_t     snapshot;
+    char                sFormat[XSTR_TINY];
+    char                sOutputUrl[XPATH_MAX];
+    XATOMIC*            pBusy;
+} xdvr_job_t;
+
+static XSTATUS XEncoder_WriteDVR(xdvr_job_t *pJob, xencoder_t *pOutput)
+{
+    xdvr_snapshot_t *pSnapshot = &pJob->snapshot;
+    size_t i;
+
+    for (i = 0; i < pSnapshot->nStreams; i++)
+    {
+        /* Packets are already in the snapshot stream time base */
+        int nDstIndex = XEncoder_OpenStream(pOutput, &pSnapshot->pCodecs[i]);
+        if (nDstIndex < 0) return XSTDERR;
+    }
+
+    XSTATUS nStatus = XEncoder_OpenOutput(pOutput, NULL);
+    if (nStatus <= 0) return nStatus;
+
+    for (i = 0; i < pSnapshot->nCount; i++)
+    {
+        AVPacket *pPacket = pSnapshot->pPackets[i];
+        if (pPacket->stream_index < 0 || (size_t)pPacket->stream_index >= pSnapshot->nStreams) continue;
+
+        /* Recording starts from zero at the first keyframe */
+        AVRational timeBase = pSnapshot->pTimeBases[pPacket->stream_index];
+        int64_t nOffset = av_rescale_q(pSnapshot->nStartTime, AV_TIME_BASE_Q, timeBase);
+        int64_t nTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+
+        /* Interleaved packets older than the cut point would go negative */
+        if (nTS == AV_NOPTS_VALUE || nTS < nOffset) continue;
+
+        if (pPacket->pts != AV_NOPTS_VALUE) pPacket->pts -= nOffset;
+        if (pPacket->dts != AV_NOPTS_VALUE) pPacket->dts -= nOffset;
+
+        nStatus = XEncoder_WritePacket(pOutput, pPacket);
+        if (nStatus < 0) return nStatus;
+    }
+
+    return XEncoder_FinishWrite(pOutput, XFALSE);
+}
+
+static void* XEncoder_DVRThread(void *pCtx)
+{
+    xdvr_job_t *pJob = (xdvr_job_t*)pCtx;
+    xstatus_t *pStatus = &pJob->status;
+
+    xencoder_t output;
+    XEncoder_Init(&output);
+    XStat_Init(&output.status, pStatus->nTypes, pStatus->cb, pStatus->pUserCtx);
+    output.eTSType = XPTS_RESCALE;
+    output.bMuxOnly = XTRUE;
+
+    const char *pFormat = xstrused(pJob->sFormat) ? pJob->sFormat : NULL;
+    XSTATUS nStatus = XEncoder_OpenFormat(&output, pFormat, pJob->sOutputUrl);
+    if (nStatus > 0) nStatus = XEncoder_WriteDVR(pJob, &output);
+
+    if (nStatus > 0)
+    {
+        XStat_InfoCb(pStatus, "Saved DVR buffer: url(%s), packets(%zu), start(%lld us)",
+            pJob->sOutputUrl, pJob->snapshot.nCount, (long long)pJob->snapshot.nStartTime);
+    }
+    else
+    {
+        XStat_ErrCb(pStatus, "Failed to save DVR buffer: url(%s)", pJob->sOutputUrl);
+    }
+
+    XEncoder_Destroy(&output);
+    XSYNC_ATOMIC_SET(pJob->pBusy, XFALSE);
+    XDVR_FreeSnapshot(&pJob->snapshot);
+    free(pJob);
+    return NULL;
+}
+
+XSTATUS XEncoder_SaveDVR(xencoder_t *pEncoder, const char *pFormat, const char *pOutputUrl)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t status;
+
+    /* Caller may be any thread, do not touch the encoder status */
+    XStat_Init(&status, pEncoder->status.nTypes, pEncoder->status.cb, pEncoder->status.pUserCtx);
+    XASSERT(pEncoder->bDVR, XStat_ErrCb(&status, "DVR buffer is not enabled"));
+    XASSERT(xstrused(pOutputUrl), XStat_ErrCb(&status, "Invalid DVR output argument"));
+
+    xdvr_job_t *pJob = (xdvr_job_t*)calloc(1, sizeof(xdvr_job_t));
+    XASSERT(pJob, XStat_ErrCb(&status, "Failed to allocate DVR job: %s", strerror(errno)));
+
+    pJob->status = status;
+    pJob->pBusy = &pEncoder->nDVRBusy;
+    if (xstrused(pFormat)) xstrncpy(pJob->sFormat, sizeof(pJob->sFormat), pFormat);
+    xstrncpy(pJob->sOutputUrl, sizeof(pJob->sOutputUrl), pOutputUrl);
+
+    pthread_mutex_lock(&pEncoder->dvrLock);
+    if (XSYNC_ATOMIC_GET(&pEncoder->nDVRBusy))
+    {
+        pthread_mutex_unlock(&pEncoder->dvrLock);
+        free(pJob);
+        return XStat_ErrCb(&status, "DVR save is already in progress");
+    }
+
+    if (pEncoder->bDVRThread)
+    {
+        /* Previous save has already finished */
+        pthread_join(pEncoder->dvrThread, NULL);
+        pEncoder->bDVRThread = XFALSE;
+    }
+
+    /* Packets and their stream parameters are copied together */
+    XSTATUS nStatus = XDVR_Snapshot(&pEncoder->dvr, &pJob->snapshot);
+    if (nStatus <= 0)
+    {
+        pthread_mutex_unlock(&pEncoder->dvrLock);
+        free(pJob);
+
+        if (nStatus == XSTDNON) return XStat_ErrCb(&status, "No keyframe in DVR buffer");
+        return XStat_ErrCb(&status, "Failed to copy DVR buffer: %s", strerror(errno));
+    }
+
+    XSYNC_ATOMIC_SET(&pEncoder->nDVRBusy, XTRUE);
+    if (pthread_create(&pEncoder->dvrThread, NULL, XEncoder_DVRThread, pJob))
+    {
+        XSYNC_ATOMIC_SET(&pEncoder->nDVRBusy, XFALSE);
+        pthread_mutex_unlock(&pEncoder->dvrLock);
+        XDVR_FreeSnapshot(&pJob->snapshot);
+        free(pJob);
+        return XStat_ErrCb(&status, "Failed to start DVR save thread");
+    }
+
+    pEncoder->bDVRThread = XTRUE;
+    pthread_mutex_unlock(&pEncoder->dvrLock);
+    return XSTDOK;
+}
+
+typedef struct xencoder_sink_ {
+    xmuxer_cb_t callback;
+    void *pCtx;
+} xencoder_sink_t;
+
+static int XEncoder_PrimeSink(void *pCtx, const uint8_t *pData, int nSize)
+{
+    xencoder_sink_t *pSink = (xencoder_sink_t*)pCtx;
+    return pSink->callback(pSink->pCtx, (uint8_t*)pData, nSize);
+}
+
+/*
+ * Sends the container header and the current GOP to a new consumer.
+ * Live output is blocked until the callback returns from the final
+ * empty write, that is the point to attach the consumer to the flow.
+ */
+XSTATUS XEncoder_PrimeOutput(xencoder_t *pEncoder, xmuxer_cb_t callback, void *pCtx)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XASSERT(callback, XStat_ErrCb(pStatus, "Invalid prime callback argument"));
+    XASSERT(XEncoder_HasGOPData(pEncoder), XStat_ErrCb(pStatus, "GOP cache is not enabled for muxer output"));
+
+    xencoder_sink_t sink;
+    sink.callback = callback;
+    sink.pCtx = pCtx;
+
+    XSTATUS nStatus = XGOPCache_PrimeData(&pEncoder->gopCache, XEncoder_PrimeSink, &sink);
+    XASSERT((nStatus >= 0), XStat_ErrCb(pStatus, "Failed to prime output consumer"));
+    return nStatus;
+}
+
+XSTATUS XEncoder_PrimePackets(xencoder_t *pEncoder, xencoder_pkt_cb_t callback, void *pCtx)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+
+    XASSERT(callback, XStat_ErrCb(pStatus, "Invalid prime callback argument"));
+    XASSERT(pEncoder->bGOPCache, XStat_ErrCb(pStatus, "GOP cache is not enabled"));
+
+    XSTATUS nStatus = XGOPCache_PrimePackets(&pEncoder->gopCache, callback, pCtx);
+    XASSERT((nStatus >= 0), XStat_ErrCb(pStatus, "Failed to prime packet consumer"));
+    return nStatus;
+}
+
+XSTATUS XEncoder_FlushInterleaver(xencoder_t *pEncoder)
+{
+    XASSERT(pEncoder, XSTDINV);
+    XASSERT_RET(pEncoder->bLowLatency, XSTDNON);
+    XASSERT_RET(pEncoder->bOutputOpen, XSTDNON);
+    return XEncoder_WriteInterleaved(pEncoder, XTRUE);
+}
+
+XSTATUS XEncoder_GetLatency(xencoder_t *pEncoder, int nStreamIndex, xlatency_t *pLatency)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pLatency, XStat_ErrCb(pStatus, "Invalid latency argument"));
+
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
+
+    *pLatency = pStream->latency;
+    return XSTDOK;
+}
+
+static XSTATUS XEncoder_BatchPacket(xencoder_t *pEncoder, AVPacket *pPacket)
 {
-    XASSERT(pEncoder, NULL);
     xstatus_t *pStatus = &pEncoder->status;
+    xbatcher_t *pBatcher = &pEncoder->batcher;
 
-    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
-    if (pStream == NULL)
+    if (pBatcher->callback == NULL)
     {
-        XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex);
-        return NULL;
+        pBatcher->callback = pEncoder->batchCallback;
+        pBatcher->pUserCtx = pEncoder->pUserCtx;
+
+        XBatcher_Setup(pBatcher, pEncoder->nBatchPackets, pEncoder->nBatchBytes, pEncoder->nBatchWindow);
+        XStat_DebugCb(pStatus, "Batched packet delivery: packets(%zu), bytes(%zu), window(%llu us)",
+            pBatcher->nMaxPackets, pBatcher->nMaxBytes, (unsigned long long)pBatcher->nMaxWindow);
     }
 
-    return XStream_GetCodecInfo(pStream);
+    int nRetVal = XBatcher_Add(pBatcher, pPacket);
+    XASSERT((nRetVal != XSTDERR), XStat_ErrCb(pStatus, "Failed to add packet to batch: %s", strerror(errno)));
+    XASSERT((nRetVal >= 0), XStat_ErrCb(pStatus, "User terminated batched packet delivery"));
+
+    return XSTDOK;
 }
 
-XSTATUS XEncoder_CopyCodecInfo(xencoder_t* pEncoder, xcodec_t *pCodecInfo, int nStreamIndex)
+XSTATUS XEncoder_FlushBatch(xencoder_t *pEncoder)
 {
     XASSERT(pEncoder, XSTDINV);
-    xstatus_t *pStatus = &pEncoder->status;
-    XASSERT(pCodecInfo, XStat_ErrCb(pStatus, "Invalid codec info argument"));
+    XASSERT_RET(pEncoder->batcher.callback, XSTDNON);
 
-    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
-    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
-    return XStream_CopyCodecInfo(pStream, pCodecInfo);
+    int nRetVal = XBatcher_Flush(&pEncoder->batcher);
+    XASSERT((nRetVal >= 0), XStat_ErrCb(&pEncoder->status, "User terminated batched packet delivery"));
+
+    return XSTDOK;
 }
 
-XSTATUS XEncoder_WriteHeader(xencoder_t *pEncoder, AVDictionary *pHeaderOpts)
+static int XEncoder_PacketSink(void *pCtx, AVPacket *pPacket)
 {
-    XASSERT(pEncoder, XSTDINV);
-    xstatus_t *pStatus = &pEncoder->status;
+    xencoder_t *pEncoder = (xencoder_t*)pCtx;
+    return pEncoder->packetCallback(pEncoder->pUserCtx, pPacket);
+}
 
-    XASSERT(pEncoder->pFmtCtx, XStat_ErrCb(pStatus, "Invalid format context"));
-    XASSERT(pEncoder->bOutputOpen, XStat_ErrCb(pStatus, "Output context is not open"));
+static int XEncoder_DeliverPacket(xencoder_t *pEncoder, AVPacket *pPacket)
+{
+    if (!pEncoder->bGOPCache) return pEncoder->packetCallback(pEncoder->pUserCtx, pPacket);
+    xgop_cache_t *pCache = &pEncoder->gopCache;
 
-    pStatus->nAVStatus = avformat_write_header(pEncoder->pFmtCtx, &pHeaderOpts);
-    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to write header"));
-    return XSTDOK;
+    xbool_t bCutPoint = (pPacket->stream_index == pCache->nRefStream &&
+                        (pPacket->flags & AV_PKT_FLAG_KEY)) ? XTRUE : XFALSE;
+
+    return XGOPCache_Deliver(pCache, pPacket, bCutPoint, XEncoder_PacketSink, pEncoder);
 }
 
-XSTATUS XEncoder_OpenOutput(xencoder_t *pEncoder, AVDictionary *pOpts)
+static XSTATUS XEncoder_EncodeFrame(xencoder_t *pEncoder, xstream_t *pStream, AVFrame *pFrame)
 {
-    XASSERT(pEncoder, XSTDINV);
     xstatus_t *pStatus = &pEncoder->status;
+    int nStreamIndex = pStream->nDstIndex;
 
-    XASSERT(pEncoder->pFmtCtx, XStat_ErrCb(pStatus, "Invalid format context"));
-    xbool_t bAvFormatNoFile = (pEncoder->pFmtCtx->oformat->flags & AVFMT_NOFILE);
+    AVPacket* pPacket = XStream_GetOrCreatePacket(pStream);
+    XASSERT(pPacket, XStat_ErrCb(pStatus, "Failed to allocate packet: %s", strerror(errno)));
 
-    XASSERT((pEncoder->muxerCallback != NULL || xstrused(pEncoder->sOutputPath)),
-        XStat_ErrCb(pStatus, "Required muxer callback or output file to open the muxer"));
+    if (pFrame != NULL)
+    {
+        XStream_MarkFrameTime(pStream, pFrame->pts);
+        XStats_AddFrameIn(&pStream->stats);
+    }
 
-    if (pEncoder->muxerCallback)
+    pStatus->nAVStatus = avcodec_send_frame(pStream->pCodecCtx, pFrame);
+    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to send frame to encoder: dst(%d)", nStreamIndex));
+
+    while (pStatus->nAVStatus >= 0)
     {
-        if (!pEncoder->nIOBuffSize) pEncoder->nIOBuffSize = XENCODER_IO_SIZE;
-        size_t nPacketSize = pEncoder->nIOBuffSize;
+        pStatus->nAVStatus = avcodec_receive_packet(pStream->pCodecCtx, pPacket);
+        if (pStatus->nAVStatus == AVERROR(EAGAIN) || pStatus->nAVStatus == AVERROR_EOF) return XSTDOK;
+        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to encode packet: dst(%d)", nStreamIndex));
 
-        unsigned char *pBuffer = (unsigned char *)av_malloc(nPacketSize);
-        XASSERT(pBuffer, XStat_ErrCb(pStatus, "Failed to alloc output buffer: %s", strerror(errno)));
+        pPacket->stream_index = nStreamIndex;
+        int nRetVal = XSTDOK;
 
-        pEncoder->pIOCtx = avio_alloc_context(pBuffer, nPacketSize, 1,
-            pEncoder->pUserCtx, NULL, pEncoder->muxerCallback, NULL);
+        uint64_t nFrameTime = XStream_GetFrameTime(pStream, pPacket->pts);
+        XStats_AddFrameOut(&pStream->stats, nFrameTime ? XTime_GetStamp() - nFrameTime : 0);
 
-        XASSERT_CALL(pEncoder->pIOCtx, av_free, pBuffer,
-            XStat_ErrCb(pStatus, "Failed to alloc output context"));
+        if (pStream->bNewExtra)
+        {
+            /* Parameter sets changed after encoder reconfiguration */
+            AVCodecContext *pCodecCtx = pStream->pCodecCtx;
+            uint8_t *pExtra = av_packet_new_side_data(pPacket, AV_PKT_DATA_NEW_EXTRADATA, pCodecCtx->extradata_size);
+            if (pExtra != NULL) memcpy(pExtra, pCodecCtx->extradata, pCodecCtx->extradata_size);
+            pStream->bNewExtra = XFALSE;
+        }
 
-        pEncoder->pFmtCtx->packet_size = nPacketSize;
-        pEncoder->pFmtCtx->pb = pEncoder->pIOCtx;
-        pEncoder->pIOBuffer = pBuffer;
+        if (pEncoder->packetCallback != NULL)
+        {
+            nRetVal = XEncoder_DeliverPacket(pEncoder, pPacket);
+            XASSERT((nRetVal >= 0), XStat_ErrCb(pStatus, "User terminated packet encoding"));
+        }
 
-        XStat_InfoCb(pStatus, "Created output context: buffer(%zu)", nPacketSize);
-    }
-    else if (xstrused(pEncoder->sOutputPath))
-    {
-        if (!bAvFormatNoFile)
+        if (pEncoder->batchCallback != NULL &&
+            XEncoder_BatchPacket(pEncoder, pPacket) < 0)
         {
-            pStatus->nAVStatus = avio_open(&pEncoder->pFmtCtx->pb, pEncoder->sOutputPath, AVIO_FLAG_WRITE);
-            XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to open output context"));
+            av_packet_unref(pPacket);
+            return XSTDERR;
         }
 
-        XStat_InfoCb(pStatus, "Output context: url(%s), AVFMT_NOFILE(%s)",
-            pEncoder->sOutputPath, bAvFormatNoFile ? "true" : "false");
+        if (nRetVal > 0)
+        {
+            if (pEncoder->bLowLatency) pStream->nPacketTime = nFrameTime;
+            XEncoder_WritePacket(pEncoder, pPacket);
+            XASSERT_RET((pStatus->nAVStatus >= 0), XSTDERR);
+        }
+
+        /* Recycle packet */
+        av_packet_unref(pPacket);
     }
 
-    pEncoder->bOutputOpen = XTRUE;
-    return XEncoder_WriteHeader(pEncoder, pOpts);
+    return XSTDOK;
 }
 
-XSTATUS XEncoder_RescaleTS(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+static xstream_t* XEncoder_GetRefClock(xencoder_t *pEncoder)
+{
+    size_t i, nCount = XStreams_GetCount(&pEncoder->streams);
+
+    for (i = 0; i < nCount; i++)
+    {
+        /* Audio timeline is sample accurate, use it as the master clock */
+        xstream_t *pStream = XStreams_GetByIndex(&pEncoder->streams, i);
+        if (pStream != NULL && pStream->codecInfo.mediaType == AVMEDIA_TYPE_AUDIO &&
+            pStream->tsNorm.metrics.nSamples) return pStream;
+    }
+
+    return NULL;
+}
+
+static XSTATUS XEncoder_WriteNormalized(xencoder_t *pEncoder, xstream_t *pStream, AVFrame *pFrame)
 {
-    XASSERT_RET(pEncoder, XSTDINV);
     xstatus_t *pStatus = &pEncoder->status;
-    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+    xts_norm_t *pNorm = &pStream->tsNorm;
+    xcodec_t *pCodecInfo = &pStream->codecInfo;
 
-    if (pStream == NULL)
+    xtsnorm_action_t eAction = XTSNORM_PASS;
+    xbool_t bAudio = pCodecInfo->mediaType == AVMEDIA_TYPE_AUDIO;
+    int64_t nDuration = 0;
+
+    if (bAudio && pCodecInfo->nSampleRate > 0)
     {
-        pStream = XStreams_GetByDstIndex(&pEncoder->streams, pPacket->stream_index);
-        XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", pPacket->stream_index));
+        AVRational sampleTimeBase = (AVRational){1, pCodecInfo->nSampleRate};
+        nDuration = av_rescale_q(pFrame->nb_samples, sampleTimeBase, pCodecInfo->timeBase);
     }
 
-    if (pEncoder->eTSType == XPTS_RESCALE)
+    if (!pNorm->bSetup)
     {
-        /* Rescale packet timestamps and reset position */
-        AVRational srcTimeBase = pStream->codecInfo.timeBase;
-        AVRational dstTimeBase = pStream->pAvStream->time_base;
+        int64_t nPeriod = nDuration;
+        if (!bAudio && pCodecInfo->frameRate.num > 0 && pCodecInfo->frameRate.den > 0)
+            nPeriod = av_rescale_q(1, av_inv_q(pCodecInfo->frameRate), pCodecInfo->timeBase);
 
-        av_packet_rescale_ts(pPacket, srcTimeBase, dstTimeBase);
-        pPacket->pos = XSTDERR; /* Let FFMPEG decide position */
+        XTSNorm_Setup(pNorm, pCodecInfo->timeBase, nPeriod, bAudio);
     }
-    else if (pEncoder->eTSType == XPTS_ROUND)
-    {
-        /* Rescale and round PTS/DTS to the nearest value */
-        AVRational srcTimeBase =  pStream->codecInfo.timeBase;
-        AVRational dstTimeBase = pStream->pAvStream->time_base;
-        enum AVRounding avRound = (enum AVRounding)(AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
 
-        pPacket->pts = av_rescale_q_rnd(pPacket->pts, srcTimeBase, dstTimeBase, avRound);
-        pPacket->dts = av_rescale_q_rnd(pPacket->dts, srcTimeBase, dstTimeBase, avRound);
+    if (pCodecInfo->mediaType == AVMEDIA_TYPE_VIDEO)
+    {
+        xstream_t *pRefStream = XEncoder_GetRefClock(pEncoder);
+        if (pRefStream != NULL) eAction = XTSNorm_CheckDrift(pNorm, &pRefStream->tsNorm);
     }
-    else if (pEncoder->eTSType == XPTS_CALCULATE)
+
+    if (eAction == XTSNORM_DROP)
     {
-        /* Calculate PTS based on the elapsed time and clock rate */
-        if (!pEncoder->nStartTime) pEncoder->nStartTime = XTime_GetStamp();
-        AVRational dstTimeBase = pStream->pAvStream->time_base;
+        XTSNorm_Drop(pNorm);
+        XStat_DebugCb(pStatus, "Dropped video frame: dst(%d), drift(%lld us)",
+            pStream->nDstIndex, (long long)pNorm->metrics.nDrift);
+        return XSTDOK;
+    }
 
-        uint64_t nCurrentTime = XTime_GetStamp();
-        uint64_t nElapsedTime = nCurrentTime - pEncoder->nStartTime;
-        uint64_t nPTS = (nElapsedTime * dstTimeBase.den) / 1000000;
+    /* Frame belongs to the caller, restore its timestamp when done */
+    int64_t nPTS = pFrame->pts;
+    pFrame->pts = XTSNorm_Apply(pNorm, nPTS, nDuration);
+    XEncoder_LogTSEvents(pEncoder, pStream);
 
-        pPacket->pts = nPTS;
-        pPacket->dts = nPTS;
-    }
-    else if (pEncoder->eTSType == XPTS_COMPUTE)
+    XSTATUS nStatus = XEncoder_EncodeFrame(pEncoder, pStream, pFrame);
+    if (nStatus > 0 && eAction == XTSNORM_DUP)
     {
-        if (pStream->codecInfo.mediaType == AVMEDIA_TYPE_VIDEO)
-        {
-            /* Calculate the PTS and DTS based on the frame count and time base */
-            AVRational srcTimeBase = av_inv_q(pStream->codecInfo.frameRate);
-            AVRational dstTimeBase = pStream->pAvStream->time_base;
-
-            pPacket->duration = av_rescale_q(1, srcTimeBase, dstTimeBase);
-            pPacket->pts = av_rescale_q(pStream->nPacketCount, srcTimeBase, dstTimeBase);
-            pPacket->dts = pPacket->pts;
-        }
-        else if (pStream->codecInfo.mediaType == AVMEDIA_TYPE_AUDIO)
-        {
-            /* Calculate the PTS based on the sample rate and time base */
-            AVRational srcTimeBase = (AVRational){1, pStream->codecInfo.nSampleRate};
-            AVRational dstTimeBase = pStream->pAvStream->time_base;
-            int nSamplesPerFrame = pStream->codecInfo.nFrameSize;
+        pFrame->pts = XTSNorm_Duplicate(pNorm);
+        nStatus = XEncoder_EncodeFrame(pEncoder, pStream, pFrame);
 
-            pPacket->duration = av_rescale_q(nSamplesPerFrame, srcTimeBase, dstTimeBase);
-            pPacket->pts = av_rescale_q(pStream->nPacketCount * nSamplesPerFrame, srcTimeBase, dstTimeBase);
-            pPacket->dts = pPacket->pts;
-        }
+        XStat_DebugCb(pStatus, "Duplicated video frame: dst(%d), drift(%lld us)",
+            pStream->nDstIndex, (long long)pNorm->metrics.nDrift);
     }
 
-    return XSTDOK;
+    pFrame->pts = nPTS;
+    return nStatus;
 }
 
-XSTATUS XEncoder_FixTS(xencoder_t *pEncoder, AVPacket *pPacket, xstream_t *pStream)
+static XSTATUS XEncoder_WriteTimed(xencoder_t *pEncoder, xstream_t *pStream, AVFrame *pFrame)
+{
+    if (pFrame != NULL && pFrame->pts != AV_NOPTS_VALUE &&
+        pEncoder->eTSType == XPTS_NORMALIZE)
+        return XEncoder_WriteNormalized(pEncoder, pStream, pFrame);
+
+    return XEncoder_EncodeFrame(pEncoder, pStream, pFrame);
+}
+
+static void XEncoder_StepDownPreset(xencoder_t *pEncoder, xstream_t *pStream)
 {
-    XASSERT_RET(pEncoder, XSTDINV);
     xstatus_t *pStatus = &pEncoder->status;
-    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
+    AVCodecContext *pCodecCtx = pStream->pCodecCtx;
+    XASSERT_VOID_RET(pCodecCtx->priv_data);
 
-    enum AVMediaType eType = pStream->codecInfo.mediaType;
-    const char* pType = (eType == AVMEDIA_TYPE_AUDIO) ? "audio" : "video";
+    uint8_t *pCurrent = NULL;
+    if (av_opt_get(pCodecCtx->priv_data, "preset", 0, &pCurrent) < 0) return;
+    const char *pNext = XLoadShed_NextPreset((const char*)pCurrent);
 
-    if (pStream == NULL)
+    if (pNext == NULL)
     {
-        pStream = XStreams_GetByDstIndex(&pEncoder->streams, pPacket->stream_index);
-        XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", pPacket->stream_index));
+        XStat_DebugCb(pStatus, "Encoder preset can not be lowered: dst(%d), preset(%s)",
+            pStream->nDstIndex, (const char*)pCurrent);
+
+        av_freep(&pCurrent);
+        return;
     }
 
-    if (pEncoder->nTSFix &&
-       (pStream->nLastPTS >= pPacket->pts ||
-        pStream->nLastDTS >= pPacket->dts))
-    {
-        pPacket->pts = pStream->nLastPTS + pEncoder->nTSFix;
-        pPacket->dts = pStream->nLastDTS + pEncoder->nTSFix;
+    XStat_InfoCb(pStatus, "Stepping down encoder preset: dst(%d), preset(%s -> %s)",
+        pStream->nDstIndex, xstrused((const char*)pCurrent) ? (const char*)pCurrent : "default", pNext);
 
-        XStat_InfoCb(pStatus, "Fixed %s TS: PTS(%lld), DTS(%lld)",
-            pType, pPacket->pts, pPacket->dts);
+    xencoder_reconf_t reconf;
+    XEncoder_InitReconf(&reconf);
+    reconf.pPreset = pNext;
 
-        return XSTDOK;
-    }
+    if (XEncoder_Reconfigure(pEncoder, pStream->nDstIndex, &reconf) > 0)
+        pEncoder->loadShed.stats.nStepDowns++;
 
-    return XSTDNON;
+    av_freep(&pCurrent);
 }
 
-XSTATUS XEncoder_WritePacket(xencoder_t *pEncoder, AVPacket *pPacket)
+static XSTATUS XEncoder_WriteShedded(xencoder_t *pEncoder, xstream_t *pStream, AVFrame *pFrame)
 {
-    XASSERT_RET(pEncoder, XSTDINV);
-    xstatus_t *pStatus = &pEncoder->status;
+    xloadshed_t *pShed = &pEncoder->loadShed;
+    xcodec_t *pCodecInfo = &pStream->codecInfo;
+    xbool_t bOverload = pShed->bOverload;
+    uint64_t nPeriod = 0;
 
-    XASSERT(pPacket, XStat_ErrCb(pStatus, "Invalid packet argument"));
-    XASSERT(pEncoder->pFmtCtx, XStat_ErrCb(pStatus, "Encoder format context is not init"));
-    XASSERT(pEncoder->bOutputOpen, XStat_ErrCb(pStatus, "Output context is not open"));
+    if (pCodecInfo->frameRate.num > 0 && pCodecInfo->frameRate.den > 0)
+        nPeriod = av_rescale_q(1, av_inv_q(pCodecInfo->frameRate), AV_TIME_BASE_Q);
 
-    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, pPacket->stream_index);
-    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", pPacket->stream_index));
-    XASSERT(pStream->pAvStream, XStat_ErrCb(pStatus, "Stream is not open: dst(%d)", pStream->nDstIndex));
+    int64_t nMediaTime = av_rescale_q(pFrame->pts, pCodecInfo->timeBase, AV_TIME_BASE_Q);
+    size_t nDepth = XEncoder_GetQueueDepth(pEncoder);
 
-    /* Rescale timestamps and fix non motion PTS/DTS if detected */
-    XEncoder_RescaleTS(pEncoder, pPacket, pStream);
-    XEncoder_FixTS(pEncoder, pPacket, pStream);
+    xbool_t bDrop = XLoadShed_CheckFrame(pShed, nMediaTime, nPeriod, nDepth);
+    XEncoder_ReportShed(pEncoder, bOverload);
 
-    pStream->nLastPTS = pPacket->pts;
-    pStream->nLastDTS = pPacket->dts;
+    if (bDrop)
+    {
+        XStat_DebugCb(&pEncoder->status, "Dropped frame: dst(%d), pts(%lld), lag(%lld us), encode time(%llu us)",
+            pStream->nDstIndex, (long long)pFrame->pts, (long long)pShed->stats.nLag,
+            (unsigned long long)pShed->stats.nEncodeTime);
+
+        return XSTDOK;
+    }
 
-    pStatus->nAVStatus = av_interleaved_write_frame(pEncoder->pFmtCtx, pPacket);
-    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to write packet: dst(%d)", pPacket->stream_index));
+    uint64_t nStartTime = XTime_GetStamp();
+    XSTATUS nStatus = XEncoder_WriteTimed(pEncoder, pStream, pFrame);
+    XASSERT_RET((nStatus > 0), nStatus);
 
-    pStream->nPacketCount++;
-    return XSTDOK;
+    uint64_t nEncodeTime = XTime_GetStamp() - nStartTime;
+    if (XLoadShed_UpdateTime(pShed, nEncodeTime, nPeriod))
+        XEncoder_StepDownPreset(pEncoder, pStream);
+
+    return nStatus;
 }
 
 XSTATUS XEncoder_WriteFrame(xencoder_t *pEncoder, AVFrame *pFrame, int nStreamIndex)
@@ -440,37 +1976,33 @@ XSTATUS XEncoder_WriteFrame(xencoder_t *pEncoder, AVFrame *pFrame, int nStreamIn
     XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
     XASSERT(pStream->bCodecOpen, XStat_ErrCb(pStatus, "Codec is not open: dst(%d)", nStreamIndex));
 
-    AVPacket* pPacket = XStream_GetOrCreatePacket(pStream);
-    XASSERT(pPacket, XStat_ErrCb(pStatus, "Failed to allocate packet: %s", strerror(errno)));
-
-    pStatus->nAVStatus = avcodec_send_frame(pStream->pCodecCtx, pFrame);
-    XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to send frame to encoder: dst(%d)", nStreamIndex));
-
-    while (pStatus->nAVStatus >= 0)
-    {
-        pStatus->nAVStatus = avcodec_receive_packet(pStream->pCodecCtx, pPacket);
-        if (pStatus->nAVStatus == AVERROR(EAGAIN) || pStatus->nAVStatus == AVERROR_EOF) return XSTDOK;
-        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to encode packet: dst(%d)", nStreamIndex));
+    /* Audio is never dropped, it is cheap to encode and gaps are audible */
+    if (pFrame != NULL && pFrame->pts != AV_NOPTS_VALUE &&
+        pEncoder->loadShed.ePolicy != XLOADSHED_OFF &&
+        pStream->codecInfo.mediaType == AVMEDIA_TYPE_VIDEO)
+        return XEncoder_WriteShedded(pEncoder, pStream, pFrame);
 
-        pPacket->stream_index = nStreamIndex;
-        int nRetVal = XSTDOK;
+    return XEncoder_WriteTimed(pEncoder, pStream, pFrame);
+}
 
-        if (pEncoder->packetCallback != NULL)
-        {
-            nRetVal = pEncoder->packetCallback(pEncoder->pUserCtx, pPacket);
-            XASSERT((nRetVal >= 0), XStat_ErrCb(pStatus, "User terminated packet encoding"));
-        }
+XSTATUS XEncoder_GetShedStats(xencoder_t *pEncoder, xloadshed_stats_t *pStats)
+{
+    XASSERT(pEncoder, XSTDINV);
+    XASSERT(pStats, XStat_ErrCb(&pEncoder->status, "Invalid stats argument"));
+    *pStats = pEncoder->loadShed.stats;
+    return XSTDOK;
+}
 
-        if (nRetVal > 0)
-        {
-            XEncoder_WritePacket(pEncoder, pPacket);
-            XASSERT_RET((pStatus->nAVStatus >= 0), XSTDERR);
-        }
+XSTATUS XEncoder_GetTSMetrics(xencoder_t *pEncoder, int nStreamIndex, xts_metrics_t *pMetrics)
+{
+    XASSERT(pEncoder, XSTDINV);
+    xstatus_t *pStatus = &pEncoder->status;
+    XASSERT(pMetrics, XStat_ErrCb(pStatus, "Invalid metrics argument"));
 
-        /* Recycle packet */
-        av_packet_unref(pPacket);
-    }
+    xstream_t *pStream = XStreams_GetByDstIndex(&pEncoder->streams, nStreamIndex);
+    XASSERT(pStream, XStat_ErrCb(pStatus, "Stream is not found: dst(%d)", nStreamIndex));
 
+    *pMetrics = pStream->tsNorm.metrics;
     return XSTDOK;
 }
 
@@ -761,13 +2293,94 @@ XSTATUS XEncoder_FinishWrite(xencoder_t *pEncoder, xbool_t bFlush)
     XASSERT(pEncoder, XSTDINV);
     xstatus_t *pStatus = &pEncoder->status;
     if (bFlush) XEncoder_FlushStreams(pEncoder);
+    XEncoder_FlushInterleaver(pEncoder);
+
+    if (pEncoder->batcher.callback != NULL)
+    {
+        XEncoder_FlushBatch(pEncoder);
+        XStat_InfoCb(pStatus, "Batched delivery finished: batches(%llu), packets(%llu)",
+            (unsigned long long)pEncoder->batcher.nBatches, (unsigned long long)pEncoder->batcher.nPackets);
+    }
+
+    if (pEncoder->loadShed.ePolicy != XLOADSHED_OFF)
+    {
+        xloadshed_stats_t *pStats = &pEncoder->loadShed.stats;
+        XStat_InfoCb(pStatus, "Load shedding stats: frames(%llu), dropped frames(%llu), dropped packets(%llu), "
+            "step downs(%llu), encode time(%llu us), max encode time(%llu us)",
+            (unsigned long long)pStats->nFrames, (unsigned long long)pStats->nDropped,
+            (unsigned long long)pStats->nPacketsDropped, (unsigned long long)pStats->nStepDowns,
+            (unsigned long long)pStats->nEncodeTime, (unsigned long long)pStats->nMaxEncodeTime);
+    }
+
+    if (pEncoder->bDVR)
+    {
+        xdvr_stats_t *pStats = &pEncoder->dvr.stats;
+        XStat_InfoCb(pStatus, "DVR buffer stats: packets(%llu), evicted(%llu), snapshots(%llu)",
+            (unsigned long long)pStats->nPackets, (unsigned long long)pStats->nEvicted,
+            (unsigned long long)pStats->nSnapshots);
+    }
+
+    if (pEncoder->eTSType == XPTS_NORMALIZE)
+    {
+        size_t i, nCount = XStreams_GetCount(&pEncoder->streams);
+        for (i = 0; i < nCount; i++)
+        {
+            xstream_t *pStream = XStreams_GetByIndex(&pEncoder->streams, i);
+            if (pStream == NULL || !pStream->tsNorm.metrics.nSamples) continue;
+            xts_metrics_t *pMetrics = &pStream->tsNorm.metrics;
+
+            XStat_InfoCb(pStatus, "Timestamp metrics: dst(%d), wraps(%llu), discont(%llu), resyncs(%llu), "
+                "reorders(%llu), dropped(%llu), duplicated(%llu), max jitter(%lld us), drift(%lld us)",
+                pStream->nDstIndex, (unsigned long long)pMetrics->nWraps, (unsigned long long)pMetrics->nDiscontinuities,
+                (unsigned long long)pMetrics->nResyncs, (unsigned long long)pMetrics->nReorders,
+                (unsigned long long)pMetrics->nDropped, (unsigned long long)pMetrics->nDuplicated,
+                (long long)pMetrics->nMaxJitter, (long long)pMetrics->nDrift);
+        }
+    }
 
     /* Write trailer */
     if (pEncoder->pFmtCtx != NULL)
     {
         const char *pFmt = xstrused(pEncoder->sOutFormat) ? pEncoder->sOutFormat : "N/A";
         XStat_InfoCb(pStatus, "Writing trailer: fmt(%s), url(%s)", pFmt, pEncoder->sOutputPath);
-        av_write_trailer(pEncoder->pFmtCtx);
+
+        if (pEncoder->bNativeTS) XEncoder_FlushTSMuxer(pEncoder);
+        else av_write_trailer(pEncoder->pFmtCtx);
+    }
+
+    if (pEncoder->bSegment && pEncoder->segmenter.pFile != NULL)
+    {
+        XSTATUS nStatus = XSegmenter_Finish(&pEncoder->segmenter);
+        XASSERT((nStatus >= 0), XStat_ErrCb(pStatus, "Failed to finish segments: %s", strerror(errno)));
+
+        XStat_InfoCb(pStatus, "Segmented output finished: playlist(%s), segments(%u)",
+            pEncoder->segmenter.sPlaylist, pEncoder->segmenter.nIndex);
+    }
+
+    if (pEncoder->bAsyncIO && XSYNC_ATOMIC_GET(&pEncoder->asyncIO.nRunning))
+    {
+        xasync_stats_t *pStats = &pEncoder->asyncIO.stats;
+        pStatus->nAVStatus = XAsyncIO_Stop(&pEncoder->asyncIO);
+
+        XStat_InfoCb(pStatus, "Async writer stopped: bytes(%llu), batches(%llu), stalls(%llu), stall time(%llu us)",
+            (unsigned long long)pStats->nBytesWritten, (unsigned long long)pStats->nBatches,
+            (unsigned long long)pStats->nStalls, (unsigned long long)pStats->nStallTime);
+
+        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to write output"));
+    }
+
+    if (pEncoder->bFileSink && pEncoder->fileSink.nFD >= 0)
+    {
+        xfile_stats_t *pStats = &pEncoder->fileSink.stats;
+        pStatus->nAVStatus = XFileSink_Close(&pEncoder->fileSink);
+        uint64_t nAvgTime = pStats->nWrites ? pStats->nWriteTime / pStats->nWrites : 0;
+
+        XStat_InfoCb(pStatus, "File sink closed: bytes(%llu), writes(%llu), reloads(%llu), avg write(%llu us), max write(%llu us)",
+            (unsigned long long)pStats->nBytesWritten, (unsigned long long)pStats->nWrites,
+            (unsigned long long)pStats->nReloads, (unsigned long long)nAvgTime,
+            (unsigned long long)pStats->nMaxWriteTime);
+
+        XASSERT((pStatus->nAVStatus >= 0), XStat_ErrCb(pStatus, "Failed to close output file"));
     }
 
     return XSTDOK;
@@ -20,6 +20,15 @@ extern "C" {
 #include "stream.h"
 #include "frame.h"
 #include "meta.h"
+#include "interleave.h"
+#include "asyncio.h"
+#include "filesink.h"
+#include "segment.h"
+#include "batch.h"
+#include "loadshed.h"
+#include "tsmux.h"
+#include "dvr.h"
+#include "gopcache.h"
 
 typedef void(*xencoder_stat_cb_t)(void *pUserCtx, const char *pStatus);
 typedef void(*xencoder_err_cb_t)(void *pUserCtx, const char *pErrStr);
@@ -39,9 +48,18 @@ typedef enum {
     XPTS_RESCALE,       // Rescale original timestamps using av_packet_rescale_ts()
     XPTS_ROUND,         // Rescale original timestamps and round to the nearest value
     XPTS_SOURCE,        // Use original timestamps from the source stream
+    XPTS_NORMALIZE,     // Unwrap, smooth and drift correct timestamps per stream
     XPTS_INVALID        // Invalid PTS/DTS calculation type
 } xpts_ctl_t;
 
+typedef struct xencoder_reconf_ {
+    int64_t             nBitRate;
+    AVRational          frameRate;
+    const char*         pPreset;
+    int                 nWidth;
+    int                 nHeight;
+} xencoder_reconf_t;
+
 typedef struct xencoder_ {
     /* Encoder/muxer context */
     AVFormatContext*    pFmtCtx;
@@ -60,9 +78,59 @@ typedef struct xencoder_ {
     xencoder_pkt_cb_t   packetCallback;
     xmuxer_cb_t         muxerCallback;
     xbool_t             bMuxOnly;
+    int                 nCodecThreads;  /* Video encoders, 0: codec default */
     FILE*               pOutFile;
     void*               pUserCtx;
 
+    /* Low latency output mode */
+    xinterleaver_t      interleaver;
+    int64_t             nMaxInterleaveDelta;
+    size_t              nInterleaveSize;
+    xbool_t             bLowLatency;
+
+    /* Asynchronous muxer output */
+    xasync_pressure_cb_t pressureCallback;
+    xasync_io_t         asyncIO;
+    size_t              nAsyncDepth;
+    int                 nAsyncFD;
+    xbool_t             bAsyncIO;
+
+    /* Native file output */
+    xfile_sink_t        fileSink;
+    xbool_t             bFileSink;
+    xbool_t             bDirectIO;
+
+    /* Segmented (HLS/CMAF) output */
+    xsegmenter_t        segmenter;
+    xbool_t             bSegment;
+
+    /* Batched packet delivery */
+    xbatch_cb_t         batchCallback;
+    xbatcher_t          batcher;
+    size_t              nBatchPackets;
+    size_t              nBatchBytes;
+    uint64_t            nBatchWindow;
+
+    /* Real-time load shedding */
+    xloadshed_t         loadShed;
+
+    /* Native MPEG-TS muxer */
+    xts_muxer_t         tsMuxer;
+    xbool_t             bNativeTS;
+
+    /* Pre-event ring buffer (DVR) */
+    xdvr_t              dvr;
+    size_t              nDVRCapacity;
+    xbool_t             bDVR;
+    pthread_mutex_t     dvrLock;        /* Guards the save thread */
+    pthread_t           dvrThread;      /* Background save in progress */
+    xbool_t             bDVRThread;
+    XATOMIC             nDVRBusy;
+
+    /* GOP cache for late joining consumers */
+    xgop_cache_t        gopCache;
+    xbool_t             bGOPCache;
+
     /* Timestamp calculation stuff */
     xpts_ctl_t          eTSType;
     uint64_t            nStartTime;
@@ -80,7 +148,23 @@ XSTATUS XEncoder_OpenFormat(xencoder_t *pEncoder, const char *pFormat, const cha
 XSTATUS XEncoder_GuessFormat(xencoder_t *pEncoder, const char *pFormat, const char *pOutputUrl);
 XSTATUS XEncoder_OpenStream(xencoder_t *pEncoder, xcodec_t *pCodecInfo);
 XSTATUS XEncoder_OpenOutput(xencoder_t *pEncoder, AVDictionary *pOpts);
-
+XSTATUS XEncoder_ApplyLowLatency(xencoder_t *pEncoder, AVCodecContext *pCodecCtx);
+XSTATUS XEncoder_GetLatency(xencoder_t *pEncoder, int nStreamIndex, xlatency_t *pLatency);
+XSTATUS XEncoder_GetIOStats(xencoder_t *pEncoder, xasync_stats_t *pStats);
+XSTATUS XEncoder_GetFileStats(xencoder_t *pEncoder, xfile_stats_t *pStats);
+XSTATUS XEncoder_GetTSMetrics(xencoder_t *pEncoder, int nStreamIndex, xts_metrics_t *pMetrics);
+XSTATUS XEncoder_GetShedStats(xencoder_t *pEncoder, xloadshed_stats_t *pStats);
+XSTATUS XEncoder_GetStreamStats(xencoder_t *pEncoder, int nStreamIndex, xstream_stats_t *pStats);
+size_t XEncoder_DumpStatsJSON(xencoder_t *pEncoder, char *pOutput, size_t nSize, size_t nTabSize, xbool_t bPretty);
+
+/*
+ * A reopened video encoder starts a new HLS segment marked with a
+ * discontinuity. Segmented fMP4 output has one init section for the
+ * whole playlist, so video reopens are rejected there.
+ */
+void XEncoder_InitReconf(xencoder_reconf_t *pReconf);
+XSTATUS XEncoder_Reconfigure(xencoder_t *pEncoder, int nStreamIndex, const xencoder_reconf_t *pReconf);
+XSTATUS XEncoder_SetBitRate(xencoder_t *pEncoder, int nStreamIndex, int64_t nBitRate);
 XSTATUS XEncoder_RestartCodec(xencoder_t *pEncoder, int nStreamIndex);
 XSTATUS XEncoder_FlushStream(xencoder_t *pEncoder, int nStreamIndex);
 XSTATUS XEncoder_FlushBuffer(xencoder_t *pEncoder, int nStreamIndex);
@@ -97,6 +181,25 @@ XSTATUS XEncoder_WriteFrame2(xencoder_t *pEncoder, AVFrame *pFrame, xframe_param
 XSTATUS XEncoder_WriteFrame(xencoder_t *pEncoder, AVFrame *pFrame, int nStreamIndex);
 XSTATUS XEncoder_WriteHeader(xencoder_t *pEncoder, AVDictionary *pHeaderOpts);
 XSTATUS XEncoder_WritePacket(xencoder_t *pEncoder, AVPacket *pPacket);
+XSTATUS XEncoder_FlushInterleaver(xencoder_t *pEncoder);
+XSTATUS XEncoder_FlushBatch(xencoder_t *pEncoder);
+
+/*
+ * Can be called from any thread once the header is written. Packets
+ * and stream parameters are copied under the DVR lock, the recording
+ * is muxed by a background thread and its result is reported through
+ * the status callbacks from that thread.
+ */
+XSTATUS XEncoder_SaveDVR(xencoder_t *pEncoder, const char *pFormat, const char *pOutputUrl);
+
+/*
+ * Priming holds the GOP cache lock while the callback runs, the same
+ * lock the live muxer/packet callbacks run under. Do not call these
+ * from any of those callbacks (nested calls fail with XSTDERR) and do
+ * not wait there for a thread that is priming, it would deadlock.
+ */
+XSTATUS XEncoder_PrimeOutput(xencoder_t *pEncoder, xmuxer_cb_t callback, void *pCtx);
+XSTATUS XEncoder_PrimePackets(xencoder_t *pEncoder, xencoder_pkt_cb_t callback, void *pCtx);
 XSTATUS XEncoder_FinishWrite(xencoder_t *pEncoder, xbool_t bFlush);
 
 XSTATUS XEncoder_AddMeta(xencoder_t *pEncoder, xmeta_t *pMeta);
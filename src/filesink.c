@@ -0,0 +1,278 @@
+/*!
+ *  @file libxmedia/src/filesink.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the native file output sink
+ * with aligned buffers, O_DIRECT and space preallocation.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "filesink.h"
+#include <fcntl.h>
+
+static int64_t XFileSink_Align(int64_t nSize, size_t nAlignment)
+{
+    int64_t nMask = (int64_t)nAlignment - 1;
+    return (nSize + nMask) & ~nMask;
+}
+
+void XFileSink_Init(xfile_sink_t *pSink)
+{
+    XASSERT_VOID(pSink);
+    memset(&pSink->stats, 0, sizeof(xfile_stats_t));
+
+    pSink->pBuffer = NULL;
+    pSink->nBuffSize = 0;
+    pSink->nBuffUsed = 0;
+    pSink->nBuffOffset = 0;
+    pSink->bDirty = XFALSE;
+
+    pSink->nPosition = 0;
+    pSink->nFileSize = 0;
+    pSink->nDiskSize = 0;
+    pSink->nAllocated = 0;
+    pSink->nAllocChunk = XFILESINK_ALLOC_CHUNK;
+    pSink->nAlignment = XFILESINK_ALIGNMENT;
+
+    pSink->bDirect = XFALSE;
+    pSink->nFD = XSTDERR;
+}
+
+XSTATUS XFileSink_Open(xfile_sink_t *pSink, const char *pPath, xbool_t bDirect, size_t nBuffSize)
+{
+    XASSERT((pSink && xstrused(pPath)), XSTDINV);
+    XASSERT((pSink->nFD < 0), XSTDINV);
+
+    /* Read access is needed for read-modify-write of patched blocks */
+    int nFlags = O_RDWR | O_CREAT | O_TRUNC;
+    int nFD = XSTDERR;
+
+    if (bDirect)
+    {
+        nFD = open(pPath, nFlags | O_DIRECT, 0644);
+        if (nFD < 0 && errno != EINVAL) return XSTDERR;
+        else if (nFD < 0) bDirect = XFALSE;
+    }
+
+    if (nFD < 0) nFD = open(pPath, nFlags, 0644);
+    XASSERT((nFD >= 0), XSTDERR);
+
+    size_t nAlignment = XFILESINK_ALIGNMENT;
+    struct stat fileStat;
+
+    if (!fstat(nFD, &fileStat) && fileStat.st_blksize > (blksize_t)nAlignment &&
+        !(fileStat.st_blksize & (fileStat.st_blksize - 1)))
+        nAlignment = (size_t)fileStat.st_blksize;
+
+    if (!nBuffSize) nBuffSize = XFILESINK_BUFFER_SIZE;
+    nBuffSize = (size_t)XFileSink_Align((int64_t)nBuffSize, nAlignment);
+
+    void *pBuffer = NULL;
+    if (posix_memalign(&pBuffer, nAlignment, nBuffSize))
+    {
+        close(nFD);
+        return XSTDERR;
+    }
+
+    XFileSink_Init(pSink);
+    memset(pBuffer, 0, nBuffSize);
+
+    pSink->pBuffer = (uint8_t*)pBuffer;
+    pSink->nBuffSize = nBuffSize;
+    pSink->nAlignment = nAlignment;
+    pSink->bDirect = bDirect;
+    pSink->nFD = nFD;
+
+    return XSTDOK;
+}
+
+static void XFileSink_Reserve(xfile_sink_t *pSink, int64_t nEnd)
+{
+    XASSERT_VOID_RET(pSink->nAllocChunk);
+    XASSERT_VOID_RET((nEnd > pSink->nAllocated));
+
+    int64_t nLength = XFileSink_Align(nEnd - pSink->nAllocated, pSink->nAllocChunk);
+    if (fallocate(pSink->nFD, FALLOC_FL_KEEP_SIZE, pSink->nAllocated, nLength) < 0)
+    {
+        /* Filesystem does not support it, do not retry */
+        pSink->nAllocChunk = 0;
+        return;
+    }
+
+    pSink->nAllocated += nLength;
+}
+
+static int XFileSink_WriteWindow(xfile_sink_t *pSink)
+{
+    XASSERT_RET((pSink->bDirty && pSink->nBuffUsed), XSTDOK);
+    size_t nLength = pSink->nBuffUsed;
+
+    /* Tail is zero filled, padding is truncated on close */
+    if (pSink->bDirect) nLength = (size_t)XFileSink_Align((int64_t)nLength, pSink->nAlignment);
+    XFileSink_Reserve(pSink, pSink->nBuffOffset + (int64_t)nLength);
+
+    uint64_t nStartTime = XTime_GetStamp();
+    size_t nDone = 0;
+
+    while (nDone < nLength)
+    {
+        ssize_t nWritten = pwrite(pSink->nFD, pSink->pBuffer + nDone,
+            nLength - nDone, pSink->nBuffOffset + (int64_t)nDone);
+
+        if (nWritten < 0)
+        {
+            if (errno == EINTR) continue;
+            return AVERROR(errno);
+        }
+
+        nDone += (size_t)nWritten;
+    }
+
+    uint64_t nWriteTime = XTime_GetStamp() - nStartTime;
+    xfile_stats_t *pStats = &pSink->stats;
+
+    if (nWriteTime > pStats->nMaxWriteTime) pStats->nMaxWriteTime = nWriteTime;
+    pStats->nBytesWritten += nLength;
+    pStats->nWriteTime += nWriteTime;
+    pStats->nWrites++;
+
+    int64_t nEnd = pSink->nBuffOffset + (int64_t)nLength;
+    if (nEnd > pSink->nDiskSize) pSink->nDiskSize = nEnd;
+
+    pSink->bDirty = XFALSE;
+    return XSTDOK;
+}
+
+static int XFileSink_LoadWindow(xfile_sink_t *pSink, int64_t nPosition)
+{
+    int64_t nWindowEnd = pSink->nBuffOffset + (int64_t)pSink->nBuffSize;
+    XASSERT_RET((nPosition < pSink->nBuffOffset || nPosition >= nWindowEnd), XSTDOK);
+
+    int nStatus = XFileSink_WriteWindow(pSink);
+    XASSERT_RET((nStatus >= 0), nStatus);
+
+    memset(pSink->pBuffer, 0, pSink->nBuffSize);
+    pSink->nBuffOffset = nPosition - (nPosition % (int64_t)pSink->nAlignment);
+    pSink->nBuffUsed = 0;
+    XASSERT_RET((pSink->nBuffOffset < pSink->nFileSize), XSTDOK);
+
+    /* Seek back to the written data (moov/trailer patching) */
+    size_t nValid = (size_t)XSTD_MIN((int64_t)pSink->nBuffSize, pSink->nFileSize - pSink->nBuffOffset);
+    size_t nLength = pSink->bDirect ? (size_t)XFileSink_Align((int64_t)nValid, pSink->nAlignment) : nValid;
+    size_t nDone = 0;
+
+    while (nDone < nLength)
+    {
+        ssize_t nRead = pread(pSink->nFD, pSink->pBuffer + nDone,
+            nLength - nDone, pSink->nBuffOffset + (int64_t)nDone);
+
+        if (nRead < 0)
+        {
+            if (errno == EINTR) continue;
+            return AVERROR(errno);
+        }
+
+        if (!nRead) break;
+        nDone += (size_t)nRead;
+    }
+
+    /* Clear alignment padding read from the previous writes */
+    if (nLength > nValid) memset(pSink->pBuffer + nValid, 0, nLength - nValid);
+
+    pSink->nBuffUsed = nValid;
+    pSink->stats.nReloads++;
+    return XSTDOK;
+}
+
+int XFileSink_Write(xfile_sink_t *pSink, const uint8_t *pData, int nSize)
+{
+    XASSERT((pSink && pData && nSize >= 0), AVERROR(EINVAL));
+    XASSERT((pSink->nFD >= 0), AVERROR(EBADF));
+    size_t nLeft = (size_t)nSize;
+
+    while (nLeft > 0)
+    {
+        int nStatus = XFileSink_LoadWindow(pSink, pSink->nPosition);
+        if (nStatus < 0) return nStatus;
+
+        size_t nWindowPos = (size_t)(pSink->nPosition - pSink->nBuffOffset);
+        size_t nCopy = XSTD_MIN(pSink->nBuffSize - nWindowPos, nLeft);
+
+        memcpy(pSink->pBuffer + nWindowPos, pData, nCopy);
+        pSink->nPosition += (int64_t)nCopy;
+        pSink->bDirty = XTRUE;
+        pData += nCopy;
+        nLeft -= nCopy;
+
+        if (nWindowPos + nCopy > pSink->nBuffUsed) pSink->nBuffUsed = nWindowPos + nCopy;
+        if (pSink->nPosition > pSink->nFileSize) pSink->nFileSize = pSink->nPosition;
+
+        /* Sequential write reached the end of window */
+        if (nWindowPos + nCopy >= pSink->nBuffSize)
+        {
+            nStatus = XFileSink_WriteWindow(pSink);
+            if (nStatus < 0) return nStatus;
+        }
+    }
+
+    return nSize;
+}
+
+int64_t XFileSink_Seek(xfile_sink_t *pSink, int64_t nOffset, int nWhence)
+{
+    XASSERT(pSink, AVERROR(EINVAL));
+    int64_t nPosition = 0;
+
+    switch (nWhence & ~AVSEEK_FORCE)
+    {
+        case AVSEEK_SIZE:
+            return pSink->nFileSize;
+        case SEEK_SET:
+            nPosition = nOffset;
+            break;
+        case SEEK_CUR:
+            nPosition = pSink->nPosition + nOffset;
+            break;
+        case SEEK_END:
+            nPosition = pSink->nFileSize + nOffset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    XASSERT((nPosition >= 0), AVERROR(EINVAL));
+    pSink->nPosition = nPosition;
+    return nPosition;
+}
+
+int XFileSink_Flush(xfile_sink_t *pSink)
+{
+    XASSERT(pSink, AVERROR(EINVAL));
+    XASSERT((pSink->nFD >= 0), AVERROR(EBADF));
+    return XFileSink_WriteWindow(pSink);
+}
+
+int XFileSink_Close(xfile_sink_t *pSink)
+{
+    XASSERT(pSink, AVERROR(EINVAL));
+    XASSERT((pSink->nFD >= 0), XSTDNON);
+    int nStatus = XFileSink_WriteWindow(pSink);
+
+    /* Drop alignment padding and unused preallocated space */
+    if (ftruncate(pSink->nFD, pSink->nFileSize) < 0 && nStatus >= 0)
+        nStatus = AVERROR(errno);
+
+    if (close(pSink->nFD) < 0 && nStatus >= 0)
+        nStatus = AVERROR(errno);
+
+    free(pSink->pBuffer);
+    pSink->pBuffer = NULL;
+    pSink->nFD = XSTDERR;
+
+    return nStatus < 0 ? nStatus : XSTDOK;
+}
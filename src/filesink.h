@@ -0,0 +1,65 @@
+/*!
+ *  @file libxmedia/src/filesink.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the native file output sink
+ * with aligned buffers, O_DIRECT and space preallocation.
+ */
+
+#ifndef __XMEDIA_FILESINK_H__
+#define __XMEDIA_FILESINK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XFILESINK_ALIGNMENT     4096
+#define XFILESINK_BUFFER_SIZE   (1024 * 1024)
+#define XFILESINK_ALLOC_CHUNK   (1024 * 1024 * 16)
+
+typedef struct xfile_stats_ {
+    uint64_t        nBytesWritten;
+    uint64_t        nWrites;
+    uint64_t        nReloads;       /* Read-modify-write after seek */
+    uint64_t        nWriteTime;     /* usec */
+    uint64_t        nMaxWriteTime;  /* usec */
+} xfile_stats_t;
+
+typedef struct xfile_sink_ {
+    /* Aligned staging window */
+    uint8_t*        pBuffer;
+    size_t          nBuffSize;
+    size_t          nBuffUsed;
+    int64_t         nBuffOffset;
+    xbool_t         bDirty;
+
+    /* Logical and physical file state */
+    int64_t         nPosition;
+    int64_t         nFileSize;
+    int64_t         nDiskSize;
+    int64_t         nAllocated;
+    size_t          nAllocChunk;
+    size_t          nAlignment;
+
+    xfile_stats_t   stats;
+    xbool_t         bDirect;
+    int             nFD;
+} xfile_sink_t;
+
+void XFileSink_Init(xfile_sink_t *pSink);
+XSTATUS XFileSink_Open(xfile_sink_t *pSink, const char *pPath, xbool_t bDirect, size_t nBuffSize);
+int XFileSink_Close(xfile_sink_t *pSink);
+
+int XFileSink_Write(xfile_sink_t *pSink, const uint8_t *pData, int nSize);
+int64_t XFileSink_Seek(xfile_sink_t *pSink, int64_t nOffset, int nWhence);
+int XFileSink_Flush(xfile_sink_t *pSink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_FILESINK_H__ */
@@ -0,0 +1,142 @@
+/*!
+ *  @file libxmedia/src/frmqueue.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the bounded, blocking frame
+ * queue used between the decoder threads and the consumer.
+ */
+
+#include "frmqueue.h"
+
+void XFrmQueue_Init(xfrm_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    pthread_mutex_init(&pQueue->lock, NULL);
+    pthread_cond_init(&pQueue->pushCond, NULL);
+    pthread_cond_init(&pQueue->popCond, NULL);
+
+    pQueue->pEntries = NULL;
+    pQueue->nCapacity = 0;
+    pQueue->nHead = 0;
+    pQueue->nCount = 0;
+
+    pQueue->nProducers = 0;
+    pQueue->bAbort = XFALSE;
+}
+
+void XFrmQueue_Destroy(xfrm_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+
+    while (pQueue->nCount)
+    {
+        av_frame_free(&pQueue->pEntries[pQueue->nHead].pFrame);
+        pQueue->nHead = (pQueue->nHead + 1) % pQueue->nCapacity;
+        pQueue->nCount--;
+    }
+
+    free(pQueue->pEntries);
+    pQueue->pEntries = NULL;
+    pQueue->nCapacity = 0;
+    pQueue->nHead = 0;
+
+    pthread_cond_destroy(&pQueue->pushCond);
+    pthread_cond_destroy(&pQueue->popCond);
+    pthread_mutex_destroy(&pQueue->lock);
+}
+
+XSTATUS XFrmQueue_Setup(xfrm_queue_t *pQueue, size_t nCapacity, size_t nProducers)
+{
+    XASSERT(pQueue, XSTDINV);
+    XASSERT((pQueue->pEntries == NULL), XSTDINV);
+    if (!nCapacity) nCapacity = XFRMQUEUE_DEPTH;
+
+    pQueue->pEntries = (xfrm_entry_t*)calloc(nCapacity, sizeof(xfrm_entry_t));
+    XASSERT(pQueue->pEntries, XSTDERR);
+
+    pQueue->nCapacity = nCapacity;
+    pQueue->nProducers = nProducers;
+    return XSTDOK;
+}
+
+XSTATUS XFrmQueue_Push(xfrm_queue_t *pQueue, AVFrame *pFrame, int nStream)
+{
+    XASSERT((pQueue && pFrame), XSTDINV);
+    XASSERT(pQueue->pEntries, XSTDINV);
+
+    AVFrame *pNewFrame = av_frame_alloc();
+    XASSERT(pNewFrame, XSTDERR);
+
+    pthread_mutex_lock(&pQueue->lock);
+    while (pQueue->nCount >= pQueue->nCapacity && !pQueue->bAbort)
+        pthread_cond_wait(&pQueue->pushCond, &pQueue->lock);
+
+    if (pQueue->bAbort)
+    {
+        pthread_mutex_unlock(&pQueue->lock);
+        av_frame_free(&pNewFrame);
+        return XSTDNON;
+    }
+
+    /* Queue takes over the reference, frame data is not copied */
+    av_frame_move_ref(pNewFrame, pFrame);
+    size_t nTail = (pQueue->nHead + pQueue->nCount) % pQueue->nCapacity;
+    pQueue->pEntries[nTail].pFrame = pNewFrame;
+    pQueue->pEntries[nTail].nStream = nStream;
+    pQueue->nCount++;
+
+    pthread_cond_signal(&pQueue->popCond);
+    pthread_mutex_unlock(&pQueue->lock);
+    return XSTDOK;
+}
+
+XSTATUS XFrmQueue_Pop(xfrm_queue_t *pQueue, AVFrame *pFrame, int *pStream)
+{
+    XASSERT((pQueue && pFrame), XSTDINV);
+    XASSERT(pQueue->pEntries, XSTDINV);
+    pthread_mutex_lock(&pQueue->lock);
+
+    while (!pQueue->nCount && pQueue->nProducers && !pQueue->bAbort)
+        pthread_cond_wait(&pQueue->popCond, &pQueue->lock);
+
+    /* Queued frames are still delivered after EOF */
+    if (!pQueue->nCount || pQueue->bAbort)
+    {
+        pthread_mutex_unlock(&pQueue->lock);
+        return XSTDNON;
+    }
+
+    xfrm_entry_t entry = pQueue->pEntries[pQueue->nHead];
+    pQueue->pEntries[pQueue->nHead].pFrame = NULL;
+    pQueue->nHead = (pQueue->nHead + 1) % pQueue->nCapacity;
+    pQueue->nCount--;
+
+    pthread_cond_signal(&pQueue->pushCond);
+    pthread_mutex_unlock(&pQueue->lock);
+
+    if (pStream != NULL) *pStream = entry.nStream;
+    av_frame_move_ref(pFrame, entry.pFrame);
+    av_frame_free(&entry.pFrame);
+    return XSTDOK;
+}
+
+void XFrmQueue_SetEOF(xfrm_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    pthread_mutex_lock(&pQueue->lock);
+    if (pQueue->nProducers) pQueue->nProducers--;
+    pthread_cond_broadcast(&pQueue->popCond);
+    pthread_mutex_unlock(&pQueue->lock);
+}
+
+void XFrmQueue_Abort(xfrm_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    pthread_mutex_lock(&pQueue->lock);
+    pQueue->bAbort = XTRUE;
+    pthread_cond_broadcast(&pQueue->pushCond);
+    pthread_cond_broadcast(&pQueue->popCond);
+    pthread_mutex_unlock(&pQueue->lock);
+}
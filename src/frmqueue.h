@@ -0,0 +1,56 @@
+/*!
+ *  @file libxmedia/src/frmqueue.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the bounded, blocking frame
+ * queue used between the decoder threads and the consumer.
+ */
+
+#ifndef __XMEDIA_FRMQUEUE_H__
+#define __XMEDIA_FRMQUEUE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include <pthread.h>
+
+#define XFRMQUEUE_DEPTH         8
+
+typedef struct xfrm_entry_ {
+    AVFrame*                pFrame;
+    int                     nStream;
+} xfrm_entry_t;
+
+typedef struct xfrm_queue_ {
+    pthread_mutex_t         lock;
+    pthread_cond_t          pushCond;
+    pthread_cond_t          popCond;
+
+    xfrm_entry_t*           pEntries;
+    size_t                  nCapacity;
+    size_t                  nHead;
+    size_t                  nCount;
+
+    size_t                  nProducers;     /* EOF when all of them finished */
+    xbool_t                 bAbort;
+} xfrm_queue_t;
+
+void XFrmQueue_Init(xfrm_queue_t *pQueue);
+void XFrmQueue_Destroy(xfrm_queue_t *pQueue);
+
+XSTATUS XFrmQueue_Setup(xfrm_queue_t *pQueue, size_t nCapacity, size_t nProducers);
+XSTATUS XFrmQueue_Push(xfrm_queue_t *pQueue, AVFrame *pFrame, int nStream);
+XSTATUS XFrmQueue_Pop(xfrm_queue_t *pQueue, AVFrame *pFrame, int *pStream);
+
+void XFrmQueue_SetEOF(xfrm_queue_t *pQueue);
+void XFrmQueue_Abort(xfrm_queue_t *pQueue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_FRMQUEUE_H__ */
@@ -0,0 +1,257 @@
+/*!
+ *  @file libxmedia/src/gopcache.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the GOP cache used to prime
+ * late joining consumers of the live outputs.
+ */
+
+#include "gopcache.h"
+
+static void XGOPBuffer_Init(xgop_buffer_t *pBuffer)
+{
+    pBuffer->pData = NULL;
+    pBuffer->nCapacity = 0;
+    pBuffer->nSize = 0;
+}
+
+static void XGOPBuffer_Destroy(xgop_buffer_t *pBuffer)
+{
+    free(pBuffer->pData);
+    XGOPBuffer_Init(pBuffer);
+}
+
+static XSTATUS XGOPBuffer_Append(xgop_buffer_t *pBuffer, const uint8_t *pData, size_t nSize)
+{
+    if (pBuffer->nSize + nSize > pBuffer->nCapacity)
+    {
+        size_t nCapacity = pBuffer->nCapacity ? pBuffer->nCapacity : 65536;
+        while (nCapacity < pBuffer->nSize + nSize) nCapacity *= 2;
+
+        uint8_t *pNewData = (uint8_t*)realloc(pBuffer->pData, nCapacity);
+        XASSERT(pNewData, XSTDERR);
+
+        pBuffer->pData = pNewData;
+        pBuffer->nCapacity = nCapacity;
+    }
+
+    memcpy(&pBuffer->pData[pBuffer->nSize], pData, nSize);
+    pBuffer->nSize += nSize;
+    return XSTDOK;
+}
+
+static void XGOPCache_EnterCallback(xgop_cache_t *pCache)
+{
+    pCache->cbThread = pthread_self();
+    XSYNC_ATOMIC_SET(&pCache->nInCallback, XTRUE);
+}
+
+static void XGOPCache_LeaveCallback(xgop_cache_t *pCache)
+{
+    XSYNC_ATOMIC_SET(&pCache->nInCallback, XFALSE);
+}
+
+static xbool_t XGOPCache_IsNested(xgop_cache_t *pCache)
+{
+    /* Owner is published before the flag, a stale one never matches us */
+    return (XSYNC_ATOMIC_GET(&pCache->nInCallback) &&
+            pthread_equal(pCache->cbThread, pthread_self())) ? XTRUE : XFALSE;
+}
+
+static void XGOPCache_ClearPackets(xgop_cache_t *pCache)
+{
+    size_t i;
+    for (i = 0; i < pCache->nPktCount; i++)
+        av_packet_free(&pCache->pPackets[i]);
+
+    pCache->nPktCount = 0;
+    pCache->nPktBytes = 0;
+}
+
+void XGOPCache_Init(xgop_cache_t *pCache)
+{
+    XASSERT_VOID(pCache);
+    pthread_mutex_init(&pCache->lock, NULL);
+    pCache->nInCallback = 0;
+
+    XGOPBuffer_Init(&pCache->header);
+    XGOPBuffer_Init(&pCache->data);
+    pCache->bHeaderDone = XFALSE;
+    pCache->bDataValid = XFALSE;
+
+    pCache->pPackets = NULL;
+    pCache->nPktCapacity = 0;
+    pCache->nPktCount = 0;
+    pCache->nPktBytes = 0;
+    pCache->bPacketsValid = XFALSE;
+
+    pCache->nMaxBytes = XGOPCACHE_MAX_BYTES;
+    pCache->nRefStream = XSTDERR;
+}
+
+void XGOPCache_Destroy(xgop_cache_t *pCache)
+{
+    XASSERT_VOID(pCache);
+    XGOPCache_ClearPackets(pCache);
+    XGOPBuffer_Destroy(&pCache->header);
+    XGOPBuffer_Destroy(&pCache->data);
+
+    free(pCache->pPackets);
+    pCache->pPackets = NULL;
+    pCache->nPktCapacity = 0;
+
+    pthread_mutex_destroy(&pCache->lock);
+}
+
+void XGOPCache_EndHeader(xgop_cache_t *pCache)
+{
+    XASSERT_VOID(pCache);
+    pthread_mutex_lock(&pCache->lock);
+    pCache->bHeaderDone = XTRUE;
+    pthread_mutex_unlock(&pCache->lock);
+}
+
+void XGOPCache_BeginData(xgop_cache_t *pCache)
+{
+    XASSERT_VOID(pCache);
+    pthread_mutex_lock(&pCache->lock);
+
+    /* Next write is the start of a decodable GOP */
+    pCache->data.nSize = 0;
+    pCache->bDataValid = pCache->bHeaderDone;
+
+    pthread_mutex_unlock(&pCache->lock);
+}
+
+int XGOPCache_Write(xgop_cache_t *pCache, const uint8_t *pData, int nSize, xgop_data_cb_t callback, void *pCtx)
+{
+    XASSERT((pCache && callback), AVERROR(EINVAL));
+    pthread_mutex_lock(&pCache->lock);
+
+    if (!pCache->bHeaderDone)
+    {
+        if (XGOPBuffer_Append(&pCache->header, pData, (size_t)nSize) <= 0)
+            pCache->bHeaderDone = XTRUE;
+    }
+    else if (pCache->bDataValid)
+    {
+        /* GOP is too large to cache, wait for the next keyframe */
+        if (pCache->data.nSize + (size_t)nSize > pCache->nMaxBytes ||
+            XGOPBuffer_Append(&pCache->data, pData, (size_t)nSize) <= 0)
+            pCache->bDataValid = XFALSE;
+    }
+
+    XGOPCache_EnterCallback(pCache);
+    int nStatus = callback(pCtx, pData, nSize);
+    XGOPCache_LeaveCallback(pCache);
+
+    pthread_mutex_unlock(&pCache->lock);
+    return nStatus;
+}
+
+static XSTATUS XGOPCache_AddPacket(xgop_cache_t *pCache, AVPacket *pPacket)
+{
+    XASSERT((pCache->nPktBytes + (size_t)pPacket->size <= pCache->nMaxBytes), XSTDERR);
+
+    if (pCache->nPktCount >= pCache->nPktCapacity)
+    {
+        size_t nCapacity = pCache->nPktCapacity ? pCache->nPktCapacity * 2 : 256;
+        AVPacket **pPackets = (AVPacket**)realloc(pCache->pPackets, nCapacity * sizeof(AVPacket*));
+        XASSERT(pPackets, XSTDERR);
+
+        pCache->pPackets = pPackets;
+        pCache->nPktCapacity = nCapacity;
+    }
+
+    AVPacket *pClone = av_packet_clone(pPacket);
+    XASSERT(pClone, XSTDERR);
+
+    pCache->pPackets[pCache->nPktCount++] = pClone;
+    pCache->nPktBytes += (size_t)pPacket->size;
+    return XSTDOK;
+}
+
+int XGOPCache_Deliver(xgop_cache_t *pCache, AVPacket *pPacket, xbool_t bCutPoint, xgop_packet_cb_t callback, void *pCtx)
+{
+    XASSERT((pCache && pPacket && callback), AVERROR(EINVAL));
+    pthread_mutex_lock(&pCache->lock);
+
+    if (bCutPoint)
+    {
+        XGOPCache_ClearPackets(pCache);
+        pCache->bPacketsValid = XTRUE;
+    }
+
+    if (pCache->bPacketsValid && XGOPCache_AddPacket(pCache, pPacket) <= 0)
+    {
+        XGOPCache_ClearPackets(pCache);
+        pCache->bPacketsValid = XFALSE;
+    }
+
+    XGOPCache_EnterCallback(pCache);
+    int nStatus = callback(pCtx, pPacket);
+    XGOPCache_LeaveCallback(pCache);
+
+    pthread_mutex_unlock(&pCache->lock);
+    return nStatus;
+}
+
+XSTATUS XGOPCache_PrimeData(xgop_cache_t *pCache, xgop_data_cb_t callback, void *pCtx)
+{
+    XASSERT((pCache && callback), XSTDINV);
+    XASSERT(!XGOPCache_IsNested(pCache), XSTDERR);
+
+    pthread_mutex_lock(&pCache->lock);
+    XGOPCache_EnterCallback(pCache);
+    XSTATUS nStatus = XSTDNON;
+
+    if (pCache->bDataValid)
+    {
+        xgop_buffer_t *pHeader = &pCache->header;
+        xgop_buffer_t *pData = &pCache->data;
+        nStatus = XSTDOK;
+
+        if (pHeader->nSize && callback(pCtx, pHeader->pData, (int)pHeader->nSize) < 0) nStatus = XSTDERR;
+        if (nStatus > 0 && pData->nSize && callback(pCtx, pData->pData, (int)pData->nSize) < 0) nStatus = XSTDERR;
+
+        /* Empty write marks the join point, live output is still blocked */
+        if (nStatus > 0 && callback(pCtx, NULL, 0) < 0) nStatus = XSTDERR;
+    }
+
+    XGOPCache_LeaveCallback(pCache);
+    pthread_mutex_unlock(&pCache->lock);
+    return nStatus;
+}
+
+XSTATUS XGOPCache_PrimePackets(xgop_cache_t *pCache, xgop_packet_cb_t callback, void *pCtx)
+{
+    XASSERT((pCache && callback), XSTDINV);
+    XASSERT(!XGOPCache_IsNested(pCache), XSTDERR);
+
+    pthread_mutex_lock(&pCache->lock);
+    XGOPCache_EnterCallback(pCache);
+    XSTATUS nStatus = XSTDNON;
+
+    if (pCache->bPacketsValid && pCache->nPktCount)
+    {
+        AVPacket *pPacket = av_packet_alloc();
+        size_t i;
+
+        nStatus = pPacket != NULL ? XSTDOK : XSTDERR;
+        for (i = 0; nStatus > 0 && i < pCache->nPktCount; i++)
+        {
+            /* Consumer gets its own reference, same as the live callback */
+            if (av_packet_ref(pPacket, pCache->pPackets[i]) < 0) nStatus = XSTDERR;
+            else if (callback(pCtx, pPacket) < 0) nStatus = XSTDERR;
+            av_packet_unref(pPacket);
+        }
+
+        av_packet_free(&pPacket);
+    }
+
+    XGOPCache_LeaveCallback(pCache);
+    pthread_mutex_unlock(&pCache->lock);
+    return nStatus;
+}
@@ -0,0 +1,78 @@
+/*!
+ *  @file libxmedia/src/gopcache.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the GOP cache used to prime
+ * late joining consumers of the live outputs.
+ */
+
+#ifndef __XMEDIA_GOPCACHE_H__
+#define __XMEDIA_GOPCACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include <pthread.h>
+
+#define XGOPCACHE_MAX_BYTES     (16 * 1024 * 1024)
+
+typedef int(*xgop_data_cb_t)(void *pCtx, const uint8_t *pData, int nSize);
+typedef int(*xgop_packet_cb_t)(void *pCtx, AVPacket *pPacket);
+
+typedef struct xgop_buffer_ {
+    uint8_t*                pData;
+    size_t                  nCapacity;
+    size_t                  nSize;
+} xgop_buffer_t;
+
+/*
+ * Live output path and priming share the same lock, so a new
+ * consumer sees the cached bytes (or packets) immediately
+ * followed by the live flow with nothing lost in between.
+ * Callbacks run with the lock held and must not prime again,
+ * such nested calls are detected and rejected.
+ */
+typedef struct xgop_cache_ {
+    pthread_mutex_t         lock;
+    pthread_t               cbThread;       /* Thread running a callback */
+    XATOMIC                 nInCallback;
+
+    /* Container header and muxed bytes since the last keyframe */
+    xgop_buffer_t           header;
+    xgop_buffer_t           data;
+    xbool_t                 bHeaderDone;
+    xbool_t                 bDataValid;
+
+    /* Encoded packets since the last keyframe */
+    AVPacket**              pPackets;
+    size_t                  nPktCapacity;
+    size_t                  nPktCount;
+    size_t                  nPktBytes;
+    xbool_t                 bPacketsValid;
+
+    /* User options */
+    size_t                  nMaxBytes;
+    int                     nRefStream;
+} xgop_cache_t;
+
+void XGOPCache_Init(xgop_cache_t *pCache);
+void XGOPCache_Destroy(xgop_cache_t *pCache);
+
+void XGOPCache_EndHeader(xgop_cache_t *pCache);
+void XGOPCache_BeginData(xgop_cache_t *pCache);
+
+int XGOPCache_Write(xgop_cache_t *pCache, const uint8_t *pData, int nSize, xgop_data_cb_t callback, void *pCtx);
+int XGOPCache_Deliver(xgop_cache_t *pCache, AVPacket *pPacket, xbool_t bCutPoint, xgop_packet_cb_t callback, void *pCtx);
+
+XSTATUS XGOPCache_PrimeData(xgop_cache_t *pCache, xgop_data_cb_t callback, void *pCtx);
+XSTATUS XGOPCache_PrimePackets(xgop_cache_t *pCache, xgop_packet_cb_t callback, void *pCtx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_GOPCACHE_H__ */
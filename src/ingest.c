@@ -0,0 +1,452 @@
+/*!
+ *  @file libxmedia/src/ingest.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the multi-input ingest scheduler
+ * serving many decoders from a fixed pool of worker threads.
+ */
+
+#include "ingest.h"
+
+void XIngest_Init(xingest_t *pIngest)
+{
+    XASSERT_VOID(pIngest);
+    XStat_Init(&pIngest->status, XSTDNON, NULL, NULL);
+
+    pthread_mutex_init(&pIngest->lock, NULL);
+    pthread_cond_init(&pIngest->readyCond, NULL);
+
+    pIngest->pInputs = NULL;
+    pIngest->nInputs = 0;
+    pIngest->nCapacity = 0;
+    pIngest->nCursor = 0;
+
+    pIngest->pThreads = NULL;
+    pIngest->nThreads = 0;
+    pIngest->nStop = 0;
+
+    pIngest->nSlicePackets = XINGEST_SLICE;
+    pIngest->nSliceTime = XINGEST_SLICE_TIME;
+    pIngest->nCodecThreads = 1;
+    pIngest->nPollTime = XINGEST_POLL_TIME;
+    pIngest->nTimeout = XINGEST_TIMEOUT;
+    pIngest->nBackoffMin = XINGEST_BACKOFF_MIN;
+    pIngest->nBackoffMax = XINGEST_BACKOFF_MAX;
+    pIngest->nMaxRetries = 0;
+
+    pIngest->frameCallback = NULL;
+    pIngest->setupCallback = NULL;
+    pIngest->pUserCtx = NULL;
+}
+
+static void XIngest_CloseInput(xingest_input_t *pInput)
+{
+    XASSERT_VOID_RET(pInput->bOpen);
+    XDecoder_Destroy(&pInput->decoder);
+    pInput->bOpen = XFALSE;
+}
+
+void XIngest_Destroy(xingest_t *pIngest)
+{
+    XASSERT_VOID(pIngest);
+    XIngest_Stop(pIngest);
+    size_t i;
+
+    for (i = 0; i < pIngest->nInputs; i++)
+    {
+        xingest_input_t *pInput = pIngest->pInputs[i];
+        XIngest_CloseInput(pInput);
+        av_packet_free(&pInput->pPacket);
+        free(pInput);
+    }
+
+    free(pIngest->pInputs);
+    pIngest->pInputs = NULL;
+    pIngest->nInputs = 0;
+    pIngest->nCapacity = 0;
+
+    pthread_cond_destroy(&pIngest->readyCond);
+    pthread_mutex_destroy(&pIngest->lock);
+}
+
+int XIngest_AddInput(xingest_t *pIngest, const char *pInput, const char *pInputFmt)
+{
+    XASSERT(pIngest, XSTDINV);
+    xstatus_t *pStatus = &pIngest->status;
+    XASSERT(pInput, XStat_ErrCb(pStatus, "Invalid input argument"));
+
+    xingest_input_t *pNew = (xingest_input_t*)calloc(1, sizeof(xingest_input_t));
+    XASSERT(pNew, XStat_ErrCb(pStatus, "Failed to alloc input: %s", strerror(errno)));
+
+    pNew->pPacket = av_packet_alloc();
+    XASSERT_CALL(pNew->pPacket, free, pNew, XStat_ErrCb(pStatus, "Failed to alloc input packet"));
+
+    xstrncpy(pNew->sInput, sizeof(pNew->sInput), pInput);
+    if (pInputFmt != NULL) xstrncpy(pNew->sInputFmt, sizeof(pNew->sInputFmt), pInputFmt);
+    pNew->stats.eState = XINGEST_IDLE;
+    pNew->work.eState = XINGEST_IDLE;
+    pNew->pIngest = pIngest;
+
+    pthread_mutex_lock(&pIngest->lock);
+    if (pIngest->nInputs >= pIngest->nCapacity)
+    {
+        size_t nCapacity = pIngest->nCapacity ? pIngest->nCapacity * 2 : 16;
+        xingest_input_t **pInputs = (xingest_input_t**)realloc(pIngest->pInputs, nCapacity * sizeof(xingest_input_t*));
+
+        if (pInputs == NULL)
+        {
+            pthread_mutex_unlock(&pIngest->lock);
+            av_packet_free(&pNew->pPacket);
+            free(pNew);
+            return XStat_ErrCb(pStatus, "Failed to grow input list: %s", strerror(errno));
+        }
+
+        pIngest->pInputs = pInputs;
+        pIngest->nCapacity = nCapacity;
+    }
+
+    pNew->nID = (int)pIngest->nInputs;
+    pIngest->pInputs[pIngest->nInputs++] = pNew;
+
+    pthread_cond_signal(&pIngest->readyCond);
+    pthread_mutex_unlock(&pIngest->lock);
+
+    XStat_InfoCb(pStatus, "Added ingest input: id(%d), input(%s)", pNew->nID, pNew->sInput);
+    return pNew->nID;
+}
+
+static xingest_input_t* XIngest_GetInput(xingest_t *pIngest, int nID)
+{
+    XASSERT_RET((nID >= 0 && (size_t)nID < pIngest->nInputs), NULL);
+    return pIngest->pInputs[nID];
+}
+
+XSTATUS XIngest_StopInput(xingest_t *pIngest, int nID)
+{
+    XASSERT(pIngest, XSTDINV);
+    pthread_mutex_lock(&pIngest->lock);
+
+    xingest_input_t *pInput = XIngest_GetInput(pIngest, nID);
+    if (pInput == NULL)
+    {
+        pthread_mutex_unlock(&pIngest->lock);
+        return XSTDNON;
+    }
+
+    /* Serving worker is interrupted, next turn closes the input */
+    XSYNC_ATOMIC_SET(&pInput->nStopReq, XTRUE);
+    pInput->nNextTime = 0;
+
+    pthread_cond_signal(&pIngest->readyCond);
+    pthread_mutex_unlock(&pIngest->lock);
+    return XSTDOK;
+}
+
+XSTATUS XIngest_GetStats(xingest_t *pIngest, int nID, xingest_stats_t *pStats)
+{
+    XASSERT((pIngest && pStats), XSTDINV);
+    pthread_mutex_lock(&pIngest->lock);
+
+    xingest_input_t *pInput = XIngest_GetInput(pIngest, nID);
+    if (pInput != NULL) *pStats = pInput->stats;
+
+    pthread_mutex_unlock(&pIngest->lock);
+    return pInput != NULL ? XSTDOK : XSTDNON;
+}
+
+static int XIngest_InterruptCb(void *pCtx)
+{
+    xingest_input_t *pInput = (xingest_input_t*)pCtx;
+    xingest_t *pIngest = pInput->pIngest;
+
+    if (XSYNC_ATOMIC_GET(&pIngest->nStop) ||
+        XSYNC_ATOMIC_GET(&pInput->nStopReq)) return 1;
+
+    /* Protocols without non-blocking support must not hold the worker forever */
+    return pIngest->nTimeout && XTime_GetStamp() - pInput->nOpTime > pIngest->nTimeout;
+}
+
+static int XIngest_FrameCb(void *pUserCtx, AVFrame *pFrame, int nStreamIndex)
+{
+    xingest_input_t *pInput = (xingest_input_t*)pUserCtx;
+    xingest_t *pIngest = pInput->pIngest;
+
+    pInput->work.nFrames++;
+    XASSERT_RET(pIngest->frameCallback, 0);
+
+    int nStatus = pIngest->frameCallback(pIngest->pUserCtx, pInput->nID, pFrame, nStreamIndex);
+    if (nStatus < 0) pInput->nSinkStatus = nStatus;
+    return nStatus;
+}
+
+static XSTATUS XIngest_OpenInput(xingest_t *pIngest, xingest_input_t *pInput)
+{
+    xstatus_t *pParent = &pIngest->status;
+    xdecoder_t *pDecoder = &pInput->decoder;
+
+    XDecoder_Init(pDecoder);
+    XStat_Init(&pDecoder->status, pParent->nTypes, pParent->cb, pParent->pUserCtx);
+    pInput->nDecodeErrors = 0;
+    pInput->nSinkStatus = 0;
+    pInput->bOpen = XTRUE;
+
+    pDecoder->frameCallback = XIngest_FrameCb;
+    pDecoder->pUserCtx = pInput;
+    pDecoder->videoOpts.nThreads = pIngest->nCodecThreads;
+    pDecoder->audioOpts.nThreads = pIngest->nCodecThreads;
+
+    if (pIngest->setupCallback != NULL)
+        pIngest->setupCallback(pIngest->pUserCtx, pInput->nID, pDecoder);
+
+    /* Pre-allocated context carries the interrupt callback into the open */
+    pDecoder->pFmtCtx = avformat_alloc_context();
+    XASSERT(pDecoder->pFmtCtx, XStat_ErrCb(pParent, "Failed to alloc input context: id(%d)", pInput->nID));
+    pDecoder->pFmtCtx->interrupt_callback.callback = XIngest_InterruptCb;
+    pDecoder->pFmtCtx->interrupt_callback.opaque = pInput;
+
+    const char *pInputFmt = xstrused(pInput->sInputFmt) ? pInput->sInputFmt : NULL;
+    pInput->nOpTime = XTime_GetStamp();
+
+    XSTATUS nStatus = XDecoder_OpenInput(pDecoder, pInput->sInput, pInputFmt);
+    XASSERT_RET((nStatus > 0), nStatus);
+
+    /*
+     * Only demuxers that honor it (mostly devices) return AVERROR(EAGAIN),
+     * network protocols still block the worker for up to nTimeout.
+     */
+    pDecoder->pFmtCtx->flags |= AVFMT_FLAG_NONBLOCK;
+    pInput->work.eState = XINGEST_RUNNING;
+    return XSTDOK;
+}
+
+static void XIngest_Backoff(xingest_t *pIngest, xingest_input_t *pInput)
+{
+    XIngest_CloseInput(pInput);
+    pInput->work.nRetries++;
+
+    if (pIngest->nMaxRetries && pInput->work.nRetries > pIngest->nMaxRetries)
+    {
+        XStat_ErrCb(&pIngest->status, "Giving up ingest input: id(%d), retries(%u)",
+            pInput->nID, pInput->work.nRetries - 1);
+
+        pInput->work.eState = XINGEST_STOPPED;
+        return;
+    }
+
+    if (!pInput->nBackoff) pInput->nBackoff = pIngest->nBackoffMin;
+    else pInput->nBackoff = XSTD_MIN(pInput->nBackoff * 2, pIngest->nBackoffMax);
+
+    XStat_InfoCb(&pIngest->status, "Restarting ingest input: id(%d), retry(%u), after(%llu ms)",
+        pInput->nID, pInput->work.nRetries, (unsigned long long)(pInput->nBackoff / 1000));
+
+    pInput->nNextTime = XTime_GetStamp() + pInput->nBackoff;
+    pInput->work.eState = XINGEST_BACKOFF;
+    pInput->work.nRestarts++;
+}
+
+static void XIngest_Serve(xingest_t *pIngest, xingest_input_t *pInput)
+{
+    if (XSYNC_ATOMIC_GET(&pInput->nStopReq))
+    {
+        XIngest_CloseInput(pInput);
+        pInput->work.eState = XINGEST_STOPPED;
+        return;
+    }
+
+    if (!pInput->bOpen && XIngest_OpenInput(pIngest, pInput) <= 0)
+    {
+        XIngest_Backoff(pIngest, pInput);
+        return;
+    }
+
+    xdecoder_t *pDecoder = &pInput->decoder;
+    AVPacket *pPacket = pInput->pPacket;
+    size_t i;
+
+    uint64_t nTurnStart = XTime_GetStamp();
+
+    for (i = 0; i < pIngest->nSlicePackets; i++)
+    {
+        if (XSYNC_ATOMIC_GET(&pIngest->nStop)) return;
+        pInput->nOpTime = XTime_GetStamp();
+
+        /* Fast input with slow decoding must not keep the worker either */
+        if (pIngest->nSliceTime && pInput->nOpTime - nTurnStart >= pIngest->nSliceTime) break;
+
+        int nStatus = XDecoder_ReadPacket(pDecoder, pPacket);
+        if (nStatus == AVERROR(EAGAIN))
+        {
+            /* Nothing to read yet, let other inputs use the worker */
+            pInput->nNextTime = XTime_GetStamp() + pIngest->nPollTime;
+            pInput->work.nPolls++;
+            return;
+        }
+        else if (nStatus < 0)
+        {
+            if (nStatus == AVERROR_EOF) XDecoder_Drain(pDecoder);
+            XIngest_Backoff(pIngest, pInput);
+            return;
+        }
+
+        pInput->work.nPackets++;
+        nStatus = XDecoder_DecodePacket(pDecoder, pPacket);
+        av_packet_unref(pPacket);
+
+        if (pInput->nSinkStatus < 0)
+        {
+            /* Consumer does not take the frames, reading more is pointless */
+            XStat_ErrCb(&pIngest->status, "Stopping ingest input, frame callback failed: id(%d), status(%d)",
+                pInput->nID, pInput->nSinkStatus);
+
+            XIngest_CloseInput(pInput);
+            pInput->work.eState = XINGEST_STOPPED;
+            return;
+        }
+
+        /* Single corrupt packets are common in live streams */
+        if (nStatus >= 0)
+        {
+            pInput->work.nRetries = 0;
+            pInput->nDecodeErrors = 0;
+            pInput->nBackoff = 0;
+        }
+        else if (++pInput->nDecodeErrors >= XINGEST_DECODE_ERRORS)
+        {
+            XStat_ErrCb(&pIngest->status, "Decoding keeps failing: id(%d), packets(%u)",
+                pInput->nID, pInput->nDecodeErrors);
+
+            XIngest_Backoff(pIngest, pInput);
+            return;
+        }
+    }
+
+    /* Slice is used up, input goes behind the others */
+    pInput->nNextTime = 0;
+}
+
+static void XIngest_GetTime(struct timespec *pTime, uint64_t nWait)
+{
+    clock_gettime(CLOCK_REALTIME, pTime);
+    pTime->tv_sec += (time_t)(nWait / 1000000);
+    pTime->tv_nsec += (long)(nWait % 1000000) * 1000;
+
+    if (pTime->tv_nsec >= 1000000000)
+    {
+        pTime->tv_nsec -= 1000000000;
+        pTime->tv_sec++;
+    }
+}
+
+static xingest_input_t* XIngest_NextInput(xingest_t *pIngest)
+{
+    pthread_mutex_lock(&pIngest->lock);
+
+    while (!XSYNC_ATOMIC_GET(&pIngest->nStop))
+    {
+        uint64_t nNow = XTime_GetStamp();
+        uint64_t nWait = XINGEST_IDLE_WAIT;
+        size_t i;
+
+        /* Round-robin from the cursor keeps the turns fair */
+        for (i = 0; i < pIngest->nInputs; i++)
+        {
+            size_t nIndex = (pIngest->nCursor + i) % pIngest->nInputs;
+            xingest_input_t *pInput = pIngest->pInputs[nIndex];
+
+            if (pInput->bBusy || pInput->stats.eState == XINGEST_STOPPED) continue;
+            if (pInput->nNextTime > nNow)
+            {
+                nWait = XSTD_MIN(nWait, pInput->nNextTime - nNow);
+                continue;
+            }
+
+            pIngest->nCursor = nIndex + 1;
+            pInput->bBusy = XTRUE;
+
+            pthread_mutex_unlock(&pIngest->lock);
+            return pInput;
+        }
+
+        struct timespec waitTime;
+        XIngest_GetTime(&waitTime, nWait);
+        pthread_cond_timedwait(&pIngest->readyCond, &pIngest->lock, &waitTime);
+    }
+
+    pthread_mutex_unlock(&pIngest->lock);
+    return NULL;
+}
+
+static void* XIngest_WorkerThread(void *pCtx)
+{
+    xingest_t *pIngest = (xingest_t*)pCtx;
+    xingest_input_t *pInput = NULL;
+
+    while ((pInput = XIngest_NextInput(pIngest)) != NULL)
+    {
+        XIngest_Serve(pIngest, pInput);
+        pthread_mutex_lock(&pIngest->lock);
+
+        /* Publish the turn, stop request may have raced with the schedule */
+        if (XSYNC_ATOMIC_GET(&pInput->nStopReq)) pInput->nNextTime = 0;
+        pInput->stats = pInput->work;
+        pInput->bBusy = XFALSE;
+        pthread_cond_signal(&pIngest->readyCond);
+        pthread_mutex_unlock(&pIngest->lock);
+    }
+
+    return NULL;
+}
+
+XSTATUS XIngest_Start(xingest_t *pIngest, size_t nThreads)
+{
+    XASSERT(pIngest, XSTDINV);
+    xstatus_t *pStatus = &pIngest->status;
+    XASSERT(!pIngest->pThreads, XStat_ErrCb(pStatus, "Ingest workers are already started"));
+
+    if (!nThreads)
+    {
+        long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+        nThreads = nCPUs > 0 ? (size_t)nCPUs : 1;
+    }
+
+    pIngest->pThreads = (pthread_t*)calloc(nThreads, sizeof(pthread_t));
+    XASSERT(pIngest->pThreads, XStat_ErrCb(pStatus, "Failed to alloc ingest workers"));
+    XSYNC_ATOMIC_SET(&pIngest->nStop, XFALSE);
+
+    while (pIngest->nThreads < nThreads)
+    {
+        if (pthread_create(&pIngest->pThreads[pIngest->nThreads], NULL, XIngest_WorkerThread, pIngest))
+        {
+            XIngest_Stop(pIngest);
+            return XStat_ErrCb(pStatus, "Failed to start ingest worker: %s", strerror(errno));
+        }
+
+        pIngest->nThreads++;
+    }
+
+    XStat_InfoCb(pStatus, "Started ingest: workers(%zu), inputs(%zu), slice(%zu)",
+        pIngest->nThreads, pIngest->nInputs, pIngest->nSlicePackets);
+
+    return XSTDOK;
+}
+
+void XIngest_Stop(xingest_t *pIngest)
+{
+    XASSERT_VOID(pIngest);
+    XASSERT_VOID_RET(pIngest->pThreads);
+    size_t i;
+
+    pthread_mutex_lock(&pIngest->lock);
+    XSYNC_ATOMIC_SET(&pIngest->nStop, XTRUE);
+    pthread_cond_broadcast(&pIngest->readyCond);
+    pthread_mutex_unlock(&pIngest->lock);
+
+    for (i = 0; i < pIngest->nThreads; i++)
+        pthread_join(pIngest->pThreads[i], NULL);
+
+    free(pIngest->pThreads);
+    pIngest->pThreads = NULL;
+    pIngest->nThreads = 0;
+}
@@ -0,0 +1,125 @@
+/*!
+ *  @file libxmedia/src/ingest.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the multi-input ingest scheduler
+ * serving many decoders from a fixed pool of worker threads.
+ */
+
+#ifndef __XMEDIA_INGEST_H__
+#define __XMEDIA_INGEST_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include "decoder.h"
+#include <pthread.h>
+
+#define XINGEST_SLICE           32          /* Packets per turn */
+#define XINGEST_SLICE_TIME      20000       /* usec per turn */
+#define XINGEST_POLL_TIME       5000        /* usec, retry after EAGAIN */
+#define XINGEST_IDLE_WAIT       100000      /* usec */
+#define XINGEST_TIMEOUT         5000000     /* usec, blocking open/read limit */
+#define XINGEST_BACKOFF_MIN     500000      /* usec */
+#define XINGEST_BACKOFF_MAX     30000000    /* usec */
+#define XINGEST_DECODE_ERRORS   16          /* Failed packets in a row before restart */
+
+typedef enum {
+    XINGEST_IDLE = 0,
+    XINGEST_RUNNING,
+    XINGEST_BACKOFF,
+    XINGEST_STOPPED
+} xingest_state_t;
+
+typedef int(*xingest_frame_cb_t)(void *pUserCtx, int nInput, AVFrame *pFrame, int nStreamIndex);
+typedef void(*xingest_setup_cb_t)(void *pUserCtx, int nInput, xdecoder_t *pDecoder);
+
+typedef struct xingest_stats_ {
+    xingest_state_t         eState;
+    uint64_t                nPackets;
+    uint64_t                nFrames;
+    uint64_t                nPolls;         /* Reads that would block */
+    uint64_t                nRestarts;
+    uint32_t                nRetries;       /* Failures since the last decoded packet */
+} xingest_stats_t;
+
+typedef struct xingest_input_ {
+    struct xingest_*        pIngest;
+    xdecoder_t              decoder;
+    AVPacket*               pPacket;
+    xbool_t                 bOpen;
+    xbool_t                 bBusy;          /* Served by a worker */
+    XATOMIC                 nStopReq;
+
+    char                    sInput[XPATH_MAX];
+    char                    sInputFmt[XSTR_TINY];
+    uint64_t                nNextTime;      /* usec, not served before */
+    uint64_t                nOpTime;        /* usec, start of blocking call */
+    uint64_t                nBackoff;
+    uint32_t                nDecodeErrors;  /* Failed packets in a row */
+    int                     nSinkStatus;    /* Frame callback failure */
+    xingest_stats_t         work;           /* Updated by the serving worker */
+    xingest_stats_t         stats;          /* Published after each turn under the lock */
+    int                     nID;
+} xingest_input_t;
+
+/*
+ * Each input is served by at most one worker at a time and for at
+ * most nSlicePackets packets or nSliceTime, then the next ready input
+ * is taken in round-robin order. Reads that return AVERROR(EAGAIN)
+ * give the worker back to the pool, but most protocols (tcp, http,
+ * rtmp, srt) block inside av_read_frame() until data arrives or
+ * nTimeout expires. For such live inputs start one worker per input,
+ * a smaller pool only serves inputs whose reads do not block.
+ *
+ * Input is stopped when the frame callback returns an error and is
+ * restarted with backoff after XINGEST_DECODE_ERRORS failed packets.
+ */
+typedef struct xingest_ {
+    pthread_mutex_t         lock;
+    pthread_cond_t          readyCond;
+
+    xingest_input_t**       pInputs;
+    size_t                  nInputs;
+    size_t                  nCapacity;
+    size_t                  nCursor;
+
+    pthread_t*              pThreads;
+    size_t                  nThreads;
+    XATOMIC                 nStop;
+
+    /* User options */
+    size_t                  nSlicePackets;
+    uint64_t                nSliceTime;     /* usec, 0: packets only */
+    int                     nCodecThreads;  /* Per decoder, workers add parallelism */
+    uint64_t                nPollTime;
+    uint64_t                nTimeout;
+    uint64_t                nBackoffMin;
+    uint64_t                nBackoffMax;
+    uint32_t                nMaxRetries;    /* 0: restart forever */
+
+    xingest_frame_cb_t      frameCallback;
+    xingest_setup_cb_t      setupCallback;
+    void*                   pUserCtx;
+    xstatus_t               status;
+} xingest_t;
+
+void XIngest_Init(xingest_t *pIngest);
+void XIngest_Destroy(xingest_t *pIngest);
+
+int XIngest_AddInput(xingest_t *pIngest, const char *pInput, const char *pInputFmt);
+XSTATUS XIngest_StopInput(xingest_t *pIngest, int nID);
+XSTATUS XIngest_GetStats(xingest_t *pIngest, int nID, xingest_stats_t *pStats);
+
+XSTATUS XIngest_Start(xingest_t *pIngest, size_t nThreads);
+void XIngest_Stop(xingest_t *pIngest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_INGEST_H__ */
@@ -0,0 +1,331 @@
+/*!
+ *  @file libxmedia/src/inputio.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the demuxer input ring buffer
+ * filled by the user transport and drained by the AVIO,
+ * and the memory-mapped local file input.
+ */
+
+#include "inputio.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+void XInputIO_Init(xinput_io_t *pInputIO)
+{
+    XASSERT_VOID(pInputIO);
+    memset(&pInputIO->stats, 0, sizeof(xinput_stats_t));
+
+    pthread_mutex_init(&pInputIO->lock, NULL);
+    pthread_cond_init(&pInputIO->dataCond, NULL);
+    pthread_cond_init(&pInputIO->spaceCond, NULL);
+    pthread_cond_init(&pInputIO->idleCond, NULL);
+    pInputIO->nBusy = 0;
+
+    pInputIO->pBuffer = NULL;
+    pInputIO->nCapacity = 0;
+    pInputIO->nReadPos = 0;
+    pInputIO->nUsed = 0;
+
+    pInputIO->bEOF = XFALSE;
+    pInputIO->bAbort = XFALSE;
+}
+
+static void XInputIO_Leave(xinput_io_t *pInputIO)
+{
+    /* Called with the lock held */
+    if (pInputIO->nBusy) pInputIO->nBusy--;
+    if (!pInputIO->nBusy) pthread_cond_broadcast(&pInputIO->idleCond);
+}
+
+void XInputIO_Destroy(xinput_io_t *pInputIO)
+{
+    XASSERT_VOID(pInputIO);
+    pthread_mutex_lock(&pInputIO->lock);
+
+    /* Wake up and wait out the producer and the demuxer */
+    pInputIO->bAbort = XTRUE;
+    pthread_cond_broadcast(&pInputIO->dataCond);
+    pthread_cond_broadcast(&pInputIO->spaceCond);
+
+    while (pInputIO->nBusy)
+        pthread_cond_wait(&pInputIO->idleCond, &pInputIO->lock);
+
+    pthread_mutex_unlock(&pInputIO->lock);
+    free(pInputIO->pBuffer);
+    pInputIO->pBuffer = NULL;
+    pInputIO->nCapacity = 0;
+    pInputIO->nUsed = 0;
+
+    pthread_cond_destroy(&pInputIO->dataCond);
+    pthread_cond_destroy(&pInputIO->spaceCond);
+    pthread_cond_destroy(&pInputIO->idleCond);
+    pthread_mutex_destroy(&pInputIO->lock);
+}
+
+XSTATUS XInputIO_Setup(xinput_io_t *pInputIO, size_t nCapacity)
+{
+    XASSERT(pInputIO, XSTDINV);
+    XASSERT((pInputIO->pBuffer == NULL), XSTDINV);
+    if (!nCapacity) nCapacity = XINPUTIO_SIZE;
+
+    pInputIO->pBuffer = (uint8_t*)malloc(nCapacity);
+    XASSERT(pInputIO->pBuffer, XSTDERR);
+
+    pInputIO->nCapacity = nCapacity;
+    pInputIO->nReadPos = 0;
+    pInputIO->nUsed = 0;
+    return XSTDOK;
+}
+
+uint8_t* XInputIO_Reserve(xinput_io_t *pInputIO, size_t *pSize)
+{
+    XASSERT((pInputIO && pSize), NULL);
+    XASSERT(pInputIO->pBuffer, NULL);
+
+    pthread_mutex_lock(&pInputIO->lock);
+    pInputIO->nBusy++;
+    *pSize = 0;
+
+    if (pInputIO->nUsed >= pInputIO->nCapacity && !pInputIO->bAbort)
+    {
+        while (pInputIO->nUsed >= pInputIO->nCapacity && !pInputIO->bAbort)
+            pthread_cond_wait(&pInputIO->spaceCond, &pInputIO->lock);
+
+        pInputIO->stats.nWriteStalls++;
+    }
+
+    if (pInputIO->bAbort || pInputIO->bEOF)
+    {
+        XInputIO_Leave(pInputIO);
+        pthread_mutex_unlock(&pInputIO->lock);
+        return NULL;
+    }
+
+    /* Contiguous free space up to the end of the ring */
+    size_t nWritePos = (pInputIO->nReadPos + pInputIO->nUsed) % pInputIO->nCapacity;
+    size_t nFree = pInputIO->nCapacity - pInputIO->nUsed;
+    *pSize = XSTD_MIN(nFree, pInputIO->nCapacity - nWritePos);
+
+    /* Stays busy until the region is committed */
+    uint8_t *pData = &pInputIO->pBuffer[nWritePos];
+    pthread_mutex_unlock(&pInputIO->lock);
+    return pData;
+}
+
+XSTATUS XInputIO_Commit(xinput_io_t *pInputIO, size_t nSize)
+{
+    XASSERT(pInputIO, XSTDINV);
+    pthread_mutex_lock(&pInputIO->lock);
+    XInputIO_Leave(pInputIO);
+
+    if (!nSize || pInputIO->bAbort)
+    {
+        pthread_mutex_unlock(&pInputIO->lock);
+        return XSTDNON;
+    }
+
+    if (pInputIO->nUsed + nSize > pInputIO->nCapacity)
+    {
+        pthread_mutex_unlock(&pInputIO->lock);
+        return XSTDINV;
+    }
+
+    pInputIO->nUsed += nSize;
+    pInputIO->stats.nBytesIn += nSize;
+    if (pInputIO->nUsed > pInputIO->stats.nMaxUsed) pInputIO->stats.nMaxUsed = pInputIO->nUsed;
+
+    pthread_cond_signal(&pInputIO->dataCond);
+    pthread_mutex_unlock(&pInputIO->lock);
+    return XSTDOK;
+}
+
+XSTATUS XInputIO_Write(xinput_io_t *pInputIO, const uint8_t *pData, size_t nSize)
+{
+    XASSERT((pInputIO && pData), XSTDINV);
+
+    while (nSize > 0)
+    {
+        size_t nAvail = 0;
+        uint8_t *pDst = XInputIO_Reserve(pInputIO, &nAvail);
+        XASSERT_RET(pDst, XSTDNON);
+
+        size_t nCopy = XSTD_MIN(nAvail, nSize);
+        memcpy(pDst, pData, nCopy);
+        XInputIO_Commit(pInputIO, nCopy);
+
+        pData += nCopy;
+        nSize -= nCopy;
+    }
+
+    return XSTDOK;
+}
+
+int XInputIO_Read(xinput_io_t *pInputIO, uint8_t *pData, int nSize)
+{
+    XASSERT((pInputIO && pData && nSize > 0), AVERROR(EINVAL));
+    pthread_mutex_lock(&pInputIO->lock);
+    pInputIO->nBusy++;
+
+    if (!pInputIO->nUsed && !pInputIO->bEOF && !pInputIO->bAbort)
+    {
+        while (!pInputIO->nUsed && !pInputIO->bEOF && !pInputIO->bAbort)
+            pthread_cond_wait(&pInputIO->dataCond, &pInputIO->lock);
+
+        pInputIO->stats.nReadStalls++;
+    }
+
+    if (pInputIO->bAbort || !pInputIO->nUsed)
+    {
+        int nStatus = pInputIO->bAbort ? AVERROR_EXIT : AVERROR_EOF;
+        XInputIO_Leave(pInputIO);
+        pthread_mutex_unlock(&pInputIO->lock);
+        return nStatus;
+    }
+
+    /* Up to two memcpy() calls when the data wraps around */
+    size_t nRead = XSTD_MIN(pInputIO->nUsed, (size_t)nSize);
+    size_t nFirst = XSTD_MIN(nRead, pInputIO->nCapacity - pInputIO->nReadPos);
+
+    memcpy(pData, &pInputIO->pBuffer[pInputIO->nReadPos], nFirst);
+    if (nRead > nFirst) memcpy(&pData[nFirst], pInputIO->pBuffer, nRead - nFirst);
+
+    pInputIO->nReadPos = (pInputIO->nReadPos + nRead) % pInputIO->nCapacity;
+    pInputIO->nUsed -= nRead;
+    pInputIO->stats.nBytesOut += nRead;
+
+    pthread_cond_signal(&pInputIO->spaceCond);
+    XInputIO_Leave(pInputIO);
+    pthread_mutex_unlock(&pInputIO->lock);
+    return (int)nRead;
+}
+
+void XInputIO_SetEOF(xinput_io_t *pInputIO)
+{
+    XASSERT_VOID(pInputIO);
+    pthread_mutex_lock(&pInputIO->lock);
+    pInputIO->bEOF = XTRUE;
+    pthread_cond_broadcast(&pInputIO->dataCond);
+    pthread_mutex_unlock(&pInputIO->lock);
+}
+
+void XInputIO_Abort(xinput_io_t *pInputIO)
+{
+    XASSERT_VOID(pInputIO);
+    pthread_mutex_lock(&pInputIO->lock);
+    pInputIO->bAbort = XTRUE;
+    pthread_cond_broadcast(&pInputIO->dataCond);
+    pthread_cond_broadcast(&pInputIO->spaceCond);
+    pthread_mutex_unlock(&pInputIO->lock);
+}
+
+XSTATUS XInputIO_GetStats(xinput_io_t *pInputIO, xinput_stats_t *pStats)
+{
+    XASSERT((pInputIO && pStats), XSTDINV);
+    pthread_mutex_lock(&pInputIO->lock);
+    *pStats = pInputIO->stats;
+    pthread_mutex_unlock(&pInputIO->lock);
+    return XSTDOK;
+}
+
+void XInputMap_Init(xinput_map_t *pMap)
+{
+    XASSERT_VOID(pMap);
+    pMap->pData = NULL;
+    pMap->nSize = 0;
+    pMap->nPos = 0;
+    pMap->nAdvised = 0;
+    pMap->nReadAhead = XINPUTMAP_AHEAD_MIN;
+}
+
+void XInputMap_Close(xinput_map_t *pMap)
+{
+    XASSERT_VOID(pMap);
+    if (pMap->pData != NULL) munmap(pMap->pData, pMap->nSize);
+    XInputMap_Init(pMap);
+}
+
+static void XInputMap_Advise(xinput_map_t *pMap)
+{
+    /* Ask the kernel to start reading the next window */
+    size_t nPageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t nStart = pMap->nPos - (pMap->nPos % nPageSize);
+    XASSERT_VOID_RET(nStart < pMap->nSize);
+
+    size_t nLength = XSTD_MIN(pMap->nReadAhead, pMap->nSize - nStart);
+    madvise(pMap->pData + nStart, nLength, MADV_WILLNEED);
+    pMap->nAdvised = nStart + nLength;
+}
+
+XSTATUS XInputMap_Open(xinput_map_t *pMap, const char *pPath)
+{
+    XASSERT((pMap && pPath), XSTDINV);
+    XASSERT((pMap->pData == NULL), XSTDINV);
+
+    int nFD = open(pPath, O_RDONLY);
+    XASSERT((nFD >= 0), XSTDERR);
+
+    /* Devices, pipes and empty files can not be mapped */
+    struct stat fileStat;
+    if (fstat(nFD, &fileStat) < 0 || !S_ISREG(fileStat.st_mode) || fileStat.st_size <= 0)
+    {
+        close(nFD);
+        return XSTDNON;
+    }
+
+    size_t nSize = (size_t)fileStat.st_size;
+    uint8_t *pData = (uint8_t*)mmap(NULL, nSize, PROT_READ, MAP_PRIVATE, nFD, 0);
+    close(nFD);
+
+    XASSERT((pData != MAP_FAILED), XSTDERR);
+    madvise(pData, nSize, MADV_SEQUENTIAL);
+
+    pMap->pData = pData;
+    pMap->nSize = nSize;
+    pMap->nPos = 0;
+
+    XInputMap_Advise(pMap);
+    return XSTDOK;
+}
+
+void XInputMap_SetBitrate(xinput_map_t *pMap, int64_t nBitRate)
+{
+    XASSERT_VOID((pMap && nBitRate > 0));
+    size_t nReadAhead = (size_t)(nBitRate / 8) * XINPUTMAP_AHEAD_SEC;
+    nReadAhead = XSTD_MAX(nReadAhead, (size_t)XINPUTMAP_AHEAD_MIN);
+    pMap->nReadAhead = XSTD_MIN(nReadAhead, (size_t)XINPUTMAP_AHEAD_MAX);
+}
+
+int XInputMap_Read(xinput_map_t *pMap, uint8_t *pData, int nSize)
+{
+    XASSERT((pMap && pData && nSize > 0), AVERROR(EINVAL));
+    XASSERT_RET((pMap->nPos < pMap->nSize), AVERROR_EOF);
+
+    size_t nRead = XSTD_MIN((size_t)nSize, pMap->nSize - pMap->nPos);
+    memcpy(pData, pMap->pData + pMap->nPos, nRead);
+    pMap->nPos += nRead;
+
+    /* Keep half of the window ahead of the reader */
+    if (pMap->nPos + pMap->nReadAhead / 2 > pMap->nAdvised) XInputMap_Advise(pMap);
+    return (int)nRead;
+}
+
+int64_t XInputMap_Seek(xinput_map_t *pMap, int64_t nOffset, int nWhence)
+{
+    XASSERT(pMap, AVERROR(EINVAL));
+    nWhence &= ~AVSEEK_FORCE;
+
+    if (nWhence == AVSEEK_SIZE) return (int64_t)pMap->nSize;
+    else if (nWhence == SEEK_CUR) nOffset += (int64_t)pMap->nPos;
+    else if (nWhence == SEEK_END) nOffset += (int64_t)pMap->nSize;
+    else if (nWhence != SEEK_SET) return AVERROR(EINVAL);
+
+    XASSERT((nOffset >= 0 && (size_t)nOffset <= pMap->nSize), AVERROR(EINVAL));
+    pMap->nPos = (size_t)nOffset;
+
+    XInputMap_Advise(pMap);
+    return nOffset;
+}
@@ -0,0 +1,100 @@
+/*!
+ *  @file libxmedia/src/inputio.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the demuxer input ring buffer
+ * filled by the user transport and drained by the AVIO,
+ * and the memory-mapped local file input.
+ */
+
+#ifndef __XMEDIA_INPUTIO_H__
+#define __XMEDIA_INPUTIO_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include <pthread.h>
+
+#define XINPUTIO_SIZE           (1024 * 1024)
+
+/* Readahead window of the mapped input */
+#define XINPUTMAP_AHEAD_MIN     (1024 * 1024)
+#define XINPUTMAP_AHEAD_MAX     (1024 * 1024 * 64)
+#define XINPUTMAP_AHEAD_SEC     2
+
+typedef struct xinput_stats_ {
+    uint64_t                nBytesIn;
+    uint64_t                nBytesOut;
+    uint64_t                nReadStalls;    /* Demuxer waited for data */
+    uint64_t                nWriteStalls;   /* Producer waited for space */
+    size_t                  nMaxUsed;
+} xinput_stats_t;
+
+/*
+ * Producer can reserve a contiguous region, fill it in place
+ * (e.g. recv() straight into the ring) and commit, so no extra
+ * copy is made before the bytes reach the AVIO read buffer.
+ * Every reservation must be committed (zero size is allowed).
+ * Destroy waits until no thread is inside the ring and nothing
+ * is reserved, but callers must not enter it after that.
+ */
+typedef struct xinput_io_ {
+    pthread_mutex_t         lock;
+    pthread_cond_t          dataCond;
+    pthread_cond_t          spaceCond;
+    pthread_cond_t          idleCond;
+    size_t                  nBusy;          /* Blocked callers and open reservations */
+
+    uint8_t*                pBuffer;
+    size_t                  nCapacity;
+    size_t                  nReadPos;
+    size_t                  nUsed;
+
+    xbool_t                 bEOF;
+    xbool_t                 bAbort;
+    xinput_stats_t          stats;
+} xinput_io_t;
+
+/*
+ * Read-only mapping of a local file used instead of the
+ * file protocol, reads are served with memcpy() from the
+ * page cache and the kernel is hinted ahead of the reader.
+ */
+typedef struct xinput_map_ {
+    uint8_t*                pData;
+    size_t                  nSize;
+    size_t                  nPos;
+    size_t                  nAdvised;       /* End of the last WILLNEED window */
+    size_t                  nReadAhead;
+} xinput_map_t;
+
+void XInputMap_Init(xinput_map_t *pMap);
+void XInputMap_Close(xinput_map_t *pMap);
+XSTATUS XInputMap_Open(xinput_map_t *pMap, const char *pPath);
+void XInputMap_SetBitrate(xinput_map_t *pMap, int64_t nBitRate);
+
+int XInputMap_Read(xinput_map_t *pMap, uint8_t *pData, int nSize);
+int64_t XInputMap_Seek(xinput_map_t *pMap, int64_t nOffset, int nWhence);
+
+void XInputIO_Init(xinput_io_t *pInputIO);
+void XInputIO_Destroy(xinput_io_t *pInputIO);
+XSTATUS XInputIO_Setup(xinput_io_t *pInputIO, size_t nCapacity);
+
+uint8_t* XInputIO_Reserve(xinput_io_t *pInputIO, size_t *pSize);
+XSTATUS XInputIO_Commit(xinput_io_t *pInputIO, size_t nSize);
+XSTATUS XInputIO_Write(xinput_io_t *pInputIO, const uint8_t *pData, size_t nSize);
+int XInputIO_Read(xinput_io_t *pInputIO, uint8_t *pData, int nSize);
+
+void XInputIO_SetEOF(xinput_io_t *pInputIO);
+void XInputIO_Abort(xinput_io_t *pInputIO);
+XSTATUS XInputIO_GetStats(xinput_io_t *pInputIO, xinput_stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_INPUTIO_H__ */
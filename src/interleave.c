@@ -0,0 +1,144 @@
+/*!
+ *  @file libxmedia/src/interleave.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the bounded packet interleaver
+ * used by low latency output with av_write_frame().
+ */
+
+#include "interleave.h"
+
+void XInterleaver_Init(xinterleaver_t *pInterleaver)
+{
+    XASSERT_VOID(pInterleaver);
+    pInterleaver->pEntries = NULL;
+    pInterleaver->nCapacity = 0;
+    pInterleaver->nUsed = 0;
+    pInterleaver->nStreams = 0;
+    pInterleaver->nMaxDelta = XINTERLEAVE_MAX_DELTA;
+    pInterleaver->nNewestDTS = AV_NOPTS_VALUE;
+
+    int i;
+    for (i = 0; i < XINTERLEAVE_STREAMS_MAX; i++)
+        pInterleaver->nLastDTS[i] = AV_NOPTS_VALUE;
+}
+
+void XInterleaver_Destroy(xinterleaver_t *pInterleaver)
+{
+    XASSERT_VOID(pInterleaver);
+    size_t i;
+
+    for (i = 0; i < pInterleaver->nUsed; i++)
+    {
+        AVPacket *pPacket = pInterleaver->pEntries[i].pPacket;
+        if (pPacket != NULL) av_packet_free(&pPacket);
+    }
+
+    if (pInterleaver->pEntries != NULL)
+    {
+        free(pInterleaver->pEntries);
+        pInterleaver->pEntries = NULL;
+    }
+
+    pInterleaver->nCapacity = 0;
+    pInterleaver->nUsed = 0;
+}
+
+XSTATUS XInterleaver_Setup(xinterleaver_t *pInterleaver, int nStreams, size_t nCapacity, int64_t nMaxDelta)
+{
+    XASSERT(pInterleaver, XSTDINV);
+    XInterleaver_Destroy(pInterleaver);
+    XInterleaver_Init(pInterleaver);
+
+    XASSERT((nStreams > 0 && nStreams <= XINTERLEAVE_STREAMS_MAX), XSTDINV);
+    if (!nCapacity) nCapacity = XINTERLEAVE_QUEUE_SIZE;
+
+    pInterleaver->pEntries = (xinterleave_entry_t*)calloc(nCapacity, sizeof(xinterleave_entry_t));
+    XASSERT(pInterleaver->pEntries, XSTDERR);
+
+    pInterleaver->nCapacity = nCapacity;
+    pInterleaver->nMaxDelta = nMaxDelta;
+    pInterleaver->nStreams = nStreams;
+    return XSTDOK;
+}
+
+XSTATUS XInterleaver_Push(xinterleaver_t *pInterleaver, AVPacket *pPacket, AVRational timeBase, uint64_t nStartTime)
+{
+    XASSERT((pInterleaver && pPacket), XSTDINV);
+    XASSERT((pInterleaver->nUsed < pInterleaver->nCapacity), XSTDNON);
+    XASSERT((pPacket->stream_index >= 0 && pPacket->stream_index < pInterleaver->nStreams), XSTDINV);
+
+    int64_t nTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+    int64_t nDTS = pInterleaver->nNewestDTS;
+
+    if (nTS != AV_NOPTS_VALUE) nDTS = av_rescale_q(nTS, timeBase, AV_TIME_BASE_Q);
+    if (nDTS == AV_NOPTS_VALUE) nDTS = 0;
+
+    AVPacket *pRef = av_packet_alloc();
+    XASSERT(pRef, XSTDERR);
+
+    if (av_packet_ref(pRef, pPacket) < 0)
+    {
+        av_packet_free(&pRef);
+        return XSTDERR;
+    }
+
+    /* Keep entries sorted by DTS, new packets usually land at the tail */
+    size_t nPos = pInterleaver->nUsed;
+    while (nPos > 0 && pInterleaver->pEntries[nPos - 1].nDTS > nDTS)
+    {
+        pInterleaver->pEntries[nPos] = pInterleaver->pEntries[nPos - 1];
+        nPos--;
+    }
+
+    pInterleaver->pEntries[nPos].pPacket = pRef;
+    pInterleaver->pEntries[nPos].nStartTime = nStartTime;
+    pInterleaver->pEntries[nPos].nDTS = nDTS;
+    pInterleaver->nUsed++;
+
+    pInterleaver->nLastDTS[pPacket->stream_index] = nDTS;
+    if (pInterleaver->nNewestDTS == AV_NOPTS_VALUE ||
+        pInterleaver->nNewestDTS < nDTS)
+        pInterleaver->nNewestDTS = nDTS;
+
+    return XSTDOK;
+}
+
+static xbool_t XInterleaver_CanRelease(xinterleaver_t *pInterleaver)
+{
+    xinterleave_entry_t *pHead = &pInterleaver->pEntries[0];
+    if (pInterleaver->nUsed >= pInterleaver->nCapacity) return XTRUE;
+
+    if (pInterleaver->nMaxDelta >= 0 &&
+        pInterleaver->nNewestDTS - pHead->nDTS >= pInterleaver->nMaxDelta)
+        return XTRUE;
+
+    /* Release when no other stream can produce an earlier packet */
+    int i;
+    for (i = 0; i < pInterleaver->nStreams; i++)
+    {
+        if (i == pHead->pPacket->stream_index) continue;
+        int64_t nLastDTS = pInterleaver->nLastDTS[i];
+        if (nLastDTS == AV_NOPTS_VALUE || nLastDTS < pHead->nDTS) return XFALSE;
+    }
+
+    return XTRUE;
+}
+
+AVPacket* XInterleaver_Pop(xinterleaver_t *pInterleaver, xbool_t bFlush, uint64_t *pStartTime)
+{
+    XASSERT_RET((pInterleaver && pInterleaver->nUsed), NULL);
+    if (!bFlush && !XInterleaver_CanRelease(pInterleaver)) return NULL;
+
+    xinterleave_entry_t *pHead = &pInterleaver->pEntries[0];
+    AVPacket *pPacket = pHead->pPacket;
+    if (pStartTime != NULL) *pStartTime = pHead->nStartTime;
+
+    pInterleaver->nUsed--;
+    memmove(&pInterleaver->pEntries[0], &pInterleaver->pEntries[1],
+        pInterleaver->nUsed * sizeof(xinterleave_entry_t));
+
+    return pPacket;
+}
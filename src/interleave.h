@@ -0,0 +1,55 @@
+/*!
+ *  @file libxmedia/src/interleave.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the bounded packet interleaver
+ * used by low latency output with av_write_frame().
+ */
+
+#ifndef __XMEDIA_INTERLEAVE_H__
+#define __XMEDIA_INTERLEAVE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XINTERLEAVE_QUEUE_SIZE      64
+#define XINTERLEAVE_MAX_DELTA       (50 * 1000) /* usec */
+#define XINTERLEAVE_STREAMS_MAX     32
+
+typedef struct xinterleave_entry_ {
+    AVPacket*   pPacket;
+    uint64_t    nStartTime;
+    int64_t     nDTS;
+} xinterleave_entry_t;
+
+typedef struct xinterleaver_ {
+    xinterleave_entry_t*    pEntries;
+    size_t                  nCapacity;
+    size_t                  nUsed;
+
+    /* Last seen DTS per stream in AV_TIME_BASE */
+    int64_t                 nLastDTS[XINTERLEAVE_STREAMS_MAX];
+    int                     nStreams;
+
+    /* Maximum DTS span (usec) to hold packets */
+    int64_t                 nMaxDelta;
+    int64_t                 nNewestDTS;
+} xinterleaver_t;
+
+void XInterleaver_Init(xinterleaver_t *pInterleaver);
+void XInterleaver_Destroy(xinterleaver_t *pInterleaver);
+
+XSTATUS XInterleaver_Setup(xinterleaver_t *pInterleaver, int nStreams, size_t nCapacity, int64_t nMaxDelta);
+XSTATUS XInterleaver_Push(xinterleaver_t *pInterleaver, AVPacket *pPacket, AVRational timeBase, uint64_t nStartTime);
+AVPacket* XInterleaver_Pop(xinterleaver_t *pInterleaver, xbool_t bFlush, uint64_t *pStartTime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_INTERLEAVE_H__ */
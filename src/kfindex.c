@@ -0,0 +1,230 @@
+/*!
+ *  @file libxmedia/src/kfindex.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the keyframe index with
+ * memory-mapped sidecar file used for the fast seeking.
+ */
+
+#include "kfindex.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#define XKFINDEX_TIME(entry) ((entry)->nPTS != AV_NOPTS_VALUE ? (entry)->nPTS : (entry)->nDTS)
+
+void XKFIndex_Init(xkf_index_t *pIndex)
+{
+    XASSERT_VOID(pIndex);
+    pIndex->pEntries = NULL;
+    pIndex->nCapacity = 0;
+    pIndex->nCount = 0;
+    pIndex->bSorted = XTRUE;
+
+    pIndex->pMap = NULL;
+    pIndex->nMapSize = 0;
+
+    pIndex->nStreams = 0;
+    pIndex->nSourceSize = XSTDERR;
+}
+
+void XKFIndex_Destroy(xkf_index_t *pIndex)
+{
+    XASSERT_VOID(pIndex);
+
+    if (pIndex->pMap != NULL) munmap(pIndex->pMap, pIndex->nMapSize);
+    else free(pIndex->pEntries);
+
+    XKFIndex_Init(pIndex);
+}
+
+void XKFIndex_Move(xkf_index_t *pDst, xkf_index_t *pSrc)
+{
+    XASSERT_VOID((pDst && pSrc));
+    XKFIndex_Destroy(pDst);
+    *pDst = *pSrc;
+    XKFIndex_Init(pSrc);
+}
+
+XSTATUS XKFIndex_Add(xkf_index_t *pIndex, const AVPacket *pPacket)
+{
+    XASSERT((pIndex && pPacket), XSTDINV);
+    XASSERT((pIndex->pMap == NULL), XSTDINV);
+
+    XASSERT_RET((pPacket->flags & AV_PKT_FLAG_KEY), XSTDNON);
+    XASSERT_RET((pPacket->pts != AV_NOPTS_VALUE ||
+                 pPacket->dts != AV_NOPTS_VALUE), XSTDNON);
+
+    if (pIndex->nCount >= pIndex->nCapacity)
+    {
+        size_t nCapacity = pIndex->nCapacity ? pIndex->nCapacity * 2 : 1024;
+        xkf_entry_t *pEntries = (xkf_entry_t*)realloc(pIndex->pEntries, nCapacity * sizeof(xkf_entry_t));
+        XASSERT(pEntries, XSTDERR);
+
+        pIndex->pEntries = pEntries;
+        pIndex->nCapacity = nCapacity;
+    }
+
+    xkf_entry_t *pEntry = &pIndex->pEntries[pIndex->nCount];
+    pEntry->nPTS = pPacket->pts;
+    pEntry->nDTS = pPacket->dts;
+    pEntry->nPos = pPacket->pos;
+    pEntry->nStream = pPacket->stream_index;
+    pEntry->nFlags = pPacket->flags;
+
+    if (pIndex->nCount && pIndex->bSorted)
+    {
+        /* Demuxing order is mostly sorted already, avoid needless qsort */
+        const xkf_entry_t *pLast = &pIndex->pEntries[pIndex->nCount - 1];
+        if (pLast->nStream > pEntry->nStream || (pLast->nStream == pEntry->nStream &&
+            XKFINDEX_TIME(pLast) > XKFINDEX_TIME(pEntry))) pIndex->bSorted = XFALSE;
+    }
+
+    if ((uint32_t)pEntry->nStream >= pIndex->nStreams)
+        pIndex->nStreams = (uint32_t)pEntry->nStream + 1;
+
+    pIndex->nCount++;
+    return XSTDOK;
+}
+
+static int XKFIndex_Compare(const void *pA, const void *pB)
+{
+    const xkf_entry_t *pFirst = (const xkf_entry_t*)pA;
+    const xkf_entry_t *pSecond = (const xkf_entry_t*)pB;
+
+    if (pFirst->nStream != pSecond->nStream)
+        return pFirst->nStream < pSecond->nStream ? -1 : 1;
+
+    int64_t nFirst = XKFINDEX_TIME(pFirst);
+    int64_t nSecond = XKFINDEX_TIME(pSecond);
+    return nFirst < nSecond ? -1 : (nFirst > nSecond ? 1 : 0);
+}
+
+void XKFIndex_Sort(xkf_index_t *pIndex)
+{
+    XASSERT_VOID(pIndex);
+    XASSERT_VOID_RET(!pIndex->bSorted);
+
+    qsort(pIndex->pEntries, pIndex->nCount, sizeof(xkf_entry_t), XKFIndex_Compare);
+    pIndex->bSorted = XTRUE;
+}
+
+XSTATUS XKFIndex_Save(xkf_index_t *pIndex, const char *pPath)
+{
+    XASSERT((pIndex && pPath), XSTDINV);
+    XKFIndex_Sort(pIndex);
+
+    xkf_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.sMagic, XKFINDEX_MAGIC, sizeof(header.sMagic));
+
+    header.nVersion = XKFINDEX_VERSION;
+    header.nStreams = pIndex->nStreams;
+    header.nCount = pIndex->nCount;
+    header.nSourceSize = pIndex->nSourceSize;
+
+    FILE *pFile = fopen(pPath, "wb");
+    XASSERT(pFile, XSTDERR);
+
+    xbool_t bWritten = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+        (!pIndex->nCount || fwrite(pIndex->pEntries, sizeof(xkf_entry_t), pIndex->nCount, pFile) == pIndex->nCount);
+
+    if (fclose(pFile) || !bWritten)
+    {
+        remove(pPath);
+        return XSTDERR;
+    }
+
+    return XSTDOK;
+}
+
+XSTATUS XKFIndex_Load(xkf_index_t *pIndex, const char *pPath)
+{
+    XASSERT((pIndex && pPath), XSTDINV);
+    XKFIndex_Destroy(pIndex);
+
+    int nFD = open(pPath, O_RDONLY);
+    XASSERT((nFD >= 0), XSTDERR);
+
+    struct stat fileStat;
+    if (fstat(nFD, &fileStat) < 0 || (size_t)fileStat.st_size < sizeof(xkf_header_t))
+    {
+        close(nFD);
+        return XSTDERR;
+    }
+
+    size_t nMapSize = (size_t)fileStat.st_size;
+    uint8_t *pMap = (uint8_t*)mmap(NULL, nMapSize, PROT_READ, MAP_SHARED, nFD, 0);
+    close(nFD);
+
+    XASSERT((pMap != MAP_FAILED), XSTDERR);
+    const xkf_header_t *pHeader = (const xkf_header_t*)pMap;
+
+    if (memcmp(pHeader->sMagic, XKFINDEX_MAGIC, sizeof(pHeader->sMagic)) ||
+        pHeader->nVersion != XKFINDEX_VERSION ||
+        pHeader->nCount > (nMapSize - sizeof(xkf_header_t)) / sizeof(xkf_entry_t))
+    {
+        munmap(pMap, nMapSize);
+        return XSTDERR;
+    }
+
+    /* Entries are used in place, nothing is copied */
+    pIndex->pEntries = (xkf_entry_t*)(pMap + sizeof(xkf_header_t));
+    pIndex->nCount = (size_t)pHeader->nCount;
+    pIndex->nCapacity = pIndex->nCount;
+    pIndex->nStreams = pHeader->nStreams;
+    pIndex->nSourceSize = pHeader->nSourceSize;
+    pIndex->bSorted = XTRUE;
+    pIndex->pMap = pMap;
+    pIndex->nMapSize = nMapSize;
+
+    return XSTDOK;
+}
+
+static size_t XKFIndex_LowerBound(xkf_index_t *pIndex, int nStream, int64_t nTS)
+{
+    /* First entry that is not less than (nStream, nTS) */
+    size_t nLow = 0, nHigh = pIndex->nCount;
+
+    while (nLow < nHigh)
+    {
+        size_t nMid = nLow + (nHigh - nLow) / 2;
+        const xkf_entry_t *pEntry = &pIndex->pEntries[nMid];
+
+        if (pEntry->nStream < nStream || (pEntry->nStream == nStream &&
+            XKFINDEX_TIME(pEntry) < nTS)) nLow = nMid + 1;
+        else nHigh = nMid;
+    }
+
+    return nLow;
+}
+
+const xkf_entry_t* XKFIndex_Find(xkf_index_t *pIndex, int nStream, int64_t nTS)
+{
+    XASSERT((pIndex && pIndex->nCount), NULL);
+    XKFIndex_Sort(pIndex);
+
+    /* Last keyframe at or before the target */
+    size_t nPos = XKFIndex_LowerBound(pIndex, nStream, nTS);
+    if (nPos < pIndex->nCount)
+    {
+        const xkf_entry_t *pEntry = &pIndex->pEntries[nPos];
+        if (pEntry->nStream == nStream && XKFINDEX_TIME(pEntry) == nTS) return pEntry;
+    }
+
+    XASSERT_RET(nPos, NULL);
+    const xkf_entry_t *pEntry = &pIndex->pEntries[nPos - 1];
+    return pEntry->nStream == nStream ? pEntry : NULL;
+}
+
+size_t XKFIndex_GetCount(xkf_index_t *pIndex, int nStream)
+{
+    XASSERT_RET(pIndex, 0);
+    XKFIndex_Sort(pIndex);
+
+    size_t nFirst = XKFIndex_LowerBound(pIndex, nStream, INT64_MIN);
+    size_t nLast = XKFIndex_LowerBound(pIndex, nStream + 1, INT64_MIN);
+    return nLast - nFirst;
+}
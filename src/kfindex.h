@@ -0,0 +1,71 @@
+/*!
+ *  @file libxmedia/src/kfindex.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the keyframe index with
+ * memory-mapped sidecar file used for the fast seeking.
+ */
+
+#ifndef __XMEDIA_KFINDEX_H__
+#define __XMEDIA_KFINDEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XKFINDEX_MAGIC          "XKFINDEX"
+#define XKFINDEX_VERSION        1
+
+/* On-disk layout, header is followed by the sorted entries */
+typedef struct xkf_header_ {
+    char                    sMagic[8];
+    uint32_t                nVersion;
+    uint32_t                nStreams;
+    uint64_t                nCount;
+    int64_t                 nSourceSize;
+} xkf_header_t;
+
+typedef struct xkf_entry_ {
+    int64_t                 nPTS;
+    int64_t                 nDTS;
+    int64_t                 nPos;       /* Byte offset in the source */
+    int32_t                 nStream;
+    int32_t                 nFlags;
+} xkf_entry_t;
+
+typedef struct xkf_index_ {
+    xkf_entry_t*            pEntries;
+    size_t                  nCapacity;
+    size_t                  nCount;
+    xbool_t                 bSorted;
+
+    /* Read-only when loaded from the sidecar */
+    uint8_t*                pMap;
+    size_t                  nMapSize;
+
+    uint32_t                nStreams;
+    int64_t                 nSourceSize;
+} xkf_index_t;
+
+void XKFIndex_Init(xkf_index_t *pIndex);
+void XKFIndex_Destroy(xkf_index_t *pIndex);
+void XKFIndex_Move(xkf_index_t *pDst, xkf_index_t *pSrc);
+
+XSTATUS XKFIndex_Add(xkf_index_t *pIndex, const AVPacket *pPacket);
+void XKFIndex_Sort(xkf_index_t *pIndex);
+
+XSTATUS XKFIndex_Save(xkf_index_t *pIndex, const char *pPath);
+XSTATUS XKFIndex_Load(xkf_index_t *pIndex, const char *pPath);
+
+const xkf_entry_t* XKFIndex_Find(xkf_index_t *pIndex, int nStream, int64_t nTS);
+size_t XKFIndex_GetCount(xkf_index_t *pIndex, int nStream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_KFINDEX_H__ */
@@ -0,0 +1,186 @@
+/*!
+ *  @file libxmedia/src/loadshed.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the real-time load shedding
+ * policy used to keep the encoding latency bounded.
+ */
+
+#include "loadshed.h"
+
+static const char *g_presets[] =
+{
+    "placebo", "veryslow", "slower", "slow", "medium",
+    "fast", "faster", "veryfast", "superfast", "ultrafast"
+};
+
+void XLoadShed_Init(xloadshed_t *pShed)
+{
+    XASSERT_VOID(pShed);
+    pShed->ePolicy = XLOADSHED_OFF;
+    pShed->nBudget = 0;
+    pShed->nMaxLag = XLOADSHED_MAX_LAG;
+    pShed->nMaxQueue = XLOADSHED_MAX_QUEUE;
+    pShed->bStepDown = XFALSE;
+    XLoadShed_Reset(pShed);
+}
+
+void XLoadShed_Reset(xloadshed_t *pShed)
+{
+    XASSERT_VOID(pShed);
+    memset(&pShed->stats, 0, sizeof(xloadshed_stats_t));
+
+    pShed->nStartTime = 0;
+    pShed->nStartPTS = 0;
+    pShed->fEncodeTime = 0.;
+    pShed->nDropInterval = 0;
+    pShed->nFrameCounter = 0;
+    pShed->nOverloaded = 0;
+    pShed->bOverload = XFALSE;
+    pShed->bWaitKey = XFALSE;
+}
+
+static int64_t XLoadShed_GetLag(xloadshed_t *pShed, int64_t nMediaTime)
+{
+    uint64_t nNow = XTime_GetStamp();
+
+    /* Start over on the first frame and when the source loops back */
+    if (!pShed->nStartTime || nMediaTime < pShed->nStartPTS)
+    {
+        pShed->nStartTime = nNow;
+        pShed->nStartPTS = nMediaTime;
+        return 0;
+    }
+
+    int64_t nElapsed = (int64_t)(nNow - pShed->nStartTime);
+    pShed->stats.nLag = nElapsed - (nMediaTime - pShed->nStartPTS);
+    return pShed->stats.nLag;
+}
+
+static xbool_t XLoadShed_Evaluate(xloadshed_t *pShed, int64_t nLag, size_t nQueueDepth, uint64_t nBudget)
+{
+    xbool_t bBacklog = (pShed->nMaxLag > 0 && nLag > pShed->nMaxLag) ||
+                       (pShed->nMaxQueue && nQueueDepth > pShed->nMaxQueue);
+
+    xbool_t bSlow = nBudget && pShed->fEncodeTime > (double)nBudget;
+
+    if (bBacklog || bSlow)
+    {
+        /* Drop enough frames to bring the encode time under budget */
+        uint32_t nInterval = 2;
+        if (bSlow && !bBacklog)
+        {
+            double fRatio = 1. - (double)nBudget / pShed->fEncodeTime;
+            nInterval = (uint32_t)XSTD_MAX(1. / fRatio + 0.5, 2.);
+        }
+
+        pShed->nDropInterval = nInterval;
+        pShed->bOverload = XTRUE;
+    }
+    else if (pShed->bOverload)
+    {
+        /* Hysteresis, recover only with a clear margin */
+        xbool_t bLagOk = pShed->nMaxLag <= 0 || nLag < pShed->nMaxLag / 2;
+        xbool_t bQueueOk = !pShed->nMaxQueue || nQueueDepth <= pShed->nMaxQueue / 2;
+        xbool_t bTimeOk = !nBudget || pShed->fEncodeTime < (double)nBudget * 0.8;
+
+        if (bLagOk && bQueueOk && bTimeOk)
+        {
+            pShed->bOverload = XFALSE;
+            pShed->nFrameCounter = 0;
+            pShed->nOverloaded = 0;
+        }
+    }
+
+    return bBacklog;
+}
+
+xbool_t XLoadShed_CheckFrame(xloadshed_t *pShed, int64_t nMediaTime, uint64_t nPeriod, size_t nQueueDepth)
+{
+    XASSERT_RET((pShed && pShed->ePolicy != XLOADSHED_OFF), XFALSE);
+    uint64_t nBudget = pShed->nBudget ? pShed->nBudget : nPeriod;
+    pShed->stats.nFrames++;
+
+    int64_t nLag = XLoadShed_GetLag(pShed, nMediaTime);
+    xbool_t bBacklog = XLoadShed_Evaluate(pShed, nLag, nQueueDepth, nBudget);
+    XASSERT_RET(pShed->bOverload, XFALSE);
+
+    xbool_t bDrop = XFALSE;
+    pShed->nOverloaded++;
+
+    if (pShed->ePolicy == XLOADSHED_SKIP && bBacklog) bDrop = XTRUE;
+    else if (pShed->nDropInterval && !(++pShed->nFrameCounter % pShed->nDropInterval)) bDrop = XTRUE;
+
+    if (bDrop) pShed->stats.nDropped++;
+    return bDrop;
+}
+
+xbool_t XLoadShed_CheckPacket(xloadshed_t *pShed, int64_t nMediaTime, int nFlags, size_t nQueueDepth)
+{
+    XASSERT_RET((pShed && pShed->ePolicy != XLOADSHED_OFF), XFALSE);
+    xbool_t bKey = (nFlags & AV_PKT_FLAG_KEY) ? XTRUE : XFALSE;
+
+    int64_t nLag = XLoadShed_GetLag(pShed, nMediaTime);
+    xbool_t bBacklog = XLoadShed_Evaluate(pShed, nLag, nQueueDepth, 0);
+    xbool_t bDrop = XFALSE;
+
+    /* Reference chain is broken until the next keyframe */
+    if (pShed->bWaitKey && !bKey) bDrop = XTRUE;
+    else if (pShed->bWaitKey) pShed->bWaitKey = XFALSE;
+    else if (pShed->bOverload && (nFlags & AV_PKT_FLAG_DISPOSABLE)) bDrop = XTRUE;
+    else if (pShed->bOverload && bBacklog && !bKey && pShed->ePolicy == XLOADSHED_SKIP)
+    {
+        pShed->bWaitKey = XTRUE;
+        bDrop = XTRUE;
+    }
+
+    if (bDrop) pShed->stats.nPacketsDropped++;
+    return bDrop;
+}
+
+xbool_t XLoadShed_UpdateTime(xloadshed_t *pShed, uint64_t nEncodeTime, uint64_t nPeriod)
+{
+    XASSERT_RET((pShed && pShed->ePolicy != XLOADSHED_OFF), XFALSE);
+    xloadshed_stats_t *pStats = &pShed->stats;
+
+    if (pShed->fEncodeTime <= 0.) pShed->fEncodeTime = (double)nEncodeTime;
+    else pShed->fEncodeTime += XLOADSHED_SMOOTH * ((double)nEncodeTime - pShed->fEncodeTime);
+
+    if (nEncodeTime > pStats->nMaxEncodeTime) pStats->nMaxEncodeTime = nEncodeTime;
+    pStats->nEncodeTime = (uint64_t)pShed->fEncodeTime;
+
+    /* Dropping alone did not help for a while, encoder itself is too slow */
+    uint64_t nBudget = pShed->nBudget ? pShed->nBudget : nPeriod;
+    XASSERT_RET((pShed->bStepDown && nBudget), XFALSE);
+    XASSERT_RET((pShed->nOverloaded >= XLOADSHED_STEP_FRAMES), XFALSE);
+    XASSERT_RET((pShed->fEncodeTime > (double)nBudget), XFALSE);
+
+    pShed->nOverloaded = 0;
+    return XTRUE;
+}
+
+const char* XLoadShed_GetPolicyStr(xloadshed_policy_t ePolicy)
+{
+    switch (ePolicy)
+    {
+        case XLOADSHED_DECIMATE: return "decimate";
+        case XLOADSHED_SKIP: return "skip";
+        case XLOADSHED_OFF:
+        default: break;
+    }
+
+    return "off";
+}
+
+const char* XLoadShed_NextPreset(const char *pPreset)
+{
+    size_t i, nCount = sizeof(g_presets) / sizeof(g_presets[0]);
+    if (!xstrused(pPreset)) pPreset = "medium";
+
+    for (i = 0; i + 1 < nCount; i++)
+        if (!strcmp(g_presets[i], pPreset)) return g_presets[i + 1];
+
+    return NULL;
+}
@@ -0,0 +1,78 @@
+/*!
+ *  @file libxmedia/src/loadshed.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the real-time load shedding
+ * policy used to keep the encoding latency bounded.
+ */
+
+#ifndef __XMEDIA_LOADSHED_H__
+#define __XMEDIA_LOADSHED_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XLOADSHED_MAX_LAG       (500 * 1000)    /* usec */
+#define XLOADSHED_MAX_QUEUE     32
+#define XLOADSHED_SMOOTH        0.1
+#define XLOADSHED_STEP_FRAMES   100             /* Overloaded frames before preset step down */
+
+typedef enum {
+    XLOADSHED_OFF,          // Never drop, encoding may block the producer
+    XLOADSHED_DECIMATE,     // Drop evenly spaced frames in proportion to the overload
+    XLOADSHED_SKIP          // Drop every frame until the backlog is cleared
+} xloadshed_policy_t;
+
+typedef struct xloadshed_stats_ {
+    uint64_t                nFrames;
+    uint64_t                nDropped;
+    uint64_t                nPacketsDropped;
+    uint64_t                nStepDowns;
+    uint64_t                nEncodeTime;    /* usec, smoothed */
+    uint64_t                nMaxEncodeTime; /* usec */
+    int64_t                 nLag;           /* usec, behind the wall clock */
+} xloadshed_stats_t;
+
+typedef struct xloadshed_ {
+    xloadshed_policy_t      ePolicy;
+    xloadshed_stats_t       stats;
+
+    /* Media time against wall clock */
+    uint64_t                nStartTime;
+    int64_t                 nStartPTS;
+
+    /* Overload state */
+    double                  fEncodeTime;
+    uint32_t                nDropInterval;
+    uint32_t                nFrameCounter;
+    uint32_t                nOverloaded;
+    xbool_t                 bOverload;
+    xbool_t                 bWaitKey;
+
+    /* User options */
+    uint64_t                nBudget;        /* usec per frame, 0 = frame period */
+    int64_t                 nMaxLag;        /* usec */
+    size_t                  nMaxQueue;
+    xbool_t                 bStepDown;
+} xloadshed_t;
+
+void XLoadShed_Init(xloadshed_t *pShed);
+void XLoadShed_Reset(xloadshed_t *pShed);
+
+xbool_t XLoadShed_CheckFrame(xloadshed_t *pShed, int64_t nMediaTime, uint64_t nPeriod, size_t nQueueDepth);
+xbool_t XLoadShed_CheckPacket(xloadshed_t *pShed, int64_t nMediaTime, int nFlags, size_t nQueueDepth);
+xbool_t XLoadShed_UpdateTime(xloadshed_t *pShed, uint64_t nEncodeTime, uint64_t nPeriod);
+
+const char* XLoadShed_GetPolicyStr(xloadshed_policy_t ePolicy);
+const char* XLoadShed_NextPreset(const char *pPreset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_LOADSHED_H__ */
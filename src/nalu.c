@@ -35,8 +35,10 @@ xnal_unit_t* XNAL_AllocUnit()
     return pUnit;
 }
 
-size_t XNAL_CheckStartCode(uint8_t *pBuffer, size_t nPos)
+size_t XNAL_CheckStartCode(const uint8_t *pBuffer, size_t nSize, size_t nPos)
 {
+    XASSERT_RET((nPos + 3 <= nSize), 0);
+
     /* Search for NAL unit start code: 0x000001 */
     if (pBuffer[nPos] == 0x00 &&
         pBuffer[nPos + 1] == 0x00 &&
@@ -44,7 +46,8 @@ size_t XNAL_CheckStartCode(uint8_t *pBuffer, size_t nPos)
             return 3;
 
     /* Search for NAL unit start code: 0x00000001  */
-    if (pBuffer[nPos] == 0x00 &&
+    if (nPos + 4 <= nSize &&
+        pBuffer[nPos] == 0x00 &&
         pBuffer[nPos + 1] == 0x00 &&
         pBuffer[nPos + 2] == 0x00 &&
         pBuffer[nPos + 3] == 0x01)
@@ -53,55 +56,105 @@ size_t XNAL_CheckStartCode(uint8_t *pBuffer, size_t nPos)
     return 0;
 }
 
-xarray_t* XNAL_ParseUnits(uint8_t *pBuffer, size_t nSize)
+const uint8_t* XNAL_FindStartCode(const uint8_t *pData, const uint8_t *pEnd, size_t *pCodeSize)
+{
+    XASSERT((pData && pEnd && pCodeSize), NULL);
+
+    while (pEnd - pData >= 3)
+    {
+        /* Only zero bytes can start the code, memchr() is vectorized by libc */
+        const uint8_t *pZero = (const uint8_t*)memchr(pData, 0x00, (size_t)(pEnd - pData - 2));
+        XASSERT_RET(pZero, NULL);
+
+        if (pZero[1] != 0x00)
+        {
+            /* Next candidate is after the non-zero byte */
+            pData = pZero + 2;
+            continue;
+        }
+
+        if (pZero[2] == 0x01)
+        {
+            *pCodeSize = 3;
+            return pZero;
+        }
+
+        if (pZero[2] == 0x00 && pEnd - pZero >= 4 && pZero[3] == 0x01)
+        {
+            *pCodeSize = 4;
+            return pZero;
+        }
+
+        pData = pZero + 1;
+    }
+
+    return NULL;
+}
+
+void XNAL_InitIter(xnal_iter_t *pIter, const uint8_t *pBuffer, size_t nSize)
+{
+    XASSERT_VOID(pIter);
+    pIter->pBuffer = pBuffer;
+    pIter->nSize = pBuffer != NULL ? nSize : 0;
+    pIter->nNextPos = pIter->nSize;
+    pIter->nCodeSize = 0;
+
+    const uint8_t *pCode = XNAL_FindStartCode(pBuffer, pBuffer + pIter->nSize, &pIter->nCodeSize);
+    if (pCode != NULL) pIter->nNextPos = (size_t)(pCode - pBuffer);
+}
+
+xbool_t XNAL_NextUnit(xnal_iter_t *pIter, xnal_unit_t *pUnit)
+{
+    XASSERT((pIter && pUnit), XFALSE);
+    const uint8_t *pBuffer = pIter->pBuffer;
+
+    /* Start code without the header byte is not a unit */
+    size_t nDataPos = pIter->nNextPos + pIter->nCodeSize;
+    XASSERT_RET((pIter->nNextPos < pIter->nSize && nDataPos < pIter->nSize), XFALSE);
+
+    /* Unit ends where the next one starts, sizes need no second pass */
+    size_t nCodeSize = 0;
+    const uint8_t *pNext = XNAL_FindStartCode(&pBuffer[nDataPos], &pBuffer[pIter->nSize], &nCodeSize);
+    size_t nNextPos = pNext != NULL ? (size_t)(pNext - pBuffer) : pIter->nSize;
+
+    pUnit->nNalPos = (int)pIter->nNextPos;
+    pUnit->nDataPos = (int)nDataPos;
+    pUnit->nSize = (int)(nNextPos - nDataPos);
+    pUnit->nUnitType = pBuffer[nDataPos] & 0x1f;
+    pUnit->nReference = pBuffer[nDataPos] & 0x20;
+
+    pIter->nNextPos = nNextPos;
+    pIter->nCodeSize = nCodeSize;
+    return XTRUE;
+}
+
+xarray_t* XNAL_ParseUnits(const uint8_t *pBuffer, size_t nSize)
 {
     size_t nPoolSize = sizeof(xnal_unit_t) * XNAL_UNIT_INITIAL_COUNT;
     xarray_t *pUnits = XArray_NewPool(nPoolSize, XSTDNON, XFALSE);
     XASSERT(pUnits, NULL);
 
     pUnits->clearCb = XNAL_UnitClearCb;
-    size_t i;
+    xnal_iter_t iter;
+    xnal_unit_t unit;
 
-    for (i = 0; i < nSize - 4; i++)
+    XNAL_InitIter(&iter, pBuffer, nSize);
+    while (XNAL_NextUnit(&iter, &unit))
     {
-        size_t nStartCodeSize = XNAL_CheckStartCode(pBuffer, i);
-        if (nStartCodeSize)
+        /* Units are taken from the array pool */
+        xnal_unit_t *pUnit = (xnal_unit_t*)xalloc(pUnits->pPool, sizeof(xnal_unit_t));
+        if (pUnit == NULL)
         {
-            xnal_unit_t* pUnit = XNAL_AllocUnit();
-            if (pUnit == NULL)
-            {
-                XArray_Destroy(pUnits);
-                return NULL;
-            }
-
-            pUnit->nNalPos = (int)i;
-            pUnit->nDataPos = (int)(i + nStartCodeSize);
-            pUnit->nUnitType = pBuffer[pUnit->nDataPos] & 0x1f;
-            pUnit->nReference = pBuffer[pUnit->nDataPos] & 0x20;
-
-            if (XArray_AddData(pUnits, pUnit, XSTDNON) < 0)
-            {
-                XArray_Destroy(pUnits);
-                return NULL;
-            }
+            XArray_Destroy(pUnits);
+            return NULL;
         }
-    }
-
-    /* Update NAL unit sizes */
-    for (i = 0; i < pUnits->nUsed; i++)
-    {
-        xnal_unit_t* pUnit = XArray_GetData(pUnits, i);
-        if (pUnit == NULL) continue;
 
-        if (i == (pUnits->nUsed - 1))
-        {
-            /* This is the last unit in the array */
-            pUnit->nSize = nSize - pUnit->nDataPos;
-        }
-        else
+        *pUnit = unit;
+        if (XArray_AddData(pUnits, pUnit, XSTDNON) < 0)
         {
-            xnal_unit_t* pNext = XArray_GetData(pUnits, i + 1);
-            pUnit->nSize = pNext ? pNext->nNalPos - pUnit->nDataPos : 0;
+            xfreen(pUnits->pPool, pUnit, sizeof(xnal_unit_t));
+            XArray_Destroy(pUnits);
+            return NULL;
         }
     }
 
@@ -110,40 +163,29 @@ xarray_t* XNAL_ParseUnits(uint8_t *pBuffer, size_t nSize)
 
 XSTATUS XNAL_ParseH264(uint8_t *pBuffer, size_t nSize, x264_extra_t *pExtraData)
 {
-    xarray_t *pUnits = XNAL_ParseUnits(pBuffer, nSize);
-    XASSERT(pUnits, XSTDERR);
+    XASSERT((pBuffer && pExtraData), XSTDINV);
+    xnal_iter_t iter;
+    xnal_unit_t unit;
 
-    size_t nUsed = XArray_Used(pUnits);
-    if (!nUsed)
+    XNAL_InitIter(&iter, pBuffer, nSize);
+    while (XNAL_NextUnit(&iter, &unit))
     {
-        XArray_Destroy(pUnits);
-        return XSTDNON;
-    }
-
-    size_t i;
-    xbool_t bHaveExtra = XFALSE;
-
-    for (i = 0; i < nUsed; i++)
-    {
-        xnal_unit_t* pUnit = XArray_GetData(pUnits, i);
-        if (pUnit == NULL) continue;
-
-        if (pUnit->nUnitType == 7) // SPS
+        if (unit.nUnitType == 7) // SPS
         {
-            pExtraData->pSPS = &pBuffer[pUnit->nDataPos];
-            pExtraData->nSPSSize = pUnit->nSize;
+            pExtraData->pSPS = &pBuffer[unit.nDataPos];
+            pExtraData->nSPSSize = unit.nSize;
         }
-        else if (pUnit->nUnitType == 8) // PPS
+        else if (unit.nUnitType == 8) // PPS
         {
-            pExtraData->pPPS = &pBuffer[pUnit->nDataPos];
-            pExtraData->nPPSSize = pUnit->nSize;
+            pExtraData->pPPS = &pBuffer[unit.nDataPos];
+            pExtraData->nPPSSize = unit.nSize;
         }
 
+        /* Slice data after the parameter sets is not scanned */
         if (pExtraData->pSPS &&
             pExtraData->pPPS)
-            bHaveExtra = XTRUE;
+            return XSTDOK;
     }
 
-    XArray_Destroy(pUnits);
-    return bHaveExtra ? XSTDOK : XSTDNON;
-}
\ No newline at end of file
+    return XSTDNON;
+}
@@ -25,11 +25,24 @@ typedef struct xnal_unit_ {
     int nSize;
 } xnal_unit_t;
 
+/* Walks the units in place, nothing is allocated */
+typedef struct xnal_iter_ {
+    const uint8_t* pBuffer;
+    size_t nSize;
+    size_t nNextPos;
+    size_t nCodeSize;
+} xnal_iter_t;
+
 void XNAL_InitUnit(xnal_unit_t *pUnit);
 xnal_unit_t* XNAL_AllocUnit();
 
-size_t XNAL_CheckStartCode(uint8_t *pBuffer, size_t nPos);
-xarray_t* XNAL_ParseUnits(uint8_t *pBuffer, size_t nSize);
+size_t XNAL_CheckStartCode(const uint8_t *pBuffer, size_t nSize, size_t nPos);
+const uint8_t* XNAL_FindStartCode(const uint8_t *pData, const uint8_t *pEnd, size_t *pCodeSize);
+
+void XNAL_InitIter(xnal_iter_t *pIter, const uint8_t *pBuffer, size_t nSize);
+xbool_t XNAL_NextUnit(xnal_iter_t *pIter, xnal_unit_t *pUnit);
+
+xarray_t* XNAL_ParseUnits(const uint8_t *pBuffer, size_t nSize);
 
 XSTATUS XNAL_ParseH264(uint8_t *pBuffer, size_t nSize, x264_extra_t *pExtraData);
 
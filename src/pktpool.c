@@ -0,0 +1,169 @@
+/*!
+ *  @file libxmedia/src/pktpool.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the packet pool with recycled
+ * AVPackets and pooled, padded, refcounted payload buffers.
+ */
+
+#include "pktpool.h"
+
+void XPktPool_Init(xpkt_pool_t *pPool)
+{
+    XASSERT_VOID(pPool);
+    pthread_mutex_init(&pPool->lock, NULL);
+    memset(pPool->pBuffers, 0, sizeof(pPool->pBuffers));
+
+    pPool->pPackets = NULL;
+    pPool->nCapacity = 0;
+    pPool->nCount = 0;
+}
+
+void XPktPool_Destroy(xpkt_pool_t *pPool)
+{
+    XASSERT_VOID(pPool);
+    size_t i;
+
+    /* Buffers still referenced by packets are freed when released */
+    for (i = 0; i < XPKTPOOL_CLASSES; i++)
+        if (pPool->pBuffers[i] != NULL) av_buffer_pool_uninit(&pPool->pBuffers[i]);
+
+    for (i = 0; i < pPool->nCount; i++)
+        av_packet_free(&pPool->pPackets[i]);
+
+    free(pPool->pPackets);
+    pPool->pPackets = NULL;
+    pPool->nCapacity = 0;
+    pPool->nCount = 0;
+
+    pthread_mutex_destroy(&pPool->lock);
+}
+
+XSTATUS XPktPool_Setup(xpkt_pool_t *pPool, size_t nPackets)
+{
+    XASSERT(pPool, XSTDINV);
+    XASSERT((pPool->pPackets == NULL), XSTDINV);
+    if (!nPackets) nPackets = XPKTPOOL_PACKETS;
+
+    pPool->pPackets = (AVPacket**)calloc(nPackets, sizeof(AVPacket*));
+    XASSERT(pPool->pPackets, XSTDERR);
+    pPool->nCapacity = nPackets;
+
+    while (pPool->nCount < nPackets)
+    {
+        AVPacket *pPacket = av_packet_alloc();
+        XASSERT(pPacket, XSTDERR);
+        pPool->pPackets[pPool->nCount++] = pPacket;
+    }
+
+    return XSTDOK;
+}
+
+AVPacket* XPktPool_Get(xpkt_pool_t *pPool)
+{
+    XASSERT(pPool, NULL);
+    AVPacket *pPacket = NULL;
+
+    pthread_mutex_lock(&pPool->lock);
+    if (pPool->nCount) pPacket = pPool->pPackets[--pPool->nCount];
+    pthread_mutex_unlock(&pPool->lock);
+
+    return pPacket != NULL ? pPacket : av_packet_alloc();
+}
+
+void XPktPool_Release(xpkt_pool_t *pPool, AVPacket *pPacket)
+{
+    XASSERT_VOID((pPool && pPacket));
+    av_packet_unref(pPacket);
+
+    pthread_mutex_lock(&pPool->lock);
+    if (pPool->nCount < pPool->nCapacity)
+    {
+        pPool->pPackets[pPool->nCount++] = pPacket;
+        pPacket = NULL;
+    }
+    pthread_mutex_unlock(&pPool->lock);
+
+    if (pPacket != NULL) av_packet_free(&pPacket);
+}
+
+static AVBufferRef* XPktPool_GetBuffer(xpkt_pool_t *pPool, size_t nSize)
+{
+    size_t nClassSize = XPKTPOOL_MIN_SIZE;
+    int nClass = 0;
+
+    while (nClass < XPKTPOOL_CLASSES && nClassSize < nSize)
+    {
+        nClassSize *= 4;
+        nClass++;
+    }
+
+    /* Too large to keep around */
+    if (nClass >= XPKTPOOL_CLASSES)
+        return av_buffer_alloc(nSize + AV_INPUT_BUFFER_PADDING_SIZE);
+
+    pthread_mutex_lock(&pPool->lock);
+    AVBufferPool *pBuffers = pPool->pBuffers[nClass];
+
+    if (pBuffers == NULL)
+    {
+        pBuffers = av_buffer_pool_init(nClassSize + AV_INPUT_BUFFER_PADDING_SIZE, av_buffer_alloc);
+        pPool->pBuffers[nClass] = pBuffers;
+    }
+
+    pthread_mutex_unlock(&pPool->lock);
+    XASSERT_RET(pBuffers, NULL);
+
+    /* AVBufferPool is thread safe on its own */
+    return av_buffer_pool_get(pBuffers);
+}
+
+AVPacket* XPktPool_Copy(xpkt_pool_t *pPool, const uint8_t *pData, size_t nSize)
+{
+    XASSERT((pPool && pData && nSize), NULL);
+    XASSERT((nSize <= INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE), NULL);
+
+    AVPacket *pPacket = XPktPool_Get(pPool);
+    XASSERT(pPacket, NULL);
+
+    pPacket->buf = XPktPool_GetBuffer(pPool, nSize);
+    if (pPacket->buf == NULL)
+    {
+        XPktPool_Release(pPool, pPacket);
+        return NULL;
+    }
+
+    /* Decoders may over-read, padding must be zeroed */
+    memcpy(pPacket->buf->data, pData, nSize);
+    memset(pPacket->buf->data + nSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    pPacket->data = pPacket->buf->data;
+    pPacket->size = (int)nSize;
+    return pPacket;
+}
+
+AVPacket* XPktPool_Wrap(xpkt_pool_t *pPool, uint8_t *pData, size_t nSize, xpkt_free_cb_t freeCb, void *pOpaque)
+{
+    XASSERT((pPool && pData && nSize), NULL);
+    XASSERT((nSize <= INT_MAX), NULL);
+
+    /* NULL would make FFmpeg av_free() a buffer it did not allocate */
+    XASSERT(freeCb, NULL);
+
+    AVPacket *pPacket = XPktPool_Get(pPool);
+    XASSERT(pPacket, NULL);
+
+    /* Caller buffer must already have AV_INPUT_BUFFER_PADDING_SIZE bytes after nSize */
+    pPacket->buf = av_buffer_create(pData, nSize + AV_INPUT_BUFFER_PADDING_SIZE, freeCb, pOpaque, 0);
+    if (pPacket->buf == NULL)
+    {
+        XPktPool_Release(pPool, pPacket);
+        return NULL;
+    }
+
+    pPacket->data = pData;
+    pPacket->size = (int)nSize;
+    return pPacket;
+}
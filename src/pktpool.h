@@ -0,0 +1,55 @@
+/*!
+ *  @file libxmedia/src/pktpool.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the packet pool with recycled
+ * AVPackets and pooled, padded, refcounted payload buffers.
+ */
+
+#ifndef __XMEDIA_PKTPOOL_H__
+#define __XMEDIA_PKTPOOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include <pthread.h>
+
+#define XPKTPOOL_PACKETS        256
+#define XPKTPOOL_CLASSES        6
+#define XPKTPOOL_MIN_SIZE       2048    /* Smallest class, next ones are 4x larger */
+
+/* Called when the last reference to a wrapped buffer is released */
+typedef void(*xpkt_free_cb_t)(void *pOpaque, uint8_t *pData);
+
+typedef struct xpkt_pool_ {
+    pthread_mutex_t         lock;
+
+    /* Payload buffers by size class, larger ones are allocated */
+    AVBufferPool*           pBuffers[XPKTPOOL_CLASSES];
+
+    /* Recycled empty packets */
+    AVPacket**              pPackets;
+    size_t                  nCapacity;
+    size_t                  nCount;
+} xpkt_pool_t;
+
+/* Packets taken from the pool must be released before it is destroyed */
+void XPktPool_Init(xpkt_pool_t *pPool);
+void XPktPool_Destroy(xpkt_pool_t *pPool);
+XSTATUS XPktPool_Setup(xpkt_pool_t *pPool, size_t nPackets);
+
+AVPacket* XPktPool_Get(xpkt_pool_t *pPool);
+void XPktPool_Release(xpkt_pool_t *pPool, AVPacket *pPacket);
+
+AVPacket* XPktPool_Copy(xpkt_pool_t *pPool, const uint8_t *pData, size_t nSize);
+AVPacket* XPktPool_Wrap(xpkt_pool_t *pPool, uint8_t *pData, size_t nSize, xpkt_free_cb_t freeCb, void *pOpaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_PKTPOOL_H__ */
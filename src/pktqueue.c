@@ -0,0 +1,200 @@
+/*!
+ *  @file libxmedia/src/pktqueue.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the bounded, blocking packet
+ * queue used between the demuxer and decoder threads.
+ */
+
+#include "pktqueue.h"
+
+void XPktQueue_Init(xpkt_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    memset(&pQueue->stats, 0, sizeof(xpkt_queue_stats_t));
+
+    pthread_mutex_init(&pQueue->lock, NULL);
+    pthread_cond_init(&pQueue->pushCond, NULL);
+    pthread_cond_init(&pQueue->popCond, NULL);
+
+    pQueue->pPackets = NULL;
+    pQueue->nCapacity = 0;
+    pQueue->nHead = 0;
+    pQueue->nCount = 0;
+
+    pQueue->bEOF = XFALSE;
+    pQueue->bAbort = XFALSE;
+}
+
+static void XPktQueue_Clear(xpkt_queue_t *pQueue)
+{
+    while (pQueue->nCount)
+    {
+        av_packet_free(&pQueue->pPackets[pQueue->nHead]);
+        pQueue->nHead = (pQueue->nHead + 1) % pQueue->nCapacity;
+        pQueue->nCount--;
+    }
+
+    pQueue->nHead = 0;
+}
+
+void XPktQueue_Destroy(xpkt_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    XPktQueue_Clear(pQueue);
+
+    free(pQueue->pPackets);
+    pQueue->pPackets = NULL;
+    pQueue->nCapacity = 0;
+
+    pthread_cond_destroy(&pQueue->pushCond);
+    pthread_cond_destroy(&pQueue->popCond);
+    pthread_mutex_destroy(&pQueue->lock);
+}
+
+void XPktQueue_Flush(xpkt_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    pthread_mutex_lock(&pQueue->lock);
+
+    XPktQueue_Clear(pQueue);
+    pQueue->bEOF = XFALSE;
+
+    pthread_cond_broadcast(&pQueue->pushCond);
+    pthread_mutex_unlock(&pQueue->lock);
+}
+
+XSTATUS XPktQueue_Setup(xpkt_queue_t *pQueue, size_t nCapacity)
+{
+    XASSERT(pQueue, XSTDINV);
+    XASSERT((pQueue->pPackets == NULL), XSTDINV);
+    if (!nCapacity) nCapacity = XPKTQUEUE_DEPTH;
+
+    pQueue->pPackets = (AVPacket**)calloc(nCapacity, sizeof(AVPacket*));
+    XASSERT(pQueue->pPackets, XSTDERR);
+
+    pQueue->nCapacity = nCapacity;
+    return XSTDOK;
+}
+
+XSTATUS XPktQueue_Push(xpkt_queue_t *pQueue, AVPacket *pPacket)
+{
+    XASSERT((pQueue && pPacket), XSTDINV);
+    XASSERT(pQueue->pPackets, XSTDINV);
+
+    AVPacket *pNewPacket = av_packet_alloc();
+    XASSERT(pNewPacket, XSTDERR);
+
+    pthread_mutex_lock(&pQueue->lock);
+    xpkt_queue_stats_t *pStats = &pQueue->stats;
+
+    if (pQueue->nCount >= pQueue->nCapacity && !pQueue->bAbort)
+    {
+        uint64_t nStartTime = XTime_GetStamp();
+
+        while (pQueue->nCount >= pQueue->nCapacity && !pQueue->bAbort)
+            pthread_cond_wait(&pQueue->pushCond, &pQueue->lock);
+
+        pStats->nPushStallTime += XTime_GetStamp() - nStartTime;
+        pStats->nPushStalls++;
+    }
+
+    if (pQueue->bAbort)
+    {
+        pthread_mutex_unlock(&pQueue->lock);
+        av_packet_free(&pNewPacket);
+        return XSTDNON;
+    }
+
+    /* Queue takes over the reference, payload is not copied */
+    av_packet_move_ref(pNewPacket, pPacket);
+    size_t nTail = (pQueue->nHead + pQueue->nCount) % pQueue->nCapacity;
+    pQueue->pPackets[nTail] = pNewPacket;
+    pQueue->nCount++;
+
+    if (pQueue->nCount > pStats->nMaxDepth) pStats->nMaxDepth = pQueue->nCount;
+    pStats->nPushed++;
+
+    pthread_cond_signal(&pQueue->popCond);
+    pthread_mutex_unlock(&pQueue->lock);
+    return XSTDOK;
+}
+
+XSTATUS XPktQueue_Pop(xpkt_queue_t *pQueue, AVPacket *pPacket)
+{
+    XASSERT((pQueue && pPacket), XSTDINV);
+    XASSERT(pQueue->pPackets, XSTDINV);
+
+    pthread_mutex_lock(&pQueue->lock);
+    xpkt_queue_stats_t *pStats = &pQueue->stats;
+
+    if (!pQueue->nCount && !pQueue->bEOF && !pQueue->bAbort)
+    {
+        uint64_t nStartTime = XTime_GetStamp();
+
+        while (!pQueue->nCount && !pQueue->bEOF && !pQueue->bAbort)
+            pthread_cond_wait(&pQueue->popCond, &pQueue->lock);
+
+        pStats->nPopStallTime += XTime_GetStamp() - nStartTime;
+        pStats->nPopStalls++;
+    }
+
+    /* Queued packets are still delivered after EOF */
+    if (!pQueue->nCount || pQueue->bAbort)
+    {
+        pthread_mutex_unlock(&pQueue->lock);
+        return XSTDNON;
+    }
+
+    AVPacket *pQueued = pQueue->pPackets[pQueue->nHead];
+    pQueue->pPackets[pQueue->nHead] = NULL;
+    pQueue->nHead = (pQueue->nHead + 1) % pQueue->nCapacity;
+    pQueue->nCount--;
+    pStats->nPopped++;
+
+    pthread_cond_signal(&pQueue->pushCond);
+    pthread_mutex_unlock(&pQueue->lock);
+
+    av_packet_move_ref(pPacket, pQueued);
+    av_packet_free(&pQueued);
+    return XSTDOK;
+}
+
+void XPktQueue_SetEOF(xpkt_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    pthread_mutex_lock(&pQueue->lock);
+    pQueue->bEOF = XTRUE;
+    pthread_cond_broadcast(&pQueue->popCond);
+    pthread_mutex_unlock(&pQueue->lock);
+}
+
+void XPktQueue_Abort(xpkt_queue_t *pQueue)
+{
+    XASSERT_VOID(pQueue);
+    pthread_mutex_lock(&pQueue->lock);
+    pQueue->bAbort = XTRUE;
+    pthread_cond_broadcast(&pQueue->pushCond);
+    pthread_cond_broadcast(&pQueue->popCond);
+    pthread_mutex_unlock(&pQueue->lock);
+}
+
+size_t XPktQueue_GetDepth(xpkt_queue_t *pQueue)
+{
+    XASSERT_RET(pQueue, 0);
+    pthread_mutex_lock(&pQueue->lock);
+    size_t nCount = pQueue->nCount;
+    pthread_mutex_unlock(&pQueue->lock);
+    return nCount;
+}
+
+XSTATUS XPktQueue_GetStats(xpkt_queue_t *pQueue, xpkt_queue_stats_t *pStats)
+{
+    XASSERT((pQueue && pStats), XSTDINV);
+    pthread_mutex_lock(&pQueue->lock);
+    *pStats = pQueue->stats;
+    pthread_mutex_unlock(&pQueue->lock);
+    return XSTDOK;
+}
@@ -0,0 +1,70 @@
+/*!
+ *  @file libxmedia/src/pktqueue.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the bounded, blocking packet
+ * queue used between the demuxer and decoder threads.
+ */
+
+#ifndef __XMEDIA_PKTQUEUE_H__
+#define __XMEDIA_PKTQUEUE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include <pthread.h>
+
+#define XPKTQUEUE_DEPTH         64
+
+typedef struct xpkt_queue_stats_ {
+    uint64_t                nPushed;
+    uint64_t                nPopped;
+    size_t                  nMaxDepth;
+
+    /* Producer waited for free space (consumer is slower) */
+    uint64_t                nPushStalls;
+    uint64_t                nPushStallTime;     /* usec */
+
+    /* Consumer waited for packets (producer is slower) */
+    uint64_t                nPopStalls;
+    uint64_t                nPopStallTime;      /* usec */
+} xpkt_queue_stats_t;
+
+typedef struct xpkt_queue_ {
+    pthread_mutex_t         lock;
+    pthread_cond_t          pushCond;
+    pthread_cond_t          popCond;
+
+    AVPacket**              pPackets;
+    size_t                  nCapacity;
+    size_t                  nHead;
+    size_t                  nCount;
+
+    xbool_t                 bEOF;
+    xbool_t                 bAbort;
+    xpkt_queue_stats_t      stats;
+} xpkt_queue_t;
+
+void XPktQueue_Init(xpkt_queue_t *pQueue);
+void XPktQueue_Destroy(xpkt_queue_t *pQueue);
+void XPktQueue_Flush(xpkt_queue_t *pQueue);
+
+XSTATUS XPktQueue_Setup(xpkt_queue_t *pQueue, size_t nCapacity);
+XSTATUS XPktQueue_Push(xpkt_queue_t *pQueue, AVPacket *pPacket);
+XSTATUS XPktQueue_Pop(xpkt_queue_t *pQueue, AVPacket *pPacket);
+
+void XPktQueue_SetEOF(xpkt_queue_t *pQueue);
+void XPktQueue_Abort(xpkt_queue_t *pQueue);
+
+size_t XPktQueue_GetDepth(xpkt_queue_t *pQueue);
+XSTATUS XPktQueue_GetStats(xpkt_queue_t *pQueue, xpkt_queue_stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_PKTQUEUE_H__ */
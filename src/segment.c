@@ -0,0 +1,342 @@
+/*!
+ *  @file libxmedia/src/segment.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the rolling HLS segment
+ * output (MPEG-TS and fragmented MP4/CMAF segments).
+ */
+
+#include "segment.h"
+
+void XSegmenter_Init(xsegmenter_t *pSegmenter)
+{
+    XASSERT_VOID(pSegmenter);
+    pSegmenter->pSegments = NULL;
+    pSegmenter->nCapacity = 0;
+    pSegmenter->nCount = 0;
+    pSegmenter->nTotalSize = 0;
+
+    xstrnul(pSegmenter->sPlaylist);
+    xstrnul(pSegmenter->sDirectory);
+    xstrnul(pSegmenter->sBaseName);
+    xstrnul(pSegmenter->sInitName);
+    xstrnul(pSegmenter->sCurrent);
+    pSegmenter->pFile = NULL;
+
+    pSegmenter->nStartTS = AV_NOPTS_VALUE;
+    pSegmenter->nEndTS = AV_NOPTS_VALUE;
+    pSegmenter->nIndex = 0;
+    pSegmenter->nSize = 0;
+
+    pSegmenter->nDiscSequence = 0;
+    pSegmenter->bDiscontinuity = XFALSE;
+    pSegmenter->bDiscPending = XFALSE;
+
+    pSegmenter->eType = XSEGMENT_TS;
+    pSegmenter->nTargetDuration = XSEGMENT_DURATION;
+    pSegmenter->nListSize = XSEGMENT_LIST_SIZE;
+    pSegmenter->nMaxBytes = 0;
+    pSegmenter->bDeleteOld = XFALSE;
+    pSegmenter->bForceCut = XFALSE;
+    pSegmenter->nRefStream = XSTDERR;
+}
+
+void XSegmenter_Destroy(xsegmenter_t *pSegmenter)
+{
+    XASSERT_VOID(pSegmenter);
+
+    if (pSegmenter->pFile != NULL)
+    {
+        fclose(pSegmenter->pFile);
+        pSegmenter->pFile = NULL;
+    }
+
+    if (pSegmenter->pSegments != NULL)
+    {
+        free(pSegmenter->pSegments);
+        pSegmenter->pSegments = NULL;
+    }
+
+    pSegmenter->nCapacity = 0;
+    pSegmenter->nCount = 0;
+    pSegmenter->nTotalSize = 0;
+}
+
+static void XSegmenter_GetPath(xsegmenter_t *pSegmenter, const char *pName, char *pPath, size_t nSize)
+{
+    if (!xstrused(pSegmenter->sDirectory)) xstrncpy(pPath, nSize, pName);
+    else xstrncpyf(pPath, nSize, "%s/%s", pSegmenter->sDirectory, pName);
+}
+
+static XSTATUS XSegmenter_OpenFile(xsegmenter_t *pSegmenter, const char *pName)
+{
+    char sPath[XPATH_MAX];
+    XSegmenter_GetPath(pSegmenter, pName, sPath, sizeof(sPath));
+
+    pSegmenter->pFile = fopen(sPath, "wb");
+    XASSERT(pSegmenter->pFile, XSTDERR);
+
+    xstrncpy(pSegmenter->sCurrent, sizeof(pSegmenter->sCurrent), pName);
+    pSegmenter->nSize = 0;
+    return XSTDOK;
+}
+
+static XSTATUS XSegmenter_OpenNext(xsegmenter_t *pSegmenter)
+{
+    const char *pExt = pSegmenter->eType == XSEGMENT_FMP4 ? "m4s" : "ts";
+    char sName[XSTR_MIN];
+
+    xstrncpyf(sName, sizeof(sName), "%s_%05u.%s",
+        pSegmenter->sBaseName, pSegmenter->nIndex, pExt);
+
+    return XSegmenter_OpenFile(pSegmenter, sName);
+}
+
+static XSTATUS XSegmenter_WritePlaylist(xsegmenter_t *pSegmenter, xbool_t bFinal)
+{
+    char sTmpPath[XPATH_MAX];
+    xstrncpyf(sTmpPath, sizeof(sTmpPath), "%s.tmp", pSegmenter->sPlaylist);
+
+    FILE *pFile = fopen(sTmpPath, "w");
+    XASSERT(pFile, XSTDERR);
+
+    /* Rounded EXTINF values must not exceed target duration */
+    int nTarget = (int)((pSegmenter->nTargetDuration + 500000) / 1000000);
+    uint32_t nSequence = pSegmenter->nIndex;
+    size_t i;
+
+    for (i = 0; i < pSegmenter->nCount; i++)
+    {
+        int nDuration = (int)(pSegmenter->pSegments[i].fDuration + 0.5);
+        if (nDuration > nTarget) nTarget = nDuration;
+    }
+
+    if (pSegmenter->nCount) nSequence = pSegmenter->pSegments[0].nIndex;
+    int nVersion = pSegmenter->eType == XSEGMENT_FMP4 ? 7 : 3;
+
+    fprintf(pFile, "#EXTM3U\n");
+    fprintf(pFile, "#EXT-X-VERSION:%d\n", nVersion);
+    fprintf(pFile, "#EXT-X-TARGETDURATION:%d\n", nTarget > 0 ? nTarget : 1);
+    fprintf(pFile, "#EXT-X-MEDIA-SEQUENCE:%u\n", nSequence);
+    if (pSegmenter->nDiscSequence) fprintf(pFile, "#EXT-X-DISCONTINUITY-SEQUENCE:%u\n", pSegmenter->nDiscSequence);
+    fprintf(pFile, "#EXT-X-INDEPENDENT-SEGMENTS\n");
+
+    if (!pSegmenter->nListSize && !pSegmenter->nMaxBytes) fprintf(pFile, "#EXT-X-PLAYLIST-TYPE:EVENT\n");
+    if (pSegmenter->eType == XSEGMENT_FMP4) fprintf(pFile, "#EXT-X-MAP:URI=\"%s\"\n", pSegmenter->sInitName);
+
+    for (i = 0; i < pSegmenter->nCount; i++)
+    {
+        xsegment_t *pSegment = &pSegmenter->pSegments[i];
+        if (pSegment->bDiscontinuity) fprintf(pFile, "#EXT-X-DISCONTINUITY\n");
+        fprintf(pFile, "#EXTINF:%.3f,\n%s\n", pSegment->fDuration, pSegment->sName);
+    }
+
+    if (bFinal) fprintf(pFile, "#EXT-X-ENDLIST\n");
+    xbool_t bFailed = ferror(pFile) ? XTRUE : XFALSE;
+
+    if (fclose(pFile) || bFailed)
+    {
+        unlink(sTmpPath);
+        return XSTDERR;
+    }
+
+    /* Readers see either the old or the new playlist */
+    XASSERT((rename(sTmpPath, pSegmenter->sPlaylist) == 0), XSTDERR);
+    return XSTDOK;
+}
+
+static XSTATUS XSegmenter_AddSegment(xsegmenter_t *pSegmenter, double fDuration)
+{
+    if (pSegmenter->nCount >= pSegmenter->nCapacity)
+    {
+        size_t nCapacity = pSegmenter->nCapacity ? pSegmenter->nCapacity * 2 : XSEGMENT_LIST_SIZE * 2;
+        xsegment_t *pSegments = (xsegment_t*)realloc(pSegmenter->pSegments, nCapacity * sizeof(xsegment_t));
+        XASSERT(pSegments, XSTDERR);
+
+        pSegmenter->pSegments = pSegments;
+        pSegmenter->nCapacity = nCapacity;
+    }
+
+    xsegment_t *pSegment = &pSegmenter->pSegments[pSegmenter->nCount++];
+    xstrncpy(pSegment->sName, sizeof(pSegment->sName), pSegmenter->sCurrent);
+    pSegment->nIndex = pSegmenter->nIndex++;
+    pSegment->nSize = pSegmenter->nSize;
+    pSegment->fDuration = fDuration;
+    pSegment->bDiscontinuity = pSegmenter->bDiscontinuity;
+    pSegmenter->nTotalSize += pSegment->nSize;
+
+    /* Slide the playlist window, keep the last segment in any case */
+    while ((pSegmenter->nListSize && pSegmenter->nCount > pSegmenter->nListSize) ||
+           (pSegmenter->nMaxBytes && pSegmenter->nTotalSize > pSegmenter->nMaxBytes && pSegmenter->nCount > 1))
+    {
+        if (pSegmenter->bDeleteOld || pSegmenter->nMaxBytes)
+        {
+            char sPath[XPATH_MAX];
+            XSegmenter_GetPath(pSegmenter, pSegmenter->pSegments[0].sName, sPath, sizeof(sPath));
+            unlink(sPath);
+        }
+
+        /* Players count discontinuities that left the window */
+        if (pSegmenter->pSegments[0].bDiscontinuity) pSegmenter->nDiscSequence++;
+        pSegmenter->nTotalSize -= pSegmenter->pSegments[0].nSize;
+        pSegmenter->nCount--;
+        memmove(&pSegmenter->pSegments[0], &pSegmenter->pSegments[1],
+            pSegmenter->nCount * sizeof(xsegment_t));
+    }
+
+    return XSTDOK;
+}
+
+static XSTATUS XSegmenter_Close(xsegmenter_t *pSegmenter, double fDuration, xbool_t bFinal)
+{
+    XASSERT(pSegmenter->pFile, XSTDINV);
+    xbool_t bFailed = fclose(pSegmenter->pFile) ? XTRUE : XFALSE;
+    pSegmenter->pFile = NULL;
+    XASSERT(!bFailed, XSTDERR);
+
+    if (bFinal && !pSegmenter->nSize)
+    {
+        /* Nothing was written after the last cut */
+        char sPath[XPATH_MAX];
+        XSegmenter_GetPath(pSegmenter, pSegmenter->sCurrent, sPath, sizeof(sPath));
+        unlink(sPath);
+    }
+    else if (XSegmenter_AddSegment(pSegmenter, fDuration) <= 0) return XSTDERR;
+
+    return XSegmenter_WritePlaylist(pSegmenter, bFinal);
+}
+
+XSTATUS XSegmenter_Open(xsegmenter_t *pSegmenter, const char *pPlaylist, xsegment_type_t eType)
+{
+    XASSERT((pSegmenter && xstrused(pPlaylist)), XSTDINV);
+    XASSERT((pSegmenter->pFile == NULL), XSTDINV);
+
+    xstrncpy(pSegmenter->sPlaylist, sizeof(pSegmenter->sPlaylist), pPlaylist);
+    const char *pName = strrchr(pPlaylist, '/');
+
+    if (pName == NULL) xstrnul(pSegmenter->sDirectory);
+    else if (pName == pPlaylist) xstrncpy(pSegmenter->sDirectory, sizeof(pSegmenter->sDirectory), "/");
+    else
+    {
+        size_t nLength = XSTD_MIN((size_t)(pName - pPlaylist) + 1, sizeof(pSegmenter->sDirectory));
+        xstrncpy(pSegmenter->sDirectory, nLength, pPlaylist);
+    }
+
+    pName = pName != NULL ? pName + 1 : pPlaylist;
+    xstrncpy(pSegmenter->sBaseName, sizeof(pSegmenter->sBaseName), pName);
+
+    char *pExt = strrchr(pSegmenter->sBaseName, '.');
+    if (pExt != NULL && pExt != pSegmenter->sBaseName) *pExt = XSTR_NUL;
+
+    pSegmenter->nStartTS = AV_NOPTS_VALUE;
+    pSegmenter->nEndTS = AV_NOPTS_VALUE;
+    pSegmenter->eType = eType;
+    pSegmenter->nCount = 0;
+    pSegmenter->nTotalSize = 0;
+    pSegmenter->nIndex = 0;
+    pSegmenter->nDiscSequence = 0;
+    pSegmenter->bDiscontinuity = XFALSE;
+    pSegmenter->bDiscPending = XFALSE;
+
+    if (eType == XSEGMENT_FMP4)
+    {
+        /* Muxer header (ftyp+moov) goes to the init section */
+        xstrncpyf(pSegmenter->sInitName, sizeof(pSegmenter->sInitName), "%s_init.mp4", pSegmenter->sBaseName);
+        return XSegmenter_OpenFile(pSegmenter, pSegmenter->sInitName);
+    }
+
+    return XSegmenter_OpenNext(pSegmenter);
+}
+
+XSTATUS XSegmenter_Begin(xsegmenter_t *pSegmenter)
+{
+    XASSERT((pSegmenter && pSegmenter->pFile), XSTDINV);
+    XASSERT_RET((pSegmenter->eType == XSEGMENT_FMP4), XSTDOK);
+
+    xbool_t bFailed = fclose(pSegmenter->pFile) ? XTRUE : XFALSE;
+    pSegmenter->pFile = NULL;
+    XASSERT(!bFailed, XSTDERR);
+
+    return XSegmenter_OpenNext(pSegmenter);
+}
+
+xbool_t XSegmenter_Check(xsegmenter_t *pSegmenter, int64_t nTimestamp, int64_t nDuration, xbool_t bCutPoint)
+{
+    XASSERT_RET((pSegmenter && nTimestamp != AV_NOPTS_VALUE), XFALSE);
+    xbool_t bCut = XFALSE;
+
+    if (pSegmenter->nStartTS == AV_NOPTS_VALUE) pSegmenter->nStartTS = nTimestamp;
+    else if (bCutPoint && (pSegmenter->bForceCut ||
+             nTimestamp - pSegmenter->nStartTS >= (int64_t)pSegmenter->nTargetDuration)) bCut = XTRUE;
+
+    int64_t nEndTS = nTimestamp + XSTD_MAX(nDuration, 0);
+    if (pSegmenter->nEndTS == AV_NOPTS_VALUE || pSegmenter->nEndTS < nEndTS)
+        pSegmenter->nEndTS = nEndTS;
+
+    return bCut;
+}
+
+XSTATUS XSegmenter_Cut(xsegmenter_t *pSegmenter, int64_t nTimestamp)
+{
+    XASSERT((pSegmenter && pSegmenter->pFile), XSTDINV);
+    double fDuration = (double)(nTimestamp - pSegmenter->nStartTS) / AV_TIME_BASE;
+
+    XSTATUS nStatus = XSegmenter_Close(pSegmenter, fDuration, XFALSE);
+    if (nStatus <= 0) return nStatus;
+
+    pSegmenter->nStartTS = nTimestamp;
+    pSegmenter->bForceCut = XFALSE;
+    pSegmenter->bDiscontinuity = pSegmenter->bDiscPending;
+    pSegmenter->bDiscPending = XFALSE;
+    return XSegmenter_OpenNext(pSegmenter);
+}
+
+void XSegmenter_ForceCut(xsegmenter_t *pSegmenter, xbool_t bDiscontinuity)
+{
+    XASSERT_VOID(pSegmenter);
+    pSegmenter->bForceCut = XTRUE;
+
+    /* Nothing to be discontinuous with before the first segment starts */
+    if (bDiscontinuity && pSegmenter->nStartTS != AV_NOPTS_VALUE)
+        pSegmenter->bDiscPending = XTRUE;
+}
+
+XSTATUS XSegmenter_Finish(xsegmenter_t *pSegmenter)
+{
+    XASSERT(pSegmenter, XSTDINV);
+    XASSERT(pSegmenter->pFile, XSTDNON);
+
+    if (pSegmenter->eType == XSEGMENT_FMP4 &&
+        !strcmp(pSegmenter->sCurrent, pSegmenter->sInitName))
+    {
+        fclose(pSegmenter->pFile);
+        pSegmenter->pFile = NULL;
+        return XSTDNON;
+    }
+
+    double fDuration = 0.;
+    if (pSegmenter->nStartTS != AV_NOPTS_VALUE && pSegmenter->nEndTS != AV_NOPTS_VALUE)
+        fDuration = (double)(pSegmenter->nEndTS - pSegmenter->nStartTS) / AV_TIME_BASE;
+
+    return XSegmenter_Close(pSegmenter, fDuration, XTRUE);
+}
+
+const xsegment_t* XSegmenter_GetLast(xsegmenter_t *pSegmenter)
+{
+    XASSERT_RET((pSegmenter && pSegmenter->nCount), NULL);
+    return &pSegmenter->pSegments[pSegmenter->nCount - 1];
+}
+
+int XSegmenter_Write(xsegmenter_t *pSegmenter, const uint8_t *pData, int nSize)
+{
+    XASSERT((pSegmenter && pData && nSize >= 0), AVERROR(EINVAL));
+    XASSERT(pSegmenter->pFile, AVERROR(EINVAL));
+
+    size_t nWritten = fwrite(pData, 1, (size_t)nSize, pSegmenter->pFile);
+    XASSERT((nWritten == (size_t)nSize), AVERROR(EIO));
+
+    pSegmenter->nSize += nWritten;
+    return nSize;
+}
@@ -0,0 +1,89 @@
+/*!
+ *  @file libxmedia/src/segment.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the rolling HLS segment
+ * output (MPEG-TS and fragmented MP4/CMAF segments).
+ */
+
+#ifndef __XMEDIA_SEGMENT_H__
+#define __XMEDIA_SEGMENT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XSEGMENT_DURATION       (6 * 1000 * 1000) /* usec */
+#define XSEGMENT_LIST_SIZE      6
+
+typedef enum {
+    XSEGMENT_TS,        // MPEG-TS segments
+    XSEGMENT_FMP4       // Fragmented MP4 (CMAF) segments with init section
+} xsegment_type_t;
+
+typedef struct xsegment_ {
+    char            sName[XSTR_MIN];
+    uint32_t        nIndex;
+    double          fDuration;
+    size_t          nSize;
+    xbool_t         bDiscontinuity;
+} xsegment_t;
+
+typedef struct xsegmenter_ {
+    /* Segments in the playlist window */
+    xsegment_t*     pSegments;
+    size_t          nCapacity;
+    size_t          nCount;
+    size_t          nTotalSize;
+
+    /* Output paths */
+    char            sPlaylist[XPATH_MAX];
+    char            sDirectory[XPATH_MAX];
+    char            sBaseName[XSTR_MID];
+    char            sInitName[XSTR_MIN];
+    char            sCurrent[XSTR_MIN];
+    FILE*           pFile;
+
+    /* Current segment state (usec) */
+    int64_t         nStartTS;
+    int64_t         nEndTS;
+    uint32_t        nIndex;
+    size_t          nSize;
+
+    /* Discontinuity tracking */
+    uint32_t        nDiscSequence;
+    xbool_t         bDiscontinuity;  /* Current segment follows a discontinuity */
+    xbool_t         bDiscPending;    /* Next segment follows a discontinuity */
+
+    /* User options */
+    xsegment_type_t eType;
+    uint64_t        nTargetDuration;
+    size_t          nListSize;
+    size_t          nMaxBytes;      /* Circular recording limit */
+    xbool_t         bDeleteOld;
+    xbool_t         bForceCut;
+    int             nRefStream;
+} xsegmenter_t;
+
+void XSegmenter_Init(xsegmenter_t *pSegmenter);
+void XSegmenter_Destroy(xsegmenter_t *pSegmenter);
+
+XSTATUS XSegmenter_Open(xsegmenter_t *pSegmenter, const char *pPlaylist, xsegment_type_t eType);
+XSTATUS XSegmenter_Begin(xsegmenter_t *pSegmenter);
+XSTATUS XSegmenter_Cut(xsegmenter_t *pSegmenter, int64_t nTimestamp);
+XSTATUS XSegmenter_Finish(xsegmenter_t *pSegmenter);
+
+void XSegmenter_ForceCut(xsegmenter_t *pSegmenter, xbool_t bDiscontinuity);
+xbool_t XSegmenter_Check(xsegmenter_t *pSegmenter, int64_t nTimestamp, int64_t nDuration, xbool_t bCutPoint);
+const xsegment_t* XSegmenter_GetLast(xsegmenter_t *pSegmenter);
+int XSegmenter_Write(xsegmenter_t *pSegmenter, const uint8_t *pData, int nSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_SEGMENT_H__ */
@@ -0,0 +1,242 @@
+/*!
+ *  @file libxmedia/src/stats.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the per-stream encoder and
+ * muxer statistics with lock-free counters.
+ */
+
+#include "stats.h"
+
+void XHistogram_Init(xhistogram_t *pHist)
+{
+    XASSERT_VOID(pHist);
+    size_t i;
+
+    for (i = 0; i < XSTATS_HIST_BUCKETS; i++)
+        pHist->nBuckets[i] = 0;
+
+    pHist->nCount = 0;
+    pHist->nSum = 0;
+    pHist->nMax = 0;
+}
+
+void XHistogram_Add(xhistogram_t *pHist, uint64_t nValue)
+{
+    XASSERT_VOID(pHist);
+    uint64_t nLimit = 1ULL << XSTATS_HIST_BASE;
+    size_t nBucket = 0;
+
+    /* Power of two buckets, the last one is open ended */
+    while (nValue >= nLimit && nBucket + 1 < XSTATS_HIST_BUCKETS)
+    {
+        nLimit <<= 1;
+        nBucket++;
+    }
+
+    XSYNC_ATOMIC_ADD(&pHist->nBuckets[nBucket], 1);
+    XSYNC_ATOMIC_ADD(&pHist->nSum, nValue);
+    XSYNC_ATOMIC_ADD(&pHist->nCount, 1);
+
+    /* Single writer, no compare and swap needed */
+    if (nValue > XSYNC_ATOMIC_GET(&pHist->nMax))
+        XSYNC_ATOMIC_SET(&pHist->nMax, nValue);
+}
+
+void XHistogram_Copy(xhistogram_t *pDst, xhistogram_t *pSrc)
+{
+    XASSERT_VOID((pDst && pSrc));
+    size_t i;
+
+    for (i = 0; i < XSTATS_HIST_BUCKETS; i++)
+        pDst->nBuckets[i] = XSYNC_ATOMIC_GET(&pSrc->nBuckets[i]);
+
+    pDst->nCount = XSYNC_ATOMIC_GET(&pSrc->nCount);
+    pDst->nSum = XSYNC_ATOMIC_GET(&pSrc->nSum);
+    pDst->nMax = XSYNC_ATOMIC_GET(&pSrc->nMax);
+}
+
+uint64_t XHistogram_GetPercentile(xhistogram_t *pHist, double fPercent)
+{
+    XASSERT_RET(pHist, XSTDNON);
+    uint64_t nCount = XSYNC_ATOMIC_GET(&pHist->nCount);
+    XASSERT_RET(nCount, XSTDNON);
+
+    uint64_t nTarget = (uint64_t)((double)nCount * fPercent / 100.);
+    uint64_t nMax = XSYNC_ATOMIC_GET(&pHist->nMax);
+    uint64_t nLimit = 1ULL << XSTATS_HIST_BASE;
+    uint64_t nSum = 0;
+    size_t i;
+
+    /* Upper bound of the bucket, capped by the observed maximum */
+    for (i = 0; i + 1 < XSTATS_HIST_BUCKETS; i++, nLimit <<= 1)
+    {
+        nSum += XSYNC_ATOMIC_GET(&pHist->nBuckets[i]);
+        if (nSum > nTarget) return XSTD_MIN(nLimit, nMax);
+    }
+
+    return nMax;
+}
+
+void XStats_Init(xstream_stats_t *pStats)
+{
+    XASSERT_VOID(pStats);
+    pStats->nFramesIn = 0;
+    pStats->nFramesOut = 0;
+
+    pStats->nPackets = 0;
+    pStats->nKeyFrames = 0;
+    pStats->nBytes = 0;
+
+    pStats->nStartTime = 0;
+    pStats->nBitRate = 0;
+    pStats->nPacketRate = 0;
+    pStats->nWindowStart = 0;
+    pStats->nWindowBytes = 0;
+    pStats->nWindowPackets = 0;
+
+    XHistogram_Init(&pStats->encodeLatency);
+    XHistogram_Init(&pStats->muxTime);
+}
+
+void XStats_Copy(xstream_stats_t *pDst, xstream_stats_t *pSrc)
+{
+    XASSERT_VOID((pDst && pSrc));
+    pDst->nFramesIn = XSYNC_ATOMIC_GET(&pSrc->nFramesIn);
+    pDst->nFramesOut = XSYNC_ATOMIC_GET(&pSrc->nFramesOut);
+
+    pDst->nPackets = XSYNC_ATOMIC_GET(&pSrc->nPackets);
+    pDst->nKeyFrames = XSYNC_ATOMIC_GET(&pSrc->nKeyFrames);
+    pDst->nBytes = XSYNC_ATOMIC_GET(&pSrc->nBytes);
+
+    pDst->nStartTime = XSYNC_ATOMIC_GET(&pSrc->nStartTime);
+    pDst->nBitRate = XSYNC_ATOMIC_GET(&pSrc->nBitRate);
+    pDst->nPacketRate = XSYNC_ATOMIC_GET(&pSrc->nPacketRate);
+
+    /* Window state belongs to the writer */
+    pDst->nWindowStart = 0;
+    pDst->nWindowBytes = 0;
+    pDst->nWindowPackets = 0;
+
+    XHistogram_Copy(&pDst->encodeLatency, &pSrc->encodeLatency);
+    XHistogram_Copy(&pDst->muxTime, &pSrc->muxTime);
+}
+
+void XStats_AddFrameIn(xstream_stats_t *pStats)
+{
+    XASSERT_VOID(pStats);
+    XSYNC_ATOMIC_ADD(&pStats->nFramesIn, 1);
+}
+
+void XStats_AddFrameOut(xstream_stats_t *pStats, uint64_t nLatency)
+{
+    XASSERT_VOID(pStats);
+    XSYNC_ATOMIC_ADD(&pStats->nFramesOut, 1);
+    if (nLatency) XHistogram_Add(&pStats->encodeLatency, nLatency);
+}
+
+void XStats_AddPacket(xstream_stats_t *pStats, int nSize, xbool_t bKeyFrame)
+{
+    XASSERT_VOID(pStats);
+    uint64_t nNow = XTime_GetStamp();
+
+    if (!pStats->nWindowStart)
+    {
+        XSYNC_ATOMIC_SET(&pStats->nStartTime, nNow);
+        pStats->nWindowStart = nNow;
+    }
+
+    if (bKeyFrame) XSYNC_ATOMIC_ADD(&pStats->nKeyFrames, 1);
+    XSYNC_ATOMIC_ADD(&pStats->nBytes, (uint64_t)nSize);
+    XSYNC_ATOMIC_ADD(&pStats->nPackets, 1);
+
+    pStats->nWindowBytes += (uint64_t)nSize;
+    pStats->nWindowPackets++;
+
+    uint64_t nElapsed = nNow - pStats->nWindowStart;
+    XASSERT_VOID_RET((nElapsed >= XSTATS_RATE_WINDOW));
+
+    uint64_t nBitRate = pStats->nWindowBytes * 8 * 1000000 / nElapsed;
+    uint64_t nPacketRate = pStats->nWindowPackets * 1000000000ULL / nElapsed;
+
+    XSYNC_ATOMIC_SET(&pStats->nBitRate, nBitRate);
+    XSYNC_ATOMIC_SET(&pStats->nPacketRate, nPacketRate);
+
+    pStats->nWindowStart = nNow;
+    pStats->nWindowBytes = 0;
+    pStats->nWindowPackets = 0;
+}
+
+void XStats_AddMuxTime(xstream_stats_t *pStats, uint64_t nTime)
+{
+    XASSERT_VOID(pStats);
+    XHistogram_Add(&pStats->muxTime, nTime);
+}
+
+uint64_t XStats_GetAvgBitRate(xstream_stats_t *pStats)
+{
+    XASSERT_RET(pStats, XSTDNON);
+    uint64_t nStartTime = XSYNC_ATOMIC_GET(&pStats->nStartTime);
+    XASSERT_RET(nStartTime, XSTDNON);
+
+    uint64_t nElapsed = XTime_GetStamp() - nStartTime;
+    XASSERT_RET(nElapsed, XSTDNON);
+
+    return XSYNC_ATOMIC_GET(&pStats->nBytes) * 8 * 1000000 / nElapsed;
+}
+
+static xjson_obj_t* XHistogram_ToJSON(xhistogram_t *pHist, const char *pName)
+{
+    xjson_obj_t *pHistObj = XJSON_NewObject(NULL, pName, XFALSE);
+    XASSERT(pHistObj, NULL);
+
+    uint64_t nCount = XSYNC_ATOMIC_GET(&pHist->nCount);
+    uint64_t nSum = XSYNC_ATOMIC_GET(&pHist->nSum);
+
+    XJSON_AddObject(pHistObj, XJSON_NewU64(NULL, "count", nCount));
+    XJSON_AddObject(pHistObj, XJSON_NewU64(NULL, "avg", nCount ? nSum / nCount : 0));
+    XJSON_AddObject(pHistObj, XJSON_NewU64(NULL, "max", XSYNC_ATOMIC_GET(&pHist->nMax)));
+    XJSON_AddObject(pHistObj, XJSON_NewU64(NULL, "p50", XHistogram_GetPercentile(pHist, 50.)));
+    XJSON_AddObject(pHistObj, XJSON_NewU64(NULL, "p90", XHistogram_GetPercentile(pHist, 90.)));
+    XJSON_AddObject(pHistObj, XJSON_NewU64(NULL, "p99", XHistogram_GetPercentile(pHist, 99.)));
+
+    xjson_obj_t *pBucketsObj = XJSON_NewArray(NULL, "buckets", XFALSE);
+    if (pBucketsObj != NULL)
+    {
+        size_t i;
+        for (i = 0; i < XSTATS_HIST_BUCKETS; i++)
+            XJSON_AddObject(pBucketsObj, XJSON_NewU64(NULL, NULL, XSYNC_ATOMIC_GET(&pHist->nBuckets[i])));
+
+        pBucketsObj->nAllowLinter = XFALSE;
+        XJSON_AddObject(pHistObj, pBucketsObj);
+    }
+
+    return pHistObj;
+}
+
+xjson_obj_t* XStats_ToJSON(xstream_stats_t *pStats, const char *pName)
+{
+    XASSERT(pStats, NULL);
+    xjson_obj_t *pStatsObj = XJSON_NewObject(NULL, pName, XFALSE);
+    XASSERT(pStatsObj, NULL);
+
+    double fPacketRate = (double)XSYNC_ATOMIC_GET(&pStats->nPacketRate) / 1000.;
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "framesIn", XSYNC_ATOMIC_GET(&pStats->nFramesIn)));
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "framesOut", XSYNC_ATOMIC_GET(&pStats->nFramesOut)));
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "packets", XSYNC_ATOMIC_GET(&pStats->nPackets)));
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "keyFrames", XSYNC_ATOMIC_GET(&pStats->nKeyFrames)));
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "bytes", XSYNC_ATOMIC_GET(&pStats->nBytes)));
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "bitRate", XSYNC_ATOMIC_GET(&pStats->nBitRate)));
+    XJSON_AddObject(pStatsObj, XJSON_NewU64(NULL, "avgBitRate", XStats_GetAvgBitRate(pStats)));
+    XJSON_AddObject(pStatsObj, XJSON_NewFloat(NULL, "packetRate", fPacketRate));
+
+    xjson_obj_t *pHistObj = XHistogram_ToJSON(&pStats->encodeLatency, "encodeLatency");
+    if (pHistObj != NULL) XJSON_AddObject(pStatsObj, pHistObj);
+
+    pHistObj = XHistogram_ToJSON(&pStats->muxTime, "muxTime");
+    if (pHistObj != NULL) XJSON_AddObject(pStatsObj, pHistObj);
+
+    return pStatsObj;
+}
@@ -0,0 +1,79 @@
+/*!
+ *  @file libxmedia/src/stats.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the per-stream encoder and
+ * muxer statistics with lock-free counters.
+ */
+
+#ifndef __XMEDIA_STATS_H__
+#define __XMEDIA_STATS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XSTATS_HIST_BUCKETS     16
+#define XSTATS_HIST_BASE        7                   /* First bucket is < 2^7 usec */
+#define XSTATS_RATE_WINDOW      (1000 * 1000)       /* usec */
+
+/*
+ * Counters have a single writer (encoding thread) and are
+ * updated with atomic operations, so any thread can read
+ * them at any time without taking the encoder lock.
+ */
+typedef struct xhistogram_ {
+    volatile uint64_t   nBuckets[XSTATS_HIST_BUCKETS];
+    volatile uint64_t   nCount;
+    volatile uint64_t   nSum;
+    volatile uint64_t   nMax;
+} xhistogram_t;
+
+typedef struct xstream_stats_ {
+    /* Encoder input and output */
+    volatile uint64_t   nFramesIn;
+    volatile uint64_t   nFramesOut;
+
+    /* Muxer input */
+    volatile uint64_t   nPackets;
+    volatile uint64_t   nKeyFrames;
+    volatile uint64_t   nBytes;
+
+    /* Rates of the last complete window */
+    volatile uint64_t   nStartTime;
+    volatile uint64_t   nBitRate;       /* bits per second */
+    volatile uint64_t   nPacketRate;    /* packets per 1000 seconds */
+    uint64_t            nWindowStart;
+    uint64_t            nWindowBytes;
+    uint64_t            nWindowPackets;
+
+    /* Frame -> packet and muxer write time (usec) */
+    xhistogram_t        encodeLatency;
+    xhistogram_t        muxTime;
+} xstream_stats_t;
+
+void XHistogram_Init(xhistogram_t *pHist);
+void XHistogram_Add(xhistogram_t *pHist, uint64_t nValue);
+void XHistogram_Copy(xhistogram_t *pDst, xhistogram_t *pSrc);
+uint64_t XHistogram_GetPercentile(xhistogram_t *pHist, double fPercent);
+
+void XStats_Init(xstream_stats_t *pStats);
+void XStats_Copy(xstream_stats_t *pDst, xstream_stats_t *pSrc);
+
+void XStats_AddFrameIn(xstream_stats_t *pStats);
+void XStats_AddFrameOut(xstream_stats_t *pStats, uint64_t nLatency);
+void XStats_AddPacket(xstream_stats_t *pStats, int nSize, xbool_t bKeyFrame);
+void XStats_AddMuxTime(xstream_stats_t *pStats, uint64_t nTime);
+
+uint64_t XStats_GetAvgBitRate(xstream_stats_t *pStats);
+xjson_obj_t* XStats_ToJSON(xstream_stats_t *pStats, const char *pName);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_STATS_H__ */
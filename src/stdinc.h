@@ -34,6 +34,7 @@ extern "C" {
 #include <libavutil/opt.h>
 #include <libavutil/error.h>
 #include <libavutil/channel_layout.h>
+#include <libavutil/base64.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
@@ -27,6 +27,12 @@ void XStream_Init(xstream_t *pStream)
     pStream->nPacketSize = 0;
     pStream->nLastPTS = 0;
     pStream->nLastDTS = 0;
+    pStream->nPacketTime = 0;
+    pStream->bNewExtra = XFALSE;
+
+    XStats_Init(&pStream->stats);
+    XTSNorm_Init(&pStream->tsNorm);
+    memset(&pStream->latency, 0, sizeof(xlatency_t));
 }
 
 xstream_t* XStream_New()
@@ -80,6 +86,53 @@ AVFrame* XStream_GetOrCreateFrame(xstream_t *pStream)
     return pStream->pFrame;
 }
 
+void XStream_MarkFrameTime(xstream_t *pStream, int64_t nPTS)
+{
+    XASSERT_VOID_RET(pStream);
+    xlatency_t *pLatency = &pStream->latency;
+
+    size_t nSlot = pLatency->nPosition++ % XSTREAM_LATENCY_SLOTS;
+    pLatency->nTime[nSlot] = XTime_GetStamp();
+    pLatency->nPTS[nSlot] = nPTS;
+}
+
+uint64_t XStream_GetFrameTime(xstream_t *pStream, int64_t nPTS)
+{
+    XASSERT_RET(pStream, XSTDNON);
+    xlatency_t *pLatency = &pStream->latency;
+    size_t i;
+
+    for (i = 0; i < XSTREAM_LATENCY_SLOTS; i++)
+    {
+        if (pLatency->nTime[i] && pLatency->nPTS[i] == nPTS)
+        {
+            uint64_t nTime = pLatency->nTime[i];
+            pLatency->nTime[i] = 0;
+            return nTime;
+        }
+    }
+
+    return XSTDNON;
+}
+
+uint64_t XStream_UpdateLatency(xstream_t *pStream, uint64_t nStartTime)
+{
+    XASSERT_RET((pStream && nStartTime), XSTDNON);
+    xlatency_t *pLatency = &pStream->latency;
+
+    uint64_t nNow = XTime_GetStamp();
+    uint64_t nLatency = nNow > nStartTime ? nNow - nStartTime : 0;
+
+    pLatency->nLast = nLatency;
+    pLatency->nSum += nLatency;
+    pLatency->nCount++;
+
+    if (nLatency > pLatency->nMax)
+        pLatency->nMax = nLatency;
+
+    return nLatency;
+}
+
 void XStreams_ClearCb(xarray_data_t *pArrData)
 {
     XASSERT_VOID_RET((pArrData && pArrData->pData));
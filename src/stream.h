@@ -17,6 +17,23 @@ extern "C" {
 
 #include "stdinc.h"
 #include "codec.h"
+#include "tsnorm.h"
+#include "stats.h"
+
+#define XSTREAM_LATENCY_SLOTS   64
+
+typedef struct xlatency_ {
+    /* Submit time of the recent frames by PTS */
+    int64_t             nPTS[XSTREAM_LATENCY_SLOTS];
+    uint64_t            nTime[XSTREAM_LATENCY_SLOTS];
+    size_t              nPosition;
+
+    /* Measured frame -> output latency (usec) */
+    uint64_t            nLast;
+    uint64_t            nMax;
+    uint64_t            nSum;
+    uint64_t            nCount;
+} xlatency_t;
 
 typedef struct xstream_ {
     xcodec_t            codecInfo;
@@ -32,6 +49,12 @@ typedef struct xstream_ {
     int64_t             nLastPTS;
     int64_t             nLastDTS;
 
+    xstream_stats_t     stats;
+    xts_norm_t          tsNorm;
+    xlatency_t          latency;
+    uint64_t            nPacketTime;
+    xbool_t             bNewExtra;
+
     int                 nSrcIndex;
     int                 nDstIndex;
 } xstream_t;
@@ -47,6 +70,10 @@ const xcodec_t* XStream_GetCodecInfo(xstream_t *pStream);
 XSTATUS XStream_CopyCodecInfo(xstream_t *pStream, xcodec_t *pInfo);
 XSTATUS XStream_FlushBuffers(xstream_t *pStream);
 
+void XStream_MarkFrameTime(xstream_t *pStream, int64_t nPTS);
+uint64_t XStream_GetFrameTime(xstream_t *pStream, int64_t nPTS);
+uint64_t XStream_UpdateLatency(xstream_t *pStream, uint64_t nStartTime);
+
 void XStreams_Init(xarray_t *pStreams);
 void XStreams_Destroy(xarray_t *pStreams);
 
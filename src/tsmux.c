@@ -0,0 +1,548 @@
+/*!
+ *  @file libxmedia/src/tsmux.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the native MPEG-TS muxer
+ * writing packets straight into 188 byte cells.
+ */
+
+#include "tsmux.h"
+
+#define XTSMUX_CELL_PAYLOAD     (XTS_PACKET_SIZE - 4)
+#define XTSMUX_TS_MASK          0x1FFFFFFFFULL
+#define XTSMUX_CRC_POLY         0x04C11DB7
+#define XTSMUX_ADTS_SIZE        7
+
+static uint32_t XTSMux_CRC32(const uint8_t *pData, size_t nSize)
+{
+    uint32_t nCRC = 0xFFFFFFFF;
+    size_t i;
+
+    /* MPEG-2 CRC, sections are small and built only once */
+    for (i = 0; i < nSize; i++)
+    {
+        int nBit;
+        nCRC ^= (uint32_t)pData[i] << 24;
+
+        for (nBit = 0; nBit < 8; nBit++)
+        {
+            if (nCRC & 0x80000000) nCRC = (nCRC << 1) ^ XTSMUX_CRC_POLY;
+            else nCRC <<= 1;
+        }
+    }
+
+    return nCRC;
+}
+
+static uint8_t XTSMux_GetStreamType(enum AVCodecID codecId)
+{
+    switch (codecId)
+    {
+        case AV_CODEC_ID_H264: return 0x1B;
+        case AV_CODEC_ID_HEVC: return 0x24;
+        case AV_CODEC_ID_MPEG2VIDEO: return 0x02;
+        case AV_CODEC_ID_MPEG1VIDEO: return 0x01;
+        case AV_CODEC_ID_AAC: return 0x0F;
+        case AV_CODEC_ID_MP3: return 0x04;
+        case AV_CODEC_ID_MP2: return 0x03;
+        case AV_CODEC_ID_AC3: return 0x81;
+        default: break;
+    }
+
+    return 0;
+}
+
+static void XTSMux_PutHeader(xbit_parser_t *pWriter, xts_packet_header_t *pHdr)
+{
+    XBitParser_WriteBits(pWriter, 8, pHdr->sync_byte);
+    XBitParser_WriteBits(pWriter, 1, pHdr->transport_error_indicator);
+    XBitParser_WriteBits(pWriter, 1, pHdr->payload_unit_start_indicator);
+    XBitParser_WriteBits(pWriter, 1, pHdr->transport_priority);
+    XBitParser_WriteBits(pWriter, 13, pHdr->PID);
+    XBitParser_WriteBits(pWriter, 2, pHdr->transports_crambling_control);
+    XBitParser_WriteBits(pWriter, 1, pHdr->adaptation_field_flag);
+    XBitParser_WriteBits(pWriter, 1, pHdr->payload_data_flag);
+    XBitParser_WriteBits(pWriter, 4, pHdr->continuty_counter);
+}
+
+static void XTSMux_PutAdaptation(xbit_parser_t *pWriter, xadaptation_field_t *pField)
+{
+    uint32_t nEnd = pWriter->nOffset + 1 + pField->adaptation_field_length;
+    XBitParser_WriteBits(pWriter, 8, pField->adaptation_field_length);
+
+    if (pField->adaptation_field_length)
+    {
+        XBitParser_WriteBits(pWriter, 1, pField->discontinuity_indicator);
+        XBitParser_WriteBits(pWriter, 1, pField->random_access_indicator);
+        XBitParser_WriteBits(pWriter, 1, pField->elementary_stream_priority_indicator);
+        XBitParser_WriteBits(pWriter, 1, pField->PCR_flag);
+        XBitParser_WriteBits(pWriter, 1, pField->OPCR_flag);
+        XBitParser_WriteBits(pWriter, 1, pField->splicing_point_flag);
+        XBitParser_WriteBits(pWriter, 1, pField->transport_private_data_flag);
+        XBitParser_WriteBits(pWriter, 1, pField->adaptation_field_extension_flag);
+        if (pField->PCR_flag) XBitParser_WriteBits(pWriter, 48, pField->PCR);
+    }
+
+    /* Rest of the adaptation field is stuffing */
+    if (nEnd > pWriter->nOffset)
+    {
+        memset(&pWriter->pData[pWriter->nOffset], 0xFF, nEnd - pWriter->nOffset);
+        pWriter->nOffset = nEnd;
+    }
+}
+
+static void XTSMux_PutTimestamp(xbit_parser_t *pWriter, uint8_t nPrefix, uint64_t nTS)
+{
+    XBitParser_WriteBits(pWriter, 4, nPrefix);
+    XBitParser_WriteBits(pWriter, 3, (nTS >> 30) & 0x07);
+    XBitParser_WriteBits(pWriter, 1, 1);
+    XBitParser_WriteBits(pWriter, 15, (nTS >> 15) & 0x7FFF);
+    XBitParser_WriteBits(pWriter, 1, 1);
+    XBitParser_WriteBits(pWriter, 15, nTS & 0x7FFF);
+    XBitParser_WriteBits(pWriter, 1, 1);
+}
+
+static size_t XTSMux_PutPES(uint8_t *pData, size_t nSize, xpes_packet_t *pPES)
+{
+    uint8_t nHeaderLength = pPES->PTS_DTS_flags == 3 ? 10 : 5;
+    xbit_parser_t writer;
+
+    XBitParser_Init(&writer, pData, nSize);
+    XBitParser_WriteBits(&writer, 24, pPES->packet_start_code_prefix);
+    XBitParser_WriteBits(&writer, 8, pPES->stream_id);
+    XBitParser_WriteBits(&writer, 16, pPES->PES_packet_length);
+    XBitParser_WriteBits(&writer, 2, 0x02);
+    XBitParser_WriteBits(&writer, 2, pPES->PES_scrambling_control);
+    XBitParser_WriteBits(&writer, 1, pPES->PES_priority);
+    XBitParser_WriteBits(&writer, 1, pPES->data_alignment_indicator);
+    XBitParser_WriteBits(&writer, 1, pPES->copyright);
+    XBitParser_WriteBits(&writer, 1, pPES->original_or_copy);
+    XBitParser_WriteBits(&writer, 2, pPES->PTS_DTS_flags);
+    XBitParser_WriteBits(&writer, 6, 0);
+    XBitParser_WriteBits(&writer, 8, nHeaderLength);
+
+    XTSMux_PutTimestamp(&writer, pPES->PTS_DTS_flags, pPES->PTS);
+    if (pPES->PTS_DTS_flags == 3) XTSMux_PutTimestamp(&writer, 0x01, pPES->DTS);
+
+    return writer.nOffset;
+}
+
+static size_t XTSMux_PutADTS(uint8_t *pData, size_t nSize, xtsmux_stream_t *pStream, int nFrameSize)
+{
+    xbit_parser_t writer;
+    XBitParser_Init(&writer, pData, nSize);
+
+    XBitParser_WriteBits(&writer, 12, 0xFFF);
+    XBitParser_WriteBits(&writer, 1, 0);        /* MPEG-4 */
+    XBitParser_WriteBits(&writer, 2, 0);        /* Layer */
+    XBitParser_WriteBits(&writer, 1, 1);        /* No CRC */
+    XBitParser_WriteBits(&writer, 2, pStream->nAACProfile);
+    XBitParser_WriteBits(&writer, 4, pStream->nAACFreqIndex);
+    XBitParser_WriteBits(&writer, 1, 0);
+    XBitParser_WriteBits(&writer, 3, pStream->nAACChannels);
+    XBitParser_WriteBits(&writer, 4, 0);
+    XBitParser_WriteBits(&writer, 13, nFrameSize + XTSMUX_ADTS_SIZE);
+    XBitParser_WriteBits(&writer, 11, 0x7FF);   /* VBR */
+    XBitParser_WriteBits(&writer, 2, 0);
+
+    return writer.nOffset;
+}
+
+static void XTSMux_BuildSection(uint8_t *pCell, uint16_t nPID, const uint8_t *pSection, size_t nLength)
+{
+    xts_packet_header_t hdr;
+    xbit_parser_t writer;
+
+    memset(&hdr, 0, sizeof(xts_packet_header_t));
+    hdr.sync_byte = 0x47;
+    hdr.payload_unit_start_indicator = 1;
+    hdr.payload_data_flag = 1;
+    hdr.PID = nPID;
+
+    XBitParser_Init(&writer, pCell, XTS_PACKET_SIZE);
+    XTSMux_PutHeader(&writer, &hdr);
+
+    /* Pointer field, section and 0xFF filling */
+    pCell[writer.nOffset] = 0;
+    memcpy(&pCell[writer.nOffset + 1], pSection, nLength);
+    memset(&pCell[writer.nOffset + 1 + nLength], 0xFF, XTSMUX_CELL_PAYLOAD - 1 - nLength);
+}
+
+static void XTSMux_BuildPAT(xts_muxer_t *pMuxer)
+{
+    uint8_t section[XTSMUX_CELL_PAYLOAD];
+    xbit_parser_t writer;
+    xpat_t pat;
+
+    memset(&pat, 0, sizeof(xpat_t));
+    pat.table_id = 0x00;
+    pat.section_syntax_indicator = 1;
+    pat.reserved_bits = 0x03;
+    pat.section_length = 9 + 4;
+    pat.transport_stream_id = 1;
+    pat.reserved = 0x03;
+    pat.current_next_indicator = 1;
+    pat.programs = 1;
+    pat.patTable[0].program_number = XTSMUX_PROGRAM;
+    pat.patTable[0].program_map_PID = XTSMUX_PMT_PID;
+
+    XBitParser_Init(&writer, section, sizeof(section));
+    XBitParser_WriteBits(&writer, 8, pat.table_id);
+    XBitParser_WriteBits(&writer, 1, pat.section_syntax_indicator);
+    XBitParser_WriteBits(&writer, 1, pat.private_bit);
+    XBitParser_WriteBits(&writer, 2, pat.reserved_bits);
+    XBitParser_WriteBits(&writer, 12, pat.section_length);
+    XBitParser_WriteBits(&writer, 16, pat.transport_stream_id);
+    XBitParser_WriteBits(&writer, 2, pat.reserved);
+    XBitParser_WriteBits(&writer, 5, pat.version_number);
+    XBitParser_WriteBits(&writer, 1, pat.current_next_indicator);
+    XBitParser_WriteBits(&writer, 8, pat.section_number);
+    XBitParser_WriteBits(&writer, 8, pat.last_section_number);
+
+    XBitParser_WriteBits(&writer, 16, pat.patTable[0].program_number);
+    XBitParser_WriteBits(&writer, 3, 0x07);
+    XBitParser_WriteBits(&writer, 13, pat.patTable[0].program_map_PID);
+
+    pat.CRC_32 = XTSMux_CRC32(section, writer.nOffset);
+    XBitParser_WriteBits(&writer, 32, pat.CRC_32);
+    XTSMux_BuildSection(pMuxer->patCell, 0x0000, section, writer.nOffset);
+}
+
+static void XTSMux_BuildPMT(xts_muxer_t *pMuxer)
+{
+    uint8_t section[XTSMUX_CELL_PAYLOAD];
+    xbit_parser_t writer;
+    int i;
+
+    /* xpmt_t carries descriptor storage, write the fields directly */
+    uint16_t nPCRPID = pMuxer->streams[pMuxer->nPCRIndex].nPID;
+    uint16_t nSectionLength = 13 + 5 * pMuxer->nStreamCount;
+
+    XBitParser_Init(&writer, section, sizeof(section));
+    XBitParser_WriteBits(&writer, 8, 0x02);
+    XBitParser_WriteBits(&writer, 1, 1);
+    XBitParser_WriteBits(&writer, 1, 0);
+    XBitParser_WriteBits(&writer, 2, 0x03);
+    XBitParser_WriteBits(&writer, 12, nSectionLength);
+    XBitParser_WriteBits(&writer, 16, XTSMUX_PROGRAM);
+    XBitParser_WriteBits(&writer, 2, 0x03);
+    XBitParser_WriteBits(&writer, 5, 0);
+    XBitParser_WriteBits(&writer, 1, 1);
+    XBitParser_WriteBits(&writer, 8, 0);
+    XBitParser_WriteBits(&writer, 8, 0);
+    XBitParser_WriteBits(&writer, 3, 0x07);
+    XBitParser_WriteBits(&writer, 13, nPCRPID);
+    XBitParser_WriteBits(&writer, 4, 0x0F);
+    XBitParser_WriteBits(&writer, 12, 0);
+
+    for (i = 0; i < pMuxer->nStreamCount; i++)
+    {
+        xtsmux_stream_t *pStream = &pMuxer->streams[i];
+        XBitParser_WriteBits(&writer, 8, pStream->nStreamType);
+        XBitParser_WriteBits(&writer, 3, 0x07);
+        XBitParser_WriteBits(&writer, 13, pStream->nPID);
+        XBitParser_WriteBits(&writer, 4, 0x0F);
+        XBitParser_WriteBits(&writer, 12, 0);
+    }
+
+    uint32_t nCRC = XTSMux_CRC32(section, writer.nOffset);
+    XBitParser_WriteBits(&writer, 32, nCRC);
+    XTSMux_BuildSection(pMuxer->pmtCell, XTSMUX_PMT_PID, section, writer.nOffset);
+}
+
+xbool_t XTSMux_IsLengthPrefixed(enum AVCodecID codecId, const uint8_t *pExtra, int nExtraSize)
+{
+    if (codecId != AV_CODEC_ID_H264 && codecId != AV_CODEC_ID_HEVC) return XFALSE;
+    return (pExtra != NULL && nExtraSize > 0 && pExtra[0] == 1) ? XTRUE : XFALSE;
+}
+
+void XTSMux_Init(xts_muxer_t *pMuxer)
+{
+    XASSERT_VOID(pMuxer);
+    memset(pMuxer, 0, sizeof(xts_muxer_t));
+
+    pMuxer->nPCRIndex = XSTDERR;
+    pMuxer->nLastPSI = AV_NOPTS_VALUE;
+    pMuxer->nLastPCR = AV_NOPTS_VALUE;
+    pMuxer->nDelay = XTSMUX_DELAY;
+}
+
+void XTSMux_Destroy(xts_muxer_t *pMuxer)
+{
+    XASSERT_VOID(pMuxer);
+    free(pMuxer->pBuffer);
+
+    /* Drop the stream table too so the muxer can be reused */
+    XTSMux_Init(pMuxer);
+}
+
+int XTSMux_AddStream(xts_muxer_t *pMuxer, enum AVCodecID codecId, enum AVMediaType mediaType,
+                    AVRational timeBase, const uint8_t *pExtra, int nExtraSize)
+{
+    XASSERT((pMuxer && pMuxer->nStreamCount < XTSPMT_STREAMS_MAX), XSTDERR);
+    uint8_t nStreamType = XTSMux_GetStreamType(codecId);
+    XASSERT(nStreamType, XSTDERR);
+
+    /* Length-prefixed (avcC/hvcC) payloads are not valid inside TS */
+    XASSERT((!XTSMux_IsLengthPrefixed(codecId, pExtra, nExtraSize)), XSTDERR);
+
+    int i, nIndex = pMuxer->nStreamCount;
+    xtsmux_stream_t *pStream = &pMuxer->streams[nIndex];
+    uint8_t nStreamId = mediaType == AVMEDIA_TYPE_VIDEO ? 0xE0 : 0xC0;
+
+    for (i = 0; i < nIndex; i++)
+        if (pMuxer->streams[i].mediaType == mediaType) nStreamId++;
+
+    memset(pStream, 0, sizeof(xtsmux_stream_t));
+    pStream->nStreamId = codecId == AV_CODEC_ID_AC3 ? 0xBD : nStreamId;
+    pStream->nPID = (uint16_t)(XTSMUX_ES_PID + nIndex);
+    pStream->nStreamType = nStreamType;
+    pStream->mediaType = mediaType;
+    pStream->timeBase = timeBase;
+    pStream->codecId = codecId;
+
+    if (codecId == AV_CODEC_ID_AAC && pExtra != NULL && nExtraSize >= 2)
+    {
+        /* Raw AAC needs ADTS framing inside the transport stream */
+        xbit_parser_t parser;
+        XBitParser_Init(&parser, (uint8_t*)pExtra, (size_t)nExtraSize);
+
+        uint8_t nObjectType = (uint8_t)XBitParser_ReadBits(&parser, 5);
+        uint8_t nFreqIndex = (uint8_t)XBitParser_ReadBits(&parser, 4);
+        uint8_t nChannels = (uint8_t)XBitParser_ReadBits(&parser, 4);
+
+        if (nObjectType > 0 && nObjectType <= 4 && nFreqIndex < 13)
+        {
+            pStream->nAACProfile = nObjectType - 1;
+            pStream->nAACFreqIndex = nFreqIndex;
+            pStream->nAACChannels = nChannels;
+            pStream->bADTS = XTRUE;
+        }
+    }
+
+    pMuxer->nStreamCount++;
+    return nIndex;
+}
+
+XSTATUS XTSMux_Open(xts_muxer_t *pMuxer, size_t nCells)
+{
+    XASSERT((pMuxer && pMuxer->writeCallback), XSTDINV);
+    XASSERT((pMuxer->nStreamCount > 0), XSTDINV);
+    if (!nCells) nCells = XTSMUX_CELLS;
+    int i;
+
+    pMuxer->pBuffer = (uint8_t*)malloc(nCells * XTS_PACKET_SIZE);
+    XASSERT(pMuxer->pBuffer, XSTDERR);
+
+    pMuxer->nCells = nCells;
+    pMuxer->nUsed = 0;
+    pMuxer->nError = 0;
+
+    /* Carry PCR on the first video stream if there is any */
+    for (i = 0; i < pMuxer->nStreamCount; i++)
+    {
+        if (pMuxer->streams[i].mediaType == AVMEDIA_TYPE_VIDEO)
+        {
+            pMuxer->nPCRIndex = i;
+            break;
+        }
+    }
+
+    if (pMuxer->nPCRIndex < 0) pMuxer->nPCRIndex = 0;
+    XTSMux_BuildPAT(pMuxer);
+    XTSMux_BuildPMT(pMuxer);
+
+    return XSTDOK;
+}
+
+int XTSMux_Flush(xts_muxer_t *pMuxer)
+{
+    XASSERT(pMuxer, AVERROR(EINVAL));
+    XASSERT(pMuxer->nUsed, pMuxer->nError);
+
+    int nSize = (int)(pMuxer->nUsed * XTS_PACKET_SIZE);
+    int nStatus = pMuxer->writeCallback(pMuxer->pUserCtx, pMuxer->pBuffer, nSize);
+    if (nStatus < 0) pMuxer->nError = nStatus;
+
+    pMuxer->nUsed = 0;
+    return pMuxer->nError;
+}
+
+static uint8_t* XTSMux_GetCell(xts_muxer_t *pMuxer)
+{
+    if (pMuxer->nUsed >= pMuxer->nCells &&
+        XTSMux_Flush(pMuxer) < 0) return NULL;
+
+    uint8_t *pCell = &pMuxer->pBuffer[pMuxer->nUsed * XTS_PACKET_SIZE];
+    pMuxer->stats.nCells++;
+    pMuxer->nUsed++;
+    return pCell;
+}
+
+static int XTSMux_WriteTables(xts_muxer_t *pMuxer)
+{
+    uint8_t *pCell = XTSMux_GetCell(pMuxer);
+    XASSERT(pCell, pMuxer->nError);
+
+    memcpy(pCell, pMuxer->patCell, XTS_PACKET_SIZE);
+    pCell[3] = (pCell[3] & 0xF0) | pMuxer->nPatCC;
+    pMuxer->nPatCC = (pMuxer->nPatCC + 1) & 0x0F;
+
+    pCell = XTSMux_GetCell(pMuxer);
+    XASSERT(pCell, pMuxer->nError);
+
+    memcpy(pCell, pMuxer->pmtCell, XTS_PACKET_SIZE);
+    pCell[3] = (pCell[3] & 0xF0) | pMuxer->nPmtCC;
+    pMuxer->nPmtCC = (pMuxer->nPmtCC + 1) & 0x0F;
+
+    pMuxer->stats.nTables++;
+    return 0;
+}
+
+static xbool_t XTSMux_CheckInterval(int64_t nLast, int64_t nNow, int64_t nInterval)
+{
+    if (nLast == AV_NOPTS_VALUE || nNow < nLast) return XTRUE;
+    return (nNow - nLast >= nInterval) ? XTRUE : XFALSE;
+}
+
+int XTSMux_WritePacket(xts_muxer_t *pMuxer, int nIndex, const AVPacket *pPacket)
+{
+    XASSERT((pMuxer && pMuxer->pBuffer && pPacket), AVERROR(EINVAL));
+    XASSERT((nIndex >= 0 && nIndex < pMuxer->nStreamCount), AVERROR(EINVAL));
+    XASSERT((!pMuxer->nError), pMuxer->nError);
+
+    xtsmux_stream_t *pStream = &pMuxer->streams[nIndex];
+    int64_t nDTS = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+    int64_t nPTS = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : nDTS;
+    XASSERT((nDTS != AV_NOPTS_VALUE), AVERROR(EINVAL));
+
+    AVRational tsTimeBase = (AVRational){1, 90000};
+    nDTS = av_rescale_q(nDTS, pStream->timeBase, tsTimeBase) + pMuxer->nDelay;
+    nPTS = av_rescale_q(nPTS, pStream->timeBase, tsTimeBase) + pMuxer->nDelay;
+
+    xbool_t bVideo = pStream->mediaType == AVMEDIA_TYPE_VIDEO;
+    xbool_t bKey = (pPacket->flags & AV_PKT_FLAG_KEY) ? XTRUE : XFALSE;
+    xbool_t bPCR = XFALSE;
+
+    if ((bKey && bVideo) || XTSMux_CheckInterval(pMuxer->nLastPSI, nDTS, XTSMUX_PSI_INTERVAL))
+    {
+        int nStatus = XTSMux_WriteTables(pMuxer);
+        if (nStatus < 0) return nStatus;
+        pMuxer->nLastPSI = nDTS;
+    }
+
+    if (nIndex == pMuxer->nPCRIndex && ((bKey && bVideo) ||
+        XTSMux_CheckInterval(pMuxer->nLastPCR, nDTS, XTSMUX_PCR_INTERVAL)))
+    {
+        pMuxer->nLastPCR = nDTS;
+        pMuxer->stats.nPCRs++;
+        bPCR = XTRUE;
+    }
+
+    /* PES header and optional ADTS header go in front of the payload */
+    uint8_t prefix[XTSMUX_PES_HEADER_MAX];
+    xbool_t bADTS = pStream->bADTS && !(pPacket->size >= 2 &&
+        pPacket->data[0] == 0xFF && (pPacket->data[1] & 0xF0) == 0xF0);
+
+    size_t nPayload = (size_t)pPacket->size + (bADTS ? XTSMUX_ADTS_SIZE : 0);
+    xpes_packet_t pes;
+
+    pes.packet_start_code_prefix = 0x000001;
+    pes.stream_id = pStream->nStreamId;
+    pes.PES_scrambling_control = 0;
+    pes.PES_priority = 0;
+    pes.data_alignment_indicator = 1;
+    pes.copyright = 0;
+    pes.original_or_copy = 0;
+    pes.PTS_DTS_flags = nPTS != nDTS ? 3 : 2;
+    pes.PTS = (uint64_t)nPTS & XTSMUX_TS_MASK;
+    pes.DTS = (uint64_t)nDTS & XTSMUX_TS_MASK;
+
+    /* Unbounded length is only allowed for video */
+    size_t nLength = 3 + (pes.PTS_DTS_flags == 3 ? 10 : 5) + nPayload;
+    pes.PES_packet_length = (bVideo || nLength > 0xFFFF) ? 0 : (uint16_t)nLength;
+
+    size_t nPrefix = XTSMux_PutPES(prefix, sizeof(prefix), &pes);
+    if (bADTS) nPrefix += XTSMux_PutADTS(&prefix[nPrefix], sizeof(prefix) - nPrefix, pStream, pPacket->size);
+
+    size_t nTotal = nPrefix + (size_t)pPacket->size;
+    size_t nPosition = 0;
+    xbool_t bFirst = XTRUE;
+
+    while (nPosition < nTotal)
+    {
+        uint8_t *pCell = XTSMux_GetCell(pMuxer);
+        if (pCell == NULL) return pMuxer->nError;
+
+        xts_packet_header_t hdr;
+        memset(&hdr, 0, sizeof(xts_packet_header_t));
+        xadaptation_field_t *pField = &hdr.adaptationField;
+
+        size_t nAdaptation = 0;
+        if (bFirst && bPCR) nAdaptation = 8;
+        else if (bFirst && bKey) nAdaptation = 2;
+
+        /* Stuff the last cell through the adaptation field */
+        size_t nSpace = XTSMUX_CELL_PAYLOAD - nAdaptation;
+        size_t nRemaining = nTotal - nPosition;
+
+        if (nRemaining < nSpace)
+        {
+            pMuxer->stats.nStuffing += nSpace - nRemaining;
+            nAdaptation += nSpace - nRemaining;
+            nSpace = nRemaining;
+        }
+
+        hdr.sync_byte = 0x47;
+        hdr.payload_unit_start_indicator = bFirst;
+        hdr.PID = pStream->nPID;
+        hdr.adaptation_field_flag = nAdaptation ? 1 : 0;
+        hdr.payload_data_flag = 1;
+        hdr.continuty_counter = pStream->nCC;
+        pStream->nCC = (pStream->nCC + 1) & 0x0F;
+
+        xbit_parser_t writer;
+        XBitParser_Init(&writer, pCell, XTS_PACKET_SIZE);
+        XTSMux_PutHeader(&writer, &hdr);
+
+        if (nAdaptation)
+        {
+            pField->adaptation_field_length = (uint8_t)(nAdaptation - 1);
+            pField->random_access_indicator = bFirst && bKey;
+            pField->PCR_flag = bFirst && bPCR;
+
+            if (pField->PCR_flag)
+            {
+                /* 33 bit base, 6 reserved bits and zero extension */
+                uint64_t nBase = (uint64_t)XSTD_MAX(nDTS - pMuxer->nDelay, 0) & XTSMUX_TS_MASK;
+                pField->PCR = (nBase << 15) | (0x3F << 9);
+            }
+
+            XTSMux_PutAdaptation(&writer, pField);
+        }
+
+        /* Single copy from the packet into the cell */
+        uint8_t *pPayload = &pCell[writer.nOffset];
+        size_t nCopied = 0;
+
+        if (nPosition < nPrefix)
+        {
+            nCopied = XSTD_MIN(nPrefix - nPosition, nSpace);
+            memcpy(pPayload, &prefix[nPosition], nCopied);
+        }
+
+        if (nCopied < nSpace)
+        {
+            const uint8_t *pData = &pPacket->data[nPosition + nCopied - nPrefix];
+            memcpy(&pPayload[nCopied], pData, nSpace - nCopied);
+        }
+
+        nPosition += nSpace;
+        bFirst = XFALSE;
+    }
+
+    pMuxer->stats.nPackets++;
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*!
+ *  @file libxmedia/src/tsmux.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the native MPEG-TS muxer
+ * writing packets straight into 188 byte cells.
+ */
+
+#ifndef __XMEDIA_TSMUX_H__
+#define __XMEDIA_TSMUX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+#include "mpegts.h"
+
+#define XTSMUX_PMT_PID          0x1000
+#define XTSMUX_ES_PID           0x0100
+#define XTSMUX_PROGRAM          1
+#define XTSMUX_CELLS            (7 * 16)        /* 7 cells fit into one UDP datagram */
+#define XTSMUX_PSI_INTERVAL     (90000 / 10)    /* 90kHz, 100 ms */
+#define XTSMUX_PCR_INTERVAL     (90000 / 25)    /* 90kHz, 40 ms */
+#define XTSMUX_DELAY            (90000 * 7 / 10)/* 90kHz, PTS ahead of PCR */
+#define XTSMUX_PES_HEADER_MAX   32
+
+typedef int(*xtsmux_write_cb_t)(void *pUserCtx, const uint8_t *pData, int nSize);
+
+typedef struct xtsmux_stream_ {
+    enum AVMediaType        mediaType;
+    enum AVCodecID          codecId;
+    AVRational              timeBase;
+    uint16_t                nPID;
+    uint8_t                 nStreamType;
+    uint8_t                 nStreamId;
+    uint8_t                 nCC;
+
+    /* AudioSpecificConfig fields for ADTS framing */
+    uint8_t                 nAACProfile;
+    uint8_t                 nAACFreqIndex;
+    uint8_t                 nAACChannels;
+    xbool_t                 bADTS;
+} xtsmux_stream_t;
+
+typedef struct xtsmux_stats_ {
+    uint64_t                nPackets;
+    uint64_t                nCells;
+    uint64_t                nStuffing;      /* Adaptation field stuffing bytes */
+    uint64_t                nTables;
+    uint64_t                nPCRs;
+} xtsmux_stats_t;
+
+typedef struct xts_muxer_ {
+    xtsmux_stream_t         streams[XTSPMT_STREAMS_MAX];
+    int                     nStreamCount;
+    int                     nPCRIndex;
+
+    /* Prebuilt program table cells */
+    uint8_t                 patCell[XTS_PACKET_SIZE];
+    uint8_t                 pmtCell[XTS_PACKET_SIZE];
+    uint8_t                 nPatCC;
+    uint8_t                 nPmtCC;
+
+    /* Preallocated output cells */
+    uint8_t*                pBuffer;
+    size_t                  nCells;
+    size_t                  nUsed;
+
+    /* Clock state (90kHz) */
+    int64_t                 nLastPSI;
+    int64_t                 nLastPCR;
+    int64_t                 nDelay;
+
+    xtsmux_write_cb_t       writeCallback;
+    void*                   pUserCtx;
+    xtsmux_stats_t          stats;
+    int                     nError;
+} xts_muxer_t;
+
+void XTSMux_Init(xts_muxer_t *pMuxer);
+void XTSMux_Destroy(xts_muxer_t *pMuxer);
+
+int XTSMux_AddStream(xts_muxer_t *pMuxer, enum AVCodecID codecId, enum AVMediaType mediaType,
+                    AVRational timeBase, const uint8_t *pExtra, int nExtraSize);
+
+/* H.264/HEVC extradata in avcC/hvcC form means length-prefixed NAL units */
+xbool_t XTSMux_IsLengthPrefixed(enum AVCodecID codecId, const uint8_t *pExtra, int nExtraSize);
+
+XSTATUS XTSMux_Open(xts_muxer_t *pMuxer, size_t nCells);
+int XTSMux_WritePacket(xts_muxer_t *pMuxer, int nIndex, const AVPacket *pPacket);
+int XTSMux_Flush(xts_muxer_t *pMuxer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_TSMUX_H__ */
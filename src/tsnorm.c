@@ -0,0 +1,225 @@
+/*!
+ *  @file libxmedia/src/tsnorm.c
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the per-stream timestamp normalizer
+ * with wrap handling, jitter smoothing and drift correction.
+ */
+
+#include "tsnorm.h"
+
+static int64_t XTSNorm_Round(double fValue)
+{
+    return (int64_t)(fValue < 0 ? fValue - 0.5 : fValue + 0.5);
+}
+
+static int64_t XTSNorm_ToUsec(xts_norm_t *pNorm, int64_t nTicks)
+{
+    return av_rescale_q(nTicks, pNorm->timeBase, AV_TIME_BASE_Q);
+}
+
+void XTSNorm_Init(xts_norm_t *pNorm)
+{
+    XASSERT_VOID(pNorm);
+    memset(&pNorm->metrics, 0, sizeof(xts_metrics_t));
+
+    pNorm->timeBase = (AVRational){1, AV_TIME_BASE};
+    pNorm->bSetup = XFALSE;
+
+    pNorm->nWrapPeriod = 0;
+    pNorm->nWrapOffset = 0;
+    pNorm->nLastInput = AV_NOPTS_VALUE;
+    pNorm->nRebase = 0;
+
+    pNorm->fPhase = 0.;
+    pNorm->fPeriod = 0.;
+    pNorm->fAlpha = XTSNORM_PLL_ALPHA;
+    pNorm->fBeta = XTSNORM_PLL_BETA;
+    pNorm->nLastOutput = AV_NOPTS_VALUE;
+
+    pNorm->fDrift = 0.;
+    pNorm->nDriftOrigin = 0;
+    pNorm->bDriftOrigin = XFALSE;
+
+    pNorm->nMaxJitter = XTSNORM_MAX_JITTER;
+    pNorm->nMaxGap = XTSNORM_MAX_GAP;
+    pNorm->nMaxDrift = XTSNORM_MAX_DRIFT;
+    pNorm->nWrapBits = XTSNORM_WRAP_BITS;
+    pNorm->nEvents = 0;
+}
+
+void XTSNorm_Setup(xts_norm_t *pNorm, AVRational timeBase, int64_t nPeriod, xbool_t bSampleLocked)
+{
+    XASSERT_VOID(pNorm);
+    pNorm->timeBase = timeBase;
+    pNorm->fPeriod = nPeriod > 0 ? (double)nPeriod : 0.;
+
+    /* Wrapped source clock is always the 90kHz MPEG system clock */
+    if (pNorm->nWrapBits > 0 && pNorm->nWrapBits < 63)
+    {
+        AVRational mpegTimeBase = (AVRational){1, 90000};
+        pNorm->nWrapPeriod = av_rescale_q(1LL << pNorm->nWrapBits, mpegTimeBase, timeBase);
+    }
+
+    /* Audio timeline follows the sample count, it is only resynced on jumps */
+    if (bSampleLocked)
+    {
+        pNorm->fAlpha = 0.;
+        pNorm->fBeta = 0.;
+    }
+
+    pNorm->bSetup = XTRUE;
+}
+
+static int64_t XTSNorm_Unwrap(xts_norm_t *pNorm, int64_t nTS)
+{
+    int64_t nInput = nTS + pNorm->nWrapOffset;
+
+    if (pNorm->nWrapPeriod > 0 && pNorm->nLastInput != AV_NOPTS_VALUE)
+    {
+        int64_t nDelta = nInput - pNorm->nLastInput;
+        int64_t nHalf = pNorm->nWrapPeriod / 2;
+
+        if (nDelta < -nHalf)
+        {
+            pNorm->nWrapOffset += pNorm->nWrapPeriod;
+            pNorm->nEvents |= XTSNORM_EV_WRAP;
+            pNorm->metrics.nWraps++;
+            nInput += pNorm->nWrapPeriod;
+        }
+        else if (nDelta > nHalf)
+        {
+            /* Late timestamp from before the wrap */
+            pNorm->nWrapOffset -= pNorm->nWrapPeriod;
+            nInput -= pNorm->nWrapPeriod;
+        }
+    }
+
+    pNorm->nLastInput = nInput;
+    return nInput;
+}
+
+int64_t XTSNorm_Apply(xts_norm_t *pNorm, int64_t nTS, int64_t nDuration)
+{
+    XASSERT_RET((pNorm && pNorm->bSetup), nTS);
+    XASSERT_RET((nTS != AV_NOPTS_VALUE), nTS);
+    xts_metrics_t *pMetrics = &pNorm->metrics;
+    pNorm->nEvents = 0;
+
+    int64_t nInput = XTSNorm_Unwrap(pNorm, nTS) + pNorm->nRebase;
+    if (!pMetrics->nSamples)
+    {
+        pNorm->fPhase = (double)nInput;
+        pNorm->nLastOutput = nInput;
+        pMetrics->nSamples++;
+        return nInput;
+    }
+
+    double fStep = nDuration > 0 ? (double)nDuration : pNorm->fPeriod;
+    if (fStep <= 0.)
+    {
+        /* Learn the nominal period from the first two samples */
+        fStep = (double)nInput - pNorm->fPhase;
+        if (fStep > 0.) pNorm->fPeriod = fStep;
+    }
+
+    double fPredict = pNorm->fPhase + fStep;
+    double fError = (double)nInput - fPredict;
+    int64_t nError = FFABS(XTSNorm_ToUsec(pNorm, XTSNorm_Round(fError)));
+
+    if (nError > pNorm->nMaxGap)
+    {
+        /* Source clock jumped, keep the output timeline continuous */
+        pNorm->nRebase += XTSNorm_Round(fPredict) - nInput;
+        pNorm->nEvents |= XTSNORM_EV_DISCONT;
+        pNorm->fPhase = fPredict;
+        pMetrics->nDiscontinuities++;
+    }
+    else if (nError > pNorm->nMaxJitter)
+    {
+        /* Too far for smoothing, follow the source */
+        pNorm->nEvents |= XTSNORM_EV_RESYNC;
+        pNorm->fPhase = (double)nInput;
+        pMetrics->nResyncs++;
+    }
+    else
+    {
+        pNorm->fPhase = fPredict + pNorm->fAlpha * fError;
+        if (nDuration <= 0) pNorm->fPeriod += pNorm->fBeta * fError;
+        if (nError > pMetrics->nMaxJitter) pMetrics->nMaxJitter = nError;
+    }
+
+    int64_t nOutput = XTSNorm_Round(pNorm->fPhase);
+    if (nOutput <= pNorm->nLastOutput)
+    {
+        nOutput = pNorm->nLastOutput + 1;
+        pNorm->nEvents |= XTSNORM_EV_REORDER;
+        pNorm->fPhase = (double)nOutput;
+        pMetrics->nReorders++;
+    }
+
+    pNorm->nLastOutput = nOutput;
+    pMetrics->nSamples++;
+    return nOutput;
+}
+
+int64_t XTSNorm_Duplicate(xts_norm_t *pNorm)
+{
+    XASSERT_RET((pNorm && pNorm->nLastOutput != AV_NOPTS_VALUE), AV_NOPTS_VALUE);
+    int64_t nPeriod = XTSNorm_Round(pNorm->fPeriod);
+    XASSERT_RET((nPeriod > 0), AV_NOPTS_VALUE);
+
+    /* Following samples are shifted by the inserted one */
+    pNorm->fDrift += (double)XTSNorm_ToUsec(pNorm, nPeriod);
+    pNorm->nLastOutput += nPeriod;
+    pNorm->nRebase += nPeriod;
+
+    pNorm->fPhase = (double)pNorm->nLastOutput;
+    pNorm->metrics.nDuplicated++;
+    return pNorm->nLastOutput;
+}
+
+void XTSNorm_Drop(xts_norm_t *pNorm)
+{
+    XASSERT_VOID(pNorm);
+    int64_t nPeriod = XTSNorm_Round(pNorm->fPeriod);
+    XASSERT_VOID_RET((nPeriod > 0));
+
+    /* Next sample takes the slot of the dropped one */
+    pNorm->fDrift -= (double)XTSNorm_ToUsec(pNorm, nPeriod);
+    pNorm->nRebase -= nPeriod;
+    pNorm->metrics.nDropped++;
+}
+
+xtsnorm_action_t XTSNorm_CheckDrift(xts_norm_t *pNorm, const xts_norm_t *pRef)
+{
+    XASSERT_RET((pNorm && pRef && pNorm->nMaxDrift > 0), XTSNORM_PASS);
+    XASSERT_RET((pNorm->metrics.nSamples && pRef->metrics.nSamples), XTSNORM_PASS);
+
+    int64_t nPosition = XTSNorm_ToUsec(pNorm, pNorm->nLastOutput);
+    int64_t nRefPosition = av_rescale_q(pRef->nLastOutput, pRef->timeBase, AV_TIME_BASE_Q);
+    int64_t nOffset = nPosition - nRefPosition;
+
+    /* Initial A/V offset belongs to the source, only its change is drift */
+    if (!pNorm->bDriftOrigin)
+    {
+        pNorm->nDriftOrigin = nOffset;
+        pNorm->bDriftOrigin = XTRUE;
+        return XTSNORM_PASS;
+    }
+
+    double fOffset = (double)(nOffset - pNorm->nDriftOrigin);
+    pNorm->fDrift += XTSNORM_DRIFT_SMOOTH * (fOffset - pNorm->fDrift);
+    pNorm->metrics.nDrift = XTSNorm_Round(pNorm->fDrift);
+
+    int64_t nPeriod = XTSNorm_ToUsec(pNorm, XTSNorm_Round(pNorm->fPeriod));
+    XASSERT_RET((nPeriod > 0), XTSNORM_PASS);
+
+    int64_t nLimit = XSTD_MAX(pNorm->nMaxDrift, nPeriod);
+    if (pNorm->metrics.nDrift > nLimit) return XTSNORM_DROP;
+    if (pNorm->metrics.nDrift < -nLimit) return XTSNORM_DUP;
+
+    return XTSNORM_PASS;
+}
@@ -0,0 +1,97 @@
+/*!
+ *  @file libxmedia/src/tsnorm.h
+ *
+ *  This source is part of "libxmedia" project
+ *  2022-2023 (c) Sun Dro (s.kalatoz@gmail.com)
+ *
+ * @brief Implementation of the per-stream timestamp normalizer
+ * with wrap handling, jitter smoothing and drift correction.
+ */
+
+#ifndef __XMEDIA_TSNORM_H__
+#define __XMEDIA_TSNORM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdinc.h"
+
+#define XTSNORM_WRAP_BITS       33                  /* MPEG-TS 90kHz clock */
+#define XTSNORM_MAX_JITTER      (100 * 1000)        /* usec */
+#define XTSNORM_MAX_GAP         (1000 * 1000)       /* usec */
+#define XTSNORM_MAX_DRIFT       (40 * 1000)         /* usec */
+#define XTSNORM_PLL_ALPHA       0.1
+#define XTSNORM_PLL_BETA        0.01
+#define XTSNORM_DRIFT_SMOOTH    0.05
+
+/* Events reported by the last XTSNorm_Apply() call */
+#define XTSNORM_EV_WRAP         (1 << 0)
+#define XTSNORM_EV_DISCONT      (1 << 1)
+#define XTSNORM_EV_RESYNC       (1 << 2)
+#define XTSNORM_EV_REORDER      (1 << 3)
+
+typedef enum {
+    XTSNORM_PASS,       // Keep the frame
+    XTSNORM_DROP,       // Drop the frame, stream is ahead of the reference
+    XTSNORM_DUP         // Duplicate the frame, stream is behind the reference
+} xtsnorm_action_t;
+
+typedef struct xts_metrics_ {
+    uint64_t            nSamples;
+    uint64_t            nWraps;
+    uint64_t            nDiscontinuities;
+    uint64_t            nResyncs;
+    uint64_t            nReorders;
+    uint64_t            nDropped;
+    uint64_t            nDuplicated;
+    int64_t             nMaxJitter;     /* usec */
+    int64_t             nDrift;         /* usec, against reference stream */
+} xts_metrics_t;
+
+typedef struct xts_norm_ {
+    AVRational          timeBase;
+    xbool_t             bSetup;
+
+    /* Wrap and discontinuity handling (ticks) */
+    int64_t             nWrapPeriod;
+    int64_t             nWrapOffset;
+    int64_t             nLastInput;
+    int64_t             nRebase;
+
+    /* Second order PLL state (ticks) */
+    double              fPhase;
+    double              fPeriod;
+    double              fAlpha;
+    double              fBeta;
+    int64_t             nLastOutput;
+
+    /* Drift against the reference stream (usec) */
+    double              fDrift;
+    int64_t             nDriftOrigin;
+    xbool_t             bDriftOrigin;
+
+    /* User options (usec) */
+    int64_t             nMaxJitter;
+    int64_t             nMaxGap;
+    int64_t             nMaxDrift;
+    int                 nWrapBits;
+
+    xts_metrics_t       metrics;
+    uint32_t            nEvents;
+} xts_norm_t;
+
+void XTSNorm_Init(xts_norm_t *pNorm);
+void XTSNorm_Setup(xts_norm_t *pNorm, AVRational timeBase, int64_t nPeriod, xbool_t bSampleLocked);
+
+int64_t XTSNorm_Apply(xts_norm_t *pNorm, int64_t nTS, int64_t nDuration);
+int64_t XTSNorm_Duplicate(xts_norm_t *pNorm);
+void XTSNorm_Drop(xts_norm_t *pNorm);
+
+xtsnorm_action_t XTSNorm_CheckDrift(xts_norm_t *pNorm, const xts_norm_t *pRef);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XMEDIA_TSNORM_H__ */